@@ -39,7 +39,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include "sxmlc.h"
+#include "sxmlc_thread.h"
 
 #define CHECK_NODE(node,ret) if (!XMLNode_is_valid(node)) return (ret)
 
@@ -53,6 +55,32 @@
 /* Determine if character is not ASCII. */
 #define sx_isunicode(c) ((int)c < 0 || (int)c > 127)
 
+/* Low-level output of 'XMLDoc_print_to_fd()' */
+#if defined(WIN32) || defined(WIN64)
+#include <io.h>
+#define sx_write(fd, buf, n) _write((fd), (buf), (unsigned int)(n))
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#include <errno.h>
+#define sx_write(fd, buf, n) write((fd), (buf), (n))
+#define SX_HAVE_WRITEV
+#endif
+#ifdef SXMLC_UNICODE
+#include <wchar.h>
+#endif
+
+/*
+ SSE2 search of the characters to escape (see 'str2html()'), 16 characters at a time.
+ Define 'SXMLC_NO_SIMD' to use plain C code.
+ */
+#if !defined(SXMLC_NO_SIMD) && !defined(SXMLC_UNICODE) && defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <emmintrin.h>
+#define SX_SSE2
+/* Aligned loads can read past the end of a string, but never past its memory page */
+#define SX_NO_SANITIZE __attribute__((no_sanitize_address, no_sanitize_thread))
+#endif
+
 #if defined(WIN32) || defined(WIN64)
 FILE* sx_fopen(const SXML_CHAR* filename, const SXML_CHAR* mode)
 {
@@ -118,18 +146,46 @@ static _TAG _spec[] = {
 static int NB_SPECIAL_TAGS = (int)(sizeof(_spec) / sizeof(_TAG)); /* Auto computation of number of special tags */
 
 /*
- User-registered tags.
+ Default parser configuration, holding user-registered tags.
  */
-static struct _SpecialTag {
-	_TAG *tags;
-	int n_tags;
-} _user_tags = { NULL, 0 };
+static XMLParserConfig _default_config = { NULL, 0, NULL, 0, FALSE, XML_INIT_DONE };
 
-int XML_register_user_tag(TagType tag_type, SXML_CHAR* start, SXML_CHAR* end)
+int XMLParserConfig_init(XMLParserConfig* config)
+{
+	if (config == NULL)
+		return FALSE;
+
+	config->user_tags = NULL;
+	config->n_user_tags = 0;
+	config->regexpr_compare = NULL;
+	config->max_depth = 0;
+	config->text_as_nodes = FALSE;
+	config->init_value = XML_INIT_DONE;
+
+	return TRUE;
+}
+
+int XMLParserConfig_free(XMLParserConfig* config)
+{
+	if (config == NULL || config->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	if (config->user_tags != NULL)
+		__free(config->user_tags);
+	config->user_tags = NULL;
+	config->n_user_tags = 0;
+
+	return TRUE;
+}
+
+int XMLParserConfig_register_user_tag(XMLParserConfig* config, TagType tag_type, SXML_CHAR* start, SXML_CHAR* end)
 {
 	_TAG* p;
 	int i, n, le;
 
+	if (config == NULL || config->init_value != XML_INIT_DONE)
+		return -1;
+
 	if (tag_type < TAG_USER)
 		return -1;
 
@@ -140,9 +196,9 @@ int XML_register_user_tag(TagType tag_type, SXML_CHAR* start, SXML_CHAR* end)
 	if (end[le-1] != C2SX('>'))
 		return -1;
 
-	i = _user_tags.n_tags;
+	i = config->n_user_tags;
 	n = i + 1;
-	p = __realloc(_user_tags.tags, n * sizeof(_TAG));
+	p = __realloc(config->user_tags, n * sizeof(_TAG));
 	if (p == NULL)
 		return -1;
 
@@ -151,65 +207,284 @@ int XML_register_user_tag(TagType tag_type, SXML_CHAR* start, SXML_CHAR* end)
 	p[i].end = end;
 	p[i].len_start = sx_strlen(start);
 	p[i].len_end = le;
-	_user_tags.tags = p;
-	_user_tags.n_tags = n;
+	config->user_tags = p;
+	config->n_user_tags = n;
 
 	return i;
 }
 
-int XML_unregister_user_tag(int i_tag)
+int XMLParserConfig_unregister_user_tag(XMLParserConfig* config, int i_tag)
 {
 	_TAG* pt;
 
-	if (i_tag < 0 || i_tag >= _user_tags.n_tags)
+	if (config == NULL || config->init_value != XML_INIT_DONE || i_tag < 0 || i_tag >= config->n_user_tags)
  		return -1;
 
-	if (_user_tags.n_tags == 1)
+	if (config->n_user_tags == 1)
 		pt = NULL;
 	else {
-		pt = __malloc((_user_tags.n_tags - 1) * sizeof(_TAG));
+		pt = __malloc((config->n_user_tags - 1) * sizeof(_TAG));
 		if (pt == NULL)
 			return -1;
 	}
  
 	if (pt != NULL) {
-		memcpy(pt, _user_tags.tags, i_tag * sizeof(_TAG));
-		memcpy(&pt[i_tag], &_user_tags.tags[i_tag + 1], (_user_tags.n_tags - i_tag - 1) * sizeof(_TAG));
+		memcpy(pt, config->user_tags, i_tag * sizeof(_TAG));
+		memcpy(&pt[i_tag], &config->user_tags[i_tag + 1], (config->n_user_tags - i_tag - 1) * sizeof(_TAG));
 	}
-	if (_user_tags.tags != NULL)
-		__free(_user_tags.tags);
-	_user_tags.tags = pt;
-	_user_tags.n_tags--;
+	if (config->user_tags != NULL)
+		__free(config->user_tags);
+	config->user_tags = pt;
+	config->n_user_tags--;
+
+	return config->n_user_tags;
+}
+
+int XML_register_user_tag(TagType tag_type, SXML_CHAR* start, SXML_CHAR* end)
+{
+	return XMLParserConfig_register_user_tag(&_default_config, tag_type, start, end);
+}
 
-	return _user_tags.n_tags;
+int XML_unregister_user_tag(int i_tag)
+{
+	return XMLParserConfig_unregister_user_tag(&_default_config, i_tag);
 }
 
 int XML_get_nb_registered_user_tags(void)
 {
-	return _user_tags.n_tags;
+	return _default_config.n_user_tags;
 }
 
 int XML_get_registered_user_tag(TagType tag_type)
 {
 	int i;
 
-	for (i = 0; i < _user_tags.n_tags; i++)
-		if (_user_tags.tags[i].tag_type == tag_type)
+	for (i = 0; i < _default_config.n_user_tags; i++)
+		if (_default_config.user_tags[i].tag_type == tag_type)
 			return i;
 
 	return -1;
 }
 
+/* --- Document pools --- */
+
+/*
+ Memory of the nodes emptied by 'XMLDoc_reset()' is kept in the document pool to be used again when
+ parsing the next document. Blocks are regular ones, so that nodes using them can be freed with '__free()'.
+ Strings and arrays are sorted by size class (power of 2), with the size known to be available in them.
+ They are kept apart as only the length of strings is known, so that a string block reused for a shorter
+ string does not take an array of the exact size needed by the next document.
+ Blocks that were not used while parsing a document are released on the next reset.
+ */
+#define POOL_CLASSES 32
+#define POOL_SCAN 8 /* Number of blocks checked in a size class for the best fit, before taking one of the next class */
+#define POOL_STRINGS 0
+#define POOL_ARRAYS 1
+
+typedef struct _PoolBlock {
+	void* mem;
+	size_t sz;
+	int stamp;	/* Pool stamp when the block was given back */
+} _PoolBlock;
+
+typedef struct _PoolList {
+	_PoolBlock* blocks;
+	int n;
+	int size;
+} _PoolList;
+
+struct _XMLPool {
+	XMLNode* nodes;	/* Free nodes, chained through their 'father' member */
+	_PoolList lists[2][POOL_CLASSES];	/* Free strings and arrays ('POOL_STRINGS' and 'POOL_ARRAYS'), by size class */
+	int stamp;	/* Incremented on each reset and after it, to know which blocks were not used */
+};
+
+static int _pool_class(size_t sz)
+{
+	int k;
+
+	for (k = 0; sz > 1 && k < POOL_CLASSES - 1; k++)
+		sz >>= 1;
+
+	return k;
+}
+
+/*
+ Get a block of 'kind' ('POOL_STRINGS' or 'POOL_ARRAYS') of at least 'sz' bytes from 'pool', allocating it
+ if there is none (or no 'pool'). The smallest of the last blocks given back is taken.
+ */
+static void* _pool_alloc(XMLPool* pool, int kind, size_t sz)
+{
+	_PoolList* l;
+	void* mem;
+	int i, k, best;
+
+	if (pool != NULL) {
+		k = _pool_class(sz);
+		l = &pool->lists[kind][k];
+		for (i = l->n - 1, best = -1; i >= 0 && i >= l->n - POOL_SCAN; i--) {
+			if (l->blocks[i].sz >= sz && (best < 0 || l->blocks[i].sz < l->blocks[best].sz)) {
+				best = i;
+				if (l->blocks[i].sz == sz)
+					break;
+			}
+		}
+		if (best >= 0) {
+			mem = l->blocks[best].mem;
+			l->blocks[best] = l->blocks[--l->n];
+			return mem;
+		}
+		/* Any block of the next class is large enough */
+		if (k + 1 < POOL_CLASSES && (l = &pool->lists[kind][k + 1])->n > 0)
+			return l->blocks[--l->n].mem;
+	}
+
+	return __malloc(sz);
+}
+
+/*
+ Give 'mem' of 'kind', known to hold 'sz' bytes, back to 'pool', or free it if there is no 'pool'.
+ */
+static void _pool_free(XMLPool* pool, int kind, void* mem, size_t sz)
+{
+	_PoolList* l;
+	_PoolBlock* pt;
+
+	if (mem == NULL)
+		return;
+
+	if (pool != NULL && sz > 0) {
+		l = &pool->lists[kind][_pool_class(sz)];
+		if (l->n >= l->size) {
+			pt = __realloc(l->blocks, (l->size + 64) * sizeof(_PoolBlock));
+			if (pt != NULL) {
+				l->blocks = pt;
+				l->size += 64;
+			}
+		}
+		if (l->n < l->size) {
+			l->blocks[l->n].mem = mem;
+			l->blocks[l->n].sz = sz;
+			l->blocks[l->n++].stamp = pool->stamp;
+			return;
+		}
+	}
+	__free(mem);
+}
+
+/*
+ Resize 'mem' from 'old_sz' to 'sz' bytes, taking a block of 'pool' (if not NULL) when 'mem' is NULL.
+ Existing blocks are resized by '__realloc()': arrays grow one element at a time (see '_add_node()') and giving
+ each former block back to 'pool' would keep memory quadratic in their size.
+ */
+static void* _pool_realloc(XMLPool* pool, int kind, void* mem, size_t old_sz, size_t sz)
+{
+	(void)old_sz;
+
+	if (pool == NULL || mem != NULL)
+		return __realloc(mem, sz);
+
+	return _pool_alloc(pool, kind, sz);
+}
+
+static SXML_CHAR* _pool_strdup(XMLPool* pool, const SXML_CHAR* str)
+{
+	size_t sz = (sx_strlen(str) + 1) * sizeof(SXML_CHAR);
+	SXML_CHAR* p = (SXML_CHAR*)_pool_alloc(pool, POOL_STRINGS, sz);
+
+	if (p != NULL)
+		memcpy(p, str, sz);
+
+	return p;
+}
+
+static void _pool_free_str(XMLPool* pool, SXML_CHAR* str)
+{
+	if (str != NULL)
+		_pool_free(pool, POOL_STRINGS, str, (sx_strlen(str) + 1) * sizeof(SXML_CHAR));
+}
+
+/*
+ Get an initialized node from 'pool', allocating it if there is none (or no 'pool').
+ */
+static XMLNode* _pool_node(XMLPool* pool)
+{
+	XMLNode* node;
+
+	if (pool == NULL || pool->nodes == NULL)
+		return XMLNode_alloc();
+
+	node = pool->nodes;
+	pool->nodes = node->father;
+	memset(node, 0, sizeof(XMLNode));
+	(void)XMLNode_init(node);
+
+	return node;
+}
+
+/*
+ Give an emptied 'node' back to 'pool', or free it if there is no 'pool'.
+ */
+static void _pool_free_node(XMLPool* pool, XMLNode* node)
+{
+	if (pool == NULL) {
+		__free(node);
+		return;
+	}
+
+	node->father = pool->nodes;
+	pool->nodes = node;
+}
+
+/*
+ Release the memory of 'pool' that was given back before 'stamp'.
+ */
+static void _pool_release(XMLPool* pool, int stamp)
+{
+	_PoolList* l;
+	XMLNode* node;
+	int i, k;
+
+	while ((node = pool->nodes) != NULL) {
+		pool->nodes = node->father;
+		__free(node);
+	}
+	for (k = 0; k < 2*POOL_CLASSES; k++) {
+		l = &pool->lists[k / POOL_CLASSES][k % POOL_CLASSES];
+		for (i = 0; i < l->n; ) {
+			if (l->blocks[i].stamp < stamp) {
+				__free(l->blocks[i].mem);
+				l->blocks[i] = l->blocks[--l->n];
+			} else
+				i++;
+		}
+	}
+}
+
+static void _pool_destroy(XMLPool* pool)
+{
+	int k;
+
+	if (pool == NULL)
+		return;
+
+	_pool_release(pool, pool->stamp + 1);
+	for (k = 0; k < 2*POOL_CLASSES; k++)
+		if (pool->lists[k / POOL_CLASSES][k % POOL_CLASSES].blocks != NULL)
+			__free(pool->lists[k / POOL_CLASSES][k % POOL_CLASSES].blocks);
+	__free(pool);
+}
+
 /* --- XMLNode methods --- */
 
 /*
- Add 'node' to given '*children_array' of '*len_array' elements.
+ Add 'node' to given '*children_array' of '*len_array' elements, using 'pool' memory if not NULL.
  '*len_array' is overwritten with the number of elements in '*children_array' after its reallocation.
  Return the index of the newly added 'node' in '*children_array', or '-1' for memory error.
  */
-static int _add_node(XMLNode*** children_array, int* len_array, XMLNode* node)
+static int _add_node(XMLNode*** children_array, int* len_array, XMLNode* node, XMLPool* pool)
 {
-	XMLNode** pt = __realloc(*children_array, (*len_array+1) * sizeof(XMLNode*));
+	XMLNode** pt = _pool_realloc(pool, POOL_ARRAYS, *children_array, *len_array * sizeof(XMLNode*), (*len_array+1) * sizeof(XMLNode*));
 	
 	if (pt == NULL)
 		return -1;
@@ -241,6 +516,14 @@ int XMLNode_init(XMLNode* node)
 	node->tag_type = TAG_NONE;
 	node->active = TRUE;
 
+	node->src_start = -1;
+	node->src_end = -1;
+	node->modified = 0;
+
+	node->shared = NULL;
+	node->hash = 0;
+	node->usage = NULL;
+
 	node->init_value = XML_INIT_DONE;
 
 	return TRUE;
@@ -264,6 +547,35 @@ XMLNode* XMLNode_allocN(int n)
 	return p;
 }
 
+/*
+ Text nodes built by the parser hold their text in the same memory block, right after the node.
+ Return 'true' if 'node' text is such an inline text, which is freed with the node and not on its own.
+ */
+static int _XMLNode_text_inline(const XMLNode* node)
+{
+	return node->text != NULL && node->text == (const SXML_CHAR*)(node + 1);
+}
+
+/*
+ Allocate a 'TAG_TEXT' node holding a copy of 'text' inline, in a single memory block.
+ */
+static XMLNode* _XMLNode_alloc_text(const SXML_CHAR* text)
+{
+	size_t sz = (sx_strlen(text) + 1) * sizeof(SXML_CHAR);
+	XMLNode* node = (XMLNode*)__malloc(sizeof(XMLNode) + sz);
+
+	if (node == NULL)
+		return NULL;
+
+	node->init_value = 0;
+	(void)XMLNode_init(node);
+	node->text = (SXML_CHAR*)(node + 1);
+	memcpy(node->text, text, sz);
+	node->tag_type = TAG_TEXT;
+
+	return node;
+}
+
 XMLNode* XMLNode_new(const TagType tag_type, const SXML_CHAR* tag, const SXML_CHAR* text)
 {
 	XMLNode* node = XMLNode_alloc();
@@ -280,165 +592,758 @@ XMLNode* XMLNode_new(const TagType tag_type, const SXML_CHAR* tag, const SXML_CH
 	return node;
 }
 
-XMLNode* XMLNode_dup(const XMLNode* node, int copy_children)
+/*
+ Invalidate the cached hash of 'node' and its ancestors, after 'node' was modified, and mark them as modified.
+ */
+static void _XMLNode_modified(XMLNode* node)
 {
-	XMLNode* n;
+	XMLNode* p;
 
-	if (node == NULL)
-		return NULL;
+	/* Hashes are computed for whole subtrees so the ancestors of a node without hash do not have one either */
+	for (p = node; p != NULL && p->hash != 0; p = p->father)
+		p->hash = 0;
 
-	n = __calloc(1, sizeof(XMLNode));
-	if (n == NULL)
-		return NULL;
+	if (node == NULL)
+		return;
+	node->modified |= XML_MODIFIED_NODE;
+	/* Likewise, the ancestors of a node with modified descendants are already marked */
+	for (p = node->father; p != NULL && !(p->modified & XML_MODIFIED_DESCENDANTS); p = p->father)
+		p->modified |= XML_MODIFIED_DESCENDANTS;
+}
 
-	XMLNode_init(n);
-	if (!XMLNode_copy(n, node, copy_children)) {
-		XMLNode_free(n);
+/*
+ Release 'node' share on its tag, text and attributes.
+ Returns 'true' if they are still used by other nodes, in which case they have been detached
+ from 'node' and should not be freed, or 'false' if 'node' is (now) their only owner.
+ */
+static int _XMLNode_release_shared(XMLNode* node)
+{
+	if (node->shared == NULL)
+		return FALSE;
 
-		return NULL;
+	if (_shared_dec(node->shared) > 0) {
+		node->tag = NULL;
+		node->text = NULL;
+		node->attributes = NULL;
+		node->n_attributes = 0;
+		node->shared = NULL;
+		return TRUE;
 	}
 
-	return n;
+	__free(node->shared);
+	node->shared = NULL;
+
+	return FALSE;
 }
 
-int XMLNode_free(XMLNode* node)
+/*
+ Have 'dst' use the same tag, text and attributes as 'src', which are now shared between the two nodes.
+ 'dst' is supposed to be empty.
+ Return 'false' for memory error.
+ */
+static int _XMLNode_share(XMLNode* dst, const XMLNode* src)
 {
-	CHECK_NODE(node, FALSE);
-	
-	if (node->tag != NULL) {
-		__free(node->tag);
-		node->tag = NULL;
+	/* 'src' is const but creating its share counter does not change its content */
+	int** src_shared = &((XMLNode*)src)->shared;
+	int* shared = _shared_ptr_load(src_shared);
+	int* counter;
+
+	if (shared == NULL) {
+		counter = __malloc(sizeof(int));
+		if (counter == NULL)
+			return FALSE;
+		*counter = 1;
+		/* Another thread copying 'src' might have published its counter first */
+		shared = _shared_ptr_publish(src_shared, counter);
+		if (shared == NULL)
+			shared = counter;
+		else
+			__free(counter);
 	}
+	_shared_inc(shared);
 
-	XMLNode_remove_text(node);
-	XMLNode_remove_all_attributes(node);
-	XMLNode_remove_children(node);
-	
-	node->tag_type = TAG_NONE;
+	dst->tag = src->tag;
+	dst->text = src->text;
+	dst->attributes = src->attributes;
+	dst->n_attributes = src->n_attributes;
+	dst->shared = shared;
 
 	return TRUE;
 }
 
-int XMLNode_copy(XMLNode* dst, const XMLNode* src, int copy_children)
+/*
+ Copy 'src' tag, text and attributes into 'dst', duplicating them with 'pool' memory if not NULL. 'dst' is supposed to be empty.
+ Return 'false' for memory error, in which case 'dst' may be partially filled.
+ */
+static int _XMLNode_dup_content(XMLNode* dst, const XMLNode* src, XMLPool* pool)
 {
 	int i;
-	
-	if (dst == NULL || (src != NULL && src->init_value != XML_INIT_DONE))
+
+	if (src->tag != NULL && (dst->tag = _pool_strdup(pool, src->tag)) == NULL)
 		return FALSE;
-	
-	(void)XMLNode_free(dst); /* 'dst' is freed first */
-	
-	/* NULL 'src' resets 'dst' */
-	if (src == NULL)
-		return TRUE;
-	
-	/* Tag */
-	if (src->tag != NULL) {
-		dst->tag = sx_strdup(src->tag);
-		if (dst->tag == NULL) goto copy_err;
-	}
 
-	/* Text */
-	if (dst->text != NULL) {
-		dst->text = sx_strdup(src->text);
-		if (dst->text == NULL) goto copy_err;
-	}
+	if (src->text != NULL && (dst->text = _pool_strdup(pool, src->text)) == NULL)
+		return FALSE;
 
-	/* Attributes */
 	if (src->n_attributes > 0) {
-		dst->attributes = __calloc(src->n_attributes, sizeof(XMLAttribute));
-		if (dst->attributes== NULL) goto copy_err;
+		dst->attributes = _pool_alloc(pool, POOL_ARRAYS, src->n_attributes * sizeof(XMLAttribute));
+		if (dst->attributes == NULL)
+			return FALSE;
+		memset(dst->attributes, 0, src->n_attributes * sizeof(XMLAttribute));
 		dst->n_attributes = src->n_attributes;
 		for (i = 0; i < src->n_attributes; i++) {
-			dst->attributes[i].name = sx_strdup(src->attributes[i].name);
-			dst->attributes[i].value = sx_strdup(src->attributes[i].value);
-			if (dst->attributes[i].name == NULL || dst->attributes[i].value == NULL) goto copy_err;
+			dst->attributes[i].name = _pool_strdup(pool, src->attributes[i].name);
+			dst->attributes[i].value = (src->attributes[i].value == NULL ? NULL : _pool_strdup(pool, src->attributes[i].value));
+			if (dst->attributes[i].name == NULL || (dst->attributes[i].value == NULL && src->attributes[i].value != NULL))
+				return FALSE;
 			dst->attributes[i].active = src->attributes[i].active;
 		}
 	}
 
-	dst->tag_type = src->tag_type;
-	dst->father = src->father;
-	dst->user = src->user;
-	dst->active = src->active;
-	
-	/* Copy children if required (and there are any) */
-	if (copy_children && src->n_children > 0) {
-		dst->children = __calloc(src->n_children, sizeof(XMLNode*));
-		if (dst->children == NULL) goto copy_err;
-		dst->n_children = src->n_children;
-		for (i = 0; i < src->n_children; i++) {
-			if (!XMLNode_copy(dst->children[i], src->children[i], TRUE)) goto copy_err;
-		}
-	}
-	
 	return TRUE;
-	
-copy_err:
-	(void)XMLNode_free(dst);
-	
-	return FALSE;
 }
 
-int XMLNode_set_active(XMLNode* node, int active)
+int XMLNode_unshare(XMLNode* node)
 {
+	XMLNode tmp, old;
+
 	CHECK_NODE(node, FALSE);
 
-	node->active = active;
+	if (node->shared == NULL)
+		return TRUE;
+
+	/* Last owner: nothing to duplicate */
+	if (_shared_get(node->shared) <= 1) {
+		__free(node->shared);
+		node->shared = NULL;
+		return TRUE;
+	}
+
+	tmp.init_value = 0;
+	(void)XMLNode_init(&tmp);
+	if (!_XMLNode_dup_content(&tmp, node, NULL)) {
+		(void)XMLNode_free(&tmp);
+		return FALSE;
+	}
+
+	old = *node;
+	node->tag = tmp.tag;
+	node->text = tmp.text;
+	node->attributes = tmp.attributes;
+	node->n_attributes = tmp.n_attributes;
+	node->shared = NULL;
+
+	/* Other owners might have released the content while it was duplicated (e.g. from 'XMLDoc_free_async()') */
+	if (_shared_dec(old.shared) == 0) {
+		__free(old.shared);
+		old.shared = NULL;
+		old.father = NULL; /* Only free the former content, not the hierarchy still used by 'node' */
+		old.children = NULL;
+		old.n_children = 0;
+		old.usage = NULL; /* Same size as the new content, which is still accounted */
+		(void)XMLNode_free(&old);
+	}
 
 	return TRUE;
 }
 
-int XMLNode_set_tag(XMLNode* node, const SXML_CHAR* tag)
+/*
+ Explicit stack used to walk trees without recursion, so that deep documents do not overflow the call stack.
+ The first 'NODE_STACK_SZ' frames are stored in the stack itself so usual documents need no allocation.
+ */
+#define NODE_STACK_SZ 32
+
+typedef struct _NodeFrame {
+	const XMLNode* node;
+	int i;				/* Next child of 'node' to process */
+	int cur_sz_line;	/* Used when printing */
+	int src_gap;		/* Used when printing incrementally: offset of the source to print before the next modified child, or -1 */
+	XMLHash h;			/* Used when hashing */
+} _NodeFrame;
+
+typedef struct _NodeStack {
+	_NodeFrame* frames;
+	int n;
+	int size;
+	_NodeFrame local[NODE_STACK_SZ];
+} _NodeStack;
+
+static void _NodeStack_init(_NodeStack* stack)
 {
-	SXML_CHAR* newtag;
-	if (node == NULL || tag == NULL || node->init_value != XML_INIT_DONE)
-		return FALSE;
-	
-	newtag = sx_strdup(tag);
-	if (newtag == NULL)
-		return FALSE;
-	if (node->tag != NULL)
-		__free(node->tag);
-	node->tag = newtag;
+	stack->frames = stack->local;
+	stack->n = 0;
+	stack->size = NODE_STACK_SZ;
+}
 
-	return TRUE;
+static void _NodeStack_free(_NodeStack* stack)
+{
+	if (stack->frames != stack->local)
+		__free(stack->frames);
+	_NodeStack_init(stack);
 }
 
-int XMLNode_set_type(XMLNode* node, const TagType tag_type)
+/*
+ Push 'node' on 'stack'. Return the new frame, or 'NULL' for memory error.
+ */
+static _NodeFrame* _NodeStack_push(_NodeStack* stack, const XMLNode* node)
 {
-	CHECK_NODE(node, FALSE);
+	_NodeFrame* fr;
 
-	switch (tag_type) {
-		case TAG_ERROR:
-		case TAG_END:
-		case TAG_PARTIAL:
-		case TAG_NONE:
-			return FALSE;
+	if (stack->n >= stack->size) {
+		if (stack->frames == stack->local) {
+			fr = (_NodeFrame*)__malloc(2 * stack->size * sizeof(_NodeFrame));
+			if (fr != NULL)
+				memcpy(fr, stack->local, stack->n * sizeof(_NodeFrame));
+		} else
+			fr = (_NodeFrame*)__realloc(stack->frames, 2 * stack->size * sizeof(_NodeFrame));
+		if (fr == NULL)
+			return NULL;
+		stack->frames = fr;
+		stack->size *= 2;
+	}
+	fr = &stack->frames[stack->n++];
+	fr->node = node;
+	fr->i = 0;
+	fr->src_gap = -1;
 
-		default:
-			node->tag_type = tag_type;
-			return TRUE;
+	return fr;
+}
+
+/*
+ Memory accounting (see 'XMLDoc_memory_usage()').
+ Nodes of a document point to its usage, which is updated each time their allocations change.
+ */
+#define _str_size(str) ((sx_strlen(str) + 1) * sizeof(SXML_CHAR))
+
+/* Add ('sign' > 0) or remove one allocation of 'bytes' to 'count' */
+static void _usage_count(XMLMemoryCount* count, size_t bytes, int sign)
+{
+	if (sign > 0) {
+		count->bytes += bytes;
+		count->allocs++;
+	} else {
+		count->bytes -= bytes;
+		count->allocs--;
 	}
 }
 
-int XMLNode_set_attribute(XMLNode* node, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value)
+static void _usage_str(XMLMemoryCount* count, const SXML_CHAR* str, int sign)
 {
-	XMLAttribute* pt;
+	if (str != NULL)
+		_usage_count(count, _str_size(str), sign);
+}
+
+/* Inline texts are allocated with their node */
+static void _usage_text(XMLMemoryUsage* usage, const XMLNode* node, int sign)
+{
+	if (!_XMLNode_text_inline(node))
+		_usage_str(&usage->texts, node->text, sign);
+	else
+		usage->texts.bytes += sign * _str_size(node->text);
+}
+
+/* Account for an array of 'n' elements of 'sz' bytes being resized to 'n_new' elements (0 meaning no array) */
+static void _usage_array(XMLMemoryCount* count, int n, int n_new, size_t sz)
+{
+	if (n > 0)
+		_usage_count(count, n * sz, -1);
+	if (n_new > 0)
+		_usage_count(count, n_new * sz, 1);
+}
+
+/* Add ('sign' > 0) or remove 'delta' to 'usage' */
+static void _usage_merge(XMLMemoryUsage* usage, const XMLMemoryUsage* delta, int sign)
+{
+	XMLMemoryCount* c = &usage->nodes;
+	const XMLMemoryCount* d = &delta->nodes;
+	int i;
+
+	for (i = 0; i < 5; i++) { /* 'nodes', 'tags', 'texts', 'attributes' and 'children' */
+		c[i].bytes += (sign > 0 ? d[i].bytes : -d[i].bytes);
+		c[i].allocs += (sign > 0 ? d[i].allocs : -d[i].allocs);
+	}
+}
+
+/* Add ('sign' > 0) or remove 'node' own allocations to 'usage': node, tag, text, attributes and children array */
+static void _XMLNode_usage(const XMLNode* node, XMLMemoryUsage* usage, int sign)
+{
+	int i;
+
+	_usage_count(&usage->nodes, sizeof(XMLNode), sign);
+	_usage_str(&usage->tags, node->tag, sign);
+	_usage_text(usage, node, sign);
+	_usage_array(&usage->attributes, sign > 0 ? 0 : node->n_attributes, sign > 0 ? node->n_attributes : 0, sizeof(XMLAttribute));
+	for (i = 0; i < node->n_attributes; i++) {
+		_usage_str(&usage->attributes, node->attributes[i].name, sign);
+		_usage_str(&usage->attributes, node->attributes[i].value, sign);
+	}
+	_usage_array(&usage->children, sign > 0 ? 0 : node->n_children, sign > 0 ? node->n_children : 0, sizeof(XMLNode*));
+}
+
+/*
+ Walk 'node' subtree, adding its memory to 'total' if not NULL and having its nodes accounted in 'usage' if 'set' is 'true'.
+ Return 'false' for memory error, which cannot happen when 'stack' already had the subtree depth.
+ */
+static int _XMLNode_walk_usage(const XMLNode* node, XMLMemoryUsage* total, int set, XMLMemoryUsage* usage, _NodeStack* stack)
+{
+	_NodeFrame* fr;
+	XMLNode* child;
+
+	if (total != NULL)
+		_XMLNode_usage(node, total, 1);
+	if (set)
+		((XMLNode*)node)->usage = usage;
+	stack->n = 0;
+	if (node->n_children > 0 && _NodeStack_push(stack, node) == NULL)
+		return FALSE;
+	while (stack->n > 0) {
+		fr = &stack->frames[stack->n - 1];
+		if (fr->i >= fr->node->n_children) {
+			stack->n--;
+			continue;
+		}
+		child = fr->node->children[fr->i++];
+		if (total != NULL)
+			_XMLNode_usage(child, total, 1);
+		if (set)
+			child->usage = usage;
+		if (child->n_children > 0 && _NodeStack_push(stack, child) == NULL)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ Have 'node' and its descendants accounted in 'usage' (NULL to stop accounting them) instead of 'node->usage'.
+ All nodes of a subtree are accounted in the same usage. Return 'false' for memory error, in which case nothing changed.
+ */
+static int _XMLNode_set_usage(XMLNode* node, XMLMemoryUsage* usage)
+{
+	_NodeStack stack;
+	XMLMemoryUsage total;
+
+	if (node->usage == usage)
+		return TRUE;
+
+	memset(&total, 0, sizeof(total));
+	_NodeStack_init(&stack);
+	/* First walk makes the stack large enough so that the second one cannot fail */
+	if (!_XMLNode_walk_usage(node, &total, FALSE, NULL, &stack)) {
+		_NodeStack_free(&stack);
+		return FALSE;
+	}
+	if (node->usage != NULL)
+		_usage_merge(node->usage, &total, -1);
+	(void)_XMLNode_walk_usage(node, NULL, TRUE, usage, &stack);
+	if (usage != NULL)
+		_usage_merge(usage, &total, 1);
+	_NodeStack_free(&stack);
+
+	return TRUE;
+}
+
+/*
+ Indexes of a document (see 'XMLDoc_build_tag_index()' and 'XMLDoc_build_attribute_index()').
+ Nodes are numbered ("ranked") in document order, so that the nodes following a node up to another one have
+ consecutive ranks. Each tag, and each value of an indexed attribute, lists its nodes by increasing rank.
+ */
+typedef struct _NodeRank {
+	const XMLNode* node;	/* NULL for an empty slot */
+	int rank;
+	int end;				/* Rank following the last descendant of 'node' */
+} _NodeRank;
+
+typedef struct _NodeEntry {
+	XMLNode* node;
+	int rank;
+} _NodeEntry;
+
+typedef struct _NodeList {
+	SXML_CHAR* key;			/* Tag or attribute value, NULL for an empty slot */
+	XMLHash h;
+	_NodeEntry* entries;	/* 'TAG_FATHER' and 'TAG_SELF' nodes having 'key', by increasing rank */
+	int n;
+	int size;
+} _NodeList;
+
+typedef struct _ListTable {
+	_NodeList* lists;	/* Hash table of the lists, 'size' being a power of 2 */
+	int n;
+	int size;
+} _ListTable;
+
+typedef struct _AttrIndex {
+	SXML_CHAR* name;
+	_ListTable values;
+	struct _AttrIndex* next;
+} _AttrIndex;
+
+typedef struct _NumberEntry {
+	double number;
+	int is_number;	/* 'false' when the node has no such attribute or its value is not a number */
+} _NumberEntry;
+
+typedef struct _NumberIndex {
+	SXML_CHAR* name;
+	_NumberEntry* entries;	/* Number of the first active attribute 'name' of the nodes, by rank */
+	struct _NumberIndex* next;
+} _NumberIndex;
+
+typedef struct _DocIndex {
+	XMLDoc* doc;
+	int valid;			/* 'false' when tags or structure changed since the index was built */
+	XMLNode** roots;	/* Copy of 'doc->nodes' when the index was built */
+	int n_roots;
+	_NodeRank* ranks;	/* Hash table of the document nodes, 'size_ranks' being a power of 2 */
+	int n_ranks;
+	int size_ranks;
+	int has_tags;		/* 'true' when tags are indexed in 'tags' */
+	_ListTable tags;
+	_AttrIndex* attrs;	/* Indexed attributes */
+	_NumberIndex* numbers;	/* Attributes parsed as numbers */
+} _DocIndex;
+
+/*
+ Document data reached by its nodes through their 'usage' member, which points to its first member.
+ */
+typedef struct _XMLDocData {
+	XMLMemoryUsage usage;
+	_DocIndex* index;	/* NULL when nothing is indexed */
+} _XMLDocData;
+
+#define _doc_data(usage) ((_XMLDocData*)(usage))
+
+/*
+ Get 'doc' usage, allocating it on first call. Return NULL for memory error.
+ */
+static XMLMemoryUsage* _XMLDoc_usage(XMLDoc* doc)
+{
+	if (doc->usage == NULL)
+		doc->usage = (XMLMemoryUsage*)__calloc(1, sizeof(_XMLDocData));
+
+	return doc->usage;
+}
+
+/*
+ Tell the index of the document accounted in 'usage', if any, that its structure changed.
+ It is not used anymore until built again, as the ranks of the following nodes changed.
+ */
+static void _index_changed(XMLMemoryUsage* usage)
+{
+	if (usage != NULL && _doc_data(usage)->index != NULL)
+		_doc_data(usage)->index->valid = FALSE;
+}
+
+static void _DocIndex_tag(const XMLNode* node, int add);
+static void _DocIndex_attribute(const XMLNode* node, int i_attr, int add);
+static void _DocIndex_node_numbers(const XMLNode* node, int n_attributes, int i_removed);
+static const _NumberEntry* _DocIndex_number(const XMLNode* node, const SXML_CHAR* attr_name);
+
+/*
+ Copy 'src' tag, text, attributes and properties into the empty node 'dst'.
+ Children are copied by the caller, 'copy_children' telling whether they will be.
+ */
+static int _XMLNode_copy_node(XMLNode* dst, const XMLNode* src, int copy_children, int share)
+{
+	/* Inline text is freed with 'src' so it cannot be shared: it is duplicated, leaving 'src' as it is */
+	if (share && _XMLNode_text_inline(src))
+		share = FALSE;
+
+	/* Tag, text and attributes */
+	if (share ? !_XMLNode_share(dst, src) : !_XMLNode_dup_content(dst, src, NULL))
+		return FALSE;
+
+	dst->tag_type = src->tag_type; /* 'dst' keeps its father: modifying it should not mark 'src' fathers */
+	dst->user = src->user;
+	dst->active = src->active;
+	dst->hash = (copy_children ? src->hash : 0); /* Same subtree, same hash */
+	dst->src_start = -1; /* Copies do not come from the parsed source */
+	dst->src_end = -1;
+
+	return TRUE;
+}
+
+/*
+ Copy 'src' into 'dst' ('dst' being freed first), including children when 'copy_children' is 'true'.
+ When 'share' is 'true', tag, text and attributes are shared between nodes instead of duplicated.
+ */
+static int _XMLNode_copy(XMLNode* dst, const XMLNode* src, int copy_children, int share)
+{
+	_NodeStack stack;
+	_NodeFrame* fr;
+	XMLMemoryUsage* usage;
+	XMLMemoryUsage total;
+	const XMLNode* s;
+	XMLNode* d;
+	XMLNode* child;
+	
+	if (dst == NULL || (src != NULL && src->init_value != XML_INIT_DONE))
+		return FALSE;
+	
+	(void)XMLNode_free(dst); /* 'dst' is freed first */
+	
+	/* NULL 'src' resets 'dst' */
+	if (src == NULL)
+		return TRUE;
+	
+	/* The copy is accounted at the end, once complete */
+	usage = dst->usage;
+	if (usage != NULL) {
+		_XMLNode_usage(dst, usage, -1);
+		dst->usage = NULL;
+	}
+	_NodeStack_init(&stack);
+
+	if (!_XMLNode_copy_node(dst, src, copy_children, share))
+		goto copy_err;
+	
+	/* Copy children if required (and there are any) */
+	if (!copy_children || src->n_children <= 0)
+		goto copy_end;
+
+	/* Source nodes being copied are stacked, 'd' is the copy of the top one */
+	(void)_NodeStack_push(&stack, src);
+	d = dst;
+	while (stack.n > 0) {
+		fr = &stack.frames[stack.n - 1];
+		s = fr->node;
+		if (fr->i >= s->n_children) { /* All children copied: back to father */
+			stack.n--;
+			d = d->father;
+			continue;
+		}
+		if (d->children == NULL) {
+			d->children = __calloc(s->n_children, sizeof(XMLNode*));
+			if (d->children == NULL) goto copy_err;
+		}
+		child = XMLNode_alloc();
+		if (child == NULL) goto copy_err;
+		d->children[d->n_children++] = child; /* So it is freed in case of error */
+		s = s->children[fr->i++];
+		if (!_XMLNode_copy_node(child, s, TRUE, share)) goto copy_err;
+		child->father = d;
+		if (s->n_children > 0) {
+			if (_NodeStack_push(&stack, s) == NULL) goto copy_err;
+			d = child;
+		}
+	}
+
+copy_end:
+	if (usage != NULL) {
+		/* Cannot fail as the stack already had the copy depth */
+		memset(&total, 0, sizeof(total));
+		(void)_XMLNode_walk_usage(dst, &total, TRUE, usage, &stack);
+		_usage_merge(usage, &total, 1);
+	}
+	_NodeStack_free(&stack);
+	
+	return TRUE;
+	
+copy_err:
+	_NodeStack_free(&stack);
+	(void)XMLNode_free(dst);
+	if (usage != NULL) {
+		dst->usage = usage;
+		_XMLNode_usage(dst, usage, 1);
+	}
+	
+	return FALSE;
+}
+
+static XMLNode* _XMLNode_dup(const XMLNode* node, int copy_children, int share)
+{
+	XMLNode* n;
+
+	if (node == NULL)
+		return NULL;
+
+	n = XMLNode_alloc();
+	if (n == NULL)
+		return NULL;
+
+	if (!_XMLNode_copy(n, node, copy_children, share)) {
+		(void)XMLNode_free(n);
+		__free(n);
+
+		return NULL;
+	}
+
+	return n;
+}
+
+XMLNode* XMLNode_dup(const XMLNode* node, int copy_children)
+{
+	return _XMLNode_dup(node, copy_children, TRUE);
+}
+
+/*
+ Free 'node' tag, text and attributes, unless they are still shared with other nodes.
+ */
+static void _XMLNode_free_content(XMLNode* node, XMLPool* pool)
+{
+	int i;
+
+	if (!_XMLNode_release_shared(node)) { /* Tag, text and attributes are not used by other nodes */
+		_pool_free_str(pool, node->tag);
+		if (!_XMLNode_text_inline(node))
+			_pool_free_str(pool, node->text);
+		for (i = 0; i < node->n_attributes; i++) {
+			_pool_free_str(pool, node->attributes[i].name);
+			_pool_free_str(pool, node->attributes[i].value);
+		}
+		_pool_free(pool, POOL_ARRAYS, node->attributes, node->n_attributes * sizeof(XMLAttribute));
+	}
+	node->tag = NULL;
+	node->text = NULL;
+	node->attributes = NULL;
+	node->n_attributes = 0;
+}
+
+/*
+ Detach 'node' children and chain them in front of 'list', through their 'father' member.
+ The children array is given to 'pool' if not NULL. Return the new list head.
+ */
+static XMLNode* _XMLNode_chain_children(XMLNode* node, XMLNode* list, XMLPool* pool)
+{
+	int i;
+
+	for (i = 0; i < node->n_children; i++) {
+		if (node->children[i] == NULL)
+			continue;
+		node->children[i]->father = list;
+		list = node->children[i];
+	}
+	_pool_free(pool, POOL_ARRAYS, node->children, node->n_children * sizeof(XMLNode*));
+	node->children = NULL;
+	node->n_children = 0;
+
+	return list;
+}
+
+/*
+ Free 'node' descendants, removing them from 'usage' when not NULL, and giving their memory to 'pool' if not NULL.
+ 'node' children array is freed but not unaccounted.
+ Descendants are freed without recursion: the ones left to free are chained through their 'father' member.
+ */
+static void _XMLNode_free_children(XMLNode* node, XMLMemoryUsage* usage, XMLPool* pool)
+{
+	XMLNode* list;
+	XMLNode* n;
+
+	list = _XMLNode_chain_children(node, NULL, pool);
+	while (list != NULL) {
+		n = list;
+		if (usage != NULL)
+			_XMLNode_usage(n, usage, -1);
+		list = _XMLNode_chain_children(n, n->father, pool);
+		_XMLNode_free_content(n, pool);
+		_pool_free_node(pool, n);
+	}
+}
+
+int XMLNode_free(XMLNode* node)
+{
+	CHECK_NODE(node, FALSE);
+	
+	if (node->usage != NULL) {
+		_XMLNode_usage(node, node->usage, -1);
+		_usage_count(&node->usage->nodes, sizeof(XMLNode), 1); /* 'node' itself is not freed */
+	}
+	_XMLNode_free_content(node, NULL);
+	_XMLNode_free_children(node, node->usage, NULL);
+	_XMLNode_modified(node);
+	_index_changed(node->usage);
+	
+	node->tag_type = TAG_NONE;
+
+	return TRUE;
+}
+
+int XMLNode_copy(XMLNode* dst, const XMLNode* src, int copy_children)
+{
+	return _XMLNode_copy(dst, src, copy_children, TRUE);
+}
+
+int XMLNode_set_active(XMLNode* node, int active)
+{
+	CHECK_NODE(node, FALSE);
+
+	node->active = active;
+	_XMLNode_modified(node->father);
+
+	return TRUE;
+}
+
+int XMLNode_set_tag(XMLNode* node, const SXML_CHAR* tag)
+{
+	SXML_CHAR* newtag;
+	if (node == NULL || tag == NULL || node->init_value != XML_INIT_DONE)
+		return FALSE;
+	if (!XMLNode_unshare(node))
+		return FALSE;
+	
+	newtag = sx_strdup(tag);
+	if (newtag == NULL)
+		return FALSE;
+	if (node->usage != NULL) {
+		_usage_str(&node->usage->tags, node->tag, -1);
+		_usage_str(&node->usage->tags, newtag, 1);
+	}
+	_DocIndex_tag(node, FALSE);
+	if (node->tag != NULL)
+		__free(node->tag);
+	node->tag = newtag;
+	_DocIndex_tag(node, TRUE);
+	_XMLNode_modified(node);
+
+	return TRUE;
+}
+
+int XMLNode_set_type(XMLNode* node, const TagType tag_type)
+{
+	CHECK_NODE(node, FALSE);
+
+	switch (tag_type) {
+		case TAG_ERROR:
+		case TAG_END:
+		case TAG_PARTIAL:
+		case TAG_NONE:
+			return FALSE;
+
+		default:
+			node->tag_type = tag_type;
+			_XMLNode_modified(node);
+			_index_changed(node->usage);
+			return TRUE;
+	}
+}
+
+int XMLNode_set_attribute(XMLNode* node, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value)
+{
+	XMLAttribute* pt;
 	int i;
 	
 	if (node == NULL || attr_name == NULL || attr_name[0] == NULC || node->init_value != XML_INIT_DONE)
 		return -1;
+	if (!XMLNode_unshare(node))
+		return -1;
 	
 	i = XMLNode_search_attribute(node, attr_name, 0);
 	if (i >= 0) { /* Attribute found: update it */
 		SXML_CHAR* value = NULL;
 		if (attr_value != NULL && (value = sx_strdup(attr_value)) == NULL)
 			return -1;
+		_DocIndex_attribute(node, i, FALSE);
 		pt = node->attributes;
+		if (node->usage != NULL) {
+			_usage_str(&node->usage->attributes, pt[i].value, -1);
+			_usage_str(&node->usage->attributes, value, 1);
+		}
 		if (pt[i].value != NULL)
 			__free(pt[i].value);
 		pt[i].value = value;
+		_DocIndex_attribute(node, i, TRUE);
 	} else { /* Attribute not found: add it */
 		SXML_CHAR* name = sx_strdup(attr_name);
 		SXML_CHAR* value = (attr_value == NULL ? NULL : sx_strdup(attr_value));
@@ -463,7 +1368,15 @@ int XMLNode_set_attribute(XMLNode* node, const SXML_CHAR* attr_name, const SXML_
 		pt[i].active = TRUE;
 		node->attributes = pt;
 		node->n_attributes = i + 1;
+		_DocIndex_attribute(node, i, TRUE);
+		if (node->usage != NULL) {
+			_usage_array(&node->usage->attributes, i, i + 1, sizeof(XMLAttribute));
+			_usage_str(&node->usage->attributes, name, 1);
+			_usage_str(&node->usage->attributes, value, 1);
+		}
 	}
+	_DocIndex_node_numbers(node, node->n_attributes, -1);
+	_XMLNode_modified(node);
 
 	return node->n_attributes;
 }
@@ -495,6 +1408,45 @@ int XMLNode_get_attribute_with_default(XMLNode* node, const SXML_CHAR* attr_name
 	return TRUE;
 }
 
+int XMLNode_get_attribute_double(const XMLNode* node, const SXML_CHAR* attr_name, double* attr_value, double default_attr_value)
+{
+	const _NumberEntry* e;
+	int i;
+
+	if (node == NULL || attr_name == NULL || attr_name[0] == NULC || attr_value == NULL || node->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	*attr_value = default_attr_value;
+	if ((e = _DocIndex_number(node, attr_name)) != NULL) {
+		if (e->is_number)
+			*attr_value = e->number;
+		return e->is_number;
+	}
+	i = XMLNode_search_attribute(node, attr_name, 0);
+
+	return i >= 0 && str2number(node->attributes[i].value, attr_value);
+}
+
+int XMLNode_get_attribute_int(const XMLNode* node, const SXML_CHAR* attr_name, int* attr_value, int default_attr_value)
+{
+	double number;
+
+	if (attr_value == NULL || !XMLNode_get_attribute_double(node, attr_name, &number, 0)) {
+		if (attr_value != NULL)
+			*attr_value = default_attr_value;
+		return FALSE;
+	}
+
+	/* Integers only, which 'int' can hold */
+	if (number < (double)INT_MIN || number > (double)INT_MAX || number != (double)(int)number) {
+		*attr_value = default_attr_value;
+		return FALSE;
+	}
+	*attr_value = (int)number;
+
+	return TRUE;
+}
+
 int XMLNode_get_attribute_count(const XMLNode* node)
 {
 	int i, n;
@@ -526,6 +1478,8 @@ int XMLNode_remove_attribute(XMLNode* node, int i_attr)
 	XMLAttribute* pt;
 	if (node == NULL || node->init_value != XML_INIT_DONE || i_attr < 0 || i_attr >= node->n_attributes)
 		return -1;
+	if (!XMLNode_unshare(node))
+		return -1;
 	
 	/* Before modifying first see if we run out of memory */
 	if (node->n_attributes == 1)
@@ -537,6 +1491,13 @@ int XMLNode_remove_attribute(XMLNode* node, int i_attr)
 	}
 
 	/* Can't fail anymore, free item */
+	_DocIndex_attribute(node, i_attr, FALSE);
+	_DocIndex_node_numbers(node, node->n_attributes, i_attr);
+	if (node->usage != NULL) {
+		_usage_array(&node->usage->attributes, node->n_attributes, node->n_attributes - 1, sizeof(XMLAttribute));
+		_usage_str(&node->usage->attributes, node->attributes[i_attr].name, -1);
+		_usage_str(&node->usage->attributes, node->attributes[i_attr].value, -1);
+	}
 	if (node->attributes[i_attr].name != NULL) __free(node->attributes[i_attr].name);
 	if (node->attributes[i_attr].value != NULL) __free(node->attributes[i_attr].value);
 	
@@ -548,6 +1509,7 @@ int XMLNode_remove_attribute(XMLNode* node, int i_attr)
 		__free(node->attributes);
 	node->attributes = pt;
 	node->n_attributes--;
+	_XMLNode_modified(node);
 	
 	return node->n_attributes;
 }
@@ -557,9 +1519,19 @@ int XMLNode_remove_all_attributes(XMLNode* node)
 	int i;
 
 	CHECK_NODE(node, FALSE);
+	if (!XMLNode_unshare(node))
+		return FALSE;
 
 	if (node->attributes != NULL) {
+		_DocIndex_node_numbers(node, 0, -1);
+		if (node->usage != NULL)
+			_usage_array(&node->usage->attributes, node->n_attributes, 0, sizeof(XMLAttribute));
 		for (i = 0; i < node->n_attributes; i++) {
+			_DocIndex_attribute(node, i, FALSE);
+			if (node->usage != NULL) {
+				_usage_str(&node->usage->attributes, node->attributes[i].name, -1);
+				_usage_str(&node->usage->attributes, node->attributes[i].value, -1);
+			}
 			if (node->attributes[i].name != NULL)
 				__free(node->attributes[i].name);
 			if (node->attributes[i].value != NULL)
@@ -569,6 +1541,7 @@ int XMLNode_remove_all_attributes(XMLNode* node)
 		node->attributes = NULL;
 	}
 	node->n_attributes = 0;
+	_XMLNode_modified(node);
 
 	return TRUE;
 }
@@ -577,10 +1550,17 @@ int XMLNode_set_text(XMLNode* node, const SXML_CHAR* text)
 {
 	SXML_CHAR* p;
 	CHECK_NODE(node, FALSE);
+	if (!XMLNode_unshare(node))
+		return FALSE;
+
+	_XMLNode_modified(node);
 
 	if (text == NULL) { /* We want to remove it => free node text */
 		if (node->text != NULL) {
-			__free(node->text);
+			if (node->usage != NULL)
+				_usage_text(node->usage, node, -1);
+			if (!_XMLNode_text_inline(node))
+				__free(node->text);
 			node->text = NULL;
 		}
 
@@ -590,7 +1570,11 @@ int XMLNode_set_text(XMLNode* node, const SXML_CHAR* text)
 	p = sx_strdup(text);
 	if (p == NULL)
 		return FALSE;
-	if (node->text != NULL)
+	if (node->usage != NULL) {
+		_usage_text(node->usage, node, -1);
+		_usage_str(&node->usage->texts, p, 1);
+	}
+	if (node->text != NULL && !_XMLNode_text_inline(node))
 		__free(node->text);
 	node->text = p;
 
@@ -602,9 +1586,17 @@ int XMLNode_add_child(XMLNode* node, XMLNode* child)
 	if (node == NULL || child == NULL || node->init_value != XML_INIT_DONE || child->init_value != XML_INIT_DONE)
 		return FALSE;
 	
-	if (_add_node(&node->children, &node->n_children, child) >= 0) {
+	if (_add_node(&node->children, &node->n_children, child, NULL) >= 0) {
+		if (!_XMLNode_set_usage(child, node->usage)) {
+			node->n_children--;
+			return FALSE;
+		}
+		if (node->usage != NULL)
+			_usage_array(&node->usage->children, node->n_children - 1, node->n_children, sizeof(XMLNode*));
 		node->tag_type = TAG_FATHER;
 		child->father = node;
+		_XMLNode_modified(node);
+		_index_changed(node->usage);
 		return TRUE;
 	} else
 		return FALSE;
@@ -619,26 +1611,33 @@ int XMLNode_insert_child(XMLNode* node, XMLNode* child, int index)
 	/* We could process cases "first" and "last" in an optimized way, but we prefer readability to (micro-)optimization */
 	if (index < 0) /* Before first => first */
 		index = 0;
-	if (index >= node->n_children) /* After last => last */
-		index = node->n_children - 1;
 
 	for (i = 0; i < node->n_children; i++) {
 		if (!node->children[i]->active || index-- > 0)
 			continue;
 		/* Insert it here, at 'i' */
-		if (_add_node(&node->children, &node->n_children, child) >= 0) {
+		if (_add_node(&node->children, &node->n_children, child, NULL) >= 0) {
+			if (!_XMLNode_set_usage(child, node->usage)) {
+				node->n_children--;
+				return FALSE;
+			}
+			if (node->usage != NULL)
+				_usage_array(&node->usage->children, node->n_children - 1, node->n_children, sizeof(XMLNode*));
 			node->tag_type = TAG_FATHER;
 			child->father = node;
 			/* Erase 'child', which is the last node ('n_children' has been incremented by '_add_node()') */
-			for (j = node->n_children - 1; j >= i; j--)
+			for (j = node->n_children - 1; j > i; j--)
 				node->children[j] = node->children[j-1];
 			node->children[i] = child; /* Set it */
+			_XMLNode_modified(node);
+			_index_changed(node->usage);
 			return TRUE;
 		} else
 			return FALSE;
 	}
 
-	return FALSE; /* Oops! */
+	/* After last => last */
+	return XMLNode_add_child(node, child);
 }
 
 int XMLNode_move_child(XMLNode* node, int from, int to)
@@ -664,6 +1663,8 @@ int XMLNode_move_child(XMLNode* node, int from, int to)
 			node->children[i+1] = node->children[i];
 	}
 	node->children[to] = nfrom;
+	_XMLNode_modified(node);
+	_index_changed(node->usage);
 
 	return TRUE;
 }
@@ -748,8 +1749,14 @@ int XMLNode_remove_child(XMLNode* node, int i_child, int free_child)
 
 	/* Can't fail anymore, free item */
 	(void)XMLNode_free(node->children[i_child]);
+	if (node->children[i_child]->usage != NULL) { /* Content has been unaccounted by 'XMLNode_free()' */
+		_usage_count(&node->children[i_child]->usage->nodes, sizeof(XMLNode), -1);
+		node->children[i_child]->usage = NULL;
+	}
 	if (free_child)
 		__free(node->children[i_child]);
+	if (node->usage != NULL)
+		_usage_array(&node->usage->children, node->n_children, node->n_children - 1, sizeof(XMLNode*));
 	
 	if (pt != NULL) {
 		memcpy(pt, node->children, i_child * sizeof(XMLNode*));
@@ -761,26 +1768,21 @@ int XMLNode_remove_child(XMLNode* node, int i_child, int free_child)
 	node->n_children--;
 	if (node->n_children == 0)
 		node->tag_type = TAG_SELF;
+	_XMLNode_modified(node);
+	_index_changed(node->usage);
 	
 	return node->n_children;
 }
 
 int XMLNode_remove_children(XMLNode* node)
 {
-	int i;
-
 	CHECK_NODE(node, FALSE);
 
-	if (node->children != NULL) {
-		for (i = 0; i < node->n_children; i++)
-			if (node->children[i] != NULL) {
-				(void)XMLNode_free(node->children[i]);
-				__free(node->children[i]);
-			}
-		__free(node->children);
-		node->children = NULL;
-	}
-	node->n_children = 0;
+	if (node->usage != NULL)
+		_usage_array(&node->usage->children, node->n_children, 0, sizeof(XMLNode*));
+	_XMLNode_free_children(node, node->usage, NULL);
+	_XMLNode_modified(node);
+	_index_changed(node->usage);
 	
 	return TRUE;
 }
@@ -795,6 +1797,10 @@ int XMLNode_equal(const XMLNode* node1, const XMLNode* node2)
 	if (node1 == NULL || node2 == NULL || node1->init_value != XML_INIT_DONE || node2->init_value != XML_INIT_DONE)
 		return FALSE;
 
+	/* Nodes sharing their content are equal */
+	if (node1->shared != NULL && node1->shared == node2->shared)
+		return TRUE;
+
 	if (sx_strcmp(node1->tag, node2->tag))
 		return FALSE;
 
@@ -823,6 +1829,105 @@ int XMLNode_equal(const XMLNode* node1, const XMLNode* node2)
 	return TRUE;
 }
 
+/* FNV-1a parameters */
+#define XML_HASH_OFFSET 14695981039346656037ULL
+#define XML_HASH_PRIME 1099511628211ULL
+
+/*
+ Add 'str' to hash 'h'. 'NULL' hashes as an empty string.
+ */
+static XMLHash _hash_str(XMLHash h, const SXML_CHAR* str)
+{
+	if (str != NULL)
+		for ( ; *str != NULC; str++) {
+			h ^= (XMLHash)*str;
+			h *= XML_HASH_PRIME;
+		}
+	/* Terminate the string so that ("ab", "c") and ("a", "bc") hash differently */
+	h ^= 0xff;
+	h *= XML_HASH_PRIME;
+
+	return h;
+}
+
+/*
+ Add 'v' to hash 'h', mixing all its bits ("splitmix64" finalizer).
+ */
+static XMLHash _hash_mix(XMLHash h, XMLHash v)
+{
+	h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+
+	return h ^ (h >> 31);
+}
+
+/*
+ Hash of 'node' type, tag, text and attributes, to be completed with its children hashes.
+ */
+static XMLHash _XMLNode_hash_content(const XMLNode* node)
+{
+	XMLHash h, h_attr;
+	int i;
+
+	/* 'TAG_SELF' and 'TAG_FATHER' only differ by the presence of children, which are hashed anyway */
+	h = _hash_mix(XML_HASH_OFFSET, (XMLHash)(node->tag_type == TAG_SELF ? TAG_FATHER : node->tag_type));
+	h = _hash_str(h, node->tag);
+	h = _hash_str(h, node->text);
+
+	/* Attributes order does not matter (as in 'XMLNode_equal()') so their hashes are summed */
+	h_attr = 0;
+	for (i = 0; i < node->n_attributes; i++)
+		if (node->attributes[i].active)
+			h_attr += _hash_mix(0, _hash_str(_hash_str(XML_HASH_OFFSET, node->attributes[i].name), node->attributes[i].value));
+
+	return _hash_mix(h, h_attr);
+}
+
+XMLHash XMLNode_hash(const XMLNode* node)
+{
+	_NodeStack stack;
+	_NodeFrame* fr;
+	const XMLNode* child;
+	XMLHash h;
+
+	CHECK_NODE(node, 0);
+
+	if (node->hash != 0)
+		return node->hash;
+
+	/* Children hashes are computed first, without recursion, and cached */
+	_NodeStack_init(&stack);
+	fr = _NodeStack_push(&stack, node);
+	fr->h = _XMLNode_hash_content(node);
+	while (stack.n > 0) {
+		fr = &stack.frames[stack.n - 1];
+		if (fr->i < fr->node->n_children) {
+			child = fr->node->children[fr->i++];
+			if (!child->active)
+				continue;
+			if (child->hash != 0) {
+				fr->h = _hash_mix(fr->h, child->hash);
+				continue;
+			}
+			if ((fr = _NodeStack_push(&stack, child)) == NULL)
+				break;
+			fr->h = _XMLNode_hash_content(child);
+			continue;
+		}
+		h = fr->h;
+		if (h == 0) /* 0 means "not computed" */
+			h = 1;
+		/* Node is const but caching its hash does not change its content */
+		((XMLNode*)fr->node)->hash = h;
+		if (--stack.n > 0)
+			stack.frames[stack.n - 1].h = _hash_mix(stack.frames[stack.n - 1].h, h);
+	}
+	_NodeStack_free(&stack);
+
+	return node->hash; /* Still 0 on memory error */
+}
+
 XMLNode* XMLNode_next_sibling(const XMLNode* node)
 {
 	int i;
@@ -848,12 +1953,12 @@ static XMLNode* _XMLNode_next(const XMLNode* node, int in_children)
 	if (in_children && node->n_children > 0)
 		return node->children[0];
 
-	/* Check next sibling */
-	if ((node2 = XMLNode_next_sibling(node)) != NULL)
-		return node2;
+	/* Check next sibling, then next uncle */
+	for ( ; node != NULL; node = node->father)
+		if ((node2 = XMLNode_next_sibling(node)) != NULL)
+			return node2;
 
-	/* Check next uncle */
-	return _XMLNode_next(node->father, FALSE);
+	return NULL;
 }
 
 XMLNode* XMLNode_next(const XMLNode* node)
@@ -861,290 +1966,2732 @@ XMLNode* XMLNode_next(const XMLNode* node)
 	return _XMLNode_next(node, TRUE);
 }
 
-/* --- XMLDoc methods --- */
+/* --- Document index --- */
 
-int XMLDoc_init(XMLDoc* doc)
+static void _ListTable_clear(_ListTable* table)
 {
-	if (doc == NULL)
-		return FALSE;
+	int i;
 
-	doc->filename[0] = NULC;
-	memset(&doc->bom, 0, sizeof(doc->bom));
-	doc->sz_bom = 0;
-	doc->nodes = NULL;
-	doc->n_nodes = 0;
-	doc->i_root = -1;
-	doc->init_value = XML_INIT_DONE;
+	for (i = 0; i < table->size; i++) {
+		if (table->lists[i].key == NULL)
+			continue;
+		__free(table->lists[i].key);
+		if (table->lists[i].entries != NULL)
+			__free(table->lists[i].entries);
+	}
+	if (table->lists != NULL)
+		__free(table->lists);
+	table->lists = NULL;
+	table->n = table->size = 0;
+}
 
-	return TRUE;
+/* Slot of 'key' (of hash 'h') in 'lists' (of size 'size', a power of 2), or the empty slot where to add it */
+static _NodeList* _list_slot(_NodeList* lists, int size, const SXML_CHAR* key, XMLHash h)
+{
+	size_t i = (size_t)h & (size - 1);
+
+	while (lists[i].key != NULL && (lists[i].h != h || sx_strcmp(lists[i].key, key)))
+		i = (i + 1) & (size - 1);
+
+	return &lists[i];
 }
 
-int XMLDoc_free(XMLDoc* doc)
+/* Nodes having 'key', or NULL if there are none */
+static _NodeList* _ListTable_get(const _ListTable* table, const SXML_CHAR* key)
 {
-	int i;
-	
-	if (doc == NULL || doc->init_value != XML_INIT_DONE)
-		return FALSE;
+	_NodeList* list;
 
-	for (i = 0; i < doc->n_nodes; i++) {
-		(void)XMLNode_free(doc->nodes[i]);
-		__free(doc->nodes[i]);
-	}
-	__free(doc->nodes);
-	doc->nodes = NULL;
-	doc->n_nodes = 0;
-	doc->i_root = -1;
+	if (table->size == 0)
+		return NULL;
+	list = _list_slot(table->lists, table->size, key, _hash_str(XML_HASH_OFFSET, key));
 
-	return TRUE;
+	return list->key != NULL ? list : NULL;
 }
 
-int XMLDoc_set_root(XMLDoc* doc, int i_root)
+/*
+ Nodes having 'key', adding an empty list if there are none, and keeping the table at most half full.
+ Return NULL for memory error.
+ */
+static _NodeList* _ListTable_add(_ListTable* table, const SXML_CHAR* key)
 {
-	if (doc == NULL || doc->init_value != XML_INIT_DONE || i_root < 0 || i_root >= doc->n_nodes)
-		return FALSE;
-	
-	doc->i_root = i_root;
-	
-	return TRUE;
+	_NodeList* list;
+	XMLHash h;
+	int i, size;
+
+	if (2 * (table->n + 1) > table->size) {
+		size = (table->size == 0 ? 16 : 2 * table->size);
+		list = (_NodeList*)__calloc(size, sizeof(_NodeList));
+		if (list == NULL)
+			return NULL;
+		for (i = 0; i < table->size; i++)
+			if (table->lists[i].key != NULL)
+				*_list_slot(list, size, table->lists[i].key, table->lists[i].h) = table->lists[i];
+		if (table->lists != NULL)
+			__free(table->lists);
+		table->lists = list;
+		table->size = size;
+	}
+	h = _hash_str(XML_HASH_OFFSET, key);
+	list = _list_slot(table->lists, table->size, key, h);
+	if (list->key == NULL) {
+		if ((list->key = sx_strdup(key)) == NULL)
+			return NULL;
+		list->h = h;
+		table->n++;
+	}
+
+	return list;
 }
 
-int XMLDoc_add_node(XMLDoc* doc, XMLNode* node)
+/* Index of the first entry of 'list' ranked after 'rank' */
+static int _NodeList_after(const _NodeList* list, int rank)
 {
-	if (doc == NULL || node == NULL || doc->init_value != XML_INIT_DONE)
-		return -1;
-	
-	if (_add_node(&doc->nodes, &doc->n_nodes, node) < 0)
-		return -1;
+	int lo, hi, mid;
 
-	if (node->tag_type == TAG_FATHER)
-		doc->i_root = doc->n_nodes - 1; /* Main root node is the last father node */
+	for (lo = 0, hi = list->n; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (list->entries[mid].rank <= rank)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	return doc->n_nodes;
+	return lo;
 }
 
-int XMLDoc_remove_node(XMLDoc* doc, int i_node, int free_node)
+/* Insert 'node' with rank 'rank' in 'list'. Return 'false' for memory error. */
+static int _NodeList_insert(_NodeList* list, const XMLNode* node, int rank)
 {
-	XMLNode** pt;
-	if (doc == NULL || doc->init_value != XML_INIT_DONE || i_node < 0 || i_node > doc->n_nodes)
-		return FALSE;
+	_NodeEntry* entries;
+	int i, size;
 
-	/* Before modifying first see if we run out of memory */
-	if (doc->n_nodes == 1)
-		pt = NULL;
-	else {
-		pt = __malloc((doc->n_nodes - 1) * sizeof(XMLNode*));
-		if (pt == NULL)
+	if (list->n >= list->size) {
+		size = (list->size == 0 ? 4 : 2 * list->size);
+		entries = (_NodeEntry*)__realloc(list->entries, size * sizeof(_NodeEntry));
+		if (entries == NULL)
 			return FALSE;
+		list->entries = entries;
+		list->size = size;
 	}
+	/* Nodes are usually added in document order */
+	i = (list->n == 0 || list->entries[list->n - 1].rank <= rank ? list->n : _NodeList_after(list, rank));
+	memmove(&list->entries[i + 1], &list->entries[i], (list->n - i) * sizeof(_NodeEntry));
+	list->entries[i].node = (XMLNode*)node;
+	list->entries[i].rank = rank;
+	list->n++;
 
-	/* Can't fail anymore, free item */
-	(void)XMLNode_free(doc->nodes[i_node]);
-	if (free_node) __free(doc->nodes[i_node]);
-	
-	if (pt != NULL) {
-		memcpy(pt, &doc->nodes[i_node], i_node * sizeof(XMLNode*));
-		memcpy(&pt[i_node], &doc->nodes[i_node + 1], (doc->n_nodes - i_node - 1) * sizeof(XMLNode*));
-	}
+	return TRUE;
+}
 
-	if (doc->nodes != NULL)
-		__free(doc->nodes);
-	doc->nodes = pt;
-	doc->n_nodes--;
+/* Remove 'node' with rank 'rank' from 'list', if there */
+static void _NodeList_remove(_NodeList* list, const XMLNode* node, int rank)
+{
+	int i;
 
-	return TRUE;
+	for (i = _NodeList_after(list, rank); --i >= 0 && list->entries[i].rank == rank; ) {
+		if (list->entries[i].node == node) {
+			memmove(&list->entries[i], &list->entries[i + 1], (list->n - i - 1) * sizeof(_NodeEntry));
+			list->n--;
+			return;
+		}
+	}
 }
 
-/*
- Helper functions to print formatting before a new tag.
- Returns the new number of characters in the line.
- */
-static int _count_new_char_line(const SXML_CHAR* str, int nb_char_tab, int cur_sz_line)
+static void _DocIndex_clear(_DocIndex* index)
 {
-	for (; *str; str++) {
-		if (*str == C2SX('\n'))
-			cur_sz_line = 0;
-		else if (*str == C2SX('\t'))
-			cur_sz_line += nb_char_tab;
-		else
-			cur_sz_line++;
+	_AttrIndex* a;
+	_NumberIndex* n;
+
+	_ListTable_clear(&index->tags);
+	for (a = index->attrs; a != NULL; a = a->next)
+		_ListTable_clear(&a->values);
+	for (n = index->numbers; n != NULL; n = n->next) {
+		if (n->entries != NULL)
+			__free(n->entries);
+		n->entries = NULL;
 	}
-	
-	return cur_sz_line;
+	if (index->ranks != NULL)
+		__free(index->ranks);
+	if (index->roots != NULL)
+		__free(index->roots);
+	index->ranks = NULL;
+	index->n_ranks = index->size_ranks = 0;
+	index->roots = NULL;
+	index->n_roots = 0;
+	index->valid = FALSE;
 }
-static int _print_formatting(const XMLNode* node, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, int nb_char_tab, int cur_sz_line)
+
+static void _DocIndex_free(_DocIndex* index)
 {
-	if (tag_sep != NULL) {
-		sx_fputs(tag_sep, f);
-		cur_sz_line = _count_new_char_line(tag_sep, nb_char_tab, cur_sz_line);
+	_AttrIndex* a;
+	_NumberIndex* n;
+
+	if (index == NULL)
+		return;
+	_DocIndex_clear(index);
+	while ((a = index->attrs) != NULL) {
+		index->attrs = a->next;
+		__free(a->name);
+		__free(a);
 	}
-	if (child_sep != NULL) {
-		for (node = node->father; node != NULL; node = node->father) {
-			sx_fputs(child_sep, f);
-			cur_sz_line = _count_new_char_line(child_sep, nb_char_tab, cur_sz_line);
-		}
+	while ((n = index->numbers) != NULL) {
+		index->numbers = n->next;
+		__free(n->name);
+		__free(n);
 	}
-	
-	return cur_sz_line;
+	__free(index);
 }
 
-static int _XMLNode_print_header(const XMLNode* node, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int sz_line, int cur_sz_line, int nb_char_tab)
+/* Slot of 'node' in 'ranks' (of size 'size', a power of 2), or the empty slot where to add it */
+static _NodeRank* _rank_slot(_NodeRank* ranks, int size, const XMLNode* node)
 {
-	int i;
-	SXML_CHAR* p;
+	size_t i = (size_t)_hash_mix(0, (XMLHash)(size_t)node) & (size - 1);
 
-	if (node == NULL || f == NULL || !node->active || node->tag == NULL || node->tag[0] == NULC)
-		return -1;
-	
-	/* Special handling of DOCTYPE */
-	if (node->tag_type == TAG_DOCTYPE) {
-		/* Search for an unescaped '[' in the DOCTYPE definition, in which case the end delimiter should be ']>' instead of '>' */
-		for (p = sx_strchr(node->tag, C2SX('[')); p != NULL && *(p-1) == C2SX('\\'); p = sx_strchr(p+1, C2SX('['))) ;
-		cur_sz_line += sx_fprintf(f, C2SX("<!DOCTYPE%s%s>"), node->tag, p != NULL ? C2SX("]") : C2SX(""));
-		return cur_sz_line;
+	while (ranks[i].node != NULL && ranks[i].node != node)
+		i = (i + 1) & (size - 1);
+
+	return &ranks[i];
+}
+
+/* Rank of 'node', or NULL if it is not in the index */
+static const _NodeRank* _DocIndex_rank(const _DocIndex* index, const XMLNode* node)
+{
+	const _NodeRank* r;
+
+	if (index->size_ranks == 0 || node == NULL)
+		return NULL;
+	r = _rank_slot(index->ranks, index->size_ranks, node);
+
+	return r->node != NULL ? r : NULL;
+}
+
+/* Attribute index of 'attr_name', or NULL if it is not indexed */
+static _AttrIndex* _DocIndex_attr(const _DocIndex* index, const SXML_CHAR* attr_name)
+{
+	_AttrIndex* a;
+
+	for (a = index->attrs; a != NULL && sx_strcmp(a->name, attr_name); a = a->next) ;
+
+	return a;
+}
+
+/* Number index of 'attr_name', or NULL if it is not indexed */
+static _NumberIndex* _DocIndex_numbers(const _DocIndex* index, const SXML_CHAR* attr_name)
+{
+	_NumberIndex* n;
+
+	for (n = index->numbers; n != NULL && sx_strcmp(n->name, attr_name); n = n->next) ;
+
+	return n;
+}
+
+/* Set 'e' to the number of 'node' first active attribute 'attr_name' */
+static void _NumberEntry_set(_NumberEntry* e, const XMLNode* node, const SXML_CHAR* attr_name)
+{
+	int i = XMLNode_search_attribute(node, attr_name, 0);
+
+	e->is_number = (i >= 0 && str2number(node->attributes[i].value, &e->number));
+}
+
+/*
+ Add 'node' with rank 'rank' to 'index', keeping the ranks hash table at most half full.
+ Return 'false' for memory error.
+ */
+static int _DocIndex_add(_DocIndex* index, const XMLNode* node, int rank)
+{
+	_NodeRank* r;
+	_NodeList* list;
+	_AttrIndex* a;
+	int i, size;
+
+	if (2 * (index->n_ranks + 1) > index->size_ranks) {
+		size = (index->size_ranks == 0 ? 64 : 2 * index->size_ranks);
+		r = (_NodeRank*)__calloc(size, sizeof(_NodeRank));
+		if (r == NULL)
+			return FALSE;
+		for (i = 0; i < index->size_ranks; i++)
+			if (index->ranks[i].node != NULL)
+				*_rank_slot(r, size, index->ranks[i].node) = index->ranks[i];
+		if (index->ranks != NULL)
+			__free(index->ranks);
+		index->ranks = r;
+		index->size_ranks = size;
 	}
+	r = _rank_slot(index->ranks, index->size_ranks, node);
+	r->node = node;
+	r->rank = rank;
+	r->end = rank + 1;
+	index->n_ranks++;
 
-	/* Check for special tags first */
-	for (i = 0; i < NB_SPECIAL_TAGS; i++) {
-		if (node->tag_type == _spec[i].tag_type) {
-			sx_fprintf(f, C2SX("%s%s%s"), _spec[i].start, node->tag, _spec[i].end);
-			cur_sz_line += sx_strlen(_spec[i].start) + sx_strlen(node->tag) + sx_strlen(_spec[i].end);
-			return cur_sz_line;
-		}
+	if (node->tag_type != TAG_FATHER && node->tag_type != TAG_SELF)
+		return TRUE;
+
+	if (index->has_tags && node->tag != NULL) {
+		if ((list = _ListTable_add(&index->tags, node->tag)) == NULL || !_NodeList_insert(list, node, rank))
+			return FALSE;
+	}
+	for (i = 0; index->attrs != NULL && i < node->n_attributes; i++) {
+		if (!node->attributes[i].active || node->attributes[i].value == NULL || (a = _DocIndex_attr(index, node->attributes[i].name)) == NULL)
+			continue;
+		if ((list = _ListTable_add(&a->values, node->attributes[i].value)) == NULL || !_NodeList_insert(list, node, rank))
+			return FALSE;
 	}
 
-	/* Check for user tags */
-	for (i = 0; i < _user_tags.n_tags; i++) {
-		if (node->tag_type == _user_tags.tags[i].tag_type) {
-			sx_fprintf(f, C2SX("%s%s%s"), _user_tags.tags[i].start, node->tag, _user_tags.tags[i].end);
-			cur_sz_line += sx_strlen(_user_tags.tags[i].start) + sx_strlen(node->tag) + sx_strlen(_user_tags.tags[i].end);
-			return cur_sz_line;
-		}
+	return TRUE;
+}
+
+/*
+ (Re)build 'index' from its document nodes. Return 'false' for memory error, in which case 'index' is empty.
+ */
+static int _DocIndex_build(_DocIndex* index)
+{
+	XMLDoc* doc = index->doc;
+	_NodeStack stack;
+	_NodeFrame* fr;
+	XMLNode* child;
+	_NumberIndex* n;
+	int i, rank;
+
+	_DocIndex_clear(index);
+	_NodeStack_init(&stack);
+	if (doc->n_nodes > 0) {
+		index->roots = (XMLNode**)__malloc(doc->n_nodes * sizeof(XMLNode*));
+		if (index->roots == NULL)
+			goto build_err;
+		memcpy(index->roots, doc->nodes, doc->n_nodes * sizeof(XMLNode*));
+		index->n_roots = doc->n_nodes;
 	}
-	
-	/* Print tag name */
-	cur_sz_line += sx_fprintf(f, C2SX("<%s"), node->tag);
 
-	/* Print attributes */
-	if (attr_sep == NULL)
-		attr_sep = C2SX(" ");
-	for (i = 0; i < node->n_attributes; i++) {
-		if (!node->attributes[i].active)
-			continue;
-		cur_sz_line += sx_strlen(node->attributes[i].name) + sx_strlen(node->attributes[i].value) + 3;
-		if (sz_line > 0 && cur_sz_line > sz_line) {
-			cur_sz_line = _print_formatting(node, f, tag_sep, child_sep, nb_char_tab, cur_sz_line);
-			/* Add extra separator, as if new line was a child of the previous one */
-			if (child_sep != NULL) {
-				sx_fputs(child_sep, f);
-				cur_sz_line = _count_new_char_line(child_sep, nb_char_tab, cur_sz_line);
+	/* Nodes are ranked when first visited, and know their 'end' when all their descendants are */
+	for (i = rank = 0; i < doc->n_nodes; i++) {
+		if (!_DocIndex_add(index, doc->nodes[i], rank++) || _NodeStack_push(&stack, doc->nodes[i]) == NULL)
+			goto build_err;
+		while (stack.n > 0) {
+			fr = &stack.frames[stack.n - 1];
+			if (fr->i < fr->node->n_children) {
+				child = fr->node->children[fr->i++];
+				if (!_DocIndex_add(index, child, rank++) || _NodeStack_push(&stack, child) == NULL)
+					goto build_err;
+				continue;
 			}
+			_rank_slot(index->ranks, index->size_ranks, fr->node)->end = rank;
+			stack.n--;
 		}
-		/* Attribute name */
-		cur_sz_line = _count_new_char_line(attr_sep, nb_char_tab, cur_sz_line);
-		sx_fprintf(f, C2SX("%s%s="), attr_sep, node->attributes[i].name);
-		
-		/* Attribute value */
-		(void)sx_fputc(XML_DEFAULT_QUOTE, f);
-		cur_sz_line += fprintHTML(f, node->attributes[i].value) + 2;
-		(void)sx_fputc(XML_DEFAULT_QUOTE, f);
 	}
-	
-	/* End the tag if there are no children and no text */
-	if (node->n_children == 0 && (node->text == NULL || node->text[0] == NULC)) {
-		cur_sz_line += sx_fprintf(f, C2SX("/>"));
-	} else {
-		(void)sx_fputc(C2SX('>'), f);
-		cur_sz_line++;
+	_NodeStack_free(&stack);
+
+	/* Numbers are stored by rank, once all nodes are ranked */
+	for (n = index->numbers; n != NULL; n = n->next) {
+		if (rank > 0 && (n->entries = (_NumberEntry*)__malloc(rank * sizeof(_NumberEntry))) == NULL)
+			goto build_err;
+		for (i = 0; i < index->size_ranks; i++)
+			if (index->ranks[i].node != NULL)
+				_NumberEntry_set(&n->entries[index->ranks[i].rank], index->ranks[i].node, n->name);
 	}
+	index->valid = TRUE;
 
-	return cur_sz_line;
+	return TRUE;
+
+build_err:
+	_NodeStack_free(&stack);
+	_DocIndex_clear(index);
+
+	return FALSE;
 }
 
-int XMLNode_print_header(const XMLNode* node, FILE* f, int sz_line, int nb_char_tab)
+/*
+ Check that 'index' still describes its document.
+ The document nodes array is compared as it can be modified directly (e.g. by 'XMLDoc_patch()').
+ Lookups do not rebuild a stale index, as other threads searching the document could be reading it:
+ they walk the nodes instead, until the index is built again by 'XMLDoc_build_*_index()'.
+ */
+static int _DocIndex_valid(const _DocIndex* index)
+{
+	return index->valid && index->n_roots == index->doc->n_nodes
+		&& (index->n_roots == 0 || !memcmp(index->roots, index->doc->nodes, index->n_roots * sizeof(XMLNode*)));
+}
+
+/*
+ Update the tag index of the document of 'node', if any, when its tag is added ('add' is 'true') or removed.
+ The rank of 'node' does not change, so only the lists of both tags are updated.
+ */
+static void _DocIndex_tag(const XMLNode* node, int add)
+{
+	_DocIndex* index;
+	_NodeList* list;
+	const _NodeRank* r;
+
+	if (node->usage == NULL || (index = _doc_data(node->usage)->index) == NULL || !index->valid || !index->has_tags)
+		return;
+	if ((node->tag_type != TAG_FATHER && node->tag_type != TAG_SELF) || node->tag == NULL)
+		return;
+
+	if ((r = _DocIndex_rank(index, node)) == NULL)
+		index->valid = FALSE;
+	else if (!add) {
+		if ((list = _ListTable_get(&index->tags, node->tag)) != NULL)
+			_NodeList_remove(list, node, r->rank);
+	} else if ((list = _ListTable_add(&index->tags, node->tag)) == NULL || !_NodeList_insert(list, node, r->rank))
+		index->valid = FALSE; /* Memory error: try again later */
+}
+
+/*
+ Update the attribute indexes of the document of 'node', if any, when its attribute #'i_attr' is added ('add' is 'true')
+ or removed. Indexes needing a rebuild anyway are left as they are.
+ */
+static void _DocIndex_attribute(const XMLNode* node, int i_attr, int add)
 {
-	return _XMLNode_print_header(node, f, NULL, NULL, NULL, sz_line, 0, nb_char_tab) < 0 ? FALSE : TRUE;
+	_DocIndex* index;
+	_AttrIndex* a;
+	_NodeList* list;
+	const _NodeRank* r;
+	const XMLAttribute* attr = &node->attributes[i_attr];
+
+	if (node->usage == NULL || (index = _doc_data(node->usage)->index) == NULL || !index->valid || index->attrs == NULL)
+		return;
+	if ((node->tag_type != TAG_FATHER && node->tag_type != TAG_SELF) || !attr->active || attr->value == NULL)
+		return;
+	if ((a = _DocIndex_attr(index, attr->name)) == NULL)
+		return;
+
+	if ((r = _DocIndex_rank(index, node)) == NULL)
+		index->valid = FALSE;
+	else if (!add) {
+		if ((list = _ListTable_get(&a->values, attr->value)) != NULL)
+			_NodeList_remove(list, node, r->rank);
+	} else if ((list = _ListTable_add(&a->values, attr->value)) == NULL || !_NodeList_insert(list, node, r->rank))
+		index->valid = FALSE; /* Memory error: try again later */
 }
 
-static int _XMLNode_print(const XMLNode* node, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int cur_sz_line, int nb_char_tab, int depth)
+/*
+ Update the numbers of 'node' in the number indexes of its document, if any, when its attributes change.
+ Only its first 'n_attributes' attributes are considered, except #'i_removed' (if not -1).
+ */
+static void _DocIndex_node_numbers(const XMLNode* node, int n_attributes, int i_removed)
 {
+	_DocIndex* index;
+	_NumberIndex* n;
+	_NumberEntry* e;
+	const _NodeRank* r;
 	int i;
-	SXML_CHAR* p;
-	
-	if (node != NULL && node->tag_type==TAG_TEXT) { /* Text has to be printed: check if it is only spaces */
-		if (!keep_text_spaces) {
-			for (p = node->text; p != NULL && *p != NULC && sx_isspace(*p); p++) ; /* 'p' points to first non-space character, or to '\0' if only spaces */
-		} else
-			p = node->text; /* '*p' won't be '\0' */
-		if (p != NULL && *p != NULC)
-			cur_sz_line += fprintHTML(f, node->text);
-		return cur_sz_line;
+
+	if (node->usage == NULL || (index = _doc_data(node->usage)->index) == NULL || !index->valid || index->numbers == NULL)
+		return;
+	if ((r = _DocIndex_rank(index, node)) == NULL) {
+		index->valid = FALSE;
+		return;
 	}
 
-	if (node == NULL || f == NULL || !node->active || node->tag == NULL || node->tag[0] == NULC)
-		return -1;
+	for (n = index->numbers; n != NULL; n = n->next) {
+		e = &n->entries[r->rank];
+		for (i = 0; i < n_attributes; i++)
+			if (i != i_removed && node->attributes[i].active && !sx_strcmp(node->attributes[i].name, n->name))
+				break;
+		e->is_number = (i < n_attributes && str2number(node->attributes[i].value, &e->number));
+	}
+}
+
+/*
+ Get the number of 'node' attribute 'attr_name' from the number index of its document.
+ Return NULL if the attribute is not indexed or the index is not up to date.
+ */
+static const _NumberEntry* _DocIndex_number(const XMLNode* node, const SXML_CHAR* attr_name)
+{
+	_DocIndex* index;
+	_NumberIndex* n;
+	const _NodeRank* r;
+
+	if (node->usage == NULL || (index = _doc_data(node->usage)->index) == NULL || index->numbers == NULL)
+		return NULL;
+	if ((n = _DocIndex_numbers(index, attr_name)) == NULL || !_DocIndex_valid(index) || (r = _DocIndex_rank(index, node)) == NULL)
+		return NULL;
+
+	return &n->entries[r->rank];
+}
+
+/*
+ Get the index of the document of 'node', and the ranks in ['*from', '*end'[ of the nodes following 'node'
+ up to 'stop_at' (see 'XMLNode_next_with_tag()'). Return NULL if there is no index or it is not up to date.
+ */
+static _DocIndex* _DocIndex_range(const XMLNode* node, const XMLNode* stop_at, int* from, int* end)
+{
+	_DocIndex* index;
+	const _NodeRank* r1;
+	const _NodeRank* r2;
+	const XMLNode* top;
+
+	index = (node->usage != NULL ? _doc_data(node->usage)->index : NULL);
+	if (index == NULL || !_DocIndex_valid(index))
+		return NULL;
+
+	for (top = node; top->father != NULL; top = top->father) ;
+	r1 = _DocIndex_rank(index, node);
+	r2 = _DocIndex_rank(index, stop_at != NULL ? stop_at : top);
+	if (r1 == NULL || r2 == NULL)
+		return NULL;
+	*from = r1->rank + 1;
+	*end = (stop_at != NULL ? r2->rank : r2->end);
+
+	return index;
+}
+
+/* Check whether 'node' is a 'TAG_FATHER' or 'TAG_SELF' node with tag 'tag' (any tag if NULL) */
+static int _XMLNode_has_tag(const XMLNode* node, const SXML_CHAR* tag)
+{
+	return (node->tag_type == TAG_FATHER || node->tag_type == TAG_SELF)
+		&& (tag == NULL || (node->tag != NULL && !sx_strcmp(node->tag, tag)));
+}
+
+/* Check whether 'node' has an active attribute 'attr_name' of value 'attr_value' */
+static int _XMLNode_has_attribute(const XMLNode* node, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value)
+{
+	int i;
+
+	for (i = 0; i < node->n_attributes; i++)
+		if (node->attributes[i].active && node->attributes[i].value != NULL
+			&& !sx_strcmp(node->attributes[i].name, attr_name) && !sx_strcmp(node->attributes[i].value, attr_value))
+			return TRUE;
+
+	return FALSE;
+}
+
+XMLNode* XMLNode_next_with_tag(const XMLNode* node, const SXML_CHAR* tag, const XMLNode* stop_at)
+{
+	_DocIndex* index;
+	const _NodeList* list;
+	XMLNode* n;
+	int from, end, i;
+
+	CHECK_NODE(node, NULL);
+	if (tag == NULL)
+		return NULL;
+
+	index = _DocIndex_range(node, stop_at, &from, &end);
+	if (index != NULL && index->has_tags) {
+		if ((list = _ListTable_get(&index->tags, tag)) == NULL)
+			return NULL;
+		i = _NodeList_after(list, from - 1);
+		return i < list->n && list->entries[i].rank < end ? list->entries[i].node : NULL;
+	}
+
+	/* No usable index: test the following nodes */
+	for (n = XMLNode_next(node); n != NULL && n != stop_at; n = XMLNode_next(n))
+		if (_XMLNode_has_tag(n, tag))
+			return n;
+
+	return NULL;
+}
+
+XMLNode* XMLNode_next_with_attribute(const XMLNode* node, const SXML_CHAR* tag, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value, const XMLNode* stop_at)
+{
+	_DocIndex* index;
+	_AttrIndex* a;
+	const _NodeList* list;
+	XMLNode* n;
+	int from, end, i;
+
+	CHECK_NODE(node, NULL);
+	if (attr_name == NULL || attr_value == NULL)
+		return NULL;
+
+	index = _DocIndex_range(node, stop_at, &from, &end);
+	if (index != NULL && (a = _DocIndex_attr(index, attr_name)) != NULL) {
+		if ((list = _ListTable_get(&a->values, attr_value)) == NULL)
+			return NULL;
+		for (i = _NodeList_after(list, from - 1); i < list->n && list->entries[i].rank < end; i++)
+			if (_XMLNode_has_tag(list->entries[i].node, tag))
+				return list->entries[i].node;
+		return NULL;
+	}
+
+	/* No usable index for the attribute: test the nodes with the tag, or all the following nodes */
+	if (tag != NULL) {
+		for (n = XMLNode_next_with_tag(node, tag, stop_at); n != NULL; n = XMLNode_next_with_tag(n, tag, stop_at))
+			if (_XMLNode_has_attribute(n, attr_name, attr_value))
+				return n;
+		return NULL;
+	}
+	for (n = XMLNode_next(node); n != NULL && n != stop_at; n = XMLNode_next(n))
+		if (_XMLNode_has_tag(n, NULL) && _XMLNode_has_attribute(n, attr_name, attr_value))
+			return n;
+
+	return NULL;
+}
+
+int XMLNode_is_indexed(const XMLNode* node, const SXML_CHAR* attr_name)
+{
+	_DocIndex* index;
+
+	CHECK_NODE(node, FALSE);
+
+	if (node->usage == NULL || (index = _doc_data(node->usage)->index) == NULL || !_DocIndex_valid(index))
+		return FALSE;
+
+	return attr_name == NULL ? index->has_tags : _DocIndex_attr(index, attr_name) != NULL;
+}
+
+/* --- XMLDoc methods --- */
+
+int XMLDoc_init(XMLDoc* doc)
+{
+	if (doc == NULL)
+		return FALSE;
+
+	doc->filename[0] = NULC;
+	memset(&doc->bom, 0, sizeof(doc->bom));
+	doc->sz_bom = 0;
+	doc->nodes = NULL;
+	doc->n_nodes = 0;
+	doc->i_root = -1;
+	doc->usage = NULL;
+	doc->pool = NULL;
+	doc->modified = FALSE;
+	doc->init_value = XML_INIT_DONE;
+
+	return TRUE;
+}
+
+int XMLDoc_free(XMLDoc* doc)
+{
+	int i;
 	
-	if (nb_char_tab <= 0)
-		nb_char_tab = 1;
+	if (doc == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	for (i = 0; i < doc->n_nodes; i++) {
+		doc->nodes[i]->usage = NULL; /* No need to account for nodes being freed */
+		(void)XMLNode_free(doc->nodes[i]);
+		__free(doc->nodes[i]);
+	}
+	__free(doc->nodes);
+	doc->nodes = NULL;
+	doc->n_nodes = 0;
+	doc->i_root = -1;
+	doc->modified = FALSE;
+	if (doc->usage != NULL) {
+		_DocIndex_free(_doc_data(doc->usage)->index);
+		__free(doc->usage);
+		doc->usage = NULL;
+	}
+	_pool_destroy(doc->pool);
+	doc->pool = NULL;
+
+	return TRUE;
+}
+
+int XMLDoc_reset(XMLDoc* doc)
+{
+	XMLPool* pool;
+	XMLNode* node;
+	int i;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	if (doc->pool == NULL) {
+		doc->pool = (XMLPool*)__calloc(1, sizeof(XMLPool));
+		if (doc->pool == NULL)
+			return XMLDoc_free(doc);
+	}
+	pool = doc->pool;
+
+	/* Release what the previous document did not use, then keep what this one uses */
+	_pool_release(pool, pool->stamp);
+	pool->stamp++;
+	for (i = 0; i < doc->n_nodes; i++) {
+		node = doc->nodes[i];
+		node->usage = NULL; /* No need to account for nodes being emptied */
+		_XMLNode_free_children(node, NULL, pool);
+		_XMLNode_free_content(node, pool);
+		_pool_free_node(pool, node);
+	}
+	_pool_free(pool, POOL_ARRAYS, doc->nodes, doc->n_nodes * sizeof(XMLNode*));
+	doc->nodes = NULL;
+	doc->n_nodes = 0;
+	doc->i_root = -1;
+	doc->modified = FALSE;
+	if (doc->usage != NULL) {
+		_DocIndex_free(_doc_data(doc->usage)->index);
+		memset(doc->usage, 0, sizeof(_XMLDocData));
+	}
+	pool->stamp++; /* Blocks given back while parsing the next document are as recent as these ones */
+
+	return TRUE;
+}
+
+/*
+ Documents detached by 'XMLDoc_free_async()', waiting to be freed by the reclaim thread.
+ */
+typedef struct _ReclaimJob {
+	XMLNode** nodes;
+	int n_nodes;
+	XMLPool* pool;	/* Memory kept by 'XMLDoc_reset()', not used by the nodes */
+	_DocIndex* index;
+	struct _ReclaimJob* next;
+} _ReclaimJob;
+
+static void _reclaim(_ReclaimJob* job)
+{
+	int i;
+
+	for (i = 0; i < job->n_nodes; i++) {
+		(void)XMLNode_free(job->nodes[i]);
+		__free(job->nodes[i]);
+	}
+	if (job->nodes != NULL)
+		__free(job->nodes);
+	_pool_destroy(job->pool);
+	_DocIndex_free(job->index);
+	__free(job);
+}
+
+#ifndef SXMLC_NO_THREADS
+static _sx_mutex _reclaim_mutex = SX_MUTEX_INITIALIZER;
+static _sx_cond _reclaim_cond = SX_COND_INITIALIZER;
+static _ReclaimJob* _reclaim_head = NULL;
+static _ReclaimJob* _reclaim_tail = NULL;
+static _sx_thread _reclaim_thread;
+static int _reclaim_running = FALSE;
+static int _reclaim_stop = FALSE;
+
+/* Pop the next job to reclaim. Must be called with '_reclaim_mutex' locked. */
+static _ReclaimJob* _reclaim_pop(void)
+{
+	_ReclaimJob* job = _reclaim_head;
+
+	if (job != NULL) {
+		_reclaim_head = job->next;
+		if (_reclaim_head == NULL)
+			_reclaim_tail = NULL;
+	}
+
+	return job;
+}
+
+SX_THREAD_FUNC(_reclaim_loop)
+{
+	_ReclaimJob* job;
+
+	(void)arg;
+	_sx_mutex_lock(&_reclaim_mutex);
+	for (;;) {
+		while (_reclaim_head == NULL && !_reclaim_stop)
+			_sx_cond_wait(&_reclaim_cond, &_reclaim_mutex);
+		if ((job = _reclaim_pop()) == NULL)
+			break;
+		_sx_mutex_unlock(&_reclaim_mutex);
+		_reclaim(job);
+		_sx_mutex_lock(&_reclaim_mutex);
+	}
+	_sx_mutex_unlock(&_reclaim_mutex);
+
+	return 0;
+}
+#endif
+
+int XMLDoc_free_async(XMLDoc* doc)
+{
+	_ReclaimJob* job;
+	int i;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	if (doc->n_nodes == 0 && doc->pool == NULL)
+		return XMLDoc_free(doc);
+
+	job = (_ReclaimJob*)__malloc(sizeof(_ReclaimJob));
+	if (job == NULL)
+		return XMLDoc_free(doc);
+	job->nodes = doc->nodes;
+	job->n_nodes = doc->n_nodes;
+	job->pool = doc->pool; /* Can be released in any order with the nodes, which do not use it anymore */
+	job->index = (doc->usage != NULL ? _doc_data(doc->usage)->index : NULL); /* Its nodes are not read when freeing it */
+	job->next = NULL;
+	doc->pool = NULL;
+	for (i = 0; i < doc->n_nodes; i++)
+		doc->nodes[i]->usage = NULL; /* Nodes are not accounted anymore */
+	doc->nodes = NULL;
+	doc->n_nodes = 0;
+	doc->i_root = -1;
+	doc->modified = FALSE;
+	if (doc->usage != NULL) {
+		__free(doc->usage);
+		doc->usage = NULL;
+	}
+
+#ifndef SXMLC_NO_THREADS
+	_sx_mutex_lock(&_reclaim_mutex);
+	if (!_reclaim_running) {
+		_reclaim_stop = FALSE;
+		_reclaim_running = _sx_thread_create(&_reclaim_thread, _reclaim_loop);
+	}
+	if (_reclaim_running) {
+		if (_reclaim_tail == NULL)
+			_reclaim_head = job;
+		else
+			_reclaim_tail->next = job;
+		_reclaim_tail = job;
+		_sx_cond_signal(&_reclaim_cond);
+		job = NULL;
+	}
+	_sx_mutex_unlock(&_reclaim_mutex);
+#endif
+
+	/* No reclaim thread: free it now */
+	if (job != NULL)
+		_reclaim(job);
+
+	return TRUE;
+}
+
+int XMLDoc_free_async_flush(void)
+{
+#ifndef SXMLC_NO_THREADS
+	_ReclaimJob* job;
+
+	_sx_mutex_lock(&_reclaim_mutex);
+	if (!_reclaim_running) {
+		_sx_mutex_unlock(&_reclaim_mutex);
+		return TRUE;
+	}
+	_reclaim_stop = TRUE;
+	_sx_cond_broadcast(&_reclaim_cond);
+	_sx_mutex_unlock(&_reclaim_mutex);
+
+	_sx_thread_join(_reclaim_thread);
+
+	/* Documents queued after the thread ended are freed here */
+	_sx_mutex_lock(&_reclaim_mutex);
+	while ((job = _reclaim_pop()) != NULL)
+		_reclaim(job);
+	_reclaim_running = FALSE;
+	_reclaim_stop = FALSE;
+	_sx_mutex_unlock(&_reclaim_mutex);
+#endif
+
+	return TRUE;
+}
+
+int XMLDoc_set_root(XMLDoc* doc, int i_root)
+{
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || i_root < 0 || i_root >= doc->n_nodes)
+		return FALSE;
 	
-	/* Print formatting */
-	if (depth < 0) /* UGLY HACK: 'depth' forced negative on very first line so we don't print an extra 'tag_sep' (usually "\n" when pretty-printing) */
-		depth = 0;
-	else
-		cur_sz_line = _print_formatting(node, f, tag_sep, child_sep, nb_char_tab, cur_sz_line);
+	doc->i_root = i_root;
 	
-	_XMLNode_print_header(node, f, tag_sep, child_sep, attr_sep, sz_line, cur_sz_line, nb_char_tab);
+	return TRUE;
+}
 
-	if (node->text != NULL && node->text[0] != NULC) {
-		/* Text has to be printed: check if it is only spaces */
-		if (!keep_text_spaces) {
-			for (p = node->text; *p != NULC && sx_isspace(*p); p++) ; /* 'p' points to first non-space character, or to '\0' if only spaces */
-		} else
-			p = node->text; /* '*p' won't be '\0' */
-		if (*p != NULC) cur_sz_line += fprintHTML(f, node->text);
-	} else if (node->n_children <= 0) /* Everything has already been printed */
-		return cur_sz_line;
+int XMLDoc_add_node(XMLDoc* doc, XMLNode* node)
+{
+	if (doc == NULL || node == NULL || doc->init_value != XML_INIT_DONE)
+		return -1;
 	
-	/* Recursively print children */
-	for (i = 0; i < node->n_children; i++)
-		(void)_XMLNode_print(node->children[i], f, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, cur_sz_line, nb_char_tab, depth+1);
+	if (_XMLDoc_usage(doc) == NULL || _add_node(&doc->nodes, &doc->n_nodes, node, NULL) < 0)
+		return -1;
+	if (!_XMLNode_set_usage(node, doc->usage)) {
+		doc->n_nodes--;
+		return -1;
+	}
+	_usage_array(&doc->usage->children, doc->n_nodes - 1, doc->n_nodes, sizeof(XMLNode*));
+
+	if (node->tag_type == TAG_FATHER)
+		doc->i_root = doc->n_nodes - 1; /* Main root node is the last father node */
+	doc->modified = TRUE;
+	_index_changed(doc->usage);
+
+	return doc->n_nodes;
+}
+
+int XMLDoc_remove_node(XMLDoc* doc, int i_node, int free_node)
+{
+	XMLNode** pt;
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || i_node < 0 || i_node >= doc->n_nodes)
+		return FALSE;
+
+	/* Before modifying first see if we run out of memory */
+	if (doc->n_nodes == 1)
+		pt = NULL;
+	else {
+		pt = __malloc((doc->n_nodes - 1) * sizeof(XMLNode*));
+		if (pt == NULL)
+			return FALSE;
+	}
+
+	/* Can't fail anymore, free item */
+	(void)XMLNode_free(doc->nodes[i_node]);
+	if (doc->nodes[i_node]->usage != NULL) { /* Content has been unaccounted by 'XMLNode_free()' */
+		_usage_count(&doc->nodes[i_node]->usage->nodes, sizeof(XMLNode), -1);
+		doc->nodes[i_node]->usage = NULL;
+	}
+	if (free_node) __free(doc->nodes[i_node]);
+	if (doc->usage != NULL)
+		_usage_array(&doc->usage->children, doc->n_nodes, doc->n_nodes - 1, sizeof(XMLNode*));
 	
-	/* Print tag end after children */
-		/* Print formatting */
-	if (node->n_children > 0)
-		cur_sz_line = _print_formatting(node, f, tag_sep, child_sep, nb_char_tab, cur_sz_line);
-	cur_sz_line += sx_fprintf(f, C2SX("</%s>"), node->tag);
+	if (pt != NULL) {
+		memcpy(pt, doc->nodes, i_node * sizeof(XMLNode*));
+		memcpy(&pt[i_node], &doc->nodes[i_node + 1], (doc->n_nodes - i_node - 1) * sizeof(XMLNode*));
+	}
 
-	return cur_sz_line;
+	if (doc->nodes != NULL)
+		__free(doc->nodes);
+	doc->nodes = pt;
+	doc->n_nodes--;
+	doc->modified = TRUE;
+	_index_changed(doc->usage);
+	if (doc->i_root == i_node)
+		doc->i_root = -1;
+	else if (doc->i_root > i_node)
+		doc->i_root--;
+
+	return TRUE;
+}
+
+/*
+ Get 'doc' index, allocating it on first call. Return NULL for memory error.
+ */
+static _DocIndex* _XMLDoc_index(XMLDoc* doc)
+{
+	_XMLDocData* data;
+
+	if (_XMLDoc_usage(doc) == NULL)
+		return NULL;
+	data = _doc_data(doc->usage);
+	if (data->index == NULL && (data->index = (_DocIndex*)__calloc(1, sizeof(_DocIndex))) == NULL)
+		return NULL;
+	data->index->doc = doc;
+
+	return data->index;
+}
+
+/* Free 'doc' index if nothing is indexed anymore */
+static void _XMLDoc_index_release(XMLDoc* doc)
+{
+	_XMLDocData* data = _doc_data(doc->usage);
+
+	if (data != NULL && data->index != NULL && !data->index->has_tags && data->index->attrs == NULL && data->index->numbers == NULL) {
+		_DocIndex_free(data->index);
+		data->index = NULL;
+	}
+}
+
+int XMLDoc_build_tag_index(XMLDoc* doc)
+{
+	_DocIndex* index;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || (index = _XMLDoc_index(doc)) == NULL)
+		return FALSE;
+
+	index->has_tags = TRUE;
+	if (!_DocIndex_build(index)) {
+		index->has_tags = FALSE;
+		_XMLDoc_index_release(doc);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+int XMLDoc_free_tag_index(XMLDoc* doc)
+{
+	if (doc == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	if (doc->usage != NULL && _doc_data(doc->usage)->index != NULL) {
+		_doc_data(doc->usage)->index->has_tags = FALSE;
+		_ListTable_clear(&_doc_data(doc->usage)->index->tags);
+		_XMLDoc_index_release(doc);
+	}
+
+	return TRUE;
+}
+
+int XMLDoc_build_attribute_index(XMLDoc* doc, const SXML_CHAR* attr_name)
+{
+	_DocIndex* index;
+	_AttrIndex* a;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || attr_name == NULL || attr_name[0] == NULC || (index = _XMLDoc_index(doc)) == NULL)
+		return FALSE;
+
+	if (_DocIndex_attr(index, attr_name) != NULL)
+		return _DocIndex_valid(index) || _DocIndex_build(index);
+
+	a = (_AttrIndex*)__calloc(1, sizeof(_AttrIndex));
+	if (a == NULL || (a->name = sx_strdup(attr_name)) == NULL)
+		goto attr_err;
+	a->next = index->attrs;
+	index->attrs = a;
+	if (_DocIndex_build(index))
+		return TRUE;
+	index->attrs = a->next;
+	__free(a->name);
+
+attr_err:
+	if (a != NULL)
+		__free(a);
+	_XMLDoc_index_release(doc);
+
+	return FALSE;
+}
+
+int XMLDoc_free_attribute_index(XMLDoc* doc, const SXML_CHAR* attr_name)
+{
+	_DocIndex* index;
+	_AttrIndex** pa;
+	_AttrIndex* a;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || attr_name == NULL)
+		return FALSE;
+
+	if (doc->usage == NULL || (index = _doc_data(doc->usage)->index) == NULL)
+		return TRUE;
+	for (pa = &index->attrs; *pa != NULL && sx_strcmp((*pa)->name, attr_name); pa = &(*pa)->next) ;
+	if ((a = *pa) != NULL) {
+		*pa = a->next;
+		_ListTable_clear(&a->values);
+		__free(a->name);
+		__free(a);
+		_XMLDoc_index_release(doc);
+	}
+
+	return TRUE;
+}
+
+XMLNode* XMLDoc_get_by_attribute(XMLDoc* doc, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value)
+{
+	_DocIndex* index;
+	_AttrIndex* a;
+	const _NodeList* list;
+	XMLNode* node;
+	int i;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || attr_name == NULL || attr_value == NULL)
+		return NULL;
+
+	index = (doc->usage != NULL ? _doc_data(doc->usage)->index : NULL);
+	if (index != NULL && (a = _DocIndex_attr(index, attr_name)) != NULL && _DocIndex_valid(index)) {
+		list = _ListTable_get(&a->values, attr_value);
+		return list != NULL && list->n > 0 ? list->entries[0].node : NULL;
+	}
+
+	for (i = 0; i < doc->n_nodes; i++) {
+		node = doc->nodes[i];
+		if (_XMLNode_has_tag(node, NULL) && _XMLNode_has_attribute(node, attr_name, attr_value))
+			return node;
+		if ((node = XMLNode_next_with_attribute(node, NULL, attr_name, attr_value, NULL)) != NULL)
+			return node;
+	}
+
+	return NULL;
+}
+
+int XMLDoc_build_number_index(XMLDoc* doc, const SXML_CHAR* attr_name)
+{
+	_DocIndex* index;
+	_NumberIndex* n;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || attr_name == NULL || attr_name[0] == NULC || (index = _XMLDoc_index(doc)) == NULL)
+		return FALSE;
+
+	if (_DocIndex_numbers(index, attr_name) != NULL)
+		return _DocIndex_valid(index) || _DocIndex_build(index);
+
+	n = (_NumberIndex*)__calloc(1, sizeof(_NumberIndex));
+	if (n == NULL || (n->name = sx_strdup(attr_name)) == NULL)
+		goto number_err;
+	n->next = index->numbers;
+	index->numbers = n;
+	if (_DocIndex_build(index))
+		return TRUE;
+	index->numbers = n->next;
+	__free(n->name);
+
+number_err:
+	if (n != NULL)
+		__free(n);
+	_XMLDoc_index_release(doc);
+
+	return FALSE;
+}
+
+int XMLDoc_free_number_index(XMLDoc* doc, const SXML_CHAR* attr_name)
+{
+	_DocIndex* index;
+	_NumberIndex** pn;
+	_NumberIndex* n;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE || attr_name == NULL)
+		return FALSE;
+
+	if (doc->usage == NULL || (index = _doc_data(doc->usage)->index) == NULL)
+		return TRUE;
+	for (pn = &index->numbers; *pn != NULL && sx_strcmp((*pn)->name, attr_name); pn = &(*pn)->next) ;
+	if ((n = *pn) != NULL) {
+		*pn = n->next;
+		if (n->entries != NULL)
+			__free(n->entries);
+		__free(n->name);
+		__free(n);
+		_XMLDoc_index_release(doc);
+	}
+
+	return TRUE;
+}
+
+/* Compute 'usage->total' */
+static void _usage_total(XMLMemoryUsage* usage)
+{
+	usage->total.bytes = usage->nodes.bytes + usage->tags.bytes + usage->texts.bytes + usage->attributes.bytes + usage->children.bytes;
+	usage->total.allocs = usage->nodes.allocs + usage->tags.allocs + usage->texts.allocs + usage->attributes.allocs + usage->children.allocs;
+}
+
+int XMLDoc_memory_usage(const XMLDoc* doc, XMLMemoryUsage* usage)
+{
+	if (doc == NULL || usage == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	if (doc->usage != NULL)
+		*usage = *doc->usage;
+	else
+		memset(usage, 0, sizeof(XMLMemoryUsage));
+	_usage_total(usage);
+
+	return TRUE;
+}
+
+int XMLNode_memory_usage(const XMLNode* node, XMLMemoryUsage* usage)
+{
+	_NodeStack stack;
+	int ret;
+
+	CHECK_NODE(node, FALSE);
+	if (usage == NULL)
+		return FALSE;
+
+	memset(usage, 0, sizeof(XMLMemoryUsage));
+	_NodeStack_init(&stack);
+	ret = _XMLNode_walk_usage(node, usage, FALSE, NULL, &stack);
+	_NodeStack_free(&stack);
+	_usage_total(usage);
+
+	return ret;
+}
+
+/* --- Output sinks --- */
+
+/*
+ Printing functions write to a sink, which buffers the output to a 'FILE*', a file descriptor or a callback, writes it
+ directly to memory, or only counts the characters printed when there is nowhere to write.
+ */
+#define SINK_BUFFER 4096 /* Number of characters buffered before being written to the file */
+
+typedef struct _XMLSink {
+	FILE* f;			/* File to write to, or NULL */
+	int fd;				/* File descriptor to write to, or -1 */
+	XMLOutputFunc func;	/* Function to give the output to, or NULL */
+	void* user;			/* User data of 'func' */
+	int buffered;		/* 'true' when output goes through 'buf' (to 'f', 'fd' or 'func') */
+	SXML_CHAR* mem;		/* Memory to write to, large enough for the whole output, or NULL */
+	size_t n;			/* Number of characters printed so far */
+	int error;			/* 'true' when writing to 'fd' failed, or 'func' returned 'false' */
+	int len;			/* Number of characters in 'buf' */
+	SXML_CHAR buf[SINK_BUFFER + 1];	/* +1 for the NUL character needed by 'sx_fputs()' */
+} _XMLSink;
+
+static void _sink_init(_XMLSink* sink, FILE* f, int fd, SXML_CHAR* mem)
+{
+	sink->f = f;
+	sink->fd = fd;
+	sink->func = NULL;
+	sink->user = NULL;
+	sink->buffered = (f != NULL || fd >= 0);
+	sink->mem = mem;
+	sink->n = 0;
+	sink->error = FALSE;
+	sink->len = 0;
+}
+
+/*
+ Write the 'n_buf' characters of 'buf' then the 'len' characters of 'str' to the sink file descriptor.
+ */
+static void _sink_write_fd(_XMLSink* sink, const SXML_CHAR* buf, size_t n_buf, const SXML_CHAR* str, size_t len)
+{
+#ifndef SXMLC_UNICODE
+#ifdef SX_HAVE_WRITEV
+	struct iovec iov[2];
+	ssize_t n;
+	size_t sz;
+
+	/* Both parts in a single call */
+	while (!sink->error && n_buf + len > 0) {
+		iov[0].iov_base = (void*)buf;
+		iov[0].iov_len = n_buf;
+		iov[1].iov_base = (void*)str;
+		iov[1].iov_len = len;
+		if ((n = writev(sink->fd, iov, 2)) < 0) {
+			if (errno != EINTR)
+				sink->error = TRUE;
+			continue;
+		}
+		sz = ((size_t)n < n_buf ? (size_t)n : n_buf);
+		buf += sz;
+		n_buf -= sz;
+		if ((size_t)n > sz) {
+			str += (size_t)n - sz;
+			len -= (size_t)n - sz;
+		}
+	}
+#else
+	int n;
+
+	for ( ; !sink->error && n_buf > 0; buf += n, n_buf -= n)
+		if ((n = sx_write(sink->fd, buf, n_buf)) < 0)
+			sink->error = TRUE;
+	for ( ; !sink->error && len > 0; str += n, len -= n)
+		if ((n = sx_write(sink->fd, str, len)) < 0)
+			sink->error = TRUE;
+#endif
+#else
+	/* Wide characters are converted to the current locale multibyte encoding, as 'fputws()' would */
+	char out[256 + MB_LEN_MAX];
+	mbstate_t state;
+	size_t i, n, sz;
+	int part;
+
+	memset(&state, 0, sizeof(state));
+	for (part = 0; part < 2 && !sink->error; part++, buf = str, n_buf = len) {
+		for (i = 0, sz = 0; i < n_buf && !sink->error; i++) {
+			n = wcrtomb(out + sz, buf[i], &state);
+			if (n == (size_t)-1)
+				out[sz++] = '?';
+			else
+				sz += n;
+			if (sz >= 256 || i == n_buf - 1) {
+				if (sx_write(sink->fd, out, sz) != (int)sz)
+					sink->error = TRUE;
+				sz = 0;
+			}
+		}
+	}
+#endif
+}
+
+/*
+ Write buffered characters to the sink file.
+ */
+static void _sink_flush(_XMLSink* sink)
+{
+	if (sink->len == 0)
+		return;
+
+	if (sink->f != NULL) {
+#ifndef SXMLC_UNICODE
+		(void)fwrite(sink->buf, sizeof(SXML_CHAR), sink->len, sink->f);
+#else
+		sink->buf[sink->len] = NULC;
+		(void)sx_fputs(sink->buf, sink->f);
+#endif
+	} else if (sink->fd >= 0)
+		_sink_write_fd(sink, sink->buf, sink->len, NULL, 0);
+	else if (sink->func != NULL && !sink->error && !sink->func(sink->buf, sink->len, sink->user))
+		sink->error = TRUE;
+	sink->len = 0;
+}
+
+static void _sink_write(_XMLSink* sink, const SXML_CHAR* str, size_t len)
+{
+	size_t n;
+
+	if (sink->mem != NULL)
+		memcpy(sink->mem + sink->n, str, len * sizeof(SXML_CHAR));
+	sink->n += len;
+	if (!sink->buffered)
+		return;
+
+	if (sink->fd >= 0 && len >= SINK_BUFFER / 2) { /* Large string: written along with the buffer, without copy */
+		_sink_write_fd(sink, sink->buf, sink->len, str, len);
+		sink->len = 0;
+		return;
+	}
+#ifndef SXMLC_UNICODE
+	if (sink->f != NULL && len >= SINK_BUFFER / 2) { /* Same for files */
+		_sink_flush(sink);
+		(void)fwrite(str, sizeof(SXML_CHAR), len, sink->f);
+		return;
+	}
+#endif
+	while (sink->len + len > SINK_BUFFER) {
+		n = SINK_BUFFER - sink->len;
+		memcpy(sink->buf + sink->len, str, n * sizeof(SXML_CHAR));
+		sink->len = SINK_BUFFER;
+		str += n;
+		len -= n;
+		_sink_flush(sink);
+	}
+	memcpy(sink->buf + sink->len, str, len * sizeof(SXML_CHAR));
+	sink->len += (int)len;
+}
+
+/* Buffer output given to 'func' */
+static void _sink_init_func(_XMLSink* sink, XMLOutputFunc func, void* user)
+{
+	_sink_init(sink, NULL, -1, NULL);
+	sink->func = func;
+	sink->user = user;
+	sink->buffered = TRUE;
+}
+
+static void _sink_puts(_XMLSink* sink, const SXML_CHAR* str)
+{
+	_sink_write(sink, str, sx_strlen(str));
+}
+
+static void _sink_putc(_XMLSink* sink, SXML_CHAR c)
+{
+	if (sink->mem != NULL)
+		sink->mem[sink->n] = c;
+	sink->n++;
+	if (!sink->buffered)
+		return;
+
+	if (sink->len >= SINK_BUFFER)
+		_sink_flush(sink);
+	sink->buf[sink->len++] = c;
+}
+
+/* Write 'str' with HTML special characters escaped. Defined along with 'fprintHTML()'. */
+static int _sink_html(_XMLSink* sink, const SXML_CHAR* str);
+
+/*
+ Helper functions to print formatting before a new tag.
+ Returns the new number of characters in the line.
+ */
+static int _count_new_char_line(const SXML_CHAR* str, int nb_char_tab, int cur_sz_line)
+{
+	for (; *str; str++) {
+		if (*str == C2SX('\n'))
+			cur_sz_line = 0;
+		else if (*str == C2SX('\t'))
+			cur_sz_line += nb_char_tab;
+		else
+			cur_sz_line++;
+	}
+	
+	return cur_sz_line;
+}
+
+/* Separator given to printing functions, with its effect on the line size */
+typedef struct _PrintSep {
+	const SXML_CHAR* str;	/* Separator, or NULL */
+	int len;				/* Number of characters in 'str' */
+	int new_line;			/* 'true' if 'str' contains a new line */
+	int width;				/* Number of characters 'str' adds to the line, or leaves on the new line if 'new_line' is 'true' */
+} _PrintSep;
+
+/* Formatting options of printing functions */
+typedef struct _PrintOptions {
+	_PrintSep tag_sep;
+	_PrintSep child_sep;
+	_PrintSep attr_sep;
+	int keep_text_spaces;
+	int sz_line;
+	int nb_char_tab;
+	SXML_CHAR* indent;		/* 'tag_sep' followed by 'max_depth' times 'child_sep', or NULL */
+	int max_depth;
+	const SXML_CHAR* src;	/* Source to copy unmodified nodes from (see 'XMLDoc_print_incremental()'), or NULL */
+	int src_len;
+} _PrintOptions;
+
+static void _print_sep_init(_PrintSep* sep, const SXML_CHAR* str, int nb_char_tab)
+{
+	sep->str = str;
+	sep->len = (str == NULL ? 0 : (int)sx_strlen(str));
+	sep->new_line = (str != NULL && sx_strchr(str, C2SX('\n')) != NULL);
+	sep->width = (str == NULL ? 0 : _count_new_char_line(str, nb_char_tab, 0));
+}
+
+static void _print_options_init(_PrintOptions* opt, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	opt->nb_char_tab = (nb_char_tab <= 0 ? 1 : nb_char_tab);
+	_print_sep_init(&opt->tag_sep, tag_sep, opt->nb_char_tab);
+	_print_sep_init(&opt->child_sep, child_sep, opt->nb_char_tab);
+	_print_sep_init(&opt->attr_sep, attr_sep == NULL ? C2SX(" ") : attr_sep, opt->nb_char_tab);
+	opt->keep_text_spaces = keep_text_spaces;
+	opt->sz_line = sz_line;
+	opt->indent = NULL;
+	opt->max_depth = -1;
+	opt->src = NULL;
+	opt->src_len = 0;
+}
+
+static void _print_options_free(_PrintOptions* opt)
+{
+	if (opt->indent != NULL)
+		__free(opt->indent);
+	opt->indent = NULL;
+	opt->max_depth = -1;
+}
+
+/*
+ Build the indentation string of 'opt' up to at least 'depth'.
+ Return 'false' on memory error.
+ */
+static int _print_options_indent(_PrintOptions* opt, int depth)
+{
+	SXML_CHAR* indent;
+	int i, max_depth;
+
+	max_depth = (opt->max_depth < 8 ? 16 : 2 * opt->max_depth);
+	if (max_depth < depth)
+		max_depth = depth;
+	indent = (SXML_CHAR*)__realloc(opt->indent, (opt->tag_sep.len + max_depth * opt->child_sep.len + 1) * sizeof(SXML_CHAR));
+	if (indent == NULL)
+		return FALSE;
+
+	if (opt->tag_sep.len > 0)
+		memcpy(indent, opt->tag_sep.str, opt->tag_sep.len * sizeof(SXML_CHAR));
+	for (i = 0; i < max_depth; i++)
+		memcpy(indent + opt->tag_sep.len + i * opt->child_sep.len, opt->child_sep.str, opt->child_sep.len * sizeof(SXML_CHAR));
+	opt->indent = indent;
+	opt->max_depth = max_depth;
+
+	return TRUE;
+}
+
+/*
+ Print 'tag_sep' then 'child_sep' for each of the 'depth' fathers of a node, in a single write of the cached
+ indentation string.
+ Returns the new number of characters in the line.
+ */
+static int _print_formatting(_PrintOptions* opt, int depth, _XMLSink* out, int cur_sz_line)
+{
+	int i;
+
+	if (opt->child_sep.len == 0 || depth <= 0) {
+		if (opt->tag_sep.len > 0)
+			_sink_write(out, opt->tag_sep.str, opt->tag_sep.len);
+	} else if (depth <= opt->max_depth || _print_options_indent(opt, depth))
+		_sink_write(out, opt->indent, opt->tag_sep.len + depth * opt->child_sep.len);
+	else { /* No memory for the indentation string */
+		if (opt->tag_sep.len > 0)
+			_sink_write(out, opt->tag_sep.str, opt->tag_sep.len);
+		for (i = 0; i < depth; i++)
+			_sink_write(out, opt->child_sep.str, opt->child_sep.len);
+	}
+
+	if (opt->tag_sep.str != NULL)
+		cur_sz_line = (opt->tag_sep.new_line ? 0 : cur_sz_line) + opt->tag_sep.width;
+	if (opt->child_sep.str != NULL && depth > 0)
+		cur_sz_line = (opt->child_sep.new_line ? opt->child_sep.width : cur_sz_line + depth * opt->child_sep.width);
+	
+	return cur_sz_line;
+}
+
+/* Number of fathers of 'node' */
+static int _XMLNode_depth(const XMLNode* node)
+{
+	int depth;
+
+	for (depth = 0; node != NULL && node->father != NULL; node = node->father)
+		depth++;
+
+	return depth;
+}
+
+/*
+ Print attribute ' name="value"' of a node at 'depth', going to a new line first if it would not fit in 'sz_line'.
+ Returns the new number of characters in the line.
+ */
+static int _print_attribute(const SXML_CHAR* name, const SXML_CHAR* value, _XMLSink* out, _PrintOptions* opt, int cur_sz_line, int depth)
+{
+	cur_sz_line += sx_strlen(name) + sx_strlen(value) + 3;
+	/* Add extra separator, as if new line was a child of the previous one */
+	if (opt->sz_line > 0 && cur_sz_line > opt->sz_line)
+		cur_sz_line = _print_formatting(opt, depth + 1, out, cur_sz_line);
+	/* Attribute name */
+	cur_sz_line = (opt->attr_sep.new_line ? 0 : cur_sz_line) + opt->attr_sep.width;
+	_sink_write(out, opt->attr_sep.str, opt->attr_sep.len);
+	_sink_puts(out, name);
+	_sink_putc(out, C2SX('='));
+	
+	/* Attribute value */
+	_sink_putc(out, XML_DEFAULT_QUOTE);
+	cur_sz_line += _sink_html(out, value) + 2;
+	_sink_putc(out, XML_DEFAULT_QUOTE);
+
+	return cur_sz_line;
+}
+
+static int _XMLNode_print_header(const XMLNode* node, _XMLSink* out, _PrintOptions* opt, int cur_sz_line, int depth)
+{
+	int i;
+	size_t n0;
+	SXML_CHAR* p;
+
+	if (node == NULL || out == NULL || !node->active || node->tag == NULL || node->tag[0] == NULC)
+		return -1;
+	
+	n0 = out->n;
+
+	/* Special handling of DOCTYPE */
+	if (node->tag_type == TAG_DOCTYPE) {
+		/* Search for an unescaped '[' in the DOCTYPE definition, in which case the end delimiter should be ']>' instead of '>' */
+		for (p = sx_strchr(node->tag, C2SX('[')); p != NULL && *(p-1) == C2SX('\\'); p = sx_strchr(p+1, C2SX('['))) ;
+		_sink_puts(out, C2SX("<!DOCTYPE"));
+		_sink_puts(out, node->tag);
+		_sink_puts(out, p != NULL ? C2SX("]>") : C2SX(">"));
+		return cur_sz_line + (int)(out->n - n0);
+	}
+
+	/* Check for special tags first */
+	for (i = 0; i < NB_SPECIAL_TAGS; i++) {
+		if (node->tag_type == _spec[i].tag_type) {
+			_sink_puts(out, _spec[i].start);
+			_sink_puts(out, node->tag);
+			_sink_puts(out, _spec[i].end);
+			return cur_sz_line + (int)(out->n - n0);
+		}
+	}
+
+	/* Check for user tags */
+	for (i = 0; i < _default_config.n_user_tags; i++) {
+		if (node->tag_type == _default_config.user_tags[i].tag_type) {
+			_sink_puts(out, _default_config.user_tags[i].start);
+			_sink_puts(out, node->tag);
+			_sink_puts(out, _default_config.user_tags[i].end);
+			return cur_sz_line + (int)(out->n - n0);
+		}
+	}
+	
+	/* Print tag name */
+	_sink_putc(out, C2SX('<'));
+	_sink_puts(out, node->tag);
+	cur_sz_line += (int)(out->n - n0);
+
+	/* Print attributes */
+	for (i = 0; i < node->n_attributes; i++) {
+		if (node->attributes[i].active)
+			cur_sz_line = _print_attribute(node->attributes[i].name, node->attributes[i].value, out, opt, cur_sz_line, depth);
+	}
+	
+	/* End the tag if there are no children and no text */
+	if (node->n_children == 0 && (node->text == NULL || node->text[0] == NULC)) {
+		_sink_puts(out, C2SX("/>"));
+		cur_sz_line += 2;
+	} else {
+		_sink_putc(out, C2SX('>'));
+		cur_sz_line++;
+	}
+
+	return cur_sz_line;
+}
+
+int XMLNode_print_header(const XMLNode* node, FILE* f, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+	int ret;
+
+	if (f == NULL)
+		return FALSE;
+
+	_print_options_init(&opt, NULL, NULL, NULL, FALSE, sz_line, nb_char_tab);
+	_sink_init(&out, f, -1, NULL);
+	ret = _XMLNode_print_header(node, &out, &opt, 0, _XMLNode_depth(node));
+	_sink_flush(&out);
+	_print_options_free(&opt);
+
+	return ret < 0 ? FALSE : TRUE;
+}
+
+/*
+ Print 'node' up to its children: formatting (unless 'first' is 'true'), header and text.
+ 'depth' is the indentation level of 'node'.
+ '*open' is set to 'true' when children and end tag should be printed afterwards.
+ Return the new line size, or -1 if 'node' cannot be printed.
+ */
+static int _XMLNode_print_start(const XMLNode* node, _XMLSink* out, _PrintOptions* opt, int cur_sz_line, int first, int depth, int* open)
+{
+	SXML_CHAR* p;
+	
+	*open = FALSE;
+	
+	if (node != NULL && node->tag_type==TAG_TEXT) { /* Text has to be printed: check if it is only spaces */
+		if (!opt->keep_text_spaces) {
+			for (p = node->text; p != NULL && *p != NULC && sx_isspace(*p); p++) ; /* 'p' points to first non-space character, or to '\0' if only spaces */
+		} else
+			p = node->text; /* '*p' won't be '\0' */
+		if (p != NULL && *p != NULC)
+			cur_sz_line += _sink_html(out, node->text);
+		return cur_sz_line;
+	}
+
+	if (node == NULL || out == NULL || !node->active || node->tag == NULL || node->tag[0] == NULC)
+		return -1;
+	
+	/* Print formatting */
+	if (!first)
+		cur_sz_line = _print_formatting(opt, depth, out, cur_sz_line);
+	
+	_XMLNode_print_header(node, out, opt, cur_sz_line, depth);
+
+	if (node->text != NULL && node->text[0] != NULC) {
+		/* Text has to be printed: check if it is only spaces */
+		if (!opt->keep_text_spaces) {
+			for (p = node->text; *p != NULC && sx_isspace(*p); p++) ; /* 'p' points to first non-space character, or to '\0' if only spaces */
+		} else
+			p = node->text; /* '*p' won't be '\0' */
+		if (*p != NULC) cur_sz_line += _sink_html(out, node->text);
+	} else if (node->n_children <= 0) /* Everything has already been printed */
+		return cur_sz_line;
+	
+	*open = TRUE;
+
+	return cur_sz_line;
+}
+
+/*
+ Print characters 'start' to 'end' of the source of incremental printing.
+ Returns the new number of characters in the line.
+ */
+static int _print_source(const _PrintOptions* opt, int start, int end, _XMLSink* out, int cur_sz_line)
+{
+	const SXML_CHAR* p;
+
+	if (end <= start)
+		return cur_sz_line;
+	_sink_write(out, opt->src + start, end - start);
+	for (p = opt->src + end; p > opt->src + start && p[-1] != C2SX('\n'); p--) ;
+
+	return (p > opt->src + start ? 0 : cur_sz_line) + (int)(opt->src + end - p);
+}
+
+/* 'true' if 'node' comes from the source of incremental printing */
+static int _print_has_source(const XMLNode* node, const _PrintOptions* opt)
+{
+	return opt->src != NULL && node->src_start >= 0 && node->src_start <= node->src_end && node->src_end <= opt->src_len;
+}
+
+/*
+ 'true' if 'nodes' can be printed between the parts of the source from 'start' to 'end' they come from,
+ i.e. they are all active and come in order from that range.
+ */
+static int _print_source_gaps(XMLNode** nodes, int n_nodes, int start, int end, const _PrintOptions* opt)
+{
+	int i;
+
+	for (i = 0; i < n_nodes; i++) {
+		if (!nodes[i]->active || !_print_has_source(nodes[i], opt) || nodes[i]->src_start < start || nodes[i]->src_end > end)
+			return FALSE;
+		start = nodes[i]->src_end;
+	}
+
+	return TRUE;
+}
+
+/*
+ Same as '_XMLNode_print_start()', copying 'node' from the source of incremental printing (if any) when it
+ was not modified.
+ When only its descendants were, '*open' is set to 'true' and '*src_gap' to the offset of 'node' in the source,
+ which should be printed up to its first modified child, then from the end of that child, and so on.
+ '*src_gap' is -1 otherwise.
+ */
+static int _XMLNode_print_start_src(const XMLNode* node, _XMLSink* out, _PrintOptions* opt, int cur_sz_line, int first, int depth, int* open, int* src_gap)
+{
+	SXML_CHAR* p;
+
+	*src_gap = -1;
+	if (node == NULL || !_print_has_source(node, opt) || (node->modified & XML_MODIFIED_NODE)
+		|| (node->tag_type != TAG_TEXT && !node->active)
+		|| (node->modified != 0 && !_print_source_gaps(node->children, node->n_children, node->src_start, node->src_end, opt)))
+		return _XMLNode_print_start(node, out, opt, cur_sz_line, first, depth, open);
+
+	*open = (node->modified != 0);
+	if (node->tag_type == TAG_TEXT) { /* Same as '_XMLNode_print_start()' for spaces */
+		for (p = node->text; !opt->keep_text_spaces && p != NULL && *p != NULC && sx_isspace(*p); p++) ;
+		return (p == NULL || *p == NULC ? cur_sz_line : _print_source(opt, node->src_start, node->src_end, out, cur_sz_line));
+	}
+
+	if (!first)
+		cur_sz_line = _print_formatting(opt, depth, out, cur_sz_line);
+	if (*open) {
+		*src_gap = node->src_start;
+		return cur_sz_line;
+	}
+
+	return _print_source(opt, node->src_start, node->src_end, out, cur_sz_line);
+}
+
+/*
+ Print 'node' and its children, 'node' being at indentation level 'depth'.
+ No formatting is printed before 'node' if 'first' is 'true' (so that there is no extra 'tag_sep' on the very first line).
+ */
+static int _XMLNode_print(const XMLNode* node, _XMLSink* out, _PrintOptions* opt, int cur_sz_line, int first, int depth)
+{
+	_NodeStack stack;
+	_NodeFrame* fr;
+	const XMLNode* child;
+	int open, sz, src_gap;
+	
+	cur_sz_line = _XMLNode_print_start_src(node, out, opt, cur_sz_line, first, depth, &open, &src_gap);
+	if (cur_sz_line < 0 || !open)
+		return cur_sz_line;
+	
+	/* Print children without recursion. Each child starts with the line size of its father */
+	_NodeStack_init(&stack);
+	fr = _NodeStack_push(&stack, node);
+	fr->cur_sz_line = cur_sz_line;
+	fr->src_gap = src_gap;
+	while (stack.n > 0) {
+		fr = &stack.frames[stack.n - 1];
+		if (fr->i < fr->node->n_children) {
+			child = fr->node->children[fr->i++];
+			if (fr->src_gap >= 0) { /* Children printed between the parts of their father source, without formatting */
+				if (child->modified == 0)
+					continue; /* Printed along with the next part */
+				fr->cur_sz_line = _print_source(opt, fr->src_gap, child->src_start, out, fr->cur_sz_line);
+				fr->src_gap = child->src_end;
+			}
+			sz = _XMLNode_print_start_src(child, out, opt, fr->cur_sz_line, fr->src_gap >= 0, depth + stack.n, &open, &src_gap);
+			if (sz >= 0 && open) {
+				if ((fr = _NodeStack_push(&stack, child)) == NULL) {
+					cur_sz_line = -1;
+					break;
+				}
+				fr->cur_sz_line = sz;
+				fr->src_gap = src_gap;
+			} else if (sz >= 0 && fr->src_gap >= 0)
+				fr->cur_sz_line = sz;
+			continue;
+		}
+	
+		/* Print tag end after children */
+		cur_sz_line = fr->cur_sz_line;
+		if (fr->src_gap >= 0)
+			cur_sz_line = _print_source(opt, fr->src_gap, fr->node->src_end, out, cur_sz_line);
+		else {
+			if (fr->node->n_children > 0)
+				cur_sz_line = _print_formatting(opt, depth + stack.n - 1, out, cur_sz_line);
+			_sink_puts(out, C2SX("</"));
+			_sink_puts(out, fr->node->tag);
+			_sink_putc(out, C2SX('>'));
+			cur_sz_line += sx_strlen(fr->node->tag) + 3;
+		}
+		stack.n--;
+		if (stack.n > 0 && stack.frames[stack.n - 1].src_gap >= 0)
+			stack.frames[stack.n - 1].cur_sz_line = cur_sz_line;
+	}
+	_NodeStack_free(&stack);
+
+	return cur_sz_line;
+}
+
+int XMLNode_print_attr_sep(const XMLNode* node, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+	int ret;
+
+	if (f == NULL)
+		return -1;
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	_sink_init(&out, f, -1, NULL);
+	ret = _XMLNode_print(node, &out, &opt, 0, FALSE, _XMLNode_depth(node));
+	_sink_flush(&out);
+	_print_options_free(&opt);
+
+	return ret;
+}
+
+static void _XMLDoc_print(const XMLDoc* doc, _XMLSink* out, _PrintOptions* opt)
+{
+	int i, cur_sz_line;
+
+	/* No 'tag_sep' (usually "\n") before the very first line */
+	for (i = 0, cur_sz_line = 0; i < doc->n_nodes; i++)
+		cur_sz_line = _XMLNode_print(doc->nodes[i], out, opt, cur_sz_line, i == 0, 0);
+	_sink_flush(out);
+}
+
+int XMLDoc_print_attr_sep(const XMLDoc* doc, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+	
+	if (doc == NULL || f == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+	
+	/* Write BOM if it exist */
+	if (doc->sz_bom > 0) fwrite(doc->bom, sizeof(unsigned char), doc->sz_bom, f);
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	_sink_init(&out, f, -1, NULL);
+	_XMLDoc_print(doc, &out, &opt);
+	_print_options_free(&opt);
+
+	return TRUE;
+}
+
+SXML_CHAR* XMLDoc_print_to_buffer(const XMLDoc* doc, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+	SXML_CHAR* buf;
+
+	if (doc == NULL || doc->init_value != XML_INIT_DONE)
+		return NULL;
+
+	/* Measure first, so that the buffer is allocated once with the exact size */
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	_sink_init(&out, NULL, -1, NULL);
+	_XMLDoc_print(doc, &out, &opt);
+	buf = (SXML_CHAR*)__malloc((out.n + 1) * sizeof(SXML_CHAR));
+	if (buf != NULL) {
+		_sink_init(&out, NULL, -1, buf);
+		_XMLDoc_print(doc, &out, &opt);
+		buf[out.n] = NULC;
+	}
+	_print_options_free(&opt);
+
+	return buf;
+}
+
+int XMLDoc_print_to_fd(const XMLDoc* doc, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+
+	if (doc == NULL || fd < 0 || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	_sink_init(&out, NULL, fd, NULL);
+
+	/* Write BOM if it exist */
+	if (doc->sz_bom > 0 && sx_write(fd, doc->bom, doc->sz_bom) != doc->sz_bom)
+		return FALSE;
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	_XMLDoc_print(doc, &out, &opt);
+	_print_options_free(&opt);
+
+	return !out.error;
+}
+
+/*
+ Print 'doc' parsed from 'opt->src', copying its unmodified nodes from it.
+ */
+static void _XMLDoc_print_incremental(const XMLDoc* doc, _XMLSink* out, _PrintOptions* opt)
+{
+	int i, cur_sz_line, src_gap;
+
+	if (doc->modified || !_print_source_gaps(doc->nodes, doc->n_nodes, 0, opt->src_len, opt)) {
+		_XMLDoc_print(doc, out, opt);
+		return;
+	}
+
+	/* Modified nodes are printed between the parts of the source */
+	for (i = 0, cur_sz_line = 0, src_gap = 0; i < doc->n_nodes; i++) {
+		if (doc->nodes[i]->modified == 0)
+			continue;
+		cur_sz_line = _print_source(opt, src_gap, doc->nodes[i]->src_start, out, cur_sz_line);
+		cur_sz_line = _XMLNode_print(doc->nodes[i], out, opt, cur_sz_line, TRUE, 0);
+		src_gap = doc->nodes[i]->src_end;
+	}
+	(void)_print_source(opt, src_gap, opt->src_len, out, cur_sz_line);
+	_sink_flush(out);
+}
+
+int XMLDoc_print_incremental(const XMLDoc* doc, const SXML_CHAR* source, int source_len, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+
+	if (doc == NULL || source == NULL || source_len < 0 || f == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	/* Write BOM if it exist */
+	if (doc->sz_bom > 0) fwrite(doc->bom, sizeof(unsigned char), doc->sz_bom, f);
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	opt.src = source;
+	opt.src_len = source_len;
+	_sink_init(&out, f, -1, NULL);
+	_XMLDoc_print_incremental(doc, &out, &opt);
+	_print_options_free(&opt);
+
+	return TRUE;
+}
+
+int XMLDoc_print_incremental_to_fd(const XMLDoc* doc, const SXML_CHAR* source, int source_len, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+
+	if (doc == NULL || source == NULL || source_len < 0 || fd < 0 || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	_sink_init(&out, NULL, fd, NULL);
+
+	/* Write BOM if it exist */
+	if (doc->sz_bom > 0 && sx_write(fd, doc->bom, doc->sz_bom) != doc->sz_bom)
+		return FALSE;
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	opt.src = source;
+	opt.src_len = source_len;
+	_XMLDoc_print_incremental(doc, &out, &opt);
+	_print_options_free(&opt);
+
+	return !out.error;
+}
+
+/* --- Parallel printing --- */
+
+/*
+ Children of a node are printed in parallel when it has at least 'PRINT_PARALLEL_CHILDREN' children per thread,
+ looking for such nodes down to 'PRINT_PARALLEL_LEVELS' levels below the document nodes.
+ Children are split in parts of at most 'PRINT_PART_CHILDREN' children (and at least 'PRINT_PARALLEL_CHILDREN'
+ parts per thread, for balance), each part being printed to memory then written in order. At most
+ 'PRINT_PARTS_AHEAD' parts per thread are held in memory.
+ */
+#define PRINT_PARALLEL_CHILDREN 8
+#define PRINT_PARALLEL_LEVELS 4
+#define PRINT_PART_CHILDREN 1024
+#define PRINT_PARTS_AHEAD 4
+
+#ifndef SXMLC_NO_THREADS
+typedef struct _PrintPart {
+	int i0, i1;			/* Children printed in the part */
+	SXML_CHAR* buf;		/* Printed children */
+	size_t len;			/* Number of characters in 'buf' */
+	size_t sz;			/* Allocated size of 'buf' */
+	int done;			/* 'true' when the part has been printed */
+	int error;			/* 'true' on memory error */
+} _PrintPart;
+
+typedef struct _PrintJob {
+	const XMLNode* node;	/* Node whose children are printed */
+	const _PrintOptions* opt;
+	int cur_sz_line;		/* Line size at the beginning of each child */
+	int depth;				/* Depth of children */
+	_PrintPart* parts;
+	int n_parts;
+	int next;				/* Next part to print */
+	int written;			/* Number of parts written to the output */
+	int ahead;				/* Maximum number of parts printed and not written yet */
+	_sx_mutex mutex;
+	_sx_cond cond;			/* Signaled when a part is printed or written */
+} _PrintJob;
+
+/* 'XMLOutputFunc' appending output to a part buffer */
+static int _print_part_append(const SXML_CHAR* data, int len, void* user)
+{
+	_PrintPart* part = (_PrintPart*)user;
+	SXML_CHAR* buf;
+	size_t sz;
+
+	if (part->len + len > part->sz) {
+		sz = (part->sz == 0 ? SINK_BUFFER : part->sz);
+		while (sz < part->len + len)
+			sz *= 2;
+		buf = (SXML_CHAR*)__realloc(part->buf, sz * sizeof(SXML_CHAR));
+		if (buf == NULL)
+			return FALSE;
+		part->buf = buf;
+		part->sz = sz;
+	}
+	memcpy(part->buf + part->len, data, len * sizeof(SXML_CHAR));
+	part->len += len;
+
+	return TRUE;
+}
+
+/*
+ Print children of a part, each one starting as if it were printed by '_XMLNode_print()' on the father.
+ Each thread builds its own indentation string.
+ */
+static void _print_part(_PrintJob* job, _PrintPart* part)
+{
+	_PrintOptions opt = *job->opt;
+	_XMLSink out;
+	int i;
+
+	opt.indent = NULL;
+	opt.max_depth = -1;
+	_sink_init_func(&out, _print_part_append, part);
+	for (i = part->i0; i < part->i1; i++)
+		(void)_XMLNode_print(job->node->children[i], &out, &opt, job->cur_sz_line, FALSE, job->depth);
+	_sink_flush(&out);
+	_print_options_free(&opt);
+	part->error = out.error;
+}
+
+SX_THREAD_FUNC(_print_worker)
+{
+	_PrintJob* job = (_PrintJob*)arg;
+	_PrintPart* part;
+
+	_sx_mutex_lock(&job->mutex);
+	for (;;) {
+		while (job->next < job->n_parts && job->next >= job->written + job->ahead)
+			_sx_cond_wait(&job->cond, &job->mutex);
+		if (job->next >= job->n_parts)
+			break;
+		part = &job->parts[job->next++];
+		_sx_mutex_unlock(&job->mutex);
+		_print_part(job, part);
+		_sx_mutex_lock(&job->mutex);
+		part->done = TRUE;
+		_sx_cond_broadcast(&job->cond);
+	}
+	_sx_mutex_unlock(&job->mutex);
+
+	return 0;
+}
+
+/*
+ Print all children of 'node' to 'out' using 'n_threads' threads, in the same order.
+ Parts are written as soon as they are printed, the calling thread printing the next part itself if no
+ thread took it yet (e.g. when threads could not be created).
+ Return 'false' on memory error.
+ */
+static int _XMLNode_print_children_parallel(const XMLNode* node, _XMLSink* out, const _PrintOptions* opt, int cur_sz_line, int depth, int n_threads)
+{
+	_PrintJob job;
+	_PrintPart* part;
+	_sx_thread* threads;
+	int i, n_started, ret = TRUE;
+
+	job.n_parts = (node->n_children + PRINT_PART_CHILDREN - 1) / PRINT_PART_CHILDREN;
+	if (job.n_parts < n_threads * PRINT_PARALLEL_CHILDREN)
+		job.n_parts = n_threads * PRINT_PARALLEL_CHILDREN;
+	if (job.n_parts > node->n_children)
+		job.n_parts = node->n_children;
+	job.parts = (_PrintPart*)__calloc(job.n_parts, sizeof(_PrintPart));
+	threads = (_sx_thread*)__malloc(n_threads * sizeof(_sx_thread));
+	if (job.parts == NULL || threads == NULL) {
+		if (job.parts != NULL)
+			__free(job.parts);
+		if (threads != NULL)
+			__free(threads);
+		return FALSE;
+	}
+	for (i = 0; i < job.n_parts; i++) {
+		job.parts[i].i0 = (int)((size_t)node->n_children * i / job.n_parts);
+		job.parts[i].i1 = (int)((size_t)node->n_children * (i + 1) / job.n_parts);
+	}
+	job.node = node;
+	job.opt = opt;
+	job.cur_sz_line = cur_sz_line;
+	job.depth = depth;
+	job.next = 0;
+	job.written = 0;
+	job.ahead = n_threads * PRINT_PARTS_AHEAD;
+	_sx_mutex_init(&job.mutex);
+	_sx_cond_init(&job.cond);
+
+	for (n_started = 0; n_started < n_threads; n_started++) {
+		if (!_sx_thread_create_arg(&threads[n_started], _print_worker, &job))
+			break;
+	}
+
+	_sx_mutex_lock(&job.mutex);
+	while (job.written < job.n_parts) {
+		part = &job.parts[job.written];
+		if (part->done) {
+			_sx_mutex_unlock(&job.mutex);
+			if (part->error)
+				ret = FALSE;
+			else if (part->len > 0)
+				_sink_write(out, part->buf, part->len);
+			if (part->buf != NULL)
+				__free(part->buf);
+			part->buf = NULL;
+			_sx_mutex_lock(&job.mutex);
+			job.written++;
+			_sx_cond_broadcast(&job.cond);
+		} else if (job.next == job.written) {
+			job.next++;
+			_sx_mutex_unlock(&job.mutex);
+			_print_part(&job, part);
+			_sx_mutex_lock(&job.mutex);
+			part->done = TRUE;
+		} else
+			_sx_cond_wait(&job.cond, &job.mutex);
+	}
+	_sx_mutex_unlock(&job.mutex);
+
+	for (i = 0; i < n_started; i++)
+		_sx_thread_join(threads[i]);
+	_sx_cond_destroy(&job.cond);
+	_sx_mutex_destroy(&job.mutex);
+	__free(threads);
+	__free(job.parts);
+
+	return ret;
+}
+#endif
+
+/*
+ Same as '_XMLNode_print()', printing children in parallel for nodes having enough of them, searched
+ down to 'level' levels below 'node'.
+ Return the new line size, -1 if 'node' cannot be printed or -2 on memory error.
+ */
+static int _XMLNode_print_parallel(const XMLNode* node, _XMLSink* out, _PrintOptions* opt, int cur_sz_line, int first, int depth, int level, int n_threads)
+{
+	int i, open;
+
+#ifndef SXMLC_NO_THREADS
+	if (node == NULL || level <= 0 || node->n_children <= 0)
+#endif
+		return _XMLNode_print(node, out, opt, cur_sz_line, first, depth);
+
+	cur_sz_line = _XMLNode_print_start(node, out, opt, cur_sz_line, first, depth, &open);
+	if (cur_sz_line < 0 || !open)
+		return cur_sz_line;
+
+	/* Each child starts with the line size of its father, so children can be printed independently */
+#ifndef SXMLC_NO_THREADS
+	if (node->n_children >= n_threads * PRINT_PARALLEL_CHILDREN) {
+		if (!_XMLNode_print_children_parallel(node, out, opt, cur_sz_line, depth + 1, n_threads))
+			return -2;
+	} else
+#endif
+	{
+		for (i = 0; i < node->n_children; i++) {
+			if (_XMLNode_print_parallel(node->children[i], out, opt, cur_sz_line, FALSE, depth + 1, level - 1, n_threads) == -2)
+				return -2;
+		}
+	}
+
+	/* Print tag end after children */
+	cur_sz_line = _print_formatting(opt, depth, out, cur_sz_line);
+	_sink_puts(out, C2SX("</"));
+	_sink_puts(out, node->tag);
+	_sink_putc(out, C2SX('>'));
+
+	return cur_sz_line + (int)sx_strlen(node->tag) + 3;
+}
+
+static int _XMLDoc_print_parallel(const XMLDoc* doc, _XMLSink* out, _PrintOptions* opt, int n_threads)
+{
+	int i, cur_sz_line, ret = TRUE;
+
+	for (i = 0, cur_sz_line = 0; i < doc->n_nodes; i++) {
+		cur_sz_line = _XMLNode_print_parallel(doc->nodes[i], out, opt, cur_sz_line, i == 0, 0, PRINT_PARALLEL_LEVELS, n_threads);
+		if (cur_sz_line == -2) {
+			ret = FALSE;
+			break;
+		}
+	}
+	_sink_flush(out);
+
+	return ret && !out->error;
+}
+
+int XMLDoc_print_parallel(const XMLDoc* doc, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab, int n_threads)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+	int ret;
+
+	if (doc == NULL || f == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	/* Write BOM if it exist */
+	if (doc->sz_bom > 0) fwrite(doc->bom, sizeof(unsigned char), doc->sz_bom, f);
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	_sink_init(&out, f, -1, NULL);
+	ret = _XMLDoc_print_parallel(doc, &out, &opt, n_threads <= 0 ? 1 : n_threads);
+	_print_options_free(&opt);
+
+	return ret;
+}
+
+int XMLDoc_print_parallel_to_fd(const XMLDoc* doc, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab, int n_threads)
+{
+	_PrintOptions opt;
+	_XMLSink out;
+	int ret;
+
+	if (doc == NULL || fd < 0 || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	_sink_init(&out, NULL, fd, NULL);
+
+	/* Write BOM if it exist */
+	if (doc->sz_bom > 0 && sx_write(fd, doc->bom, doc->sz_bom) != doc->sz_bom)
+		return FALSE;
+
+	_print_options_init(&opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	ret = _XMLDoc_print_parallel(doc, &out, &opt, n_threads <= 0 ? 1 : n_threads);
+	_print_options_free(&opt);
+
+	return ret;
+}
+
+/* --- Streaming writer --- */
+
+/* Element started and not ended yet */
+typedef struct _XMLWriterFrame {
+	size_t tag;		/* Offset of the tag name in 'XMLWriter.tags' */
+	int children;	/* 'true' once a child node was written, so the end tag goes on its own line */
+	int cur_sz_line;	/* Line size its children and end tag start from, as in '_XMLNode_print()' */
+} _XMLWriterFrame;
+
+static int _XMLWriter_init(XMLWriter* writer, FILE* f, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	if (writer == NULL)
+		return FALSE;
+
+	writer->init_value = 0;
+	writer->out = (_XMLSink*)__malloc(sizeof(_XMLSink));
+	writer->opt = (_PrintOptions*)__malloc(sizeof(_PrintOptions));
+	if (writer->out == NULL || writer->opt == NULL) {
+		if (writer->out != NULL)
+			__free(writer->out);
+		if (writer->opt != NULL)
+			__free(writer->opt);
+		return FALSE;
+	}
+	_sink_init(writer->out, f, fd, NULL);
+	_print_options_init(writer->opt, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+	writer->cur_sz_line = 0;
+	writer->first = TRUE;
+	writer->open = FALSE;
+	writer->frames = NULL;
+	writer->n_frames = 0;
+	writer->sz_frames = 0;
+	writer->tags = NULL;
+	writer->len_tags = 0;
+	writer->sz_tags = 0;
+	writer->init_value = XML_INIT_DONE;
+
+	return TRUE;
+}
+
+int XMLWriter_init(XMLWriter* writer, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	if (f == NULL)
+		return FALSE;
+
+	return _XMLWriter_init(writer, f, -1, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+}
+
+int XMLWriter_init_fd(XMLWriter* writer, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+{
+	if (fd < 0)
+		return FALSE;
+
+	return _XMLWriter_init(writer, NULL, fd, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, nb_char_tab);
+}
+
+/*
+ Prepare the writing of a new child node: end the header of its father and print formatting if 'format' is 'true'.
+ Return the line size the child starts with, which is the one of its father (not counting previous siblings)
+ so that lines are wrapped as by 'XMLNode_print_attr_sep()'.
+ */
+static int _XMLWriter_child(XMLWriter* writer, int format)
+{
+	_XMLWriterFrame* fr;
+	int cur_sz_line;
+
+	if (writer->open) {
+		_sink_putc(writer->out, C2SX('>'));
+		writer->open = FALSE;
+	}
+	if (writer->n_frames > 0) {
+		fr = &writer->frames[writer->n_frames - 1];
+		fr->children = TRUE;
+		cur_sz_line = fr->cur_sz_line;
+	} else
+		cur_sz_line = writer->cur_sz_line;
+	if (format && !writer->first)
+		cur_sz_line = _print_formatting(writer->opt, writer->n_frames, writer->out, cur_sz_line);
+	writer->first = FALSE;
+
+	return cur_sz_line;
+}
+
+int XMLWriter_start_element(XMLWriter* writer, const SXML_CHAR* tag)
+{
+	_XMLWriterFrame* frames;
+	SXML_CHAR* tags;
+	size_t len;
+	int sz, cur_sz_line;
+
+	if (writer == NULL || writer->init_value != XML_INIT_DONE || tag == NULL || tag[0] == NULC)
+		return FALSE;
+
+	/* Keep the tag name for 'XMLWriter_end_element()'. Both stacks only grow with the depth of the document. */
+	if (writer->n_frames >= writer->sz_frames) {
+		sz = (writer->sz_frames == 0 ? NODE_STACK_SZ : 2 * writer->sz_frames);
+		frames = (_XMLWriterFrame*)__realloc(writer->frames, sz * sizeof(_XMLWriterFrame));
+		if (frames == NULL)
+			return FALSE;
+		writer->frames = frames;
+		writer->sz_frames = sz;
+	}
+	len = sx_strlen(tag) + 1;
+	if (writer->len_tags + len > writer->sz_tags) {
+		tags = (SXML_CHAR*)__realloc(writer->tags, (writer->sz_tags * 2 + len) * sizeof(SXML_CHAR));
+		if (tags == NULL)
+			return FALSE;
+		writer->tags = tags;
+		writer->sz_tags = writer->sz_tags * 2 + len;
+	}
+
+	cur_sz_line = _XMLWriter_child(writer, TRUE);
+	_sink_putc(writer->out, C2SX('<'));
+	_sink_puts(writer->out, tag);
+	writer->cur_sz_line = cur_sz_line + (int)len; /* Header size, to wrap attributes */
+	writer->open = TRUE;
+
+	memcpy(writer->tags + writer->len_tags, tag, len * sizeof(SXML_CHAR));
+	writer->frames[writer->n_frames].tag = writer->len_tags;
+	writer->frames[writer->n_frames].children = FALSE;
+	writer->frames[writer->n_frames].cur_sz_line = cur_sz_line;
+	writer->n_frames++;
+	writer->len_tags += len;
+
+	return TRUE;
+}
+
+int XMLWriter_attribute(XMLWriter* writer, const SXML_CHAR* name, const SXML_CHAR* value)
+{
+	if (writer == NULL || writer->init_value != XML_INIT_DONE || !writer->open || name == NULL || name[0] == NULC)
+		return FALSE;
+
+	writer->cur_sz_line = _print_attribute(name, value != NULL ? value : C2SX(""), writer->out, writer->opt, writer->cur_sz_line, writer->n_frames - 1);
+
+	return TRUE;
+}
+
+int XMLWriter_text(XMLWriter* writer, const SXML_CHAR* text)
+{
+	_XMLWriterFrame* fr;
+	const SXML_CHAR* p;
+	int len;
+
+	if (writer == NULL || writer->init_value != XML_INIT_DONE || text == NULL)
+		return FALSE;
+
+	if (text[0] == NULC)
+		return TRUE;
+
+	/* Text is part of its element, as 'XMLNode.text': it goes right after the header, without formatting */
+	if (writer->open) {
+		_sink_putc(writer->out, C2SX('>'));
+		writer->open = FALSE;
+	}
+	if (!writer->opt->keep_text_spaces) {
+		for (p = text; *p != NULC && sx_isspace(*p); p++) ;
+		if (*p == NULC)
+			return TRUE;
+	}
+	len = _sink_html(writer->out, text);
+	/* Text after children is a text node, which does not change the line size of its father */
+	if (writer->n_frames == 0)
+		writer->cur_sz_line += len;
+	else if (!(fr = &writer->frames[writer->n_frames - 1])->children)
+		fr->cur_sz_line += len;
+
+	return TRUE;
+}
+
+/*
+ Write a special node of type 'tag_type' (see '_spec'), holding 'text'.
+ */
+static int _XMLWriter_special(XMLWriter* writer, TagType tag_type, const SXML_CHAR* text)
+{
+	int i, sz;
+
+	if (writer == NULL || writer->init_value != XML_INIT_DONE || text == NULL)
+		return FALSE;
+
+	for (i = 0; i < NB_SPECIAL_TAGS && _spec[i].tag_type != tag_type; i++) ;
+	sz = _XMLWriter_child(writer, TRUE);
+	_sink_puts(writer->out, _spec[i].start);
+	_sink_puts(writer->out, text);
+	_sink_puts(writer->out, _spec[i].end);
+	if (writer->n_frames == 0) /* Special nodes are not counted, as by '_XMLNode_print_start()' */
+		writer->cur_sz_line = sz;
+
+	return TRUE;
+}
+
+int XMLWriter_cdata(XMLWriter* writer, const SXML_CHAR* text)
+{
+	return _XMLWriter_special(writer, TAG_CDATA, text);
+}
+
+int XMLWriter_comment(XMLWriter* writer, const SXML_CHAR* text)
+{
+	return _XMLWriter_special(writer, TAG_COMMENT, text);
+}
+
+int XMLWriter_end_element(XMLWriter* writer)
+{
+	_XMLWriterFrame* fr;
+	SXML_CHAR* tag;
+	int sz;
+
+	if (writer == NULL || writer->init_value != XML_INIT_DONE || writer->n_frames <= 0)
+		return FALSE;
+
+	fr = &writer->frames[--writer->n_frames];
+	tag = writer->tags + fr->tag;
+	sz = fr->cur_sz_line;
+	if (writer->open) { /* Nothing written inside the element */
+		_sink_puts(writer->out, C2SX("/>"));
+		writer->open = FALSE;
+	} else {
+		if (fr->children)
+			sz = _print_formatting(writer->opt, writer->n_frames, writer->out, sz);
+		_sink_puts(writer->out, C2SX("</"));
+		_sink_puts(writer->out, tag);
+		_sink_putc(writer->out, C2SX('>'));
+		sz += (int)sx_strlen(tag) + 3;
+	}
+	writer->len_tags = fr->tag;
+	if (writer->n_frames == 0) /* Elements do not change the line size their next siblings start from */
+		writer->cur_sz_line = sz;
+
+	return TRUE;
+}
+
+int XMLWriter_node(XMLWriter* writer, const XMLNode* node)
+{
+	int first, sz;
+
+	if (writer == NULL || writer->init_value != XML_INIT_DONE || node == NULL)
+		return FALSE;
+
+	if (!node->active)
+		return TRUE;
+
+	/* Formatting is printed with the node */
+	first = writer->first;
+	sz = _XMLWriter_child(writer, FALSE);
+	sz = _XMLNode_print(node, writer->out, writer->opt, sz, first, writer->n_frames);
+	if (sz < 0)
+		return FALSE;
+	if (writer->n_frames == 0)
+		writer->cur_sz_line = sz;
+
+	return TRUE;
+}
+
+int XMLWriter_flush(XMLWriter* writer)
+{
+	if (writer == NULL || writer->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	_sink_flush(writer->out);
+	if (writer->out->f != NULL && fflush(writer->out->f) != 0)
+		writer->out->error = TRUE;
+
+	return !writer->out->error;
+}
+
+int XMLWriter_free(XMLWriter* writer)
+{
+	int ret;
+
+	if (writer == NULL || writer->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	while (writer->n_frames > 0)
+		(void)XMLWriter_end_element(writer);
+	ret = XMLWriter_flush(writer);
+	_print_options_free(writer->opt);
+	__free(writer->opt);
+	__free(writer->out);
+	__free(writer->frames);
+	__free(writer->tags);
+	writer->opt = NULL;
+	writer->out = NULL;
+	writer->frames = NULL;
+	writer->tags = NULL;
+	writer->init_value = 0;
+
+	return ret;
+}
+
+/* --- Canonical printing --- */
+
+/*
+ Write 'str' escaped as Canonical XML text ('attr' is 'false') or attribute value ('attr' is 'true').
+ */
+static void _sink_canonical(_XMLSink* sink, const SXML_CHAR* str, int attr)
+{
+	const SXML_CHAR* run;
+	const SXML_CHAR* ent;
+
+	for (run = str; *str != NULC; str++) {
+		switch (*str) {
+			case C2SX('&'):		ent = C2SX("&amp;"); break;
+			case C2SX('<'):		ent = C2SX("&lt;"); break;
+			case C2SX('>'):		ent = (attr ? NULL : C2SX("&gt;")); break;
+			case C2SX('"'):		ent = (attr ? C2SX("&quot;") : NULL); break;
+			case C2SX('\t'):	ent = (attr ? C2SX("&#x9;") : NULL); break;
+			case C2SX('\n'):	ent = (attr ? C2SX("&#xA;") : NULL); break;
+			case C2SX('\r'):	ent = C2SX("&#xD;"); break;
+			default:			ent = NULL; break;
+		}
+		if (ent == NULL)
+			continue;
+		if (str > run)
+			_sink_write(sink, run, str - run);
+		_sink_puts(sink, ent);
+		run = str + 1;
+	}
+	if (str > run)
+		_sink_write(sink, run, str - run);
+}
+
+/* Namespace declarations first, then other attributes, by name */
+static int _canonical_attr_cmp(const void* a1, const void* a2)
+{
+	const SXML_CHAR* n1 = (*(const XMLAttribute* const*)a1)->name;
+	const SXML_CHAR* n2 = (*(const XMLAttribute* const*)a2)->name;
+	int ns1 = (sx_strncmp(n1, C2SX("xmlns"), 5) == 0 && (n1[5] == NULC || n1[5] == C2SX(':')));
+	int ns2 = (sx_strncmp(n2, C2SX("xmlns"), 5) == 0 && (n2[5] == NULC || n2[5] == C2SX(':')));
+
+	if (ns1 != ns2)
+		return ns2 - ns1;
+
+	return sx_strcmp(n1, n2);
+}
+
+/*
+ 'true' if 'node' has no canonical form: inactive nodes, XML declaration, DOCTYPE, user tags and comments
+ (unless 'with_comments' is 'true').
+ */
+static int _canonical_skipped(const XMLNode* node, int with_comments)
+{
+	if (node == NULL || !node->active)
+		return TRUE;
+
+	switch (node->tag_type) {
+		case TAG_TEXT:
+		case TAG_CDATA:
+			return FALSE;
+		case TAG_COMMENT:
+			return !with_comments || node->tag == NULL;
+		case TAG_INSTR:
+			return node->tag == NULL || (sx_strncmp(node->tag, C2SX("xml"), 3) == 0 && (node->tag[3] == NULC || sx_isspace(node->tag[3])));
+		case TAG_FATHER:
+		case TAG_SELF:
+			return node->tag == NULL || node->tag[0] == NULC;
+		default:
+			return TRUE;
+	}
+}
+
+/*
+ Print 'node' start tag, with its attributes sorted, or all of it for nodes that have no children.
+ '*attrs' (of size '*sz_attrs') is used to sort attributes and grown as needed.
+ Return 'true' if children and end tag should be printed afterwards, -1 on memory error.
+ */
+static int _XMLNode_print_canonical_start(const XMLNode* node, _XMLSink* out, const XMLAttribute*** attrs, int* sz_attrs)
+{
+	const XMLAttribute** a;
+	int i, n;
+
+	switch (node->tag_type) {
+		case TAG_TEXT:
+			if (node->text != NULL)
+				_sink_canonical(out, node->text, FALSE);
+			return FALSE;
+		case TAG_CDATA: /* CDATA sections are replaced by their escaped content */
+			if (node->tag != NULL)
+				_sink_canonical(out, node->tag, FALSE);
+			return FALSE;
+		case TAG_COMMENT:
+			_sink_puts(out, C2SX("<!--"));
+			_sink_puts(out, node->tag);
+			_sink_puts(out, C2SX("-->"));
+			return FALSE;
+		case TAG_INSTR:
+			_sink_puts(out, C2SX("<?"));
+			_sink_puts(out, node->tag);
+			_sink_puts(out, C2SX("?>"));
+			return FALSE;
+		default:
+			break;
+	}
+
+	if (node->n_attributes > *sz_attrs) {
+		a = (const XMLAttribute**)__realloc((void*)*attrs, node->n_attributes * sizeof(XMLAttribute*));
+		if (a == NULL)
+			return -1;
+		*attrs = a;
+		*sz_attrs = node->n_attributes;
+	}
+	for (i = n = 0; i < node->n_attributes; i++) {
+		if (node->attributes[i].active)
+			(*attrs)[n++] = &node->attributes[i];
+	}
+	if (n > 1)
+		qsort((void*)*attrs, n, sizeof(XMLAttribute*), _canonical_attr_cmp);
+
+	_sink_putc(out, C2SX('<'));
+	_sink_puts(out, node->tag);
+	for (i = 0; i < n; i++) {
+		_sink_putc(out, C2SX(' '));
+		_sink_puts(out, (*attrs)[i]->name);
+		_sink_puts(out, C2SX("=\""));
+		_sink_canonical(out, (*attrs)[i]->value, TRUE);
+		_sink_putc(out, C2SX('"'));
+	}
+	_sink_putc(out, C2SX('>'));
+	if (node->text != NULL)
+		_sink_canonical(out, node->text, FALSE);
+
+	return TRUE;
+}
+
+/*
+ Print 'node' and its children in canonical form, without recursion.
+ Return 'false' on memory error.
+ */
+static int _XMLNode_print_canonical(const XMLNode* node, _XMLSink* out, int with_comments)
+{
+	_NodeStack stack;
+	_NodeFrame* fr;
+	const XMLNode* child;
+	const XMLAttribute** attrs = NULL;
+	int sz_attrs = 0;
+	int ret = TRUE;
+	int open;
+
+	if (_canonical_skipped(node, with_comments))
+		return TRUE;
+
+	if ((open = _XMLNode_print_canonical_start(node, out, &attrs, &sz_attrs)) <= 0) {
+		__free((void*)attrs);
+		return open == 0;
+	}
+
+	_NodeStack_init(&stack);
+	(void)_NodeStack_push(&stack, node);
+	while (stack.n > 0) {
+		fr = &stack.frames[stack.n - 1];
+		if (fr->i < fr->node->n_children) {
+			child = fr->node->children[fr->i++];
+			if (_canonical_skipped(child, with_comments))
+				continue;
+			open = _XMLNode_print_canonical_start(child, out, &attrs, &sz_attrs);
+			if (open < 0 || (open && _NodeStack_push(&stack, child) == NULL)) {
+				ret = FALSE;
+				break;
+			}
+			continue;
+		}
+
+		/* Empty elements are printed as a start-end tag pair */
+		_sink_puts(out, C2SX("</"));
+		_sink_puts(out, fr->node->tag);
+		_sink_putc(out, C2SX('>'));
+		stack.n--;
+	}
+	_NodeStack_free(&stack);
+	__free((void*)attrs);
+
+	return ret;
+}
+
+int XMLNode_print_canonical(const XMLNode* node, int with_comments, XMLOutputFunc func, void* user)
+{
+	_XMLSink out;
+	int ret;
+
+	if (node == NULL || func == NULL)
+		return FALSE;
+
+	_sink_init_func(&out, func, user);
+	ret = _XMLNode_print_canonical(node, &out, with_comments);
+	_sink_flush(&out);
+
+	return ret && !out.error;
+}
+
+/*
+ Print all document nodes in canonical form. Nodes before the root element are followed by a new line,
+ nodes after it are preceded by one.
+ */
+static int _XMLDoc_print_canonical(const XMLDoc* doc, _XMLSink* out, int with_comments)
+{
+	int i, after_root = FALSE;
+	const XMLNode* node;
+
+	for (i = 0; i < doc->n_nodes; i++) {
+		node = doc->nodes[i];
+		if (node->tag_type == TAG_TEXT || _canonical_skipped(node, with_comments))
+			continue;
+		if (after_root)
+			_sink_putc(out, C2SX('\n'));
+		if (!_XMLNode_print_canonical(node, out, with_comments))
+			return FALSE;
+		if (node->tag_type == TAG_FATHER || node->tag_type == TAG_SELF)
+			after_root = TRUE;
+		else if (!after_root)
+			_sink_putc(out, C2SX('\n'));
+	}
+	_sink_flush(out);
+
+	return !out->error;
 }
 
-int XMLNode_print_attr_sep(const XMLNode* node, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+int XMLDoc_print_canonical(const XMLDoc* doc, int with_comments, XMLOutputFunc func, void* user)
 {
-	return _XMLNode_print(node, f, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, 0, nb_char_tab, 0);
+	_XMLSink out;
+
+	if (doc == NULL || func == NULL || doc->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	_sink_init_func(&out, func, user);
+
+	return _XMLDoc_print_canonical(doc, &out, with_comments);
 }
 
-int XMLDoc_print_attr_sep(const XMLDoc* doc, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab)
+SXML_CHAR* XMLDoc_print_canonical_to_buffer(const XMLDoc* doc, int with_comments)
 {
-	int i, depth, cur_sz_line;
-	
-	if (doc == NULL || f == NULL || doc->init_value != XML_INIT_DONE)
-		return FALSE;
-	
-	/* Write BOM if it exist */
-	if (doc->sz_bom > 0) fwrite(doc->bom, sizeof(unsigned char), doc->sz_bom, f);
+	_XMLSink out;
+	SXML_CHAR* buf;
 
-	depth = -1; /* UGLY HACK: 'depth' forced negative on very first line so we don't print an extra 'tag_sep' (usually "\n") */
-	for (i = 0, cur_sz_line = 0; i < doc->n_nodes; i++) {
-		cur_sz_line = _XMLNode_print(doc->nodes[i], f, tag_sep, child_sep, attr_sep, keep_text_spaces, sz_line, cur_sz_line, nb_char_tab, depth);
-		depth = 0;
+	if (doc == NULL || doc->init_value != XML_INIT_DONE)
+		return NULL;
+
+	/* Measure first, so that the buffer is allocated once with the exact size */
+	_sink_init(&out, NULL, -1, NULL);
+	if (!_XMLDoc_print_canonical(doc, &out, with_comments))
+		return NULL;
+	buf = (SXML_CHAR*)__malloc((out.n + 1) * sizeof(SXML_CHAR));
+	if (buf == NULL)
+		return NULL;
+
+	_sink_init(&out, NULL, -1, buf);
+	if (!_XMLDoc_print_canonical(doc, &out, with_comments)) {
+		__free(buf);
+		return NULL;
 	}
-	/* TODO: Find something more graceful than 'depth=-1', even though everyone knows I probably never will ;) */
+	buf[out.n] = NULC;
 
-	return TRUE;
+	return buf;
 }
 
 /* --- */
 
-int XML_parse_attribute_to(const SXML_CHAR* str, int to, XMLAttribute* xmlattr)
+/*
+ Same as 'XML_parse_attribute_to()', taking attribute name and value memory from 'pool' if not NULL.
+ */
+static int _parse_attribute_to(const SXML_CHAR* str, int to, XMLAttribute* xmlattr, XMLPool* pool)
 {
 	const SXML_CHAR *p;
 	int i, n0, n1, remQ = 0;
@@ -1169,8 +4716,8 @@ int XML_parse_attribute_to(const SXML_CHAR* str, int to, XMLAttribute* xmlattr)
 		remQ = 1;
 	}
 	
-	xmlattr->name = __malloc((n0+1)*sizeof(SXML_CHAR));
-	xmlattr->value = __malloc((to+1 - n1 - 2*remQ + 1) * sizeof(SXML_CHAR)); /* 2*remQ because we expect 2 quotes */
+	xmlattr->name = _pool_alloc(pool, POOL_STRINGS, (n0+1)*sizeof(SXML_CHAR));
+	xmlattr->value = _pool_alloc(pool, POOL_STRINGS, (to+1 - n1 - 2*remQ + 1) * sizeof(SXML_CHAR)); /* 2*remQ because we expect 2 quotes */
 	xmlattr->active = TRUE;
 	if (xmlattr->name != NULL && xmlattr->value != NULL) {
 		/* Copy name */
@@ -1189,35 +4736,37 @@ int XML_parse_attribute_to(const SXML_CHAR* str, int to, XMLAttribute* xmlattr)
 		ret = 0;
 	
 	if (ret == 0) {
-		if (xmlattr->name != NULL) {
-			__free(xmlattr->name);
-			xmlattr->name = NULL;
-		}
-		if (xmlattr->value != NULL) {
-			__free(xmlattr->value);
-			xmlattr->value = NULL;
-		}
+		_pool_free(pool, POOL_STRINGS, xmlattr->name, (n0+1)*sizeof(SXML_CHAR));
+		xmlattr->name = NULL;
+		_pool_free(pool, POOL_STRINGS, xmlattr->value, (to+1 - n1 - 2*remQ + 1) * sizeof(SXML_CHAR));
+		xmlattr->value = NULL;
 	}
 	
 	return ret;
 }
 
-static TagType _parse_special_tag(const SXML_CHAR* str, int len, _TAG* tag, XMLNode* node)
+int XML_parse_attribute_to(const SXML_CHAR* str, int to, XMLAttribute* xmlattr)
+{
+	return _parse_attribute_to(str, to, xmlattr, NULL);
+}
+
+static TagType _parse_special_tag(const SXML_CHAR* str, int len, _TAG* tag, XMLNode* node, XMLPool* pool)
 {
 	int sz = len - tag->len_start - tag->len_end;
-	if (sz < 0)
-		return TAG_ERROR;
 
 	if (sx_strncmp(str, tag->start, tag->len_start))
 		return TAG_NONE;
 
+	if (sz < 0)
+		return TAG_PARTIAL;
+
 	if (sx_strncmp(str + len - tag->len_end, tag->end, tag->len_end)) /* There probably is a '>' inside the tag */
 		return TAG_PARTIAL;
 	
-	node->tag = __malloc((sz + 1)*sizeof(SXML_CHAR));
+	node->tag = _pool_alloc(pool, POOL_STRINGS, (sz + 1)*sizeof(SXML_CHAR));
 	if (node->tag == NULL)
 		return TAG_ERROR;
-	sx_strncpy(node->tag, str + tag->len_start, sz;
+	sx_strncpy(node->tag, str + tag->len_start, sz);
 	node->tag[len - tag->len_start - tag->len_end] = NULC;
 	node->tag_type = tag->tag_type;
 
@@ -1227,9 +4776,10 @@ static TagType _parse_special_tag(const SXML_CHAR* str, int len, _TAG* tag, XMLN
 /*
  Reads a string that is supposed to be an xml tag like '<tag (attribName="attribValue")* [/]>' or '</tag>'.
  Fills the 'xmlnode' structure with the tag name and its attributes.
+ Memory is taken from 'pool' if not NULL.
  Returns 'TAG_ERROR' if an error occurred (malformed 'str' or memory). 'TAG_*' when string is recognized.
  */
-TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
+static TagType _parse_1string(const SXML_CHAR* str, XMLNode* xmlnode, const XMLParserConfig* config, XMLPool* pool)
 {
 	SXML_CHAR *p;
 	XMLAttribute* pt;
@@ -1244,7 +4794,7 @@ TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
 		return TAG_NONE; /* Syntax error */
 
 	for (nn = 0; nn < NB_SPECIAL_TAGS; nn++) {
-		n = (int)_parse_special_tag(str, len, &_spec[nn], xmlnode);
+		n = (int)_parse_special_tag(str, len, &_spec[nn], xmlnode, pool);
 		switch (n) {
 			case TAG_NONE:	break;				/* Nothing found => do nothing */
 			default:		return (TagType)n;	/* Tag found => return it */
@@ -1262,7 +4812,7 @@ TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
 					return TAG_PARTIAL;
 				nn = 1;
 			}
-			xmlnode->tag = __malloc((len - 9 - nn)*sizeof(SXML_CHAR)); /* 'len' - "<!DOCTYPE" and ">" + '\0' */
+			xmlnode->tag = _pool_alloc(pool, POOL_STRINGS, (len - 9 - nn)*sizeof(SXML_CHAR)); /* 'len' - "<!DOCTYPE" and ">" + '\0' */
 			if (xmlnode->tag == NULL)
 				return TAG_ERROR;
 			sx_strncpy(xmlnode->tag, &str[9], len - 10 - nn);
@@ -1274,8 +4824,8 @@ TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
 	}
 	
 	/* Test user tags */
-	for (nn = 0; nn < _user_tags.n_tags; nn++) {
-		n = _parse_special_tag(str, len, &_user_tags.tags[nn], xmlnode);
+	for (nn = 0; nn < config->n_user_tags; nn++) {
+		n = _parse_special_tag(str, len, &config->user_tags[nn], xmlnode, pool);
 		switch (n) {
 			case TAG_ERROR:	return TAG_ERROR;	/* Error => exit */
 			case TAG_NONE:	break;				/* Not this one */
@@ -1288,7 +4838,7 @@ TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
 	
 	/* tag starts at index 1 (or 2 if tag end) and ends at the first space or '/>' */
 	for (n = 1 + tag_end; str[n] != NULC && str[n] != C2SX('>') && str[n] != C2SX('/') && !sx_isspace(str[n]); n++) ;
-	xmlnode->tag = __malloc((n - tag_end)*sizeof(SXML_CHAR));
+	xmlnode->tag = _pool_alloc(pool, POOL_STRINGS, (n - tag_end)*sizeof(SXML_CHAR));
 	if (xmlnode->tag == NULL)
 		return TAG_ERROR;
 	sx_strncpy(xmlnode->tag, &str[1 + tag_end], n - 1 - tag_end);
@@ -1317,7 +4867,7 @@ TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
 		/* New attribute found */
 		p = sx_strchr(str+n, C2SX('='));
 		if (p == NULL) goto parse_err;
-		pt = __realloc(xmlnode->attributes, (xmlnode->n_attributes + 1) * sizeof(XMLAttribute));
+		pt = _pool_realloc(pool, POOL_ARRAYS, xmlnode->attributes, xmlnode->n_attributes * sizeof(XMLAttribute), (xmlnode->n_attributes + 1) * sizeof(XMLAttribute));
 		if (pt == NULL) goto parse_err;
 		
 		pt[xmlnode->n_attributes].name = NULL;
@@ -1337,7 +4887,7 @@ TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
 		
 		/* Here 'str[nn]' is the character after value */
 		/* the attribute definition ('attrName="attrVal"') is between 'str[n]' and 'str[nn]' */
-		rc = XML_parse_attribute_to(&str[n], nn - n, &xmlnode->attributes[xmlnode->n_attributes - 1]);
+		rc = _parse_attribute_to(&str[n], nn - n, &xmlnode->attributes[xmlnode->n_attributes - 1], pool);
 		if (!rc) goto parse_err;
 		if (rc == 2) { /* Probable presence of '>' inside attribute value, which is legal XML. Remove attribute to re-parse it later */
 			XMLNode_remove_attribute(xmlnode, xmlnode->n_attributes - 1);
@@ -1360,11 +4910,16 @@ parse_err:
 	return TAG_ERROR;
 }
 
+TagType XML_parse_1string(const SXML_CHAR* str, XMLNode* xmlnode)
+{
+	return _parse_1string(str, xmlnode, &_default_config, NULL);
+}
+
 static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Callbacks* sax, SAX_Data* sd)
 {
 	SXML_CHAR *line = NULL, *txt_end, *p;
 	XMLNode node;
-	int ret, exit, sz, n0, ncr;
+	int ret, exit, sz, n0, ncr, depth, pos;
 	TagType tag_type;
 	int (*meos)(void* ds) = (in_type == DATA_SOURCE_BUFFER ? (int(*)(void*))_beob : (int(*)(void*))sx_feof);
 
@@ -1377,10 +4932,18 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 	exit = FALSE;
 	sd->line_num = 1; /* Line counter, starts at 1 */
 	sz = 0; /* 'line' buffer size */
+	if (sd->pool != NULL) { /* Reuse the line buffer of previous parsings */
+		sz = MEM_INCR_RLA;
+		if ((line = _pool_alloc(sd->pool, POOL_ARRAYS, sz*sizeof(SXML_CHAR))) == NULL)
+			sz = 0;
+	}
+	depth = 0; /* Number of father nodes started and not ended */
+	pos = (in_type == DATA_SOURCE_BUFFER ? ((DataSourceBuffer*)in)->cur_pos : 0); /* Offset of 'line' in the data source */
 	node.init_value = 0;
 	(void)XMLNode_init(&node);
 	while ((n0 = read_line_alloc(in, in_type, &line, &sz, 0, NULC, C2SX('>'), TRUE, C2SX('\n'), &ncr)) != 0) {
-		(void)XMLNode_free(&node);
+		_XMLNode_free_content(&node, sd->pool);
+		node.tag_type = TAG_NONE;
 		for (p = line; *p != NULC && sx_isspace(*p) && p - line < n0; p++) ; /* Checks if text is only spaces */
 		if (*p == NULC || p - line >= n0)
 			break;
@@ -1418,6 +4981,8 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 		}
 		/* First part of 'line' (before '<') is to be added to 'father->text' */
 		*txt_end = NULC; /* Have 'line' be the text for 'father' */
+		sd->src_start = pos;
+		sd->src_end = pos + (int)(txt_end - line);
 		if (*line != NULC && (sax->new_text != NULL || sax->all_event != NULL)) {
 			SXML_CHAR* unhtml = line;
 			int line_has_html = has_html(line);
@@ -1442,8 +5007,10 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 			if (line_has_html) __free(unhtml);
 		}
 		*txt_end = '<'; /* Restores tag start */
+		sd->src_start = pos + (int)(txt_end - line);
+		sd->src_end = pos + n0;
 
-		switch (tag_type = XML_parse_1string(txt_end, &node)) {
+		switch (tag_type = _parse_1string(txt_end, &node, sd->config, sd->pool)) {
 			case TAG_ERROR: /* Memory error */
 				ret = FALSE;
 				if (sax->on_error == NULL && sax->all_event == NULL) {
@@ -1474,6 +5041,8 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 				break;
 
 			case TAG_END:
+				if (depth > 0)
+					depth--;
 				if (sax->end_node != NULL || sax->all_event != NULL) {
 					if (sax->end_node != NULL && (exit = !sax->end_node(&node, sd)))
 						break;
@@ -1501,7 +5070,7 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 					}
 					n0 = n1;
 					txt_end = sx_strchr(line, C2SX('<')); /* In case 'line' has been moved by the '__realloc' in 'read_line_alloc' */
-					tag_type = XML_parse_1string(txt_end, &node);
+					tag_type = _parse_1string(txt_end, &node, sd->config, sd->pool);
 					if (tag_type == TAG_ERROR) {
 						ret = FALSE;
 						if (sax->on_error == NULL && sax->all_event == NULL) {
@@ -1517,6 +5086,21 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 				}
 				if (ret == FALSE)
 					break;
+				sd->src_end = pos + n0; /* Tag might have been read further */
+				if (sd->config->max_depth > 0 && depth >= sd->config->max_depth) {
+					ret = FALSE;
+					if (sax->on_error == NULL && sax->all_event == NULL) {
+						sx_fprintf(stderr, C2SX("%s:%d: NODES NESTED TOO DEEP.\n"), sd->name, sd->line_num);
+					} else {
+						if (sax->on_error != NULL && (exit = !sax->on_error(PARSE_ERR_TOO_DEEP, sd->line_num, sd)))
+							break;
+						if (sax->all_event != NULL && (exit = !sax->all_event(XML_EVENT_ERROR, NULL, (SXML_CHAR*)sd->name, PARSE_ERR_TOO_DEEP, sd)))
+							break;
+					}
+					break;
+				}
+				if (node.tag_type == TAG_FATHER)
+					depth++;
 				if (sax->start_node != NULL && (exit = !sax->start_node(&node, sd)))
 					break;
 				if (sax->all_event != NULL && (exit = !sax->all_event(XML_EVENT_START_NODE, &node, NULL, sd->line_num, sd)))
@@ -1529,13 +5113,14 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 				}
 			break;
 		}
+		pos += n0;
 		if (exit == TRUE) /* Return false when exit is requested */
 			ret = FALSE;
 		if (ret == FALSE || meos(in))
 			break;
 	}
-	__free(line);
-	(void)XMLNode_free(&node);
+	_pool_free(sd->pool, POOL_ARRAYS, line, sz*sizeof(SXML_CHAR));
+	_XMLNode_free_content(&node, sd->pool);
 
 	if (sax->end_doc != NULL && !sax->end_doc(sd))
 		return ret;
@@ -1568,6 +5153,7 @@ int DOMXMLDoc_doc_start(SAX_Data* sd)
 	dom->current = NULL;
 	dom->error = PARSE_ERR_NONE;
 	dom->line_error = 0;
+	_index_changed(dom->doc->usage);
 
 	return TRUE;
 }
@@ -1576,19 +5162,31 @@ int DOMXMLDoc_node_start(const XMLNode* node, SAX_Data* sd)
 {
 	DOM_through_SAX* dom = (DOM_through_SAX*)sd->user;
 	XMLNode* new_node;
+	XMLMemoryUsage* usage;
 	int i;
 
-	if ((new_node = XMLNode_dup(node, TRUE)) == NULL) goto node_start_err; /* No real need to put 'true' for 'XMLNode_dup', but cleaner */
+	/* 'node' is temporary so its content cannot be shared */
+	if ((new_node = _pool_node(dom->doc->pool)) == NULL) goto node_start_err;
+	if (!_XMLNode_dup_content(new_node, node, dom->doc->pool)) goto node_start_err;
+	new_node->tag_type = node->tag_type;
+	new_node->active = node->active;
 	
+	if ((usage = _XMLDoc_usage(dom->doc)) == NULL) goto node_start_err;
 	if (dom->current == NULL) {
-		if ((i = _add_node(&dom->doc->nodes, &dom->doc->n_nodes, new_node)) < 0) goto node_start_err;
+		if ((i = _add_node(&dom->doc->nodes, &dom->doc->n_nodes, new_node, dom->doc->pool)) < 0) goto node_start_err;
+		_usage_array(&usage->children, dom->doc->n_nodes - 1, dom->doc->n_nodes, sizeof(XMLNode*));
 
 		if (dom->doc->i_root < 0 && (node->tag_type == TAG_FATHER || node->tag_type == TAG_SELF))
 			dom->doc->i_root = i;
 	} else {
-		if (_add_node(&dom->current->children, &dom->current->n_children, new_node) < 0) goto node_start_err;
+		if (_add_node(&dom->current->children, &dom->current->n_children, new_node, dom->doc->pool) < 0) goto node_start_err;
+		_usage_array(&usage->children, dom->current->n_children - 1, dom->current->n_children, sizeof(XMLNode*));
 	}
 
+	new_node->usage = usage;
+	_XMLNode_usage(new_node, usage, 1);
+	new_node->src_start = sd->src_start;
+	new_node->src_end = (node->tag_type == TAG_FATHER ? -1 : sd->src_end); /* Known when the node ends */
 	new_node->father = dom->current;
 	dom->current = new_node;
 
@@ -1620,6 +5218,7 @@ int DOMXMLDoc_node_end(const XMLNode* node, SAX_Data* sd)
 		return FALSE;
 	}
 
+	dom->current->src_end = sd->src_end;
 	dom->current = dom->current->father;
 
 	return TRUE;
@@ -1648,9 +5247,11 @@ int DOMXMLDoc_node_text(SXML_CHAR* text, SAX_Data* sd)
 	}
 
 	if (dom->text_as_nodes) {
-		XMLNode* new_node = XMLNode_allocN(1);
-		if (new_node == NULL || (new_node->text = sx_strdup(text)) == NULL
-			|| _add_node(&dom->current->children, &dom->current->n_children, new_node) < 0) {
+		/* Text nodes are usually more numerous than elements in mixed content: save the text allocation,
+		   unless the document reuses the memory of the previous one */
+		XMLNode* new_node = (dom->doc->pool == NULL ? _XMLNode_alloc_text(text) : _pool_node(dom->doc->pool));
+		if (new_node == NULL || (new_node->text == NULL && (new_node->text = _pool_strdup(dom->doc->pool, text)) == NULL)
+			|| _add_node(&dom->current->children, &dom->current->n_children, new_node, dom->doc->pool) < 0) {
 			dom->error = PARSE_ERR_MEMORY;
 			dom->line_error = sd->line_num;
 			(void)XMLNode_free(new_node);
@@ -1659,22 +5260,34 @@ int DOMXMLDoc_node_text(SXML_CHAR* text, SAX_Data* sd)
 		}
 		new_node->tag_type = TAG_TEXT;
 		new_node->father = dom->current;
+		new_node->src_start = sd->src_start;
+		new_node->src_end = sd->src_end;
+		if ((new_node->usage = dom->current->usage) != NULL) {
+			_usage_array(&new_node->usage->children, dom->current->n_children - 1, dom->current->n_children, sizeof(XMLNode*));
+			_XMLNode_usage(new_node, new_node->usage, 1);
+		}
 		/*dom->current->tag_type = TAG_FATHER; // OS: should parent field be forced to be TAG_FATHER? now it has at least one TAG_TEXT child. I decided not to enforce this for backward-compatibility related to tag_types*/
 		return TRUE;
 	} else { /* Old behaviour: concatenate text to the previous one */
 		/* 'p' will point at the new text */
 		if (dom->current->text == NULL) {
-			p = sx_strdup(text);
+			p = _pool_strdup(dom->doc->pool, text);
 		} else {
-			p = __realloc(dom->current->text, (sx_strlen(dom->current->text) + sx_strlen(text) + 1)*sizeof(SXML_CHAR));
-			if (p != NULL)
+			int len = sx_strlen(dom->current->text) + 1;
+			p = _pool_realloc(dom->doc->pool, POOL_STRINGS, dom->current->text, len*sizeof(SXML_CHAR), (len + sx_strlen(text))*sizeof(SXML_CHAR));
+			if (p != NULL) {
+				if (dom->current->usage != NULL) /* Previous text is accounted again below, with its new size */
+					_usage_str(&dom->current->usage->texts, p, -1);
 				sx_strcat(p, text);
+			}
 		}
 		if (p == NULL) {
 			dom->error = PARSE_ERR_MEMORY;
 			dom->line_error = sd->line_num;
 			return FALSE;
 		}
+		if (dom->current->usage != NULL)
+			_usage_str(&dom->current->usage->texts, p, 1);
 		
 		dom->current->text = p;
 	}
@@ -1708,6 +5321,7 @@ int DOMXMLDoc_doc_end(SAX_Data* sd)
 			case PARSE_ERR_EOF:					msg = C2SX("UNEXPECTED_END_OF_FILE"); break;
 			case PARSE_ERR_TEXT_OUTSIDE_NODE:	msg = C2SX("TEXT_OUTSIDE_NODE"); break;
 			case PARSE_ERR_UNEXPECTED_NODE_END:	msg = C2SX("UNEXPECTED_NODE_END"); break;
+			case PARSE_ERR_TOO_DEEP:			msg = C2SX("TOO_DEEP"); break;
 			default:							msg = C2SX("UNKNOWN"); break;
 		}
 		sx_fprintf(stderr, C2SX("%s:%d: An error was found (%s(%d)), loading aborted...\n"), sd->name, dom->line_error, msg, dom->error);
@@ -1736,6 +5350,14 @@ int SAX_Callbacks_init_DOM(SAX_Callbacks* sax)
 }
 
 int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, void* user)
+{
+	return XMLDoc_parse_file_SAX_ex(filename, sax, user, NULL);
+}
+
+/*
+ Parse 'filename' with 'sax' callbacks, parsed nodes taking their memory from 'pool' if not NULL.
+ */
+static int _parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, void* user, const XMLParserConfig* config, XMLPool* pool)
 {
 	FILE* f = NULL;
 	int ret;
@@ -1749,7 +5371,7 @@ int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, v
 	BOM_TYPE bom;
 
 
-	if (sax == NULL || filename == NULL || filename[0] == NULC)
+	if (sax == NULL || filename == NULL || filename[0] == NULC || (config != NULL && config->init_value != XML_INIT_DONE))
 		return FALSE;
 
 	f = sx_fopen(filename, fmode);
@@ -1767,6 +5389,8 @@ int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, v
 	sd.user = user;
 	sd.type = DATA_SOURCE_FILE;
 	sd.src  = (void*)f;
+	sd.config = (config == NULL ? &_default_config : config);
+	sd.pool = pool;
 	bom = freadBOM(f, NULL, NULL); /* Skip BOM, if any */
 	/* In Unicode, re-open the file in text-mode if there is no BOM (or UTF-8) as we assume that
 	   the file is "plain" text (i.e. 1 byte = 1 character). If opened in binary mode, 'fgetwc'
@@ -1793,22 +5417,51 @@ int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, v
 	return ret;
 }
 
+int XMLDoc_parse_file_SAX_ex(const SXML_CHAR* filename, const SAX_Callbacks* sax, void* user, const XMLParserConfig* config)
+{
+	return _parse_file_SAX(filename, sax, user, config, NULL);
+}
+
 int XMLDoc_parse_buffer_SAX_len(const SXML_CHAR* buffer, int buffer_len, const SXML_CHAR* name, const SAX_Callbacks* sax, void* user)
+{
+	return XMLDoc_parse_buffer_SAX_len_ex(buffer, buffer_len, name, sax, user, NULL);
+}
+
+/*
+ Parse 'buffer_len' characters of 'buffer' with 'sax' callbacks, parsed nodes taking their memory from 'pool' if not NULL.
+ */
+static int _parse_buffer_SAX(const SXML_CHAR* buffer, int buffer_len, const SXML_CHAR* name, const SAX_Callbacks* sax, void* user, const XMLParserConfig* config, XMLPool* pool)
 {
 	DataSourceBuffer dsb = { buffer, buffer_len, 0 };
 	SAX_Data sd = { NULL };
 
-	if (sax == NULL || buffer == NULL)
+	if (sax == NULL || buffer == NULL || (config != NULL && config->init_value != XML_INIT_DONE))
 		return FALSE;
 
 	sd.name = name;
 	sd.user = user;
 	sd.type = DATA_SOURCE_BUFFER;
 	sd.src  = (void*)buffer;
+	sd.config = (config == NULL ? &_default_config : config);
+	sd.pool = pool;
 	return _parse_data_SAX((void*)&dsb, DATA_SOURCE_BUFFER, sax, &sd);
 }
 
+int XMLDoc_parse_buffer_SAX_len_ex(const SXML_CHAR* buffer, int buffer_len, const SXML_CHAR* name, const SAX_Callbacks* sax, void* user, const XMLParserConfig* config)
+{
+	return _parse_buffer_SAX(buffer, buffer_len, name, sax, user, config, NULL);
+}
+
 int XMLDoc_parse_file_DOM_text_as_nodes(const SXML_CHAR* filename, XMLDoc* doc, int text_as_nodes)
+{
+	XMLParserConfig config = _default_config;
+
+	config.text_as_nodes = text_as_nodes;
+
+	return XMLDoc_parse_file_DOM_ex(filename, doc, &config);
+}
+
+int XMLDoc_parse_file_DOM_ex(const SXML_CHAR* filename, XMLDoc* doc, const XMLParserConfig* config)
 {
 	DOM_through_SAX dom;
 	SAX_Callbacks sax;
@@ -1816,6 +5469,8 @@ int XMLDoc_parse_file_DOM_text_as_nodes(const SXML_CHAR* filename, XMLDoc* doc,
 
 	if (doc == NULL || filename == NULL || filename[0] == NULC || doc->init_value != XML_INIT_DONE)
 		return FALSE;
+	if (config == NULL)
+		config = &_default_config;
 
 	sx_strncpy(doc->filename, filename, SXMLC_MAX_PATH - 1);
 	doc->filename[SXMLC_MAX_PATH - 1] = NULC;
@@ -1835,10 +5490,10 @@ int XMLDoc_parse_file_DOM_text_as_nodes(const SXML_CHAR* filename, XMLDoc* doc,
 
 	dom.doc = doc;
 	dom.current = NULL;
-	dom.text_as_nodes = text_as_nodes;
+	dom.text_as_nodes = config->text_as_nodes;
 	SAX_Callbacks_init_DOM(&sax);
 
-	ret = XMLDoc_parse_file_SAX(filename, &sax, &dom);
+	ret = _parse_file_SAX(filename, &sax, &dom, config, doc->pool);
 	if (!ret) {
 		(void)XMLDoc_free(doc);
 		dom.doc = NULL;
@@ -1850,6 +5505,15 @@ int XMLDoc_parse_file_DOM_text_as_nodes(const SXML_CHAR* filename, XMLDoc* doc,
 }
 
 int XMLDoc_parse_buffer_DOM_text_as_nodes(const SXML_CHAR* buffer, const SXML_CHAR* name, XMLDoc* doc, int text_as_nodes)
+{
+	XMLParserConfig config = _default_config;
+
+	config.text_as_nodes = text_as_nodes;
+
+	return XMLDoc_parse_buffer_DOM_ex(buffer, name, doc, &config);
+}
+
+int XMLDoc_parse_buffer_DOM_ex(const SXML_CHAR* buffer, const SXML_CHAR* name, XMLDoc* doc, const XMLParserConfig* config)
 {
 	DOM_through_SAX dom;
 	SAX_Callbacks sax;
@@ -1857,13 +5521,15 @@ int XMLDoc_parse_buffer_DOM_text_as_nodes(const SXML_CHAR* buffer, const SXML_CH
 
 	if (doc == NULL || buffer == NULL || doc->init_value != XML_INIT_DONE)
 		return FALSE;
+	if (config == NULL)
+		config = &_default_config;
 
 	dom.doc = doc;
 	dom.current = NULL;
-	dom.text_as_nodes = text_as_nodes;
+	dom.text_as_nodes = config->text_as_nodes;
 	SAX_Callbacks_init_DOM(&sax);
 
-	ret = XMLDoc_parse_buffer_SAX(buffer, name, &sax, &dom);
+	ret = _parse_buffer_SAX(buffer, sx_strlen(buffer), name, &sax, &dom, config, doc->pool);
 	if (!ret) {
 		XMLDoc_free(doc);
 		return ret;
@@ -1873,6 +5539,227 @@ int XMLDoc_parse_buffer_DOM_text_as_nodes(const SXML_CHAR* buffer, const SXML_CH
 	return ret;
 }
 
+/*
+ Same as 'DOMXMLDoc_node_end()' without error message, as ranges parsed by 'XMLDoc_reparse_range_ex()'
+ are expected not to fit when the edit spans several nodes.
+ */
+static int _reparse_node_end(const XMLNode* node, SAX_Data* sd)
+{
+	DOM_through_SAX* dom = (DOM_through_SAX*)sd->user;
+
+	if (dom->current == NULL || dom->current->tag == NULL || node->tag == NULL || sx_strcmp(dom->current->tag, node->tag)) {
+		dom->error = PARSE_ERR_UNEXPECTED_NODE_END;
+		dom->line_error = sd->line_num;
+
+		return FALSE;
+	}
+
+	return DOMXMLDoc_node_end(node, sd);
+}
+
+/*
+ Parse 'buffer' from 'start' to 'end' into 'doc' (without error message).
+ Return 'false' if the range is not well-formed, in which case 'doc' is freed.
+ */
+static int _parse_range(const SXML_CHAR* buffer, int start, int end, const SXML_CHAR* name, XMLDoc* doc, const XMLParserConfig* config)
+{
+	DataSourceBuffer dsb = { buffer, end, start };
+	SAX_Data sd = { NULL };
+	SAX_Callbacks sax;
+	DOM_through_SAX dom;
+
+	dom.doc = doc;
+	dom.current = NULL;
+	dom.text_as_nodes = config->text_as_nodes;
+	SAX_Callbacks_init_DOM(&sax);
+	sax.end_node = _reparse_node_end;
+	sax.end_doc = NULL;
+
+	sd.name = name;
+	sd.user = &dom;
+	sd.type = DATA_SOURCE_BUFFER;
+	sd.src = (void*)buffer;
+	sd.config = config;
+	if (!_parse_data_SAX((void*)&dsb, DATA_SOURCE_BUFFER, &sax, &sd) || dom.error != PARSE_ERR_NONE) {
+		(void)XMLDoc_free(doc);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ Get the smallest node of 'doc' (but text) whose source holds the range from 'start' to 'end', or NULL.
+ */
+static XMLNode* _XMLDoc_node_at(const XMLDoc* doc, int start, int end)
+{
+	XMLNode** nodes = doc->nodes;
+	XMLNode* found = NULL;
+	int n = doc->n_nodes;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (nodes[i]->tag_type != TAG_TEXT && nodes[i]->src_start >= 0 && nodes[i]->src_start <= start && end <= nodes[i]->src_end) {
+			found = nodes[i];
+			nodes = found->children;
+			n = found->n_children;
+			i = -1;
+		}
+	}
+
+	return found;
+}
+
+/*
+ Add 'delta' to the source offsets of 'doc' nodes that are after 'from', except in 'skip' subtree.
+ Nodes ending before 'from' are not walked through. Return 'false' for memory error, which cannot happen
+ when 'stack' already had the depth needed (e.g. after a first call with a 0 'delta').
+ */
+static int _XMLDoc_shift_offsets(XMLDoc* doc, const XMLNode* skip, int from, int delta, _NodeStack* stack)
+{
+	_NodeFrame* fr;
+	XMLNode* node;
+	int i;
+
+	for (i = 0; i < doc->n_nodes; i++) {
+		stack->n = 0;
+		node = doc->nodes[i];
+		for (;;) {
+			if (node != skip && (node->src_end < 0 || node->src_end >= from)) {
+				if (node->src_start >= from)
+					node->src_start += delta;
+				if (node->src_end >= from)
+					node->src_end += delta;
+				if (node->n_children > 0 && _NodeStack_push(stack, node) == NULL)
+					return FALSE;
+			}
+			/* Next node is the next child of the deepest node having some left */
+			while (stack->n > 0 && stack->frames[stack->n - 1].i >= stack->frames[stack->n - 1].node->n_children)
+				stack->n--;
+			if (stack->n == 0)
+				break;
+			fr = &stack->frames[stack->n - 1];
+			node = fr->node->children[fr->i++];
+		}
+	}
+
+	return TRUE;
+}
+
+int XMLDoc_reparse_range(XMLDoc* doc, const SXML_CHAR* buffer, int buffer_len, int edit_start, int edit_old_len, int edit_new_len)
+{
+	return XMLDoc_reparse_range_ex(doc, buffer, buffer_len, edit_start, edit_old_len, edit_new_len, NULL);
+}
+
+int XMLDoc_reparse_range_ex(XMLDoc* doc, const SXML_CHAR* buffer, int buffer_len, int edit_start, int edit_old_len, int edit_new_len, const XMLParserConfig* config)
+{
+	XMLParserConfig node_config;
+	XMLDoc sub;
+	_NodeStack stack;
+	XMLNode* node;
+	XMLNode* new_node = NULL;
+	XMLNode* n;
+	XMLMemoryUsage* usage;
+	int i, delta, depth, old_end, fathers_modified;
+
+	if (doc == NULL || buffer == NULL || doc->init_value != XML_INIT_DONE || (config != NULL && config->init_value != XML_INIT_DONE)
+		|| edit_start < 0 || edit_old_len < 0 || edit_new_len < 0 || edit_start + edit_new_len > buffer_len)
+		return FALSE;
+	if (config == NULL)
+		config = &_default_config;
+	delta = edit_new_len - edit_old_len;
+
+	/* Parse the smallest node holding the edit, then its father if the edit does not fit in it, etc. */
+	XMLDoc_init(&sub);
+	node = _XMLDoc_node_at(doc, edit_start, edit_start + edit_old_len);
+	for (n = node, depth = -1; n != NULL; n = n->father)
+		depth++;
+	node_config = *config;
+	for ( ; node != NULL; node = node->father, depth--) {
+		if (node->src_end < 0 || node->src_end + delta > buffer_len) /* Unfinished node */
+			continue;
+		/* Node is parsed alone, so it is not as deep in the range as in the document */
+		if (config->max_depth > 0)
+			node_config.max_depth = config->max_depth - depth;
+		if (!_parse_range(buffer, node->src_start, node->src_end + delta, doc->filename, &sub, &node_config))
+			continue;
+		/* Range should hold exactly one complete node */
+		if (sub.n_nodes == 1 && sub.nodes[0]->src_start == node->src_start && sub.nodes[0]->src_end == node->src_end + delta) {
+			new_node = sub.nodes[0];
+			break;
+		}
+		(void)XMLDoc_free(&sub);
+	}
+
+	/* No node holds the edit: parse the whole buffer */
+	if (new_node == NULL) {
+		XMLPool* pool = doc->pool;
+		_DocIndex* index = NULL;
+
+		if (!_parse_range(buffer, 0, buffer_len, doc->filename, &sub, config))
+			return FALSE;
+		doc->pool = NULL; /* Keep it for the next parsings */
+		if (doc->usage != NULL) { /* Keep the index too, to rebuild it on the new nodes */
+			index = _doc_data(doc->usage)->index;
+			_doc_data(doc->usage)->index = NULL;
+		}
+		(void)XMLDoc_free(doc);
+		doc->pool = pool;
+		doc->nodes = sub.nodes;
+		doc->n_nodes = sub.n_nodes;
+		doc->i_root = sub.i_root;
+		doc->usage = sub.usage;
+		if (index != NULL) {
+			if (_XMLDoc_usage(doc) != NULL) {
+				index->valid = FALSE;
+				_doc_data(doc->usage)->index = index;
+			} else
+				_DocIndex_free(index);
+		}
+
+		return TRUE;
+	}
+
+	/* Size the stack first so that offsets can be shifted once the new node is accounted */
+	_NodeStack_init(&stack);
+	usage = node->usage;
+	old_end = node->src_end;
+	if (!_XMLDoc_shift_offsets(doc, node, old_end, 0, &stack) || !_XMLNode_set_usage(new_node, usage)) {
+		_NodeStack_free(&stack);
+		(void)XMLDoc_free(&sub);
+		return FALSE;
+	}
+	(void)_XMLDoc_shift_offsets(doc, node, old_end, delta, &stack);
+	_NodeStack_free(&stack);
+
+	/* Can't fail anymore, replace 'node' content with 'new_node' one so 'node' keeps its address and user data */
+	fathers_modified = (node->father != NULL && (node->father->modified & XML_MODIFIED_DESCENDANTS));
+	(void)XMLNode_free(node);
+	node->tag = new_node->tag;
+	node->text = new_node->text;
+	node->attributes = new_node->attributes;
+	node->n_attributes = new_node->n_attributes;
+	node->children = new_node->children;
+	node->n_children = new_node->n_children;
+	node->tag_type = new_node->tag_type;
+	node->shared = new_node->shared;
+	node->src_start = new_node->src_start;
+	node->src_end = new_node->src_end;
+	node->modified = 0; /* Same as 'buffer' */
+	for (i = 0; i < node->n_children; i++)
+		node->children[i]->father = node;
+	/* Undo the marks of 'XMLNode_free()' on the fathers (none of them had any if the direct father had none) */
+	for (n = node->father; !fathers_modified && n != NULL; n = n->father)
+		n->modified &= ~XML_MODIFIED_DESCENDANTS;
+	if (usage != NULL)
+		_usage_count(&usage->nodes, sizeof(XMLNode), -1); /* 'new_node' itself */
+	__free(new_node);
+	sub.n_nodes = 0;
+	(void)XMLDoc_free(&sub);
+
+	return TRUE;
+}
+
 
 
 /* --- Utility functions (ex sxmlutils.c) --- */
@@ -1949,6 +5836,74 @@ static struct _html_special_dict {
 	{ NULC, NULL, 0 }, /* Terminator */
 };
 
+/* 'true' if 'c' is one of the characters of 'HTML_SPECIAL_DICT' ('"' 34, '&' 38, '\'' 39, '<' 60 and '>' 62) */
+#define _html_special(c) ((unsigned)(c) < 64 && ((1ULL << (c)) & ((1ULL << 34) | (1ULL << 38) | (1ULL << 39) | (1ULL << 60) | (1ULL << 62))))
+
+/* Index of special character 'c' in 'HTML_SPECIAL_DICT' */
+static int _html_special_index(SXML_CHAR c)
+{
+	switch (c) {
+		case C2SX('<'):		return 0;
+		case C2SX('>'):		return 1;
+		case C2SX('"'):		return 2;
+		case C2SX('\''):	return 3;
+		default:			return 4; /* '&' */
+	}
+}
+
+/*
+ Return a pointer to the first character of 'str' that has to be escaped, or to its terminating NUL character.
+ */
+#ifdef SX_SSE2
+SX_NO_SANITIZE
+static const SXML_CHAR* _html_next(const SXML_CHAR* str)
+{
+	const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), amp = _mm_set1_epi8('&');
+	const __m128i quot = _mm_set1_epi8('"'), apos = _mm_set1_epi8('\''), zero = _mm_setzero_si128();
+	__m128i v, m;
+	int mask;
+
+	/* One character at a time up to a 16-byte boundary */
+	for ( ; ((size_t)str & 15) != 0; str++)
+		if (*str == NULC || _html_special(*str))
+			return str;
+
+	for (;; str += 16) {
+		v = _mm_load_si128((const __m128i*)str);
+		m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)), _mm_cmpeq_epi8(v, amp));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, apos)), _mm_cmpeq_epi8(v, zero)));
+		if ((mask = _mm_movemask_epi8(m)) != 0)
+			return str + __builtin_ctz(mask);
+	}
+}
+#else
+static const SXML_CHAR* _html_next(const SXML_CHAR* str)
+{
+	while (*str != NULC && !_html_special(*str))
+		str++;
+
+	return str;
+}
+#endif
+
+/*
+ Return the index in 'HTML_SPECIAL_DICT' of the HTML entity 'str' starts with (it starts with '&'), or -1.
+ */
+static int _html_entity(const SXML_CHAR* str)
+{
+	int i;
+
+	switch (str[1]) {
+		case C2SX('l'):	i = 0; break;
+		case C2SX('g'):	i = 1; break;
+		case C2SX('q'):	i = 2; break;
+		case C2SX('a'):	i = (str[2] == C2SX('p') ? 3 : 4); break;
+		default:		return -1;
+	}
+
+	return sx_strncmp(str, HTML_SPECIAL_DICT[i].html, HTML_SPECIAL_DICT[i].html_len) ? -1 : i;
+}
+
 int _beob(DataSourceBuffer* ds)
 {
 	if (ds == NULL || ds->buf[ds->cur_pos] == NULC || ds->cur_pos >= ds->buf_len)
@@ -2172,6 +6127,51 @@ SXML_CHAR* str_unescape(SXML_CHAR* str)
 	return str;
 }
 
+int str2number(const SXML_CHAR* str, double* number)
+{
+	const SXML_CHAR* p;
+	const SXML_CHAR* q;
+	double x;
+	int n_digits;
+
+	if (str == NULL)
+		return FALSE;
+
+	for (; sx_isspace(*str); str++) ;
+	p = (*str == C2SX('-') || *str == C2SX('+') ? str + 1 : str);
+
+	/* Integers up to 15 digits are computed exactly, without 'strtod()' */
+	for (x = 0, n_digits = 0; *p >= C2SX('0') && *p <= C2SX('9'); p++, n_digits++)
+		x = 10 * x + (int)(*p - C2SX('0'));
+	if (n_digits > 0 && n_digits <= 15) {
+		for (q = p; sx_isspace(*q); q++) ;
+		if (*q == NULC) {
+			*number = (*str == C2SX('-') ? -x : x);
+			return TRUE;
+		}
+	}
+
+	/* Check the syntax before 'strtod()', which accepts more */
+	if (*p == C2SX('.'))
+		for (p++; *p >= C2SX('0') && *p <= C2SX('9'); p++)
+			n_digits++;
+	if (n_digits == 0)
+		return FALSE;
+	if (*p == C2SX('e') || *p == C2SX('E')) {
+		if (*++p == C2SX('-') || *p == C2SX('+'))
+			p++;
+		if (*p < C2SX('0') || *p > C2SX('9'))
+			return FALSE;
+		for (; *p >= C2SX('0') && *p <= C2SX('9'); p++) ;
+	}
+	for (; sx_isspace(*p); p++) ;
+	if (*p != NULC)
+		return FALSE;
+	*number = sx_strtod(str, NULL);
+
+	return TRUE;
+}
+
 int split_left_right(SXML_CHAR* str, SXML_CHAR sep, int* l0, int* l1, int* i_sep, int* r0, int* r1, int ignore_spaces, int ignore_quotes)
 {
 	int n0, n1, is;
@@ -2357,7 +6357,8 @@ int has_html(SXML_CHAR* html)
 
 SXML_CHAR* html2str(SXML_CHAR* html, SXML_CHAR* str)
 {
-	SXML_CHAR *ps, *pd;
+	SXML_CHAR *ps, *pd, *p;
+	size_t n;
 	int i;
 
 	if (html == NULL)
@@ -2368,25 +6369,24 @@ SXML_CHAR* html2str(SXML_CHAR* html, SXML_CHAR* str)
 	
 	/* Look for '&' and matches it to any of the recognized HTML pattern. */
 	/* If found, replaces the '&' by the corresponding char. */
-	/* 'p2' is the char to analyze, 'p1' is where to insert it */
-	for (pd = str, ps = html; *ps; ps++, pd++) {
-		if (*ps != C2SX('&')) {
-			if (pd != ps)
-				*pd = *ps;
-			continue;
-		}
-		
-		for (i = 0; HTML_SPECIAL_DICT[i].chr; i++) {
-			if (sx_strncmp(ps, HTML_SPECIAL_DICT[i].html, HTML_SPECIAL_DICT[i].html_len))
-				continue;
-			
-			*pd = HTML_SPECIAL_DICT[i].chr;
-			ps += HTML_SPECIAL_DICT[i].html_len-1;
+	/* 'ps' is the char to analyze, 'pd' is where to insert it. Text between entities is copied at once */
+	for (pd = str, ps = html; ; ) {
+		p = sx_strchr(ps, C2SX('&'));
+		n = (p == NULL ? sx_strlen(ps) : (size_t)(p - ps));
+		if (pd != ps)
+			memmove(pd, ps, n * sizeof(SXML_CHAR));
+		pd += n;
+		ps += n;
+		if (p == NULL)
 			break;
-		}
+		
 		/* If no string was found, simply copy the character */
-		if (HTML_SPECIAL_DICT[i].chr == NULC && pd != ps)
-			*pd = *ps;
+		if ((i = _html_entity(ps)) < 0) {
+			*pd++ = *ps++;
+			continue;
+		}
+		*pd++ = HTML_SPECIAL_DICT[i].chr;
+		ps += HTML_SPECIAL_DICT[i].html_len;
 	}
 	*pd = NULC;
 	
@@ -2396,7 +6396,8 @@ SXML_CHAR* html2str(SXML_CHAR* html, SXML_CHAR* str)
 /* TODO: Allocate 'html'? */
 SXML_CHAR* str2html(SXML_CHAR* str, SXML_CHAR* html)
 {
-	SXML_CHAR *ps, *pd;
+	const SXML_CHAR *ps, *p;
+	SXML_CHAR* pd;
 	int i;
 
 	if (str == NULL)
@@ -2406,21 +6407,21 @@ SXML_CHAR* str2html(SXML_CHAR* str, SXML_CHAR* html)
 		return NULL;
 
 	if (html == NULL) { /* Allocate 'html' to the correct size */
-		html = __malloc(strlen_html(str) * sizeof(SXML_CHAR));
+		html = __malloc((strlen_html(str) + 1) * sizeof(SXML_CHAR));
 		if (html == NULL)
 			return NULL;
 	}
 
-	for (ps = str, pd = html; *ps; ps++, pd++) {
-		for (i = 0; HTML_SPECIAL_DICT[i].chr; i++) {
-			if (*ps == HTML_SPECIAL_DICT[i].chr) {
-				sx_strcpy(pd, HTML_SPECIAL_DICT[i].html);
-				pd += HTML_SPECIAL_DICT[i].html_len - 1;
-				break;
-			}
-		}
-		if (HTML_SPECIAL_DICT[i].chr == NULC && pd != ps)
-			*pd = *ps;
+	/* Characters that need no escaping are copied by runs */
+	for (ps = str, pd = html; ; ps = p + 1) {
+		p = _html_next(ps);
+		memcpy(pd, ps, (p - ps) * sizeof(SXML_CHAR));
+		pd += p - ps;
+		if (*p == NULC)
+			break;
+		i = _html_special_index(*p);
+		memcpy(pd, HTML_SPECIAL_DICT[i].html, HTML_SPECIAL_DICT[i].html_len * sizeof(SXML_CHAR));
+		pd += HTML_SPECIAL_DICT[i].html_len;
 	}
 	*pd = NULC;
 
@@ -2429,53 +6430,59 @@ SXML_CHAR* str2html(SXML_CHAR* str, SXML_CHAR* html)
 
 int strlen_html(SXML_CHAR* str)
 {
-	int i, j, n;
+	const SXML_CHAR* p;
+	int n;
 	
 	if (str == NULL)
 		return 0;
 
-	n = 0;
-	for (i = 0; str[i] != NULC; i++) {
-		for (j = 0; HTML_SPECIAL_DICT[j].chr; j++) {
-			if (str[i] == HTML_SPECIAL_DICT[j].chr) {
-				n += HTML_SPECIAL_DICT[j].html_len;
-				break;
-			}
-		}
-		if (HTML_SPECIAL_DICT[j].chr == NULC)
-			n++;
+	for (n = 0; ; str = (SXML_CHAR*)p + 1) {
+		p = _html_next(str);
+		n += (int)(p - str);
+		if (*p == NULC)
+			break;
+		n += HTML_SPECIAL_DICT[_html_special_index(*p)].html_len;
 	}
 
 	return n;
 }
 
-int fprintHTML(FILE* f, SXML_CHAR* str)
+static int _sink_html(_XMLSink* sink, const SXML_CHAR* str)
 {
-	SXML_CHAR* p;
-	int i, n;
+	const SXML_CHAR* p;
+	size_t n0 = sink->n;
+	int i;
 	
-	for (p = str, n = 0; *p != NULC; p++) {
-		for (i = 0; HTML_SPECIAL_DICT[i].chr; i++) {
-			if (*p != HTML_SPECIAL_DICT[i].chr)
-				continue;
-			if (f != NULL)
-				sx_fputs(HTML_SPECIAL_DICT[i].html, f);
-			n += HTML_SPECIAL_DICT[i].html_len;
+	/* Characters that need no escaping are written by runs */
+	for ( ; ; str = p + 1) {
+		p = _html_next(str);
+		if (p > str)
+			_sink_write(sink, str, p - str);
+		if (*p == NULC)
 			break;
-		}
-		if (HTML_SPECIAL_DICT[i].chr == NULC) {
-			if (f != NULL)
-				(void)sx_fputc(*p, f);
-			n++;
-		}
+		i = _html_special_index(*p);
+		_sink_write(sink, HTML_SPECIAL_DICT[i].html, HTML_SPECIAL_DICT[i].html_len);
 	}
 	
+	return (int)(sink->n - n0);
+}
+
+int fprintHTML(FILE* f, SXML_CHAR* str)
+{
+	_XMLSink out;
+	int n;
+
+	_sink_init(&out, f, -1, NULL);
+	n = _sink_html(&out, str);
+	_sink_flush(&out);
+	
 	return n;
 }
 
 int regstrcmp(SXML_CHAR* str, SXML_CHAR* pattern)
 {
-	SXML_CHAR *p, *s;
+	SXML_CHAR *p, *s, *q;
+	SXML_CHAR *star_p, *star_s;
 
 	if (str == NULL && pattern == NULL)
 		return TRUE;
@@ -2485,39 +6492,40 @@ int regstrcmp(SXML_CHAR* str, SXML_CHAR* pattern)
 
 	p = pattern;
 	s = str;
+	star_p = star_s = NULL;
 	for (;;) {
-		switch (*p) {
-			/* Any character matches, go to next one */
-			case C2SX('?'):
+		/* Remember where the last '*' is so it can match more characters if the rest of the pattern does not match */
+		if (*p == C2SX('*')) {
+			while (*p == C2SX('*'))
 				p++;
-				s++;
-				break;
+			star_p = p;
+			star_s = s;
+			continue;
+		}
 
-			/* Go to next character in pattern and wait until it is found in 'str' */
-			case C2SX('*'):
-				for (; *p != NULC; p++) { /* Squeeze '**?*??**' to '*' */
-					if (*p != C2SX('*') && *p != C2SX('?'))
-						break;
-				}
-				for (; *s != NULC; s++) {
-					if (*s == *p)
-						break;
-				}
-				break;
+		/* End of 'str' should be the end of the pattern */
+		if (*s == NULC)
+			return *p == NULC ? TRUE : FALSE;
 
-			/* NULL character on pattern has to be matched by 'str' */
-			case 0:
-				return *s ? FALSE : TRUE;
+		/* Any character matches, go to next one */
+		if (*p == C2SX('?')) {
+			p++;
+			s++;
+			continue;
+		}
 
-			default:
-				if (*p == C2SX('\\')) /* Escape character */
-					p++;
-				if (*p++ != *s++) /* Characters do not match */
-					return FALSE;
-				break;
+		q = (*p == C2SX('\\') && p[1] != NULC ? p + 1 : p); /* Escape character */
+		if (*q != NULC && *q == *s) {
+			p = q + 1;
+			s++;
+			continue;
 		}
-	}
 
-	return FALSE;
+		/* Characters do not match: let the last '*' match one more character */
+		if (star_p == NULL)
+			return FALSE;
+		p = star_p;
+		s = ++star_s;
+	}
 }
 
@@ -33,7 +33,7 @@
 /**
  * \brief Current SXMLC version, as a `const char[]`.
  */
-#define SXMLC_VERSION "4.5.5"
+#define SXMLC_VERSION "5.0.0"
 
 #ifdef __cplusplus
 extern "C" {
@@ -74,6 +74,7 @@ extern "C" {
 	#define sx_strdup wcsdup
 	#define sx_strchr wcschr
 	#define sx_strrchr wcsrchr
+	#define sx_strstr wcsstr
 	#define sx_strcpy wcscpy
 	#define sx_strncpy wcsncpy
 	#define sx_strcat wcscat
@@ -85,6 +86,7 @@ extern "C" {
 	#define sx_puts putws
 	#define sx_fputs fputws
     #define sx_isspace iswspace
+	#define sx_strtod wcstod
 	#if defined(WIN32) || defined(WIN64)
 		#define sx_fopen _wfopen
 	#else
@@ -102,6 +104,7 @@ extern "C" {
 	#define sx_strdup __sx_strdup
 	#define sx_strchr strchr
 	#define sx_strrchr strrchr
+	#define sx_strstr strstr
 	#define sx_strcpy strcpy
 	
 	/* TODO use safer strncpy_s and strcat_s */
@@ -120,6 +123,7 @@ extern "C" {
 	#define sx_puts puts
 	#define sx_fputs fputs
 	#define sx_isspace(c) ((int)c >= 0 && (int)c <= 127 && isspace((int)c))
+	#define sx_strtod strtod
 
 #if !defined(sx_fopen)
 	#define sx_fopen fopen
@@ -227,6 +231,44 @@ typedef struct _XMLAttribute {
  * TODO: Find a better way. */
 #define XML_INIT_DONE 0x19770522 /* Happy Birthday ;) */
 
+/**
+ * \brief Hash of a node and its children (see `XMLNode_hash()`).
+ */
+typedef unsigned long long XMLHash;
+
+/**
+ * \brief Memory used by a category of allocations (see `XMLMemoryUsage`).
+ */
+typedef struct _XMLMemoryCount {
+	size_t bytes;	/**< Number of bytes allocated. */
+	size_t allocs;	/**< Number of allocations. */
+} XMLMemoryCount;
+
+/**
+ * \brief Memory used by a document or a node, by category (see `XMLDoc_memory_usage()`).
+ *
+ * Sizes are the ones requested to the allocator, without its own overhead.
+ */
+typedef struct _XMLMemoryUsage {
+	XMLMemoryCount nodes;		/**< `XMLNode` structs. */
+	XMLMemoryCount tags;		/**< Node tags. */
+	XMLMemoryCount texts;		/**< Node texts. */
+	XMLMemoryCount attributes;	/**< Attributes arrays, names and values. */
+	XMLMemoryCount children;	/**< Children arrays, including the document nodes array. */
+	XMLMemoryCount total;		/**< Sum of all the above. */
+} XMLMemoryUsage;
+
+/**
+ * \brief Flag of `XMLNode.modified`: the node tag, type, text, attributes or children list was changed
+ * 		by `XMLNode_*()` functions.
+ */
+#define XML_MODIFIED_NODE 0x01
+
+/**
+ * \brief Flag of `XMLNode.modified`: some descendants of the node have `XML_MODIFIED_NODE`.
+ */
+#define XML_MODIFIED_DESCENDANTS 0x02
+
 /**
  * \brief An XML node.
  *
@@ -245,6 +287,11 @@ typedef struct _XMLAttribute {
  *
  * *N.B. that when reading a pretty-printed XML, the extra line breaks and spaces will be stored
  * in `node->text`*.
+ *
+ * Nodes created by `XMLNode_dup()` or `XMLNode_copy()` *share* their `tag`, `text` and `attributes`
+ * with the original node until one of them is modified through an `XMLNode_*()` function (copy-on-write).
+ * Code modifying these members directly (e.g. `node->attributes[i].active = false`) should call
+ * `XMLNode_unshare()` first.
  */
 typedef struct _XMLNode {
 	SXML_CHAR* tag;				/**< Tag name, or text for tag types `TAG_INSTR`, `TAG_COMMENT`, `TAG_CDATA` and `TAG_DOCTYPE`. */
@@ -259,8 +306,16 @@ typedef struct _XMLNode {
 	TagType tag_type;			/**< Node type. */
 	int active;					/**< 'true' to tell that node is active and should be displayed by 'XMLDoc_print_*()'. */
 
+	int src_start;	/**< Offset of the node first character in the parsed source (in characters), or -1 if the node was not parsed. */
+	int src_end;	/**< Offset after the node last character (end tag included) in the parsed source, or -1 if unknown. */
+	int modified;	/**< Changes since the node was parsed: `XML_MODIFIED_NODE` and/or `XML_MODIFIED_DESCENDANTS`, or 0 if none (see `XMLDoc_print_incremental()`). */
+
 	void* user;	/**< Pointer for user data associated to the node. */
 
+	int* shared;	/**< Number of nodes sharing `tag`, `text` and `attributes` (copy-on-write), or `NULL` if owned by this node only. */
+	XMLHash hash;	/**< Cached hash of the node subtree, or 0 if not computed yet (see `XMLNode_hash()`). */
+	XMLMemoryUsage* usage;	/**< Internal use only. Memory usage of the document the node belongs to, or NULL. */
+
 	/* Keep 'init_value' as the last member */
 	int init_value;	/**< Initialized to 'XML_INIT_DONE' to indicate that node has been initialized properly. */
 } XMLNode;
@@ -285,6 +340,11 @@ typedef enum _BOM_TYPE {
 	BOM_UTF_32LE = 0xfffe0000
 } BOM_TYPE;
     
+/**
+ * \brief Internal use only. Memory kept by a document to parse the next ones (see `XMLDoc_reset()`).
+ */
+typedef struct _XMLPool XMLPool;
+
 /**
  * \brief An XML document, basically an array of `XMLNode`.
  *
@@ -300,6 +360,9 @@ typedef struct _XMLDoc {
 	XMLNode** nodes;		/* Nodes of the document, including prolog, comments and root nodes */
 	int n_nodes;			/* Number of nodes in 'nodes' */
 	int i_root;				/* Index of first root node in 'nodes', -1 if document is empty */
+	XMLMemoryUsage* usage;	/* Memory used by the document nodes, NULL until a node is added (see 'XMLDoc_memory_usage()') */
+	XMLPool* pool;			/* Memory kept by 'XMLDoc_reset()' to parse the next documents, NULL if none */
+	int modified;			/* 'true' when nodes were added to or removed from 'nodes' since the document was parsed */
 
 	/* Keep 'init_value' as the last member */
 	int init_value;	/* Initialized to 'XML_INIT_DONE' to indicate that document has been initialized properly */
@@ -349,9 +412,58 @@ typedef enum _ParseError {
 	PARSE_ERR_SYNTAX = -3,				/**< General syntax error. */
 	PARSE_ERR_EOF = -4,					/**< Unexpected EOF. */
 	PARSE_ERR_TEXT_OUTSIDE_NODE = -5,	/**< During DOM loading. */
-	PARSE_ERR_UNEXPECTED_NODE_END = -6	/**< During DOM loading. */
+	PARSE_ERR_UNEXPECTED_NODE_END = -6,	/**< During DOM loading. */
+	PARSE_ERR_TOO_DEEP = -7				/**< Nodes are nested deeper than `XMLParserConfig.max_depth`. */
 } ParseError;
 
+/**
+ * \brief Parser configuration, given to `XMLDoc_parse_*_ex()` and `XMLSearch_*_ex()` functions.
+ *
+ * Functions without the `_ex` suffix use a global default configuration, holding the tags
+ * registered by `XML_register_user_tag()` and the function set by `XMLSearch_set_regexpr_compare()`.
+ * A configuration is only read while parsing or searching, so several threads can parse and search
+ * concurrently with their own configurations (or share one, as long as it is not modified).
+ *
+ * Initialize it with `XMLParserConfig_init()` and free it with `XMLParserConfig_free()`.
+ * *N.B. that nodes of user tags are still printed using the global user tags.*
+ */
+typedef struct _XMLParserConfig {
+	struct _Tag* user_tags;	/**< User tags, see `XMLParserConfig_register_user_tag()`. */
+	int n_user_tags;		/**< Number of user tags. */
+	int (*regexpr_compare)(SXML_CHAR* str, SXML_CHAR* pattern);	/**< Function matching strings to search patterns, `regstrcmp()` if `NULL`. */
+	int max_depth;			/**< Maximum nesting level of nodes (`PARSE_ERR_TOO_DEEP` when exceeded), 0 for no limit. */
+	int text_as_nodes;		/**< `true` to put text into separate `TAG_TEXT` nodes when parsing in DOM mode. */
+
+	/* Keep 'init_value' as the last member */
+	int init_value;	/**< Initialized to 'XML_INIT_DONE' to indicate that the configuration has been initialized properly. */
+} XMLParserConfig;
+
+/**
+ * \brief Initialize a parser configuration: no user tags, default `regstrcmp()` matching,
+ * 		no maximum depth and text stored in nodes `text`.
+ * \return `false` if `config` is `NULL`.
+ */
+int XMLParserConfig_init(XMLParserConfig* config);
+
+/**
+ * \brief Free a parser configuration user tags.
+ * \return `false` if `config` was not initialized.
+ */
+int XMLParserConfig_free(XMLParserConfig* config);
+
+/**
+ * \brief Register an XML tag in a parser configuration. See `XML_register_user_tag()`.
+ * \return tag index in `config` user tags when successful, or -1 if `config` is invalid or
+ * 		the tag could not be registered.
+ */
+int XMLParserConfig_register_user_tag(XMLParserConfig* config, TagType tag_type, SXML_CHAR* start, SXML_CHAR* end);
+
+/**
+ * \brief Remove a user tag registered in a parser configuration.
+ * \return the new number of user tags or -1 if `config` or `i_tag` is invalid.
+ */
+int XMLParserConfig_unregister_user_tag(XMLParserConfig* config, int i_tag);
+
 /**
  * \brief Events that can happen when loading an XML document.
  *
@@ -375,6 +487,10 @@ typedef struct _SAX_Data {
 	void* user;				/**< User-given data. */
 	DataSourceType type;	/**< Data source type [DATA_SOURCE_FILE|DATA_SOURCE_BUFFER]. */
 	void* src;				/**< Data source [DataSourceFile|DataSourceBuffer]. Depends on type. */
+	const XMLParserConfig* config;	/**< Parser configuration. */
+	int src_start;			/**< Offset in the data source of the current tag or text (in characters). */
+	int src_end;			/**< Offset after the current tag or text in the data source. */
+	XMLPool* pool;			/**< Internal use only. Memory to use for nodes being parsed, or NULL. */
 } SAX_Data;
 
 /**
@@ -589,6 +705,11 @@ int XMLNode_free(XMLNode* node);
 
 /**
  * \brief Copy a node to another one, optionally including its children.
+ *
+ * Tag, text and attributes are not duplicated but shared between `src` and `dst` until
+ * one of them is modified (see `XMLNode_unshare()`). Several threads can copy the same `src`
+ * at the same time, as long as none of them modifies it.
+ * `dst` keeps its `father`, so that nodes created by `XMLNode_dup()` have none.
  * \param dst The node receiving the copy. N.B. thtat the node is freed first!
  * \param src The node to duplicate. If `NULL`, `dst` is freed and initialized.
  * \param copy_children `true` to include `src` children (recursive copy).
@@ -598,12 +719,24 @@ int XMLNode_copy(XMLNode* dst, const XMLNode* src, int copy_children);
 
 /**
  * \brief Duplicate a node, potentially with its children.
+ *
+ * Tag, text and attributes are shared with `node` until modified (see `XMLNode_copy()`).
  * \param node The node to duplicate.
  * \param copy_children `true` to include `src` children (recursive copy).
  * \return `NULL` if not enough memory, or a pointer to the new node otherwise.
  */
 XMLNode* XMLNode_dup(const XMLNode* node, int copy_children);
 
+/**
+ * \brief Make `node` the only owner of its tag, text and attributes, duplicating them if they
+ * 		are shared with other nodes (e.g. after `XMLNode_dup()`).
+ *
+ * This is done automatically by all `XMLNode_*()` functions modifying a node and should only
+ * be called before modifying `node` members directly.
+ * \return `false` for memory error or invalid `node`, `true` otherwise.
+ */
+int XMLNode_unshare(XMLNode* node);
+
 /**
  * \brief Set the active/inactive state of `node`.
  *
@@ -653,6 +786,27 @@ int XMLNode_get_attribute_with_default(XMLNode* node, const SXML_CHAR* attr_name
  */
 #define XMLNode_get_attribute(node, attr_name, attr_value) XMLNode_get_attribute_with_default(node, attr_name, attr_value, C2SX(""))
 
+/**
+ * \brief Retrieve an attribute value as a number (see `str2number()`), without copying it.
+ *
+ * The number is read from the number index of the document `node` belongs to, if `attr_name` is indexed
+ * (see `XMLDoc_build_number_index()`), instead of parsing the value.
+ * \param node The node.
+ * \param attr_name The attribute name to search.
+ * \param attr_value A pointer receiving the number, or `default_attr_value` if `attr_name` does not exist
+ * 		in `node` or is not a number.
+ * \param default_attr_value The value to store in `attr_value` when there is no number.
+ * \return `true` if the attribute exists and is a number, `false` otherwise or when `node` is invalid,
+ * 		`attr_name` is NULL or empty, or `attr_value` is NULL.
+ */
+int XMLNode_get_attribute_double(const XMLNode* node, const SXML_CHAR* attr_name, double* attr_value, double default_attr_value);
+
+/**
+ * \brief Same as `XMLNode_get_attribute_double()` for attributes which are integers within the range of `int`
+ * 		(e.g. `"42"`, `"-3"`, `"1e3"` but not `"1.5"`).
+ */
+int XMLNode_get_attribute_int(const XMLNode* node, const SXML_CHAR* attr_name, int* attr_value, int default_attr_value);
+
 /**
  * \return the number of active attributes of 'node', or '-1' if 'node' is invalid.
  */
@@ -775,6 +929,31 @@ int XMLNode_remove_children(XMLNode* node);
  */
 int XMLNode_equal(const XMLNode* node1, const XMLNode* node2);
 
+/**
+ * \brief Compute the hash of a node and all its *active* children and attributes, recursively.
+ *
+ * Two nodes with the same tag, text, active attributes (in any order) and active children
+ * have the same hash, so identical subtrees can be detected without comparing them
+ * (e.g. by `XMLDoc_diff()`).
+ * The hash is cached in `node->hash` and invalidated (along with its ancestors') by all
+ * `XMLNode_*()` functions modifying the node. Code modifying node members directly should
+ * reset `node->hash` (and its ancestors') to 0.
+ * \param node The node to hash.
+ * \return the node hash, or 0 if `node` is invalid or for memory error.
+ */
+XMLHash XMLNode_hash(const XMLNode* node);
+
+/**
+ * \brief Compute the memory used by a node and its children.
+ *
+ * Contrary to `XMLDoc_memory_usage()`, the whole subtree is scanned.
+ *
+ * \param node The node.
+ * \param usage The memory usage to fill.
+ * \return `false` if `node` is invalid, `usage` is NULL or for memory error.
+ */
+int XMLNode_memory_usage(const XMLNode* node, XMLMemoryUsage* usage);
+
 /**
  * \brief Get the next sibling node.
  * \param node The node which sibling to retrieve.
@@ -790,6 +969,45 @@ XMLNode* XMLNode_next_sibling(const XMLNode* node);
  */
 XMLNode* XMLNode_next(const XMLNode* node);
 
+/**
+ * \brief Get the next node, in the order of `XMLNode_next()`, that is a `TAG_FATHER` or `TAG_SELF` node with a given tag.
+ *
+ * When the document `node` belongs to was indexed by `XMLDoc_build_tag_index()`, the node is found
+ * without visiting the ones in between.
+ * \param node The node to start after.
+ * \param tag The tag to look for (compared exactly).
+ * \param stop_at The node where to stop, which should follow `node`, or `NULL` to search up to the last node
+ * 		of `node` tree.
+ * \return the next node with tag `tag` before `stop_at`, or `NULL` if there is none or `node` or `tag` is invalid.
+ */
+XMLNode* XMLNode_next_with_tag(const XMLNode* node, const SXML_CHAR* tag, const XMLNode* stop_at);
+
+/**
+ * \brief Get the next node, in the order of `XMLNode_next()`, that is a `TAG_FATHER` or `TAG_SELF` node with
+ * 		an active attribute of a given value.
+ *
+ * When the document `node` belongs to has an index on `attr_name` (see `XMLDoc_build_attribute_index()`),
+ * the node is found without visiting the ones in between.
+ * \param node The node to start after.
+ * \param tag The tag of the node to look for, or `NULL` for any tag.
+ * \param attr_name The attribute name.
+ * \param attr_value The attribute value (compared exactly).
+ * \param stop_at The node where to stop, which should follow `node`, or `NULL` to search up to the last node
+ * 		of `node` tree.
+ * \return the next node with attribute `attr_name` equal to `attr_value` before `stop_at`, or `NULL` if there is none
+ * 		or `node`, `attr_name` or `attr_value` is invalid.
+ */
+XMLNode* XMLNode_next_with_attribute(const XMLNode* node, const SXML_CHAR* tag, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value, const XMLNode* stop_at);
+
+/**
+ * \brief Check whether the document a node belongs to has its tags or an attribute indexed
+ * 		(see `XMLDoc_build_tag_index()` and `XMLDoc_build_attribute_index()`).
+ * \param node The node.
+ * \param attr_name The attribute name, or `NULL` to check the tag index.
+ * \return `true` if the index exists and is up to date, `false` otherwise or if `node` is invalid.
+ */
+int XMLNode_is_indexed(const XMLNode* node, const SXML_CHAR* attr_name);
+
 
 
 /* --- XMLDoc methods --- */
@@ -809,6 +1027,55 @@ int XMLDoc_init(XMLDoc* doc);
  */
 int XMLDoc_free(XMLDoc* doc);
 
+/**
+ * \brief Empty an XML document to parse another one, keeping the memory of its nodes (node structs,
+ * 		strings and arrays) to be used again by the next `XMLDoc_parse_*_DOM*()` calls on `doc`.
+ * When parsing many documents of the same shape, this avoids most of the memory allocations.
+ * Memory kept is released by `XMLDoc_free()`, or by the next reset if it was not used.
+ * \param doc The document to empty.
+ * \return `false` if `doc` was not initialized.
+ */
+int XMLDoc_reset(XMLDoc* doc);
+
+/**
+ * \brief Free an XML document in the background.
+ *
+ * The nodes are detached from `doc`, which is immediately left empty (as after `XMLDoc_free()`)
+ * and can be reused, and are freed later by a reclaim thread started on first call, with the memory
+ * kept by `XMLDoc_reset()` and the indexes of `doc`.
+ * Nodes of `doc` should not be referenced anymore by the caller.
+ *
+ * When threads are not available (`SXMLC_NO_THREADS` defined or thread creation failure), `doc`
+ * is freed synchronously.
+ *
+ * \param doc The document to free.
+ * \return `false` if `doc` was not initialized.
+ */
+int XMLDoc_free_async(XMLDoc* doc);
+
+/**
+ * \brief Wait for all documents given to `XMLDoc_free_async()` to be freed and stop the reclaim thread.
+ *
+ * Should be called at program shutdown. The reclaim thread is restarted by the next
+ * call to `XMLDoc_free_async()`.
+ *
+ * \return `true`.
+ */
+int XMLDoc_free_async_flush(void);
+
+/**
+ * \brief Get the memory used by a document.
+ *
+ * Usage is maintained while parsing and modifying the document through the API, so this call
+ * does not scan the document. Tag, text and attributes shared between copies (see `XMLNode_copy()`)
+ * are counted in each document.
+ *
+ * \param doc The document.
+ * \param usage The memory usage to fill.
+ * \return `false` if `doc` was not initialized or `usage` is NULL.
+ */
+int XMLDoc_memory_usage(const XMLDoc* doc, XMLMemoryUsage* usage);
+
 /**
  * \brief Set the new document root node.
  * \param doc The document to initialize.
@@ -840,6 +1107,90 @@ int XMLDoc_remove_node(XMLDoc* doc, int i_node, int free_node);
 
 #define XMLDoc_remove_root_node XMLDoc_remove_node
 
+/**
+ * \brief Index the tags of a document nodes, so that `XMLNode_next_with_tag()` and `XMLSearch_next()`
+ * 		on a literal tag jump to the matching nodes instead of visiting all of them.
+ *
+ * The index is kept until `XMLDoc_free_tag_index()`, `XMLDoc_free()` or `XMLDoc_reset()`. It is updated
+ * by `XMLNode_set_tag()`. After changes of the document structure through `XMLNode_*()` and `XMLDoc_*()`
+ * functions (e.g. `XMLNode_add_child()`, `XMLNode_remove_child()` or `XMLNode_set_type()`), which change
+ * the document order of the following nodes, it is not used anymore (lookups visit the nodes) until this
+ * function is called again to rebuild it.
+ * Lookups never modify the index, so that several threads can search an indexed document that none of them
+ * modifies. Building the index is a modification of `doc`, to be done by the thread owning it.
+ * `doc` should not be moved to another address while it is indexed.
+ * \param doc The XML document.
+ * \return `false` if `doc` is invalid or for memory error.
+ */
+int XMLDoc_build_tag_index(XMLDoc* doc);
+
+/**
+ * \brief Free the tag index built by `XMLDoc_build_tag_index()`, if any.
+ * \param doc The XML document.
+ * \return `false` if `doc` is invalid.
+ */
+int XMLDoc_free_tag_index(XMLDoc* doc);
+
+/**
+ * \brief Index the values of an attribute of a document nodes, so that `XMLDoc_get_by_attribute()`,
+ * 		`XMLNode_next_with_attribute()` and `XMLSearch_next()` on an attribute value (e.g. `[@id="x"]`)
+ * 		jump to the matching nodes instead of visiting all of them.
+ *
+ * The index is kept until `XMLDoc_free_attribute_index()`, `XMLDoc_free()` or `XMLDoc_reset()`. It is
+ * updated by `XMLNode_set_attribute()`, `XMLNode_remove_attribute()` and `XMLNode_remove_all_attributes()`.
+ * After other changes of the document structure (e.g. `XMLNode_remove_child()`), it is not used anymore
+ * (lookups visit the nodes) until this function is called again to rebuild it. As for the tag index (see
+ * `XMLDoc_build_tag_index()`), lookups never modify it and rebuilding it is left to the thread owning `doc`.
+ * Attributes activated or deactivated directly are not taken into account.
+ * `doc` should not be moved to another address while it is indexed.
+ * \param doc The XML document.
+ * \param attr_name The attribute name (e.g. `"id"`).
+ * \return `false` if `doc` or `attr_name` is invalid or for memory error.
+ */
+int XMLDoc_build_attribute_index(XMLDoc* doc, const SXML_CHAR* attr_name);
+
+/**
+ * \brief Free the index of an attribute built by `XMLDoc_build_attribute_index()`, if any.
+ * \param doc The XML document.
+ * \param attr_name The attribute name.
+ * \return `false` if `doc` or `attr_name` is invalid.
+ */
+int XMLDoc_free_attribute_index(XMLDoc* doc, const SXML_CHAR* attr_name);
+
+/**
+ * \brief Get the first node of a document, in document order, having an active attribute of a given value.
+ *
+ * The lookup is immediate when `attr_name` is indexed (see `XMLDoc_build_attribute_index()`).
+ * \param doc The XML document.
+ * \param attr_name The attribute name (e.g. `"id"`).
+ * \param attr_value The attribute value (compared exactly).
+ * \return the node, or `NULL` if there is none or `doc`, `attr_name` or `attr_value` is invalid.
+ */
+XMLNode* XMLDoc_get_by_attribute(XMLDoc* doc, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value);
+
+/**
+ * \brief Parse the values of an attribute of a document nodes as numbers once, so that `XMLNode_get_attribute_double()`,
+ * 		`XMLNode_get_attribute_int()` and numeric searches (see `XMLSearch_search_add_number()`) read them instead
+ * 		of parsing the values each time.
+ *
+ * Numbers take 16 bytes per node of `doc`, and are stored only for the attributes given to this function.
+ * They are kept, updated and rebuilt as attribute indexes (see `XMLDoc_build_attribute_index()`): lookups
+ * never modify them, and they are not used after changes of the document structure until this function
+ * is called again.
+ * \param doc The XML document.
+ * \param attr_name The attribute name (e.g. `"price"`).
+ * \return `false` if `doc` or `attr_name` is invalid or for memory error.
+ */
+int XMLDoc_build_number_index(XMLDoc* doc, const SXML_CHAR* attr_name);
+
+/**
+ * \brief Free the numbers of an attribute parsed by `XMLDoc_build_number_index()`, if any.
+ * \param doc The XML document.
+ * \param attr_name The attribute name.
+ * \return `false` if `doc` or `attr_name` is invalid.
+ */
+int XMLDoc_free_number_index(XMLDoc* doc, const SXML_CHAR* attr_name);
+
 /**
  * \brief Shortcut macro to retrieve root node from a document. Equivalent to `doc->nodes[doc->i_root]`,
  *		or `NULL` if there is no root node.
@@ -898,6 +1249,208 @@ int XMLDoc_print_attr_sep(const XMLDoc* doc, FILE* f, const SXML_CHAR* tag_sep,
 /* For backward compatibility */
 #define XMLDoc_print(doc, f, tag_sep, child_sep, keep_text_spaces, sz_line, nb_char_tab) XMLDoc_print_attr_sep(doc, f, tag_sep, child_sep, C2SX(" "), keep_text_spaces, sz_line, nb_char_tab)
 
+/**
+ * \brief Print the XML document to memory, as `XMLDoc_print_attr_sep()` would print it to a file.
+ *
+ * The output is measured first so that the string is allocated once, with its exact size.
+ * The BOM, if any, is not printed.
+ * \return The printed document, to be freed by the caller, or `NULL` on invalid arguments or memory error.
+ */
+SXML_CHAR* XMLDoc_print_to_buffer(const XMLDoc* doc, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab);
+
+/**
+ * \brief Print the XML document to a file descriptor (e.g. a socket), as `XMLDoc_print_attr_sep()` would
+ * 		print it to a file.
+ *
+ * Output is buffered and written with `write()`/`writev()`, without going through `FILE*` streams.
+ * \return `false` on invalid arguments or write error, `true` otherwise.
+ */
+int XMLDoc_print_to_fd(const XMLDoc* doc, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab);
+
+/**
+ * \brief Print the XML document parsed from `source`, copying the nodes unchanged since then from `source`
+ * 		instead of printing them again.
+ *
+ * Nodes modified through `XMLNode_*()` functions (see `XMLNode.modified`) or not coming from `source` are
+ * printed as `XMLDoc_print_attr_sep()` does, while unchanged nodes are written as they are in `source`,
+ * formatting included. When only descendants of a node were modified, the text between its children is
+ * also copied from `source`, so that an unmodified document is printed exactly as `source`.
+ *
+ * `source` should be the buffer given to `XMLDoc_parse_buffer_*()` or `XMLDoc_reparse_range()`, or the
+ * content of the parsed file (e.g. mapped in memory), after its BOM. The BOM, if any, is printed first.
+ * \param source The data the document was parsed from.
+ * \param source_len The number of characters in `source`.
+ * \return `false` on invalid arguments, `true` otherwise.
+ */
+int XMLDoc_print_incremental(const XMLDoc* doc, const SXML_CHAR* source, int source_len, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab);
+
+/**
+ * \brief Same as `XMLDoc_print_incremental()`, to a file descriptor (see `XMLDoc_print_to_fd()`).
+ * \return `false` on invalid arguments or write error, `true` otherwise.
+ */
+int XMLDoc_print_incremental_to_fd(const XMLDoc* doc, const SXML_CHAR* source, int source_len, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab);
+
+/**
+ * \brief Print the XML document as `XMLDoc_print_attr_sep()` does, using several threads.
+ *
+ * Children of nodes having many children (searched in the first levels of the document) are split in parts
+ * printed in parallel to memory, then written to `f` in order, so that the output is the same as the one of
+ * `XMLDoc_print_attr_sep()`. Only a few parts per thread are held in memory at a time.
+ *
+ * Without threads (`SXMLC_NO_THREADS`), the document is printed by the calling thread.
+ * \param n_threads The number of threads printing parts, along with the calling thread which writes them.
+ * \return `false` on invalid arguments or memory error, `true` otherwise.
+ */
+int XMLDoc_print_parallel(const XMLDoc* doc, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab, int n_threads);
+
+/**
+ * \brief Same as `XMLDoc_print_parallel()`, to a file descriptor (see `XMLDoc_print_to_fd()`).
+ * \return `false` on invalid arguments, memory or write error, `true` otherwise.
+ */
+int XMLDoc_print_parallel_to_fd(const XMLDoc* doc, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab, int n_threads);
+
+/**
+ * \brief Function receiving printed output by chunks (e.g. to feed a hash): `len` characters of `data`,
+ * 		which is not NUL-terminated.
+ * \return `false` to stop printing.
+ */
+typedef int (*XMLOutputFunc)(const SXML_CHAR* data, int len, void* user);
+
+/**
+ * \brief Print the node and its children in canonical form, to compare or hash documents.
+ *
+ * The canonical form follows Canonical XML 1.0 (without namespace processing) so that it does not depend
+ * on formatting or attribute order:
+ * - Attributes are sorted by name, namespace declarations (`xmlns`, `xmlns:*`) first.
+ * - Attribute values are quoted with `"` and text and attribute values are escaped the same way, whatever their source.
+ * - Empty elements are printed as `<tag></tag>`, CDATA sections are replaced by their (escaped) content.
+ * - No formatting is added. Text is printed as it is stored in nodes.
+ * - XML declaration, DOCTYPE, user tags and inactive nodes or attributes are not printed.
+ *
+ * Output is given by chunks to `func`, so that the whole output is never held in memory.
+ * \param node The node to print.
+ * \param with_comments `true` to print comments.
+ * \param func The function receiving the output.
+ * \param user User data given to `func`.
+ * \return `false` on invalid arguments, memory error or if `func` returned `false`, `true` otherwise.
+ */
+int XMLNode_print_canonical(const XMLNode* node, int with_comments, XMLOutputFunc func, void* user);
+
+/**
+ * \brief Print the XML document in canonical form (see `XMLNode_print_canonical()`).
+ *
+ * Nodes before the root element (comments, processing instructions) are followed by a new line, nodes
+ * after it are preceded by one.
+ * \return `false` on invalid arguments, memory error or if `func` returned `false`, `true` otherwise.
+ */
+int XMLDoc_print_canonical(const XMLDoc* doc, int with_comments, XMLOutputFunc func, void* user);
+
+/**
+ * \brief Print the XML document in canonical form to memory (see `XMLDoc_print_canonical()`).
+ * \return The printed document, to be freed by the caller, or `NULL` on invalid arguments or memory error.
+ */
+SXML_CHAR* XMLDoc_print_canonical_to_buffer(const XMLDoc* doc, int with_comments);
+
+/**
+ * \brief Streaming XML writer, to write XML documents element by element without building an `XMLDoc`.
+ *
+ * Output is formatted and escaped as `XMLDoc_print_attr_sep()` would print the corresponding document,
+ * and is buffered. Memory used only depends on the depth of the elements still open, not on the document size.
+ *
+ * An element header is kept open after `XMLWriter_start_element()` so that attributes can be added with
+ * `XMLWriter_attribute()`. Elements ended without any content are written as `<tag/>`.
+ */
+typedef struct _XMLWriter {
+	struct _XMLSink* out;				/**< Output buffer (private). */
+	struct _PrintOptions* opt;			/**< Formatting options given to `XMLWriter_init()` (private). */
+	int cur_sz_line;					/**< Number of characters in the current line, counted as by `XMLNode_print_attr_sep()`. */
+	int first;							/**< 'true' until the first node is written (no `tag_sep` before it). */
+	int open;							/**< 'true' when the last element header is not ended, to add attributes. */
+	struct _XMLWriterFrame* frames;		/**< Elements started and not ended yet (private). */
+	int n_frames;						/**< Number of elements started and not ended yet (i.e. current depth). */
+	int sz_frames;						/**< Allocated size of `frames`. */
+	SXML_CHAR* tags;					/**< Tag names of `frames`, one after the other. */
+	size_t len_tags;					/**< Number of characters used in `tags`. */
+	size_t sz_tags;						/**< Allocated size of `tags`. */
+	int init_value;						/**< Initialized to 'XML_INIT_DONE' to indicate that writer has been initialized properly. */
+} XMLWriter;
+
+/**
+ * \brief Initialize a writer to a file (that can be `stdout`).
+ *
+ * Formatting parameters are the ones of `XMLNode_print_attr_sep()`. Strings `tag_sep`, `child_sep`
+ * and `attr_sep` are not copied and should remain valid until `XMLWriter_free()` is called.
+ * \return `false` on invalid arguments or memory error, `true` otherwise.
+ */
+int XMLWriter_init(XMLWriter* writer, FILE* f, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab);
+
+/**
+ * \brief Initialize a writer to a file descriptor (e.g. a socket), as `XMLDoc_print_to_fd()` does.
+ * \return `false` on invalid arguments or memory error, `true` otherwise.
+ */
+int XMLWriter_init_fd(XMLWriter* writer, int fd, const SXML_CHAR* tag_sep, const SXML_CHAR* child_sep, const SXML_CHAR* attr_sep, int keep_text_spaces, int sz_line, int nb_char_tab);
+
+/**
+ * \brief Start a new element `<tag`, child of the current element.
+ * \return `false` on invalid arguments or memory error, `true` otherwise.
+ */
+int XMLWriter_start_element(XMLWriter* writer, const SXML_CHAR* tag);
+
+/**
+ * \brief Add attribute `name="value"` to the element just started. `value` is escaped.
+ * \return `false` on invalid arguments or if the element header is already ended (i.e. something was written
+ * 		in the element), `true` otherwise.
+ */
+int XMLWriter_attribute(XMLWriter* writer, const SXML_CHAR* name, const SXML_CHAR* value);
+
+/**
+ * \brief Write escaped text in the current element, as `XMLNode.text` would be printed.
+ *
+ * Text composed only of spaces is not written unless `keep_text_spaces` was given.
+ * \return `false` on invalid arguments, `true` otherwise.
+ */
+int XMLWriter_text(XMLWriter* writer, const SXML_CHAR* text);
+
+/**
+ * \brief Write a `<![CDATA[text]]>` node in the current element. `text` is not escaped.
+ * \return `false` on invalid arguments, `true` otherwise.
+ */
+int XMLWriter_cdata(XMLWriter* writer, const SXML_CHAR* text);
+
+/**
+ * \brief Write a `<!--text-->` node in the current element. `text` is not escaped.
+ * \return `false` on invalid arguments, `true` otherwise.
+ */
+int XMLWriter_comment(XMLWriter* writer, const SXML_CHAR* text);
+
+/**
+ * \brief End the current element, with `/>` if nothing was written in it or `</tag>` otherwise.
+ * \return `false` on invalid arguments or if there is no element to end, `true` otherwise.
+ */
+int XMLWriter_end_element(XMLWriter* writer);
+
+/**
+ * \brief Write `node` and its children in the current element, as `XMLNode_print_attr_sep()` would print them.
+ *
+ * Inactive nodes are not written.
+ * \return `false` on invalid arguments, `true` otherwise.
+ */
+int XMLWriter_node(XMLWriter* writer, const XMLNode* node);
+
+/**
+ * \brief Write buffered output to the file or file descriptor.
+ * \return `false` on invalid arguments or if a write error occurred so far, `true` otherwise.
+ */
+int XMLWriter_flush(XMLWriter* writer);
+
+/**
+ * \brief End all elements still open, flush the output and free the writer memory.
+ *
+ * The file or file descriptor is not closed.
+ * \return `false` on invalid arguments or if a write error occurred, `true` otherwise.
+ */
+int XMLWriter_free(XMLWriter* writer);
+
 /**
  * \brief Parse a file into an initialized XML document (DOM mode).
  * \param filename The file to parse.
@@ -912,6 +1465,15 @@ int XMLDoc_parse_file_DOM_text_as_nodes(const SXML_CHAR* filename, XMLDoc* doc,
  */
 #define XMLDoc_parse_file_DOM(filename, doc) XMLDoc_parse_file_DOM_text_as_nodes(filename, doc, 0)
 
+/**
+ * \brief Parse a file into an initialized XML document (DOM mode), using a given configuration.
+ * \param filename The file to parse.
+ * \param doc The document to parse into.
+ * \param config The parser configuration (user tags, limits, `text_as_nodes`), or `NULL` for the default one.
+ * \return `false` in case of error (memory or unavailable filename, malformed document), `true` otherwise.
+ */
+int XMLDoc_parse_file_DOM_ex(const SXML_CHAR* filename, XMLDoc* doc, const XMLParserConfig* config);
+
 /**
  * \brief Parse a memory buffer into an initialized document (DOM mode).
  * \param buffer The memory buffer to parse.
@@ -927,6 +1489,41 @@ int XMLDoc_parse_buffer_DOM_text_as_nodes(const SXML_CHAR* buffer, const SXML_CH
  */
 #define XMLDoc_parse_buffer_DOM(buffer, name, doc) XMLDoc_parse_buffer_DOM_text_as_nodes(buffer, name, doc, 0)
 
+/**
+ * \brief Parse a memory buffer into an initialized document (DOM mode), using a given configuration.
+ * \param buffer The memory buffer to parse.
+ * \param name The buffer name (to identify several buffers if run concurrently).
+ * \param doc The document to parse into.
+ * \param config The parser configuration (user tags, limits, `text_as_nodes`), or `NULL` for the default one.
+ * \return `false` in case of error (memory, malformed document), `true` otherwise.
+ */
+int XMLDoc_parse_buffer_DOM_ex(const SXML_CHAR* buffer, const SXML_CHAR* name, XMLDoc* doc, const XMLParserConfig* config);
+
+/**
+ * \brief Update a document parsed from a buffer after a region of that buffer was edited, parsing again only
+ * 		the smallest node holding the edit.
+ *
+ * The node holding the edit keeps its address and `user` pointer but gets its content from the new buffer.
+ * Nodes outside of it are kept as they are, their source offsets (`src_start`/`src_end`) being shifted.
+ * When the edit cannot be handled inside a single node (e.g. it adds a sibling), the father node is tried,
+ * and so on up to the whole buffer.
+ * The document should not have been modified since it was parsed (or last updated by this function).
+ * \param doc The document parsed from the buffer before the edit.
+ * \param buffer The edited buffer.
+ * \param buffer_len The edited buffer length (in characters).
+ * \param edit_start The offset of the edit in the buffer.
+ * \param edit_old_len The number of characters replaced by the edit.
+ * \param edit_new_len The number of characters replacing them.
+ * \param config The parser configuration used to parse the document, or `NULL` for the default one.
+ * \return `false` in case of error (memory, malformed buffer), in which case `doc` is unchanged, `true` otherwise.
+ */
+int XMLDoc_reparse_range_ex(XMLDoc* doc, const SXML_CHAR* buffer, int buffer_len, int edit_start, int edit_old_len, int edit_new_len, const XMLParserConfig* config);
+
+/**
+ * \brief Same as `XMLDoc_reparse_range_ex()` using the default configuration.
+ */
+int XMLDoc_reparse_range(XMLDoc* doc, const SXML_CHAR* buffer, int buffer_len, int edit_start, int edit_old_len, int edit_new_len);
+
 /**
  * \brief Parse an XML file, calling SAX callbacks.
  * \param filename The file to parse.
@@ -937,6 +1534,14 @@ int XMLDoc_parse_buffer_DOM_text_as_nodes(const SXML_CHAR* buffer, const SXML_CH
  */
 int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, void* user);
 
+/**
+ * \brief Parse an XML file, calling SAX callbacks, using a given configuration.
+ * \param config The parser configuration (user tags, limits), or `NULL` for the default one.
+ * 		It is available to callbacks as `sd->config`.
+ * \see XMLDoc_parse_file_SAX()
+ */
+int XMLDoc_parse_file_SAX_ex(const SXML_CHAR* filename, const SAX_Callbacks* sax, void* user, const XMLParserConfig* config);
+
 /**
  * \brief Parse an XML buffer, calling SAX callbacks.
  * \param buffer The memory buffer to parse.
@@ -954,6 +1559,14 @@ int XMLDoc_parse_buffer_SAX_len(const SXML_CHAR* buffer, int buffer_len, const S
  */
 #define XMLDoc_parse_buffer_SAX(buffer, name, sax, user) XMLDoc_parse_buffer_SAX_len(buffer, sx_strlen(buffer), name, sax, user)
 
+/**
+ * \brief Parse an XML buffer, calling SAX callbacks, using a given configuration.
+ * \param config The parser configuration (user tags, limits), or `NULL` for the default one.
+ * 		It is available to callbacks as `sd->config`.
+ * \see XMLDoc_parse_buffer_SAX_len()
+ */
+int XMLDoc_parse_buffer_SAX_len_ex(const SXML_CHAR* buffer, int buffer_len, const SXML_CHAR* name, const SAX_Callbacks* sax, void* user, const XMLParserConfig* config);
+
 /**
  * \brief Parse an XML file using the DOM implementation.
  */
@@ -1052,6 +1665,17 @@ SXML_CHAR* str_unescape(SXML_CHAR* str);
  */
 int split_left_right(SXML_CHAR* str, SXML_CHAR sep, int* l0, int* l1, int* i_sep, int* r0, int* r1, int ignore_spaces, int ignore_quotes);
 
+/**
+ * \brief Parse a string as a decimal number: `[-+]digits[.digits][e[-+]digits]` (digits being optional on one side
+ * 		of the `.`), with potential spaces around it.
+ *
+ * Hexadecimal numbers, `inf` or `nan` (that `strtod()` accepts) are not numbers.
+ * \param str The string to parse.
+ * \param number A pointer receiving the number, left unchanged when `str` is not a number.
+ * \return `true` if `str` is a number, `false` otherwise or when `str` is NULL.
+ */
+int str2number(const SXML_CHAR* str, double* number);
+
 /**
  Detect a potential BOM at the current file position and read it into 'bom' (if not NULL,
  'bom' should be at least 5 bytes). It also moves the 'f' beyond the BOM so it's possible to
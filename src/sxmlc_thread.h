@@ -0,0 +1,102 @@
+/*
+	Copyright (c) 2010, Matthieu Labas
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without modification,
+	are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright notice,
+	   this list of conditions and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the above copyright notice,
+	   this list of conditions and the following disclaimer in the documentation
+	   and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+	ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+	WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+	PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+	WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	OF SUCH DAMAGE.
+
+	The views and conclusions contained in the software and documentation are those of the
+	authors and should not be interpreted as representing official policies, either expressed
+	or implied, of the FreeBSD Project.
+*/
+#ifndef _SXMLC_THREAD_H_
+#define _SXMLC_THREAD_H_
+
+/*
+ Minimal threading layer, private to the library sources, used to reclaim documents in the background
+ (see 'XMLDoc_free_async()'), to print them in parallel (see 'XMLDoc_print_parallel()') and to search them
+ in parallel (see 'XMLSearch_all_parallel()').
+ Define 'SXMLC_NO_THREADS' to build without threads, in which case these are done by the calling thread.
+ Share counters are updated atomically as nodes of a document being reclaimed can share their content
+ with nodes used by other threads. They are created on the first copy of a node and published with
+ '_shared_ptr_publish()', which sets '*pp' to 'p' if it is NULL and returns its former value, as several
+ threads can copy the same node.
+ */
+#ifdef SXMLC_NO_THREADS
+#define _shared_inc(p) (++*(p))
+#define _shared_dec(p) (--*(p))
+#define _shared_get(p) (*(p))
+#define _shared_ptr_load(pp) (*(pp))
+#define _shared_ptr_publish(pp, p) (*(pp) != NULL ? *(pp) : (*(pp) = (p), NULL))
+#elif defined(WIN32) || defined(WIN64)
+#include <windows.h>
+#define _shared_inc(p) InterlockedIncrement((volatile LONG*)(p))
+#define _shared_dec(p) InterlockedDecrement((volatile LONG*)(p))
+#define _shared_get(p) InterlockedCompareExchange((volatile LONG*)(p), 0, 0)
+#define _shared_ptr_load(pp) InterlockedCompareExchangePointer((PVOID volatile*)(pp), NULL, NULL)
+#define _shared_ptr_publish(pp, p) InterlockedCompareExchangePointer((PVOID volatile*)(pp), (p), NULL)
+typedef SRWLOCK _sx_mutex;
+typedef CONDITION_VARIABLE _sx_cond;
+typedef HANDLE _sx_thread;
+#define SX_MUTEX_INITIALIZER SRWLOCK_INIT
+#define SX_COND_INITIALIZER CONDITION_VARIABLE_INIT
+#define _sx_mutex_init(m) InitializeSRWLock(m)
+#define _sx_mutex_destroy(m)
+#define _sx_mutex_lock(m) AcquireSRWLockExclusive(m)
+#define _sx_mutex_unlock(m) ReleaseSRWLockExclusive(m)
+#define _sx_cond_init(c) InitializeConditionVariable(c)
+#define _sx_cond_destroy(c)
+#define _sx_cond_wait(c, m) SleepConditionVariableSRW((c), (m), INFINITE, 0)
+#define _sx_cond_signal(c) WakeConditionVariable(c)
+#define _sx_cond_broadcast(c) WakeAllConditionVariable(c)
+#define SX_THREAD_FUNC(fct) static DWORD WINAPI fct(LPVOID arg)
+#define _sx_thread_create_arg(t, fct, arg) ((*(t) = CreateThread(NULL, 0, (fct), (arg), 0, NULL)) != NULL)
+#define _sx_thread_join(t) (WaitForSingleObject((t), INFINITE), CloseHandle(t))
+#else
+#include <pthread.h>
+#define _shared_inc(p) __sync_add_and_fetch((p), 1)
+#define _shared_dec(p) __sync_sub_and_fetch((p), 1)
+#define _shared_get(p) __sync_add_and_fetch((p), 0)
+#define _shared_ptr_load(pp) __sync_val_compare_and_swap((pp), NULL, NULL)
+#define _shared_ptr_publish(pp, p) __sync_val_compare_and_swap((pp), NULL, (p))
+typedef pthread_mutex_t _sx_mutex;
+typedef pthread_cond_t _sx_cond;
+typedef pthread_t _sx_thread;
+#define SX_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define SX_COND_INITIALIZER PTHREAD_COND_INITIALIZER
+#define _sx_mutex_init(m) pthread_mutex_init((m), NULL)
+#define _sx_mutex_destroy(m) pthread_mutex_destroy(m)
+#define _sx_mutex_lock(m) pthread_mutex_lock(m)
+#define _sx_mutex_unlock(m) pthread_mutex_unlock(m)
+#define _sx_cond_init(c) pthread_cond_init((c), NULL)
+#define _sx_cond_destroy(c) pthread_cond_destroy(c)
+#define _sx_cond_wait(c, m) pthread_cond_wait((c), (m))
+#define _sx_cond_signal(c) pthread_cond_signal(c)
+#define _sx_cond_broadcast(c) pthread_cond_broadcast(c)
+#define SX_THREAD_FUNC(fct) static void* fct(void* arg)
+#define _sx_thread_create_arg(t, fct, arg) (pthread_create((t), NULL, (fct), (arg)) == 0)
+#define _sx_thread_join(t) pthread_join((t), NULL)
+#endif
+#ifndef SXMLC_NO_THREADS
+#define _sx_thread_create(t, fct) _sx_thread_create_arg((t), (fct), NULL)
+#endif
+
+#endif
@@ -0,0 +1,749 @@
+/*
+	Copyright (c) 2010, Matthieu Labas
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without modification,
+	are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright notice,
+	   this list of conditions and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the above copyright notice,
+	   this list of conditions and the following disclaimer in the documentation
+	   and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+	ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+	WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+	PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+	WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	OF SUCH DAMAGE.
+
+	The views and conclusions contained in the software and documentation are those of the
+	authors and should not be interpreted as representing official policies, either expressed
+	or implied, of the FreeBSD Project.
+*/
+#if defined(WIN32) || defined(WIN64)
+#pragma warning(disable : 4996)
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include "sxmlc.h"
+#include "sxmldiff.h"
+
+#define DIFF_TAG C2SX("diff")
+#define DIFF_DELETE C2SX("delete")
+#define DIFF_INSERT C2SX("insert")
+#define DIFF_UPDATE C2SX("update")
+#define DIFF_MOVE C2SX("move")
+#define DIFF_PATH C2SX("path")
+#define DIFF_TO C2SX("to")
+
+/* Maximum number of siblings looked ahead when matching changed nodes by tag */
+#define DIFF_MAX_LOOKAHEAD 64
+
+/* How a sibling is matched between the two documents */
+#define MATCH_NONE 0	/* Deleted or inserted */
+#define MATCH_SAME 1	/* Identical subtree */
+#define MATCH_CHANGED 2	/* Same tag, changed content or children */
+#define MATCH_MOVED 4	/* Flag for matched nodes that should be moved */
+
+/* Path to the node being compared: active indexes from the document nodes */
+typedef struct _Path {
+	int* idx;
+	int depth;
+	int size;
+} _Path;
+
+/*
+ Sibling level being compared: nodes 'a' from the original document and 'b' from the new one.
+ 'pairs' holds the indexes in 'a' and 'b' of the 'n_pairs' matched nodes with changes,
+ which are updated and compared in turn.
+ */
+typedef struct _DiffLevel {
+	XMLNode** a;
+	XMLNode** b;
+	int* pairs;
+	int n_pairs;
+	int next;
+} _DiffLevel;
+
+typedef struct _HashIndex {
+	XMLHash hash;
+	int i;
+} _HashIndex;
+
+static int _path_push(_Path* path, int i)
+{
+	if (path->depth >= path->size) {
+		int* pt = __realloc(path->idx, (path->size + 16) * sizeof(int));
+		if (pt == NULL)
+			return FALSE;
+		path->idx = pt;
+		path->size += 16;
+	}
+	path->idx[path->depth++] = i;
+
+	return TRUE;
+}
+
+/*
+ Write 'n' (positive) at the end of 'str' and return a pointer to the end of 'str'.
+ */
+static SXML_CHAR* _itoa_cat(SXML_CHAR* str, int n)
+{
+	SXML_CHAR buf[16];
+	int i = 0;
+
+	do {
+		buf[i++] = (SXML_CHAR)(C2SX('0') + n % 10);
+		n /= 10;
+	} while (n > 0);
+	while (i > 0)
+		*str++ = buf[--i];
+	*str = NULC;
+
+	return str;
+}
+
+/*
+ Add an edit 'op' on node 'i' of 'path' to 'diff' node. 'payload' is a copy of the node to insert or update.
+ 'to' is the destination of a move, ignored if negative.
+ Return 'false' for memory error, in which case 'payload' is freed.
+ */
+static int _add_edit(XMLNode* diff, const SXML_CHAR* op, const _Path* path, int i, XMLNode* payload, int to)
+{
+	XMLNode* edit;
+	SXML_CHAR* str = NULL;
+	SXML_CHAR* p;
+	int k;
+
+	edit = XMLNode_new(TAG_SELF, op, NULL);
+	if (edit == NULL)
+		goto edit_err;
+
+	str = __malloc((path->depth + 1) * 12 * sizeof(SXML_CHAR));
+	if (str == NULL)
+		goto edit_err;
+	for (k = 0, p = str; k < path->depth; k++) {
+		p = _itoa_cat(p, path->idx[k]);
+		*p++ = C2SX('/');
+	}
+	(void)_itoa_cat(p, i);
+	if (XMLNode_set_attribute(edit, DIFF_PATH, str) < 0)
+		goto edit_err;
+
+	if (to >= 0) {
+		(void)_itoa_cat(str, to);
+		if (XMLNode_set_attribute(edit, DIFF_TO, str) < 0)
+			goto edit_err;
+	}
+	__free(str);
+	str = NULL;
+
+	if (payload != NULL) {
+		if (!XMLNode_add_child(edit, payload))
+			goto edit_err;
+		payload = NULL; /* Now freed with 'edit' */
+	}
+
+	if (!XMLNode_add_child(diff, edit))
+		goto edit_err;
+
+	return TRUE;
+
+edit_err:
+	if (str != NULL)
+		__free(str);
+	if (payload != NULL) {
+		(void)XMLNode_free(payload);
+		__free(payload);
+	}
+	if (edit != NULL) {
+		(void)XMLNode_free(edit);
+		__free(edit);
+	}
+
+	return FALSE;
+}
+
+/*
+ Fill '*active' with the active nodes among 'nodes'. Return their number or -1 for memory error.
+ */
+static int _get_active(XMLNode** nodes, int n, XMLNode*** active)
+{
+	int i, n_active;
+
+	*active = NULL;
+	if (n == 0)
+		return 0;
+
+	*active = __malloc(n * sizeof(XMLNode*));
+	if (*active == NULL)
+		return -1;
+	for (i = n_active = 0; i < n; i++)
+		if (nodes[i]->active)
+			(*active)[n_active++] = nodes[i];
+
+	return n_active;
+}
+
+/*
+ Compare two strings, 'NULL' being equal to an empty string.
+ */
+static int _str_equal(const SXML_CHAR* s1, const SXML_CHAR* s2)
+{
+	return !sx_strcmp(s1 == NULL ? C2SX("") : s1, s2 == NULL ? C2SX("") : s2);
+}
+
+static TagType _tag_type(const XMLNode* node)
+{
+	return node->tag_type == TAG_SELF ? TAG_FATHER : node->tag_type;
+}
+
+/*
+ Return 'true' if both nodes have the same type and tag, i.e. one can be updated into the other.
+ */
+static int _same_kind(const XMLNode* node1, const XMLNode* node2)
+{
+	if (_tag_type(node1) != _tag_type(node2))
+		return FALSE;
+
+	return node1->tag == NULL || node2->tag == NULL ? node1->tag == node2->tag : !sx_strcmp(node1->tag, node2->tag);
+}
+
+/*
+ Return 'true' if both nodes have the same active attributes, whatever their order.
+ */
+static int _same_attributes(const XMLNode* node1, const XMLNode* node2)
+{
+	int i, j;
+
+	if (XMLNode_get_attribute_count(node1) != XMLNode_get_attribute_count(node2))
+		return FALSE;
+
+	for (i = 0; i < node1->n_attributes; i++) {
+		if (!node1->attributes[i].active)
+			continue;
+		j = XMLNode_search_attribute(node2, node1->attributes[i].name, 0);
+		if (j < 0 || !_str_equal(node1->attributes[i].value, node2->attributes[j].value))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int _cmp_hash_index(const void* p1, const void* p2)
+{
+	const _HashIndex* h1 = (const _HashIndex*)p1;
+	const _HashIndex* h2 = (const _HashIndex*)p2;
+
+	if (h1->hash != h2->hash)
+		return h1->hash < h2->hash ? -1 : 1;
+
+	return h1->i - h2->i;
+}
+
+/*
+ Return the position of 'x' in 'list' of 'n' elements.
+ */
+static int _find(const int* list, int n, int x)
+{
+	int i;
+
+	for (i = 0; i < n && list[i] != x; i++) ;
+
+	return i;
+}
+
+/*
+ Compare sibling nodes 'nodes_from' and 'nodes_to' at 'path', adding deletions, moves and insertions to 'diff'.
+ 'level' is filled with active nodes and the pairs of matched nodes with changes, to be compared afterwards.
+ Return the number of edits, or -1 for memory error.
+ */
+static int _diff_siblings(XMLNode** nodes_from, int n_from, XMLNode** nodes_to, int n_to, const _Path* path, XMLNode* diff, _DiffLevel* level)
+{
+	XMLNode** a = NULL; /* Active nodes from 'nodes_from' */
+	XMLNode** b = NULL; /* Active nodes from 'nodes_to' */
+	int* match_a = NULL; /* Index in 'b' of the node matching 'a[i]', or -1 */
+	int* match_b = NULL; /* Index in 'a' of the node matching 'b[j]', or -1 */
+	char* kind_a = NULL; /* 'MATCH_*' of 'a[i]' */
+	_HashIndex* hb = NULL;
+	int* lis = NULL; /* Longest increasing subsequence of 'match_a' */
+	int* prev = NULL;
+	int* work = NULL;
+	int* order = NULL;
+	int na, nb, i, j, k, t, n_lis, n_work, n_order, n_edits;
+
+	level->a = level->b = NULL;
+	level->pairs = NULL;
+	level->n_pairs = level->next = 0;
+
+	na = _get_active(nodes_from, n_from, &a);
+	nb = _get_active(nodes_to, n_to, &b);
+	level->a = a;
+	level->b = b;
+	if (na < 0 || nb < 0)
+		goto diff_err;
+	n_edits = 0;
+	if (na == 0 && nb == 0)
+		goto diff_end;
+
+	match_a = __malloc((na + nb) * sizeof(int));
+	match_b = __malloc((na + nb) * sizeof(int));
+	kind_a = __calloc(na + 1, sizeof(char));
+	hb = __malloc((nb + 1) * sizeof(_HashIndex));
+	lis = __malloc((na + 1) * sizeof(int));
+	prev = __malloc((na + 1) * sizeof(int));
+	work = __malloc((na + nb + 1) * sizeof(int));
+	order = __malloc((nb + 1) * sizeof(int));
+	level->pairs = __malloc(2 * (na + 1) * sizeof(int));
+	if (level->pairs == NULL || match_a == NULL || match_b == NULL || kind_a == NULL || hb == NULL || lis == NULL || prev == NULL || work == NULL || order == NULL)
+		goto diff_err;
+
+	/* Match identical subtrees by hash: each 'a' node takes the first unmatched 'b' node with the same hash */
+	for (j = 0; j < nb; j++) {
+		hb[j].hash = XMLNode_hash(b[j]);
+		hb[j].i = j;
+		match_b[j] = -1;
+	}
+	qsort(hb, nb, sizeof(_HashIndex), _cmp_hash_index);
+	for (i = 0; i < nb; i++)
+		work[i] = i; /* Next candidate in each group of equal hashes, indexed by the group first position */
+	for (i = 0; i < na; i++) {
+		XMLHash h = XMLNode_hash(a[i]);
+		int lo = 0, hi = nb;
+		match_a[i] = -1;
+		while (lo < hi) { /* First 'hb' with hash 'h' */
+			int mid = (lo + hi) / 2;
+			if (hb[mid].hash < h) lo = mid + 1;
+			else hi = mid;
+		}
+		if (lo < nb && hb[lo].hash == h && work[lo] < nb && hb[work[lo]].hash == h) {
+			j = hb[work[lo]++].i;
+			match_a[i] = j;
+			match_b[j] = i;
+			kind_a[i] = MATCH_SAME;
+		}
+	}
+
+	/* Match remaining nodes with the same tag, in order: they will be updated */
+	for (j = i = 0; j < nb; j++) {
+		if (match_b[j] >= 0)
+			continue;
+		for (k = i; k < na && k < i + DIFF_MAX_LOOKAHEAD; k++) {
+			if (kind_a[k] == MATCH_NONE && _same_kind(a[k], b[j])) {
+				kind_a[k] = MATCH_CHANGED;
+				match_a[k] = j;
+				match_b[j] = k;
+				i = k + 1;
+				break;
+			}
+		}
+	}
+
+	/* Longest sequence of matched nodes kept in the same order: they do not move */
+	for (i = n_lis = 0; i < na; i++) {
+		int lo = 0, hi = n_lis;
+		if (match_a[i] < 0)
+			continue;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (match_a[lis[mid]] < match_a[i]) lo = mid + 1;
+			else hi = mid;
+		}
+		prev[i] = (lo > 0 ? lis[lo-1] : -1);
+		lis[lo] = i;
+		if (lo == n_lis)
+			n_lis++;
+	}
+	for (i = 0; i < na; i++)
+		if (match_a[i] >= 0)
+			kind_a[i] |= MATCH_MOVED;
+	for (i = (n_lis > 0 ? lis[n_lis-1] : -1); i >= 0; i = prev[i])
+		kind_a[i] &= ~MATCH_MOVED;
+
+	/* Delete unmatched nodes, from the last so indexes are not shifted */
+	for (i = na - 1; i >= 0; i--) {
+		if (kind_a[i] != MATCH_NONE)
+			continue;
+		if (!_add_edit(diff, DIFF_DELETE, path, i, NULL, -1))
+			goto diff_err;
+		n_edits++;
+	}
+
+	/* Remaining nodes are in 'work', in their current order, and should end up in 'order' */
+	for (i = n_work = 0; i < na; i++)
+		if (kind_a[i] != MATCH_NONE)
+			work[n_work++] = i;
+	for (j = n_order = 0; j < nb; j++)
+		if (match_b[j] >= 0)
+			order[n_order++] = match_b[j];
+
+	/* Move each moved node after its predecessor, which is already in place */
+	for (t = 0; t < n_order; t++) {
+		int to;
+		i = order[t];
+		if (!(kind_a[i] & MATCH_MOVED))
+			continue;
+		k = _find(work, n_work, i);
+		memmove(&work[k], &work[k+1], (n_work - k - 1) * sizeof(int));
+		to = (t == 0 ? 0 : _find(work, n_work - 1, order[t-1]) + 1);
+		memmove(&work[to+1], &work[to], (n_work - to - 1) * sizeof(int));
+		work[to] = i;
+		if (!_add_edit(diff, DIFF_MOVE, path, k, NULL, to))
+			goto diff_err;
+		n_edits++;
+		kind_a[i] &= ~MATCH_MOVED;
+	}
+
+	/* Insert new nodes, from the first so all previous ones are in place */
+	for (j = 0; j < nb; j++) {
+		XMLNode* node;
+		if (match_b[j] >= 0)
+			continue;
+		node = XMLNode_dup(b[j], TRUE);
+		if (node == NULL || !_add_edit(diff, DIFF_INSERT, path, j, node, -1))
+			goto diff_err;
+		n_edits++;
+	}
+
+	/* Changed nodes are updated and their children compared later */
+	for (j = 0; j < nb; j++) {
+		i = match_b[j];
+		if (i < 0 || kind_a[i] != MATCH_CHANGED)
+			continue; /* Inserted or identical */
+		level->pairs[2 * level->n_pairs] = i;
+		level->pairs[2 * level->n_pairs + 1] = j;
+		level->n_pairs++;
+	}
+	goto diff_end;
+
+diff_err:
+	n_edits = -1;
+
+diff_end:
+	if (match_a != NULL) __free(match_a);
+	if (match_b != NULL) __free(match_b);
+	if (kind_a != NULL) __free(kind_a);
+	if (hb != NULL) __free(hb);
+	if (lis != NULL) __free(lis);
+	if (prev != NULL) __free(prev);
+	if (work != NULL) __free(work);
+	if (order != NULL) __free(order);
+
+	return n_edits;
+}
+
+static void _free_level(_DiffLevel* level)
+{
+	if (level->a != NULL) __free(level->a);
+	if (level->b != NULL) __free(level->b);
+	if (level->pairs != NULL) __free(level->pairs);
+}
+
+/*
+ Compare 'nodes_from' and 'nodes_to' subtrees, adding edits to 'diff'.
+ Levels are compared depth-first without recursion, so that deep documents do not overflow the call stack.
+ Return the number of edits, or -1 for memory error.
+ */
+static int _diff_nodes(XMLNode** nodes_from, int n_from, XMLNode** nodes_to, int n_to, _Path* path, XMLNode* diff)
+{
+	_DiffLevel* levels = NULL;
+	_DiffLevel* lv;
+	XMLNode* node;
+	XMLNode* a;
+	XMLNode* b;
+	int n_levels, sz_levels, n_edits, ret, j;
+
+	n_levels = sz_levels = n_edits = 0;
+	a = b = NULL; /* Nodes which children are compared, NULL for 'nodes_*' */
+	j = -1;
+	for (;;) {
+		if (a != NULL) {
+			/* Update changed node 'a' and compare its children */
+			if (!_str_equal(a->text, b->text) || !_same_attributes(a, b)) {
+				node = XMLNode_dup(b, FALSE);
+				if (node == NULL || !_add_edit(diff, DIFF_UPDATE, path, j, node, -1))
+					goto diff_err;
+				n_edits++;
+			}
+			if (!_path_push(path, j))
+				goto diff_err;
+		}
+		if (n_levels >= sz_levels) {
+			lv = __realloc(levels, (sz_levels + 16) * sizeof(_DiffLevel));
+			if (lv == NULL)
+				goto diff_err;
+			levels = lv;
+			sz_levels += 16;
+		}
+		lv = &levels[n_levels++];
+		ret = (a == NULL ? _diff_siblings(nodes_from, n_from, nodes_to, n_to, path, diff, lv)
+						 : _diff_siblings(a->children, a->n_children, b->children, b->n_children, path, diff, lv));
+		if (ret < 0)
+			goto diff_err;
+		n_edits += ret;
+
+		/* Next changed pair to compare, going up finished levels */
+		while (lv->next >= lv->n_pairs) {
+			_free_level(lv);
+			if (--n_levels == 0)
+				goto diff_end;
+			path->depth--;
+			lv = &levels[n_levels - 1];
+		}
+		a = lv->a[lv->pairs[2 * lv->next]];
+		j = lv->pairs[2 * lv->next + 1];
+		b = lv->b[j];
+		lv->next++;
+	}
+
+diff_err:
+	n_edits = -1;
+	while (n_levels > 0)
+		_free_level(&levels[--n_levels]);
+
+diff_end:
+	if (levels != NULL)
+		__free(levels);
+
+	return n_edits;
+}
+
+int XMLDoc_diff(const XMLDoc* from, const XMLDoc* to, XMLDoc* diff)
+{
+	XMLNode* root;
+	_Path path;
+	int n_edits;
+
+	if (from == NULL || to == NULL || diff == NULL || from->init_value != XML_INIT_DONE || to->init_value != XML_INIT_DONE || diff->init_value != XML_INIT_DONE)
+		return -1;
+
+	root = XMLNode_new(TAG_FATHER, DIFF_TAG, NULL);
+	if (root == NULL)
+		return -1;
+	if (XMLDoc_add_node(diff, root) < 0) {
+		(void)XMLNode_free(root);
+		__free(root);
+		return -1;
+	}
+	diff->i_root = diff->n_nodes - 1;
+
+	path.idx = NULL;
+	path.depth = path.size = 0;
+	n_edits = _diff_nodes(from->nodes, from->n_nodes, to->nodes, to->n_nodes, &path, root);
+	if (path.idx != NULL)
+		__free(path.idx);
+	if (root->n_children == 0)
+		root->tag_type = TAG_SELF;
+
+	return n_edits;
+}
+
+/*
+ Return the index in 'nodes' of the 'i'th active node, or 'n' if there are not that many active nodes.
+ Node 'skip' is not counted, so the index is the one before it is removed.
+ */
+static int _raw_index(XMLNode** nodes, int n, int i, int skip)
+{
+	int k;
+
+	for (k = 0; k < n; k++) {
+		if (k == skip || !nodes[k]->active)
+			continue;
+		if (i-- == 0)
+			break;
+	}
+	if (skip >= 0 && k > skip)
+		k--;
+
+	return k;
+}
+
+/*
+ Parse the positive integer at the beginning of 'str' into '*n' and return a pointer after it.
+ */
+static const SXML_CHAR* _parse_index(const SXML_CHAR* str, int* n)
+{
+	for (*n = 0; *str >= C2SX('0') && *str <= C2SX('9'); str++)
+		*n = *n * 10 + (int)(*str - C2SX('0'));
+
+	return str;
+}
+
+/*
+ Parse 'str' as a path and resolve it in 'doc'. '*father' is set to the father of the node at 'path'
+ ('NULL' for document nodes) and '*index' its active index.
+ */
+static int _resolve_path(XMLDoc* doc, const SXML_CHAR* str, XMLNode** father, int* index)
+{
+	int n;
+
+	*father = NULL;
+	if (str == NULL || *str == NULC)
+		return FALSE;
+
+	for (;;) {
+		str = _parse_index(str, &n);
+		if (*str == NULC)
+			break;
+		if (*str++ != C2SX('/'))
+			return FALSE;
+		if (*father == NULL) {
+			int k = _raw_index(doc->nodes, doc->n_nodes, n, -1);
+			if (k >= doc->n_nodes)
+				return FALSE;
+			*father = doc->nodes[k];
+		} else if ((*father = XMLNode_get_child(*father, n)) == NULL)
+			return FALSE;
+	}
+	*index = n;
+
+	return TRUE;
+}
+
+/*
+ Return the first active child of an edit node, which is the node to insert or update.
+ */
+static XMLNode* _get_payload(const XMLNode* edit)
+{
+	int i;
+
+	for (i = 0; i < edit->n_children; i++)
+		if (edit->children[i]->active)
+			return edit->children[i];
+
+	return NULL;
+}
+
+/*
+ Set 'node' tag, text and attributes to the ones of 'payload'.
+ */
+static int _update_node(XMLNode* node, const XMLNode* payload)
+{
+	int i;
+
+	if (_tag_type(node) != _tag_type(payload) && !XMLNode_set_type(node, payload->tag_type))
+		return FALSE;
+	if (payload->tag != NULL && (node->tag == NULL || sx_strcmp(node->tag, payload->tag)) && !XMLNode_set_tag(node, payload->tag))
+		return FALSE;
+	if (!_str_equal(node->text, payload->text) && !XMLNode_set_text(node, payload->text))
+		return FALSE;
+
+	if (_same_attributes(node, payload))
+		return TRUE;
+	if (!XMLNode_remove_all_attributes(node))
+		return FALSE;
+	for (i = 0; i < payload->n_attributes; i++)
+		if (payload->attributes[i].active && XMLNode_set_attribute(node, payload->attributes[i].name, payload->attributes[i].value) < 0)
+			return FALSE;
+
+	return TRUE;
+}
+
+int XMLDoc_patch(XMLDoc* doc, const XMLDoc* diff)
+{
+	XMLNode* root;
+	XMLNode* father;
+	XMLNode* edit;
+	XMLNode* node;
+	const SXML_CHAR* op;
+	int i, k, index, to, doc_changed = FALSE;
+
+	if (doc == NULL || diff == NULL || doc->init_value != XML_INIT_DONE || diff->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	root = XMLDoc_root(diff);
+	if (root == NULL || root->tag == NULL || sx_strcmp(root->tag, DIFF_TAG))
+		return FALSE;
+
+	for (i = 0; i < root->n_children; i++) {
+		edit = root->children[i];
+		if (!edit->active || edit->tag == NULL)
+			continue;
+		op = edit->tag;
+
+		k = XMLNode_search_attribute(edit, DIFF_PATH, 0);
+		if (k < 0 || !_resolve_path(doc, edit->attributes[k].value, &father, &index))
+			return FALSE;
+		if (father == NULL)
+			doc_changed = TRUE;
+
+		if (!sx_strcmp(op, DIFF_DELETE)) {
+			if (father == NULL) {
+				if (!XMLDoc_remove_node(doc, _raw_index(doc->nodes, doc->n_nodes, index, -1), TRUE))
+					return FALSE;
+			} else if (XMLNode_remove_child(father, index, TRUE) < 0)
+				return FALSE;
+
+		} else if (!sx_strcmp(op, DIFF_INSERT)) {
+			node = XMLNode_dup(_get_payload(edit), TRUE);
+			if (node == NULL)
+				return FALSE;
+			if (father == NULL) {
+				node->father = NULL;
+				k = _raw_index(doc->nodes, doc->n_nodes, index, -1);
+				if (XMLDoc_add_node(doc, node) < 0) {
+					(void)XMLNode_free(node);
+					__free(node);
+					return FALSE;
+				}
+				memmove(&doc->nodes[k+1], &doc->nodes[k], (doc->n_nodes - k - 1) * sizeof(XMLNode*));
+				doc->nodes[k] = node;
+			} else if (!XMLNode_insert_child(father, node, index)) {
+				(void)XMLNode_free(node);
+				__free(node);
+				return FALSE;
+			}
+
+		} else if (!sx_strcmp(op, DIFF_UPDATE)) {
+			if (father == NULL) {
+				k = _raw_index(doc->nodes, doc->n_nodes, index, -1);
+				node = (k < doc->n_nodes ? doc->nodes[k] : NULL);
+			} else
+				node = XMLNode_get_child(father, index);
+			if (node == NULL || _get_payload(edit) == NULL || !_update_node(node, _get_payload(edit)))
+				return FALSE;
+
+		} else if (!sx_strcmp(op, DIFF_MOVE)) {
+			XMLNode** nodes = (father == NULL ? doc->nodes : father->children);
+			int n = (father == NULL ? doc->n_nodes : father->n_children);
+			k = XMLNode_search_attribute(edit, DIFF_TO, 0);
+			if (k < 0 || edit->attributes[k].value == NULL)
+				return FALSE;
+			(void)_parse_index(edit->attributes[k].value, &to);
+			index = _raw_index(nodes, n, index, -1);
+			if (index >= n)
+				return FALSE;
+			to = _raw_index(nodes, n, to, index);
+			if (father != NULL)
+				(void)XMLNode_move_child(father, index, to);
+			else {
+				node = nodes[index];
+				if (to > index)
+					memmove(&nodes[index], &nodes[index+1], (to - index) * sizeof(XMLNode*));
+				else
+					memmove(&nodes[to+1], &nodes[to], (index - to) * sizeof(XMLNode*));
+				nodes[to] = node;
+			}
+
+		} else
+			return FALSE;
+	}
+
+	/* Root node is the first father node, as when parsing */
+	if (doc_changed) {
+		doc->i_root = -1;
+		for (i = 0; i < doc->n_nodes && doc->i_root < 0; i++)
+			if (doc->nodes[i]->active && (doc->nodes[i]->tag_type == TAG_FATHER || doc->nodes[i]->tag_type == TAG_SELF))
+				doc->i_root = i;
+	}
+
+	return TRUE;
+}
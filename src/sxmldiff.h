@@ -0,0 +1,86 @@
+/**
+	Copyright (c) 2010, Matthieu Labas
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without modification,
+	are permitted provided that the following conditions are met:
+
+	1. Redistributions of source code must retain the above copyright notice,
+	   this list of conditions and the following disclaimer.
+
+	2. Redistributions in binary form must reproduce the above copyright notice,
+	   this list of conditions and the following disclaimer in the documentation
+	   and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+	ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+	WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+	IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+	NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+	PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+	WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	OF SUCH DAMAGE.
+
+	The views and conclusions contained in the software and documentation are those of the
+	authors and should not be interpreted as representing official policies, either expressed
+	or implied, of the FreeBSD Project.
+*/
+#ifndef _SXMLCDIFF_H_
+#define _SXMLCDIFF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "sxmlc.h"
+
+/**
+ * \brief Compute the edit script transforming a document into another one.
+ *
+ * The edit script is itself an XML document, with a root node `<diff>` holding the edits
+ * to apply *in order*:
+ * - `<delete path="p"/>` removes the node at `p`;
+ * - `<insert path="p">node</insert>` inserts `node` (and its children) at `p`;
+ * - `<update path="p">node</update>` sets the tag, text and attributes of the node at `p`
+ * 		to the ones of `node` (its children are ignored);
+ * - `<move path="p" to="i"/>` moves the node at `p` among its siblings, to position `i`.
+ *
+ * Paths are the `/`-separated indexes of *active* nodes, starting with the index among
+ * the document nodes (e.g. `"1/0/3"` is the 4th child of the 1st child of the 2nd document node).
+ *
+ * Identical subtrees are detected through their hash (see `XMLNode_hash()`) and skipped
+ * without being compared, so unchanged parts of big documents are cheap to process.
+ * Siblings are matched by hash (moved nodes are detected), then by tag among the remaining
+ * ones, which are updated and compared recursively.
+ *
+ * The edit script can be printed with `XMLDoc_print()` to be sent and parsed elsewhere.
+ * It should then be printed *without* any formatting (`tag_sep` and `child_sep` empty or `NULL`)
+ * and parsed with the same `text_as_nodes` as the documents.
+ * \param from The original document.
+ * \param to The modified document.
+ * \param diff An initialized document to which the `<diff>` node is added (and set as root).
+ * 		Inserted and updated nodes share their content with `to` (see `XMLNode_dup()`).
+ * \return the number of edits (0 if documents are identical) or -1 for invalid documents
+ * 		or memory error.
+ */
+int XMLDoc_diff(const XMLDoc* from, const XMLDoc* to, XMLDoc* diff);
+
+/**
+ * \brief Apply an edit script computed by `XMLDoc_diff()`.
+ *
+ * After the patch, `doc` root node is its first active father node.
+ * \param doc The document to modify, which should be identical to the `from` document
+ * 		given to `XMLDoc_diff()`.
+ * \param diff The edit script.
+ * \return `false` if `diff` is invalid, does not apply to `doc` or for memory error (in which
+ * 		case `doc` is only partially patched), `true` otherwise.
+ */
+int XMLDoc_patch(XMLDoc* doc, const XMLDoc* diff);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -33,8 +33,14 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#ifdef SXMLC_UNICODE
+#include <wchar.h>
+#endif
 #include "sxmlc.h"
 #include "sxmlsearch.h"
+#include "sxmlc_thread.h"
 
 #define INVALID_XMLNODE_POINTER ((XMLNode*)-1)
 
@@ -59,486 +65,2599 @@ int XMLSearch_init(XMLSearch* search)
 	search->text = NULL;
 	search->attributes = NULL;
 	search->n_attributes = 0;
+	search->numbers = NULL;
+	search->n_numbers = 0;
 	search->next = NULL;
 	search->prev = NULL;
+	search->axis = XML_AXIS_CHILD;
+	search->position = 0;
+	search->compiled = NULL;
 	search->stop_at = INVALID_XMLNODE_POINTER; /* Because 'NULL' can be a valid value */
+	search->results = NULL;
 	search->init_value = XML_INIT_DONE;
 	
 	return TRUE;
 }
 
-int XMLSearch_free(XMLSearch* search, int free_next)
-{
-	int i;
-
-	if (search == NULL || search->init_value != XML_INIT_DONE)
-		return FALSE;
+/* --- Regular expressions --- */
 
-	if (search->tag != NULL) {
-		__free(search->tag);
-		search->tag = NULL;
-	}
+/*
+ Regular expressions of 'regexcmp()' are compiled into a program of a Thompson automaton, which is run on all its
+ states at once: each character of the string is read once, in time proportional to the size of the program.
+ Jumps are relative so that parts of a program can be moved or copied as they are.
+ */
+#define RE_CHAR 0		/* Character 'x' */
+#define RE_ANY 1		/* Any character */
+#define RE_CLASS 2		/* Character in the 'y' class ranges starting at range 'x' */
+#define RE_NCLASS 3		/* Character not in the 'y' class ranges starting at range 'x' */
+#define RE_BOL 4		/* Start of string */
+#define RE_EOL 5		/* End of string */
+#define RE_SPLIT 6		/* Go on at both 'pc + x' and 'pc + y' */
+#define RE_JMP 7		/* Go on at 'pc + x' */
+#define RE_MATCH 8
+
+#define RE_MAX_REPEAT 1000		/* Maximum count of '{m,n}' */
+#define RE_MAX_DEPTH 64			/* Maximum nesting of groups */
+#define RE_MAX_INSTS 100000		/* Maximum size of a program */
+#define RE_LOCAL_INSTS 64		/* Programs up to this size are run without allocating memory */
+
+typedef struct _ReInst {
+	int op;
+	int x, y;
+} _ReInst;
+
+typedef struct _Regex {
+	_ReInst* insts;
+	int n_insts;
+	int sz_insts;
+	SXML_CHAR* ranges;	/* First and last characters of each class range */
+	int n_ranges;
+	int sz_ranges;
+	int anchored;		/* Matches can only start at the start of the string */
+} _Regex;
+
+typedef struct _ReParser {
+	_Regex* re;
+	const SXML_CHAR* p;
+	int error;			/* 0, or -1 for memory error, or 1 for malformed pattern */
+} _ReParser;
+
+static void _regex_free(_Regex* re)
+{
+	if (re->insts != NULL)
+		__free(re->insts);
+	if (re->ranges != NULL)
+		__free(re->ranges);
+	re->insts = NULL;
+	re->ranges = NULL;
+}
 
-	if (search->attributes != NULL) {
-		for (i = 0; i < search->n_attributes; i++) {
-			if (search->attributes[i].name != NULL)
-				__free(search->attributes[i].name);
-			if (search->attributes[i].value != NULL)
-				__free(search->attributes[i].value);
-		}
-		__free(search->attributes);
-		search->n_attributes = 0;
-		search->attributes = NULL;
-	}
+/* Make room for 'n' more instructions. Return 'false' on error. */
+static int _re_reserve(_ReParser* ps, int n)
+{
+	_Regex* re = ps->re;
+	_ReInst* insts;
+	int sz;
 
-	if (search->text != NULL) {
-		__free(search->text);
-		search->text = NULL;
+	if (re->n_insts + n > RE_MAX_INSTS) {
+		ps->error = 1;
+		return FALSE;
 	}
-
-	if (free_next && search->next != NULL) {
-		(void)XMLSearch_free(search->next, TRUE);
-		__free(search->next);
-		search->next = NULL;
+	if (re->n_insts + n <= re->sz_insts)
+		return TRUE;
+	for (sz = (re->sz_insts < 16 ? 16 : re->sz_insts); sz < re->n_insts + n; sz *= 2) ;
+	insts = (_ReInst*)__realloc(re->insts, sz * sizeof(_ReInst));
+	if (insts == NULL) {
+		ps->error = -1;
+		return FALSE;
 	}
-	search->init_value = 0; /* Something not XML_INIT_DONE, otherwise we'll go into 'XMLSearch_free' again */
-	(void)XMLSearch_init(search);
+	re->insts = insts;
+	re->sz_insts = sz;
 
 	return TRUE;
 }
 
-int XMLSearch_search_set_tag(XMLSearch* search, const SXML_CHAR* tag)
+/* Insert an instruction at 'pc', moving the next ones. Return 'false' on error. */
+static int _re_insert(_ReParser* ps, int pc, int op, int x, int y)
 {
-	if (search == NULL)
+	_Regex* re = ps->re;
+
+	if (!_re_reserve(ps, 1))
 		return FALSE;
+	memmove(&re->insts[pc + 1], &re->insts[pc], (re->n_insts - pc) * sizeof(_ReInst));
+	re->insts[pc].op = op;
+	re->insts[pc].x = x;
+	re->insts[pc].y = y;
+	re->n_insts++;
 
-	if (tag == NULL) {
-		if (search->tag != NULL) {
-			__free(search->tag);
-			search->tag = NULL;
+	return TRUE;
+}
+
+#define _re_emit(ps, op, x, y) _re_insert((ps), (ps)->re->n_insts, (op), (x), (y))
+
+/* Add a class range. Return 'false' on error. */
+static int _re_range(_ReParser* ps, SXML_CHAR first, SXML_CHAR last)
+{
+	_Regex* re = ps->re;
+	SXML_CHAR* ranges;
+	int sz;
+
+	if (re->n_ranges >= re->sz_ranges) {
+		sz = (re->sz_ranges < 8 ? 8 : 2 * re->sz_ranges);
+		ranges = (SXML_CHAR*)__realloc(re->ranges, 2 * sz * sizeof(SXML_CHAR));
+		if (ranges == NULL) {
+			ps->error = -1;
+			return FALSE;
 		}
-		return TRUE;
+		re->ranges = ranges;
+		re->sz_ranges = sz;
 	}
+	re->ranges[2 * re->n_ranges] = first;
+	re->ranges[2 * re->n_ranges + 1] = last;
+	re->n_ranges++;
 
-	search->tag = sx_strdup(tag);
-	return (search->tag != NULL);
+	return TRUE;
 }
 
-int XMLSearch_search_set_text(XMLSearch* search, const SXML_CHAR* text)
+/*
+ Add the ranges of class escape 'c' ('\d', '\w' or '\s', in any case).
+ Return 1 if 'c' is a negated class ('\D', '\W' or '\S'), 0 if it is not, -1 if 'c' is not a class or on error
+ (with 'ps->error' set).
+ */
+static int _re_escape_class(_ReParser* ps, SXML_CHAR c)
 {
-	if (search == NULL)
-		return FALSE;
-
-	if (text == NULL) {
-		if (search->text != NULL) {
-			__free(search->text);
-			search->text = NULL;
-		}
-		return TRUE;
+	switch (c) {
+		case C2SX('d'): case C2SX('D'):
+			if (!_re_range(ps, C2SX('0'), C2SX('9')))
+				return -1;
+			break;
+		case C2SX('w'): case C2SX('W'):
+			if (!_re_range(ps, C2SX('a'), C2SX('z')) || !_re_range(ps, C2SX('A'), C2SX('Z'))
+				|| !_re_range(ps, C2SX('0'), C2SX('9')) || !_re_range(ps, C2SX('_'), C2SX('_')))
+				return -1;
+			break;
+		case C2SX('s'): case C2SX('S'):
+			if (!_re_range(ps, C2SX(' '), C2SX(' ')) || !_re_range(ps, C2SX('\t'), C2SX('\r')))
+				return -1;
+			break;
+		default:
+			return -1;
 	}
 
-	search->text = sx_strdup(text);
-	return (search->text != NULL);
+	return (c == C2SX('D') || c == C2SX('W') || c == C2SX('S')) ? 1 : 0;
 }
 
-int XMLSearch_search_add_attribute(XMLSearch* search, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value, int value_equal)
+/* Character escaped by '\c' */
+static SXML_CHAR _re_escape_char(SXML_CHAR c)
 {
-	int i;
-	XMLAttribute* pt;
-	SXML_CHAR* name;
-	SXML_CHAR* value;
+	switch (c) {
+		case C2SX('n'): return C2SX('\n');
+		case C2SX('t'): return C2SX('\t');
+		case C2SX('r'): return C2SX('\r');
+		default: return c;
+	}
+}
 
-	if (search == NULL)
-		return -1;
+/* Read a character of a class, escaped or not, into '*c'. Return 'false' if the pattern ends. */
+static int _re_class_char(_ReParser* ps, SXML_CHAR* c)
+{
+	*c = *ps->p++;
+	if (*c == C2SX('\\'))
+		*c = _re_escape_char(*ps->p++);
+	if (*c != NULC)
+		return TRUE;
+	ps->error = 1;
 
-	if (attr_name == NULL || attr_name[0] == NULC)
-		return -1;
+	return FALSE;
+}
 
-	name = sx_strdup(attr_name);
-	value = (attr_value == NULL ? NULL : sx_strdup(attr_value));
-	if (name == NULL || (attr_value && value == NULL)) {
-		if (value != NULL)
-			__free(value);
-		if (name != NULL)
-			__free(name);
-	}
+/* Parse a class after its '['. Return 'false' on error. */
+static int _re_parse_class(_ReParser* ps)
+{
+	int first = ps->re->n_ranges, negate = FALSE;
+	SXML_CHAR c, last;
 
-	i = search->n_attributes;
-	pt = (XMLAttribute*)__realloc(search->attributes, (i + 1) * sizeof(XMLAttribute));
-	if (pt == NULL) {
-		if (value)
-			__free(value);
-		__free(name);
-		return -1;
+	if (*ps->p == C2SX('^')) {
+		negate = TRUE;
+		ps->p++;
+	}
+	do {
+		/* Class escapes, except negated ones which cannot be merged with other ranges */
+		if (ps->p[0] == C2SX('\\') && _re_escape_class(ps, ps->p[1]) >= 0) {
+			if (ps->p[1] == C2SX('D') || ps->p[1] == C2SX('W') || ps->p[1] == C2SX('S')) {
+				ps->error = 1;
+				return FALSE;
+			}
+			ps->p += 2;
+			continue;
+		}
+		if (ps->error != 0 || !_re_class_char(ps, &c))
+			return FALSE;
+		last = c;
+		if (ps->p[0] == C2SX('-') && ps->p[1] != C2SX(']') && ps->p[1] != NULC) {
+			ps->p++;
+			if (!_re_class_char(ps, &last))
+				return FALSE;
+			if (last < c) {
+				ps->error = 1;
+				return FALSE;
+			}
+		}
+		if (!_re_range(ps, c, last))
+			return FALSE;
+	} while (*ps->p != C2SX(']') && *ps->p != NULC);
+	if (*ps->p != C2SX(']')) {
+		ps->error = 1;
+		return FALSE;
 	}
+	ps->p++;
 
-	pt[i].name = name;
-	pt[i].value = value;
-	pt[i].active = value_equal;
+	return _re_emit(ps, negate ? RE_NCLASS : RE_CLASS, first, ps->re->n_ranges - first);
+}
 
-	search->n_attributes = i+1;
-	search->attributes = pt;
+/* Make the instructions from 'start' match zero or more times. Return 'false' on error. */
+static int _re_star(_ReParser* ps, int start)
+{
+	int len = ps->re->n_insts - start;
 
-	return i;
+	return _re_insert(ps, start, RE_SPLIT, 1, len + 2) && _re_emit(ps, RE_JMP, -(len + 1), 0);
 }
 
-int XMLSearch_search_get_attribute_index(const XMLSearch* search, const SXML_CHAR* attr_name)
+/* Make the instructions from 'start' match one or more times. Return 'false' on error. */
+static int _re_plus(_ReParser* ps, int start)
 {
-	int i;
+	return _re_emit(ps, RE_SPLIT, start - ps->re->n_insts, 1);
+}
 
-	if (search == NULL || attr_name == NULL || attr_name[0] == NULC)
-		return -1;
+/* Make the instructions from 'start' optional. Return 'false' on error. */
+static int _re_optional(_ReParser* ps, int start)
+{
+	return _re_insert(ps, start, RE_SPLIT, 1, ps->re->n_insts - start + 1);
+}
 
-	for (i = 0; i < search->n_attributes; i++) {
-		if (!sx_strcmp(search->attributes[i].name, attr_name))
-			return i;
+/* Read a repetition count. Return it, or -1 if there is none. */
+static int _re_count(_ReParser* ps)
+{
+	int n = -1;
+
+	for (; *ps->p >= C2SX('0') && *ps->p <= C2SX('9'); ps->p++) {
+		n = (n < 0 ? 0 : 10 * n) + (*ps->p - C2SX('0'));
+		if (n > RE_MAX_REPEAT)
+			return RE_MAX_REPEAT + 1;
 	}
 
-	return -1;
+	return n;
 }
 
-int XMLSearch_search_remove_attribute(XMLSearch* search, int i_attr)
+/* Repeat the instructions from 'start' according to '{m}', '{m,}' or '{m,n}', after its '{'. Return 'false' on error. */
+static int _re_repeat(_ReParser* ps, int start)
 {
-	XMLAttribute* pt;
-
-	if (search == NULL || i_attr < 0 || i_attr >= search->n_attributes)
-		return -1;
-
-	/* Free attribute fields first */
-	if (search->n_attributes == 1)
-		pt = NULL;
-	else {
-		pt = (XMLAttribute*)__malloc((search->n_attributes - 1) * sizeof(XMLAttribute));
-		if (pt == NULL)
-			return -1;
+	_Regex* re = ps->re;
+	_ReInst* frag;
+	int i, min, max, len, last;
+
+	min = max = _re_count(ps);
+	if (*ps->p == C2SX(',')) {
+		ps->p++;
+		max = (*ps->p == C2SX('}') ? -2 : _re_count(ps)); /* -2 for no maximum */
 	}
-	if (search->attributes[i_attr].name != NULL)
-		__free(search->attributes[i_attr].name);
-	if (search->attributes[i_attr].value != NULL)
-		__free(search->attributes[i_attr].value);
+	if (*ps->p != C2SX('}') || min < 0 || min > RE_MAX_REPEAT || max == -1 || max > RE_MAX_REPEAT || (max >= 0 && max < min)) {
+		ps->error = 1;
+		return FALSE;
+	}
+	ps->p++;
 
-	if (pt != NULL) {
-		memcpy(pt, search->attributes, i_attr * sizeof(XMLAttribute));
-		memcpy(&pt[i_attr], &search->attributes[i_attr + 1], (search->n_attributes - i_attr - 1) * sizeof(XMLAttribute));
+	/* Copies of the instructions are appended, which is possible as jumps are relative */
+	len = re->n_insts - start;
+	frag = (_ReInst*)__malloc((len > 0 ? len : 1) * sizeof(_ReInst));
+	if (frag == NULL) {
+		ps->error = -1;
+		return FALSE;
 	}
-	if (search->attributes)
-		__free(search->attributes);
-	search->attributes = pt;
-	search->n_attributes--;
+	memcpy(frag, &re->insts[start], len * sizeof(_ReInst));
+	re->n_insts = start;
+	for (i = 0, last = start; i < min && _re_reserve(ps, len); i++) {
+		last = re->n_insts;
+		memcpy(&re->insts[last], frag, len * sizeof(_ReInst));
+		re->n_insts += len;
+	}
+	if (ps->error == 0 && max == -2) {
+		if (min > 0)
+			(void)_re_plus(ps, last);
+		else if (_re_reserve(ps, len)) {
+			memcpy(&re->insts[start], frag, len * sizeof(_ReInst));
+			re->n_insts += len;
+			(void)_re_star(ps, start);
+		}
+	}
+	for (i = min; ps->error == 0 && i < max && _re_reserve(ps, len); i++) {
+		last = re->n_insts;
+		memcpy(&re->insts[last], frag, len * sizeof(_ReInst));
+		re->n_insts += len;
+		(void)_re_optional(ps, last);
+	}
+	__free(frag);
 
-	return search->n_attributes;
+	return ps->error == 0;
 }
 
-int XMLSearch_search_set_children_search(XMLSearch* search, XMLSearch* children_search)
+static int _re_parse_alternation(_ReParser* ps, int depth);
+
+/* Parse an atom and its repetitions. Return 'false' on error. */
+static int _re_parse_repetition(_ReParser* ps, int depth)
 {
-	if (search == NULL)
-		return FALSE;
+	int start = ps->re->n_insts, first, ok, neg;
+	SXML_CHAR c = *ps->p++;
 
-	if (search->next != NULL)
-		XMLSearch_free(search->next, TRUE);
+	switch (c) {
+		case C2SX('('):
+			if (depth >= RE_MAX_DEPTH) {
+				ps->error = 1;
+				return FALSE;
+			}
+			if (!_re_parse_alternation(ps, depth + 1))
+				return FALSE;
+			if (*ps->p != C2SX(')')) {
+				ps->error = 1;
+				return FALSE;
+			}
+			ps->p++;
+			ok = TRUE;
+			break;
+		case C2SX('.'):
+			ok = _re_emit(ps, RE_ANY, 0, 0);
+			break;
+		case C2SX('^'):
+			ok = _re_emit(ps, RE_BOL, 0, 0);
+			break;
+		case C2SX('$'):
+			ok = _re_emit(ps, RE_EOL, 0, 0);
+			break;
+		case C2SX('['):
+			ok = _re_parse_class(ps);
+			break;
+		case C2SX('\\'):
+			c = *ps->p++;
+			if (c == NULC) {
+				ps->error = 1;
+				return FALSE;
+			}
+			first = ps->re->n_ranges;
+			neg = _re_escape_class(ps, c);
+			if (neg >= 0)
+				ok = _re_emit(ps, neg ? RE_NCLASS : RE_CLASS, first, ps->re->n_ranges - first);
+			else
+				ok = (ps->error == 0 && _re_emit(ps, RE_CHAR, _re_escape_char(c), 0));
+			break;
+		case C2SX('*'): case C2SX('+'): case C2SX('?'): case C2SX('{'):
+			ps->error = 1;
+			return FALSE;
+		default:
+			ok = _re_emit(ps, RE_CHAR, c, 0);
+			break;
+	}
 
-	search->next = children_search;
-	children_search->prev = search;
+	while (ok) {
+		c = *ps->p;
+		if (c == C2SX('*'))
+			ok = _re_star(ps, start);
+		else if (c == C2SX('+'))
+			ok = _re_plus(ps, start);
+		else if (c == C2SX('?'))
+			ok = _re_optional(ps, start);
+		else if (c == C2SX('{')) {
+			ps->p++;
+			ok = _re_repeat(ps, start);
+			continue;
+		} else
+			break;
+		ps->p++;
+	}
 
-	return TRUE;
+	return ok;
 }
 
-SXML_CHAR* XMLSearch_get_XPath_string(const XMLSearch* search, SXML_CHAR** xpath, SXML_CHAR quote)
+/* Parse alternatives separated by '|', up to the end of the pattern or of the group. Return 'false' on error. */
+static int _re_parse_alternation(_ReParser* ps, int depth)
 {
-	const XMLSearch* s;
-	SXML_CHAR squote[] = C2SX("'");
-	int i, fill;
-
-	if (xpath == NULL)
-		return NULL;
+	int start = ps->re->n_insts, jmp;
 
-	/* NULL 'search' is an empty string */
-	if (search == NULL) {
-		*xpath = sx_strdup(C2SX(""));
-		if (*xpath == NULL)
-			return NULL;
+	for (;;) {
+		while (*ps->p != NULC && *ps->p != C2SX('|') && *ps->p != C2SX(')')) {
+			if (!_re_parse_repetition(ps, depth))
+				return FALSE;
+		}
+		if (*ps->p != C2SX('|'))
+			return TRUE;
+		ps->p++;
 
-		return *xpath;
+		/* Previous alternatives are tried with the next one, and jump after it */
+		if (!_re_insert(ps, start, RE_SPLIT, 1, ps->re->n_insts - start + 2))
+			return FALSE;
+		jmp = ps->re->n_insts;
+		if (!_re_emit(ps, RE_JMP, 0, 0))
+			return FALSE;
+		while (*ps->p != NULC && *ps->p != C2SX('|') && *ps->p != C2SX(')')) {
+			if (!_re_parse_repetition(ps, depth))
+				return FALSE;
+		}
+		ps->re->insts[jmp].x = ps->re->n_insts - jmp;
 	}
+}
 
-	squote[0] = (quote == NULC ? XML_DEFAULT_QUOTE : quote);
-
-	for (s = search; s != NULL; s = s->next) {
-		if (s != search && strcat_alloc(xpath, C2SX("/")) == NULL) goto err; /* No "/" prefix for the first criteria */
-		if (strcat_alloc(xpath, s->tag == NULL || s->tag[0] == NULC ? C2SX("*"): s->tag) == NULL) goto err;
+/*
+ Compile 'pattern' into 're', which should be freed with '_regex_free()' in any case.
+ Return 1 on success, 0 for malformed pattern or -1 for memory error.
+ */
+static int _regex_compile(_Regex* re, const SXML_CHAR* pattern)
+{
+	_ReParser ps;
 
-		if (s->n_attributes > 0 || (s->text != NULL && s->text[0] != NULC))
-			if (strcat_alloc(xpath, C2SX("[")) == NULL) goto err;
+	memset(re, 0, sizeof(_Regex));
+	ps.re = re;
+	ps.p = pattern;
+	ps.error = 0;
+	if (!_re_parse_alternation(&ps, 0) || *ps.p != NULC || !_re_emit(&ps, RE_MATCH, 0, 0))
+		return ps.error < 0 ? -1 : 0;
+	re->anchored = (re->insts[0].op == RE_BOL);
 
-		fill = FALSE; /* '[' has not been filled with text yet, no ", " separator should be added */
-		if (s->text != NULL && s->text[0] != NULC) {
-			if (strcat_alloc(xpath, C2SX(".=")) == NULL) goto err;
-			if (strcat_alloc(xpath, squote) == NULL) goto err;
-			if (strcat_alloc(xpath, s->text) == NULL) goto err;
-			if (strcat_alloc(xpath, squote) == NULL) goto err;
-			fill = TRUE;
-		}
+	return 1;
+}
 
-		for (i = 0; i < s->n_attributes; i++) {
-			if (fill) {
-				if (strcat_alloc(xpath, C2SX(", ")) == NULL) goto err;
-			} else
-				fill = TRUE; /* filling is being performed */
-			if (strcat_alloc(xpath, C2SX("@")) == NULL) goto err;
-			if (strcat_alloc(xpath, s->attributes[i].name) == NULL) goto err;
-			if (s->attributes[i].value == NULL) continue;
+/*
+ Add to 'list' (of 'n' states) the states reached from state 'pc' without reading a character, unless they are
+ already marked with 'gen'. 'bol' and 'eol' tell whether the current position is the start or end of the string.
+ Return the new number of states.
+ */
+static int _regex_add(const _Regex* re, int* list, int n, int* marks, int* stack, int pc, int gen, int bol, int eol)
+{
+	const _ReInst* inst;
+	int sp = 0;
 
-			if (strcat_alloc(xpath, s->attributes[i].active ? C2SX("=") : C2SX("!=")) == NULL) goto err;
-			if (strcat_alloc(xpath, squote) == NULL) goto err;
-			if (strcat_alloc(xpath, s->attributes[i].value) == NULL) goto err;
-			if (strcat_alloc(xpath, squote) == NULL) goto err;
-		}
-		if ((s->text != NULL && s->text[0] != NULC) || s->n_attributes > 0) {
-			if (strcat_alloc(xpath, C2SX("]")) == NULL) goto err;
+	stack[sp++] = pc;
+	while (sp > 0) {
+		pc = stack[--sp];
+		if (marks[pc] == gen)
+			continue;
+		marks[pc] = gen;
+		inst = &re->insts[pc];
+		switch (inst->op) {
+			case RE_JMP:
+				stack[sp++] = pc + inst->x;
+				break;
+			case RE_SPLIT:
+				stack[sp++] = pc + inst->y;
+				stack[sp++] = pc + inst->x;
+				break;
+			case RE_BOL:
+				if (bol)
+					stack[sp++] = pc + 1;
+				break;
+			case RE_EOL:
+				if (eol)
+					stack[sp++] = pc + 1;
+				break;
+			default:
+				list[n++] = pc;
+				break;
 		}
 	}
 
-	return *xpath;
+	return n;
+}
 
-err:
-	__free(*xpath);
-	*xpath = NULL;
+/* Check whether character 'c' is in the 'n' class ranges of 're' starting at range 'first' */
+static int _regex_in_class(const _Regex* re, int first, int n, SXML_CHAR c)
+{
+	const SXML_CHAR* r;
+
+	for (r = &re->ranges[2 * first]; n > 0; n--, r += 2) {
+		if (c >= r[0] && c <= r[1])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Check whether a part of 'str' matches 're' (or memory error) */
+static int _regex_matches(const _Regex* re, const SXML_CHAR* str)
+{
+	int local[5 * RE_LOCAL_INSTS + 1];
+	int *buf, *clist, *nlist, *marks, *stack, *t;
+	int i, n_c, n_n, pc, ret = FALSE;
+	const _ReInst* inst;
+	const SXML_CHAR* s;
+
+	/* Current and next states, marks of the position a state was last added at, stack to follow jumps */
+	buf = (re->n_insts <= RE_LOCAL_INSTS ? local : (int*)__malloc((5 * re->n_insts + 1) * sizeof(int)));
+	if (buf == NULL)
+		return FALSE;
+	clist = buf;
+	nlist = clist + re->n_insts;
+	marks = nlist + re->n_insts;
+	stack = marks + re->n_insts;
+	for (i = 0; i < re->n_insts; i++)
+		marks[i] = -1;
+
+	n_c = _regex_add(re, clist, 0, marks, stack, 0, 0, TRUE, *str == NULC);
+	for (s = str; n_c > 0 || !re->anchored; s++) {
+		for (i = 0; i < n_c && re->insts[clist[i]].op != RE_MATCH; i++) ;
+		if (i < n_c) {
+			ret = TRUE;
+			break;
+		}
+		if (*s == NULC)
+			break;
+		for (i = 0, n_n = 0; i < n_c; i++) {
+			pc = clist[i];
+			inst = &re->insts[pc];
+			if (inst->op == RE_ANY || (inst->op == RE_CHAR && *s == (SXML_CHAR)inst->x)
+				|| (inst->op == RE_CLASS && _regex_in_class(re, inst->x, inst->y, *s))
+				|| (inst->op == RE_NCLASS && !_regex_in_class(re, inst->x, inst->y, *s)))
+				n_n = _regex_add(re, nlist, n_n, marks, stack, pc + 1, (int)(s - str) + 1, FALSE, s[1] == NULC);
+		}
+		/* A match can start at any position */
+		if (!re->anchored)
+			n_n = _regex_add(re, nlist, n_n, marks, stack, 0, (int)(s - str) + 1, FALSE, s[1] == NULC);
+		t = clist;
+		clist = nlist;
+		nlist = t;
+		n_c = n_n;
+	}
+	if (buf != local)
+		__free(buf);
+
+	return ret;
+}
+
+int regexcmp(SXML_CHAR* str, SXML_CHAR* pattern)
+{
+	_Regex re;
+	int ret;
+
+	if (str == NULL && pattern == NULL)
+		return TRUE;
+
+	if (str == NULL || pattern == NULL)
+		return FALSE;
+
+	ret = (_regex_compile(&re, pattern) == 1 && _regex_matches(&re, str));
+	_regex_free(&re);
+
+	return ret;
+}
+
+/* --- Compiled patterns --- */
+
+/* Kinds of compiled patterns */
+#define PATTERN_EXACT 0		/* "abc" */
+#define PATTERN_PREFIX 1	/* "abc*" */
+#define PATTERN_SUFFIX 2	/* "*abc" */
+#define PATTERN_CONTAINS 3	/* "*abc*" */
+#define PATTERN_ANY 4		/* "*", or no pattern */
+#define PATTERN_GLOB 5		/* Anything else, matched with 'regstrcmp()' */
+#define PATTERN_REGEX 6		/* Regular expression of 'regexcmp()' other than a literal */
+#define PATTERN_NONE 7		/* Malformed regular expression, which never matches */
+
+typedef struct _Pattern {
+	int kind;
+	SXML_CHAR* lit;		/* Literal part of the pattern, NULL for 'PATTERN_ANY', 'PATTERN_GLOB', 'PATTERN_REGEX' and 'PATTERN_NONE' */
+	size_t len;			/* Number of characters in 'lit' */
+	SXML_CHAR* glob;	/* The pattern itself, owned by the search */
+	_Regex* re;			/* Compiled 'PATTERN_REGEX', NULL otherwise */
+} _Pattern;
+
+/* Patterns of a search: tag, text, then name and value of each attribute */
+struct _XMLSearchCompiled {
+	REGEXPR_COMPARE cmp;	/* Matching function the patterns were compiled for ('regstrcmp' or 'regexcmp') */
+	int n;
+	_Pattern patterns[1];
+};
+
+/* Nodes found by 'XMLSearch_next()' for searches evaluated one step at a time, kept in the last search */
+struct _XMLSearchResults {
+	XMLNode** nodes;	/* In document order */
+	int n;
+	int size;
+	int next;			/* Index of the node to return next */
+};
+
+#define PATTERN_TAG 0
+#define PATTERN_TEXT 1
+#define PATTERN_ATTR_NAME(i) (2 + 2 * (i))
+#define PATTERN_ATTR_VALUE(i) (3 + 2 * (i))
+
+/*
+ Classify 'pattern' into 'pat'.
+ Return 'false' for memory error.
+ */
+static int _pattern_compile(_Pattern* pat, SXML_CHAR* pattern)
+{
+	SXML_CHAR *p, *start, *end;
+
+	pat->kind = PATTERN_ANY;
+	pat->lit = NULL;
+	pat->len = 0;
+	pat->glob = pattern;
+	pat->re = NULL;
+	if (pattern == NULL)
+		return TRUE;
+
+	/* A literal without wildcards nor escapes, between optional '*' */
+	for (start = pattern; *start == C2SX('*'); start++) ;
+	for (end = start; *end != NULC && *end != C2SX('*') && *end != C2SX('?') && *end != C2SX('\\'); end++) ;
+	for (p = end; *p == C2SX('*'); p++) ;
+	if (*p != NULC) {
+		pat->kind = PATTERN_GLOB;
+		return TRUE;
+	}
+	if (end == start && start != pattern) /* Only '*' */
+		return TRUE;
+
+	pat->len = end - start;
+	pat->lit = (SXML_CHAR*)__malloc((pat->len + 1) * sizeof(SXML_CHAR));
+	if (pat->lit == NULL)
+		return FALSE;
+	memcpy(pat->lit, start, pat->len * sizeof(SXML_CHAR));
+	pat->lit[pat->len] = NULC;
+	if (start == pattern)
+		pat->kind = (*end == NULC ? PATTERN_EXACT : PATTERN_PREFIX);
+	else
+		pat->kind = (*end == NULC ? PATTERN_SUFFIX : PATTERN_CONTAINS);
+
+	return TRUE;
+}
+
+/*
+ Same as '_pattern_compile()' for 'regexcmp()': literals between optional anchors are classified the same way,
+ other patterns are compiled into a program.
+ Return 'false' for memory error.
+ */
+static int _pattern_compile_regex(_Pattern* pat, SXML_CHAR* pattern)
+{
+	const SXML_CHAR *start, *end;
+	int bol, eol;
+
+	pat->kind = PATTERN_ANY;
+	pat->lit = NULL;
+	pat->len = 0;
+	pat->glob = pattern;
+	pat->re = NULL;
+	if (pattern == NULL)
+		return TRUE;
+
+	bol = (*pattern == C2SX('^'));
+	start = pattern + bol;
+	for (end = start; *end != NULC && sx_strchr(C2SX(".[]()|*+?{}^$\\"), *end) == NULL; end++) ;
+	eol = (end[0] == C2SX('$') && end[1] == NULC);
+	if (*end == NULC || eol) {
+		if (end == start && !(bol && eol)) /* Matches any string */
+			return TRUE;
+		pat->len = end - start;
+		pat->lit = (SXML_CHAR*)__malloc((pat->len + 1) * sizeof(SXML_CHAR));
+		if (pat->lit == NULL)
+			return FALSE;
+		memcpy(pat->lit, start, pat->len * sizeof(SXML_CHAR));
+		pat->lit[pat->len] = NULC;
+		if (bol)
+			pat->kind = (eol ? PATTERN_EXACT : PATTERN_PREFIX);
+		else
+			pat->kind = (eol ? PATTERN_SUFFIX : PATTERN_CONTAINS);
+		return TRUE;
+	}
+
+	pat->re = (_Regex*)__malloc(sizeof(_Regex));
+	if (pat->re == NULL)
+		return FALSE;
+	switch (_regex_compile(pat->re, pattern)) {
+		case 1:
+			pat->kind = PATTERN_REGEX;
+			return TRUE;
+		case 0:
+			pat->kind = PATTERN_NONE;
+			_regex_free(pat->re);
+			__free(pat->re);
+			pat->re = NULL;
+			return TRUE;
+		default:
+			_regex_free(pat->re);
+			__free(pat->re);
+			pat->re = NULL;
+			return FALSE;
+	}
+}
+
+/* Same as 'regstrcmp(str, pat->glob)' or 'regexcmp(str, pat->glob)', 'pat->glob' not being NULL */
+static int _pattern_matches(const _Pattern* pat, const SXML_CHAR* str)
+{
+	size_t n;
+
+	if (str == NULL)
+		return FALSE;
+
+	switch (pat->kind) {
+		case PATTERN_EXACT:
+			return sx_strcmp(str, pat->lit) == 0;
+
+		case PATTERN_PREFIX:
+			return sx_strncmp(str, pat->lit, pat->len) == 0;
+
+		case PATTERN_SUFFIX:
+			n = sx_strlen(str);
+			return n >= pat->len && sx_strcmp(str + n - pat->len, pat->lit) == 0;
+
+		case PATTERN_CONTAINS:
+			return sx_strstr(str, pat->lit) != NULL;
+
+		case PATTERN_ANY:
+			return TRUE;
+
+		case PATTERN_REGEX:
+			return _regex_matches(pat->re, str);
+
+		case PATTERN_NONE:
+			return FALSE;
+
+		default:
+			return regstrcmp((SXML_CHAR*)str, pat->glob);
+	}
+}
+
+/* Match 'str' to 'pattern', with its compiled pattern #'i' in 'c' when 'c' is not NULL */
+#define _MATCHES(c, i, str, pattern, cmp) ((c) != NULL ? _pattern_matches(&(c)->patterns[i], str) : (cmp)(str, pattern))
+
+/* Free the compiled patterns of 'search' (not its next searches) */
+static void _search_uncompile(XMLSearch* search)
+{
+	int i;
+
+	if (search->compiled == NULL)
+		return;
+
+	for (i = 0; i < search->compiled->n; i++) {
+		if (search->compiled->patterns[i].lit != NULL)
+			__free(search->compiled->patterns[i].lit);
+		if (search->compiled->patterns[i].re != NULL) {
+			_regex_free(search->compiled->patterns[i].re);
+			__free(search->compiled->patterns[i].re);
+		}
+	}
+	__free(search->compiled);
+	search->compiled = NULL;
+}
+
+/*
+ Compile 'search' and its next searches for matching function 'cmp', unless they already are.
+ Return 'false' for invalid 'search', memory error or when 'cmp' cannot be compiled.
+ */
+static int _search_compile(XMLSearch* search, REGEXPR_COMPARE cmp)
+{
+	struct _XMLSearchCompiled* c;
+	int (*compile)(_Pattern*, SXML_CHAR*);
+	int i, ok;
+
+	if (search == NULL || search->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	if (cmp == regstrcmp)
+		compile = _pattern_compile;
+	else if (cmp == regexcmp)
+		compile = _pattern_compile_regex;
+	else
+		return FALSE;
+
+	for ( ; search != NULL; search = search->next) {
+		if (search->compiled != NULL && search->compiled->cmp == cmp)
+			continue;
+		_search_uncompile(search);
+		c = (struct _XMLSearchCompiled*)__malloc(sizeof(struct _XMLSearchCompiled) + (1 + 2 * search->n_attributes) * sizeof(_Pattern));
+		if (c == NULL)
+			return FALSE;
+		c->cmp = cmp;
+		c->n = 0;
+		ok = compile(&c->patterns[c->n++], search->tag) && compile(&c->patterns[c->n++], search->text);
+		for (i = 0; ok && i < search->n_attributes; i++)
+			ok = compile(&c->patterns[c->n++], search->attributes[i].name) && compile(&c->patterns[c->n++], search->attributes[i].value);
+		search->compiled = c;
+		if (!ok) {
+			_search_uncompile(search);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+int XMLSearch_compile(XMLSearch* search)
+{
+	return _search_compile(search, regstrcmp_search == regexcmp ? regexcmp : regstrcmp);
+}
+
+int XMLSearch_free(XMLSearch* search, int free_next)
+{
+	int i;
+
+	if (search == NULL || search->init_value != XML_INIT_DONE)
+		return FALSE;
+
+	_search_uncompile(search);
+
+	if (search->tag != NULL) {
+		__free(search->tag);
+		search->tag = NULL;
+	}
+
+	if (search->attributes != NULL) {
+		for (i = 0; i < search->n_attributes; i++) {
+			if (search->attributes[i].name != NULL)
+				__free(search->attributes[i].name);
+			if (search->attributes[i].value != NULL)
+				__free(search->attributes[i].value);
+		}
+		__free(search->attributes);
+		search->n_attributes = 0;
+		search->attributes = NULL;
+	}
+
+	if (search->text != NULL) {
+		__free(search->text);
+		search->text = NULL;
+	}
+
+	if (search->numbers != NULL) {
+		for (i = 0; i < search->n_numbers; i++)
+			__free(search->numbers[i].name);
+		__free(search->numbers);
+		search->n_numbers = 0;
+		search->numbers = NULL;
+	}
+
+	if (search->results != NULL) {
+		if (search->results->nodes != NULL)
+			__free(search->results->nodes);
+		__free(search->results);
+		search->results = NULL;
+	}
+
+	if (free_next && search->next != NULL) {
+		(void)XMLSearch_free(search->next, TRUE);
+		__free(search->next);
+		search->next = NULL;
+	}
+	search->init_value = 0; /* Something not XML_INIT_DONE, otherwise we'll go into 'XMLSearch_free' again */
+	(void)XMLSearch_init(search);
+
+	return TRUE;
+}
+
+int XMLSearch_search_set_tag(XMLSearch* search, const SXML_CHAR* tag)
+{
+	if (search == NULL)
+		return FALSE;
+
+	_search_uncompile(search);
+
+	if (tag == NULL) {
+		if (search->tag != NULL) {
+			__free(search->tag);
+			search->tag = NULL;
+		}
+		return TRUE;
+	}
+
+	search->tag = sx_strdup(tag);
+	return (search->tag != NULL);
+}
+
+int XMLSearch_search_set_text(XMLSearch* search, const SXML_CHAR* text)
+{
+	if (search == NULL)
+		return FALSE;
+
+	_search_uncompile(search);
+
+	if (text == NULL) {
+		if (search->text != NULL) {
+			__free(search->text);
+			search->text = NULL;
+		}
+		return TRUE;
+	}
+
+	search->text = sx_strdup(text);
+	return (search->text != NULL);
+}
+
+int XMLSearch_search_add_attribute(XMLSearch* search, const SXML_CHAR* attr_name, const SXML_CHAR* attr_value, int value_equal)
+{
+	int i;
+	XMLAttribute* pt;
+	SXML_CHAR* name;
+	SXML_CHAR* value;
+
+	if (search == NULL)
+		return -1;
+
+	if (attr_name == NULL || attr_name[0] == NULC)
+		return -1;
+
+	name = sx_strdup(attr_name);
+	value = (attr_value == NULL ? NULL : sx_strdup(attr_value));
+	if (name == NULL || (attr_value && value == NULL)) {
+		if (value != NULL)
+			__free(value);
+		if (name != NULL)
+			__free(name);
+	}
+
+	_search_uncompile(search);
+	i = search->n_attributes;
+	pt = (XMLAttribute*)__realloc(search->attributes, (i + 1) * sizeof(XMLAttribute));
+	if (pt == NULL) {
+		if (value)
+			__free(value);
+		__free(name);
+		return -1;
+	}
+
+	pt[i].name = name;
+	pt[i].value = value;
+	pt[i].active = value_equal;
+
+	search->n_attributes = i+1;
+	search->attributes = pt;
+
+	return i;
+}
+
+int XMLSearch_search_get_attribute_index(const XMLSearch* search, const SXML_CHAR* attr_name)
+{
+	int i;
+
+	if (search == NULL || attr_name == NULL || attr_name[0] == NULC)
+		return -1;
+
+	for (i = 0; i < search->n_attributes; i++) {
+		if (!sx_strcmp(search->attributes[i].name, attr_name))
+			return i;
+	}
+
+	return -1;
+}
+
+int XMLSearch_search_remove_attribute(XMLSearch* search, int i_attr)
+{
+	XMLAttribute* pt;
+
+	if (search == NULL || i_attr < 0 || i_attr >= search->n_attributes)
+		return -1;
+
+	/* Free attribute fields first */
+	if (search->n_attributes == 1)
+		pt = NULL;
+	else {
+		pt = (XMLAttribute*)__malloc((search->n_attributes - 1) * sizeof(XMLAttribute));
+		if (pt == NULL)
+			return -1;
+	}
+	_search_uncompile(search);
+	if (search->attributes[i_attr].name != NULL)
+		__free(search->attributes[i_attr].name);
+	if (search->attributes[i_attr].value != NULL)
+		__free(search->attributes[i_attr].value);
+
+	if (pt != NULL) {
+		memcpy(pt, search->attributes, i_attr * sizeof(XMLAttribute));
+		memcpy(&pt[i_attr], &search->attributes[i_attr + 1], (search->n_attributes - i_attr - 1) * sizeof(XMLAttribute));
+	}
+	if (search->attributes)
+		__free(search->attributes);
+	search->attributes = pt;
+	search->n_attributes--;
+
+	return search->n_attributes;
+}
+
+/*
+ Add numeric criteria on 'attr_name' for the range from 'min' to 'max'.
+ Return its index, or -1 for invalid arguments or memory error.
+ */
+static int _search_add_number(XMLSearch* search, const SXML_CHAR* attr_name, double min, int min_excluded, double max, int max_excluded)
+{
+	int i;
+	XMLSearchNumber* pt;
+	SXML_CHAR* name;
+
+	if (search == NULL || attr_name == NULL || attr_name[0] == NULC || min != min || max != max) /* NaN never matches */
+		return -1;
+
+	name = sx_strdup(attr_name);
+	if (name == NULL)
+		return -1;
+
+	i = search->n_numbers;
+	pt = (XMLSearchNumber*)__realloc(search->numbers, (i + 1) * sizeof(XMLSearchNumber));
+	if (pt == NULL) {
+		__free(name);
+		return -1;
+	}
+
+	pt[i].name = name;
+	pt[i].min = min;
+	pt[i].max = max;
+	pt[i].min_excluded = min_excluded;
+	pt[i].max_excluded = max_excluded;
+
+	search->n_numbers = i+1;
+	search->numbers = pt;
+
+	return i;
+}
+
+int XMLSearch_search_add_number(XMLSearch* search, const SXML_CHAR* attr_name, XMLNumberCompare compare, double value)
+{
+	switch (compare) {
+		case XML_NUMBER_LT:
+			return _search_add_number(search, attr_name, -HUGE_VAL, FALSE, value, TRUE);
+		case XML_NUMBER_LE:
+			return _search_add_number(search, attr_name, -HUGE_VAL, FALSE, value, FALSE);
+		case XML_NUMBER_GT:
+			return _search_add_number(search, attr_name, value, TRUE, HUGE_VAL, FALSE);
+		case XML_NUMBER_GE:
+			return _search_add_number(search, attr_name, value, FALSE, HUGE_VAL, FALSE);
+		case XML_NUMBER_EQ:
+			return _search_add_number(search, attr_name, value, FALSE, value, FALSE);
+		default:
+			return -1;
+	}
+}
+
+int XMLSearch_search_add_range(XMLSearch* search, const SXML_CHAR* attr_name, double min, double max)
+{
+	if (min > max)
+		return -1;
+
+	return _search_add_number(search, attr_name, min, FALSE, max, FALSE);
+}
+
+int XMLSearch_search_set_children_search(XMLSearch* search, XMLSearch* children_search)
+{
+	if (search == NULL)
+		return FALSE;
+
+	if (search->next != NULL)
+		XMLSearch_free(search->next, TRUE);
+
+	search->next = children_search;
+	children_search->prev = search;
+
+	return TRUE;
+}
+
+/* XPath axes, in 'XMLSearchAxis' order */
+static const SXML_CHAR* XPATH_AXES[] = {
+	C2SX("child::"),
+	C2SX("descendant::"),
+	C2SX("parent::"),
+	C2SX("ancestor::"),
+	C2SX("following-sibling::")
+};
+
+/*
+ Append '@name', 'op' and 'value' to '*xpath', 'value' being written with as few digits as possible to be read
+ back by 'str2number()'. Return NULL for memory error.
+ */
+static SXML_CHAR* _xpath_cat_number(SXML_CHAR** xpath, const SXML_CHAR* name, const SXML_CHAR* op, double value)
+{
+	SXML_CHAR number[40];
+	double x;
+	int digits;
+
+	if (value == HUGE_VAL || value == -HUGE_VAL)
+		sx_strcpy(number, value > 0 ? C2SX("1e999") : C2SX("-1e999"));
+	else {
+		for (digits = 15; ; digits = 17) {
+			/* Standard and Unicode versions of 'sprintf' do not have the same signature! :( */
+			sx_sprintf(number,
+#ifdef SXMLC_UNICODE
+				sizeof(number) / sizeof(SXML_CHAR),
+#endif
+				C2SX("%.*g"), digits, value);
+			if (digits == 17 || (str2number(number, &x) && x == value))
+				break;
+		}
+	}
+
+	if (strcat_alloc(xpath, C2SX("@")) == NULL || strcat_alloc(xpath, name) == NULL || strcat_alloc(xpath, op) == NULL)
+		return NULL;
+
+	return strcat_alloc(xpath, number);
+}
+
+SXML_CHAR* XMLSearch_get_XPath_string(const XMLSearch* search, SXML_CHAR** xpath, SXML_CHAR quote)
+{
+	const XMLSearch* s;
+	const XMLSearchNumber* number;
+	SXML_CHAR squote[] = C2SX("'");
+	SXML_CHAR position[24];
+	int i, fill;
+
+	if (xpath == NULL)
+		return NULL;
+
+	/* NULL 'search' is an empty string */
+	if (search == NULL) {
+		*xpath = sx_strdup(C2SX(""));
+		if (*xpath == NULL)
+			return NULL;
+
+		return *xpath;
+	}
+
+	squote[0] = (quote == NULC ? XML_DEFAULT_QUOTE : quote);
+
+	for (s = search; s != NULL; s = s->next) {
+		/* No "/" prefix for the first criteria */
+		if (s != search && strcat_alloc(xpath, s->axis == XML_AXIS_DESCENDANT ? C2SX("//") : C2SX("/")) == NULL) goto err;
+		if (s->axis == XML_AXIS_PARENT && (s->tag == NULL || s->tag[0] == NULC) && (s->text == NULL || s->text[0] == NULC)
+			&& s->n_attributes == 0 && s->position == 0) {
+			if (strcat_alloc(xpath, C2SX("..")) == NULL) goto err;
+			continue;
+		}
+		if (s->axis >= XML_AXIS_PARENT && strcat_alloc(xpath, XPATH_AXES[s->axis]) == NULL) goto err;
+		if (strcat_alloc(xpath, s->tag == NULL || s->tag[0] == NULC ? C2SX("*"): s->tag) == NULL) goto err;
+
+		if (s->n_attributes > 0 || s->n_numbers > 0 || (s->text != NULL && s->text[0] != NULC))
+			if (strcat_alloc(xpath, C2SX("[")) == NULL) goto err;
+
+		fill = FALSE; /* '[' has not been filled with text yet, no ", " separator should be added */
+		if (s->text != NULL && s->text[0] != NULC) {
+			if (strcat_alloc(xpath, C2SX(".=")) == NULL) goto err;
+			if (strcat_alloc(xpath, squote) == NULL) goto err;
+			if (strcat_alloc(xpath, s->text) == NULL) goto err;
+			if (strcat_alloc(xpath, squote) == NULL) goto err;
+			fill = TRUE;
+		}
+
+		for (i = 0; i < s->n_attributes; i++) {
+			if (fill) {
+				if (strcat_alloc(xpath, C2SX(", ")) == NULL) goto err;
+			} else
+				fill = TRUE; /* filling is being performed */
+			if (strcat_alloc(xpath, C2SX("@")) == NULL) goto err;
+			if (strcat_alloc(xpath, s->attributes[i].name) == NULL) goto err;
+			if (s->attributes[i].value == NULL) continue;
+
+			if (strcat_alloc(xpath, s->attributes[i].active ? C2SX("=") : C2SX("!=")) == NULL) goto err;
+			if (strcat_alloc(xpath, squote) == NULL) goto err;
+			if (strcat_alloc(xpath, s->attributes[i].value) == NULL) goto err;
+			if (strcat_alloc(xpath, squote) == NULL) goto err;
+		}
+
+		for (i = 0; i < s->n_numbers; i++) {
+			number = &s->numbers[i];
+			/* A range without bounds is written '@attrib>=-1e999' */
+			if (number->min != -HUGE_VAL || number->max == HUGE_VAL) {
+				if (fill) {
+					if (strcat_alloc(xpath, C2SX(", ")) == NULL) goto err;
+				} else
+					fill = TRUE;
+				if (_xpath_cat_number(xpath, number->name, number->min_excluded ? C2SX(">") : C2SX(">="), number->min) == NULL) goto err;
+			}
+			if (number->max != HUGE_VAL) {
+				if (fill) {
+					if (strcat_alloc(xpath, C2SX(", ")) == NULL) goto err;
+				} else
+					fill = TRUE;
+				if (_xpath_cat_number(xpath, number->name, number->max_excluded ? C2SX("<") : C2SX("<="), number->max) == NULL) goto err;
+			}
+		}
+		if ((s->text != NULL && s->text[0] != NULC) || s->n_attributes > 0 || s->n_numbers > 0) {
+			if (strcat_alloc(xpath, C2SX("]")) == NULL) goto err;
+		}
+
+		if (s->position == XML_POSITION_LAST) {
+			if (strcat_alloc(xpath, C2SX("[last()]")) == NULL) goto err;
+		} else if (s->position != 0) {
+			/* Standard and Unicode versions of 'sprintf' do not have the same signature! :( */
+			sx_sprintf(position,
+#ifdef SXMLC_UNICODE
+				sizeof(position) / sizeof(SXML_CHAR),
+#endif
+				C2SX("[%d]"), s->position);
+			if (strcat_alloc(xpath, position) == NULL) goto err;
+		}
+	}
+
+	return *xpath;
+
+err:
+	__free(*xpath);
+	*xpath = NULL;
+
+	return NULL;
+}
+
+/*
+ First character of 'xpath' which is one of 'stops', outside of quotes and predicates ('[...]'), or its end.
+ '\' escapes the next character.
+ */
+static SXML_CHAR* _xpath_end(SXML_CHAR* xpath, const SXML_CHAR* stops)
+{
+	SXML_CHAR quote = NULC;
+	int depth = 0;
+
+	for (; *xpath != NULC; xpath++) {
+		if (*xpath == C2SX('\\')) {
+			if (*++xpath == NULC)
+				break; /* Escape character, '\' could be the last character... */
+		} else if (quote != NULC) {
+			if (*xpath == quote)
+				quote = NULC;
+		} else if (depth == 0 && sx_strchr(stops, *xpath) != NULL)
+			break;
+		else if (isquote(*xpath))
+			quote = *xpath;
+		else if (*xpath == C2SX('['))
+			depth++;
+		else if (*xpath == C2SX(']') && depth > 0)
+			depth--;
+	}
+
+	return xpath;
+}
+
+/*
+ Add numeric criteria '@attrib<number' to 'search' ('p' being after '@' and 'op' on the operator, which can also
+ be '<=', '>' or '>='), with potential spaces around the operator and quotes around 'number'.
+ Return 'false' if parsing failed.
+ */
+static int _search_add_number_criteria(XMLSearch* search, SXML_CHAR* p, SXML_CHAR* op)
+{
+	XMLNumberCompare compare;
+	SXML_CHAR *q, *v;
+	SXML_CHAR c, quote = NULC;
+	double number;
+	int ret;
+
+	if (op[0] == C2SX('<'))
+		compare = (op[1] == C2SX('=') ? XML_NUMBER_LE : XML_NUMBER_LT);
+	else
+		compare = (op[1] == C2SX('=') ? XML_NUMBER_GE : XML_NUMBER_GT);
+
+	/* Number, possibly quoted */
+	for (v = op + (op[1] == C2SX('=') ? 2 : 1); sx_isspace(*v); v++) ;
+	if (isquote(*v))
+		quote = *v++;
+	for (q = v; *q != NULC && *q != quote; q++) ;
+	if (quote != NULC) {
+		if (*q != quote)
+			return FALSE;
+		for (q++; sx_isspace(*q); q++) ;
+		if (*q != NULC)
+			return FALSE;
+		q = sx_strchr(v, quote);
+	}
+	c = *q;
+	*q = NULC;
+	ret = str2number(v, &number);
+	*q = c;
+	if (!ret)
+		return FALSE;
+
+	/* Attribute name */
+	for (q = op; q > p && sx_isspace(q[-1]); q--) ;
+	if (q == p)
+		return FALSE;
+	c = *q;
+	*q = NULC;
+	ret = (XMLSearch_search_add_number(search, p, compare, number) >= 0);
+	*q = c;
+
+	return ret;
+}
+
+/*
+ Add criteria 'p' (of a predicate) to 'search': '.=text', '@attrib', '@attrib=value', '@attrib!=value' or
+ numeric comparisons (see '_search_add_number_criteria()'), with potential spaces around '=' and quotes
+ around 'text' and 'value'. Other criteria are ignored.
+ Return 'false' if parsing failed.
+ */
+static int _search_add_criteria(XMLSearch* search, SXML_CHAR* p)
+{
+	SXML_CHAR *q;
+	SXML_CHAR c, c1;
+	int l0, l1, is, r0, r1;
+	int equal, ret;
+
+	for (; sx_isspace(*p); p++) ;
+	switch (*p) {
+		case C2SX('.'): /* '.[ ]=[ ]["']...["']' to search for text */
+			if (!split_left_right(p, C2SX('='), &l0, &l1, &is, &r0, &r1, TRUE, TRUE))
+				return FALSE;
+			c = p[r1+1];
+			p[r1+1] = NULC;
+			ret = XMLSearch_search_set_text(search, &p[r0]);
+			p[r1+1] = c;
+			return ret;
+
+		/* Attribute name, possibly '@attrib[[ ]=[ ]"value"]' or '@attrib[[ ]!=[ ]"value"]' */
+		case C2SX('@'):
+			p++;
+			for (q = p; *q != NULC && *q != C2SX('=') && *q != C2SX('<') && *q != C2SX('>') && !isquote(*q); q++) ;
+			if (*q == C2SX('<') || *q == C2SX('>'))
+				return _search_add_number_criteria(search, p, q);
+			/* '!' of '!=' is blanked for 'split_left_right()' */
+			for (q = p; *q != NULC && *q != C2SX('=') && !isquote(*q); q++) ;
+			equal = !(*q == C2SX('=') && q > p && q[-1] == C2SX('!'));
+			if (!equal)
+				q[-1] = C2SX(' ');
+			ret = split_left_right(p, C2SX('='), &l0, &l1, &is, &r0, &r1, TRUE, TRUE);
+			if (!equal)
+				q[-1] = C2SX('!');
+			if (!ret || l1 < l0)
+				return FALSE;
+			c = p[l1+1];
+			c1 = p[r1+1];
+			p[l1+1] = NULC;
+			p[r1+1] = NULC;
+			ret = (XMLSearch_search_add_attribute(search, &p[l0], (is < 0 ? NULL : &p[r0]), equal) < 0 ? FALSE : TRUE); /* 'is' < 0 when there is no '=' (i.e. check for attribute presence only */
+			p[l1+1] = c;
+			p[r1+1] = c1;
+			return ret;
+
+		default: /* Not implemented */
+			return TRUE;
+	}
+}
+
+/*
+ Add predicate 'p' (without its brackets) to 'search': a position ('2' or 'last()'), or criteria separated by ','.
+ Return 'false' if parsing failed.
+ */
+static int _search_add_predicate(XMLSearch* search, SXML_CHAR* p)
+{
+	SXML_CHAR *q;
+	SXML_CHAR c;
+	int position, ret;
+
+	for (; sx_isspace(*p); p++) ;
+	if (*p >= C2SX('0') && *p <= C2SX('9')) {
+		for (position = 0; *p >= C2SX('0') && *p <= C2SX('9') && position < 100000000; p++)
+			position = 10 * position + (int)(*p - C2SX('0'));
+		for (; sx_isspace(*p); p++) ;
+		if (*p != NULC || position <= 0)
+			return FALSE;
+		search->position = position;
+		return TRUE;
+	}
+	if (sx_strncmp(p, C2SX("last()"), 6) == 0) {
+		for (p += 6; sx_isspace(*p); p++) ;
+		if (*p != NULC)
+			return FALSE;
+		search->position = XML_POSITION_LAST;
+		return TRUE;
+	}
+
+	for (;;) {
+		q = _xpath_end(p, C2SX(","));
+		c = *q; /* Either ',' or '\0' */
+		*q = NULC;
+		ret = _search_add_criteria(search, p);
+		*q = c;
+		if (!ret)
+			return FALSE;
+		if (c == NULC)
+			return TRUE;
+		p = q + 1;
+	}
+}
+
+/*
+ Check that 'tag' (of an XPath step, after its axis) is a name, possibly with '*' and '?' wildcards and characters
+ escaped by '\'. Another '::' is a repeated or unknown axis.
+ */
+static int _xpath_is_tag(const SXML_CHAR* tag)
+{
+	if (*tag == NULC)
+		return FALSE;
+
+	for (; *tag != NULC; tag++) {
+		if (*tag == C2SX('\\')) {
+			if (*++tag == NULC)
+				return FALSE;
+		} else if (*tag == C2SX(':') && tag[1] == C2SX(':'))
+			return FALSE;
+		else if (!((*tag >= C2SX('a') && *tag <= C2SX('z')) || (*tag >= C2SX('A') && *tag <= C2SX('Z'))
+				|| (*tag >= C2SX('0') && *tag <= C2SX('9')) || (unsigned int)*tag > 127
+				|| sx_strchr(C2SX("_-.:*?"), *tag) != NULL))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ Extract search information from 'xpath', where 'xpath' represents a single step
+ (i.e. no '/' inside, except escaped or quoted ones), stripped from lead and tail '/':
+ '..' or [axis::]tag[.=text, @attrib="value"][position] with potential spaces around '=' and ','.
+ Return 'false' if parsing failed, 'true' for success.
+ This is an internal function so we assume that arguments are valid (non-NULL).
+ */
+static int _init_search_from_1XPath(SXML_CHAR* xpath, XMLSearch* search)
+{
+	SXML_CHAR *p, *q;
+	SXML_CHAR c;
+	int i, ret;
+
+	XMLSearch_init(search);
+
+	/* '..' is the father, whatever its tag */
+	if (sx_strcmp(xpath, C2SX("..")) == 0) {
+		search->axis = XML_AXIS_PARENT;
+		return TRUE;
+	}
+
+	for (i = 0; i < (int)(sizeof(XPATH_AXES) / sizeof(XPATH_AXES[0])); i++) {
+		if (sx_strncmp(xpath, XPATH_AXES[i], sx_strlen(XPATH_AXES[i])) == 0) {
+			search->axis = (XMLSearchAxis)i;
+			xpath += sx_strlen(XPATH_AXES[i]);
+			break;
+		}
+	}
+
+	/* Look for tag name, '*' being any tag */
+	p = _xpath_end(xpath, C2SX("["));
+	c = *p; /* Either '[' or '\0' */
+	*p = NULC;
+	ret = (sx_strcmp(xpath, C2SX("*")) == 0 || (_xpath_is_tag(xpath) && XMLSearch_search_set_tag(search, xpath)));
+	*p = c;
+	if (!ret)
+		return FALSE;
+
+	/* Predicates, a position being the last one */
+	while (*p == C2SX('[')) {
+		q = _xpath_end(++p, C2SX("]"));
+		if (*q != C2SX(']') || search->position != 0)
+			return FALSE;
+		*q = NULC;
+		ret = _search_add_predicate(search, p);
+		*q = C2SX(']');
+		if (!ret)
+			return FALSE;
+		p = q + 1;
+	}
+
+	return *p == NULC;
+}
+
+int XMLSearch_init_from_XPath(const SXML_CHAR* xpath, XMLSearch* search)
+{
+	XMLSearch *search1, *search2;
+	SXML_CHAR *p, *q, *xpath0;
+	SXML_CHAR c;
+	int n_slashes, ok;
+
+	if (!XMLSearch_init(search))
+		return FALSE;
+
+	/* NULL or empty xpath is an empty (initialized only) search */
+	if (xpath == NULL || *xpath == NULC)
+		return TRUE;
+
+	p = xpath0 = sx_strdup(xpath); /* Create a copy of 'xpath' to be able to patch it (or segfault if 'xpath' is const, cnacu6o Sergey@sourceforge!) */
+	if (xpath0 == NULL)
+		return FALSE;
+
+	search1 = NULL;		/* Search struct to add the xpath portion to */
+	search2 = search;	/* Search struct to be filled from xpath portion */
+
+	/* Skip all first '/', the first step being searched for from the starting node anyway */
+	for (; *p == C2SX('/'); p++) ;
+	n_slashes = 1;
+	ok = (*p != NULC);
+	while (ok && *p != NULC) {
+		if (search2 == NULL) { /* Allocate a new search when the original one (i.e. 'search') has already been filled */
+			search2 = (XMLSearch*)__calloc(1, sizeof(XMLSearch));
+			if (search2 == NULL) {
+				ok = FALSE;
+				break;
+			}
+		}
+
+		/* Look for the end of the step: '/' outside of predicates (to get another step) or end of string */
+		q = _xpath_end(p, C2SX("/"));
+		c = *q; /* Backup character before nulling it */
+		*q = NULC;
+		ok = _init_search_from_1XPath(p, search2);
+		*q = c;
+
+		/* '//' is the descendant axis, which cannot be combined with another one */
+		if (ok && n_slashes == 2) {
+			ok = (search2->axis == XML_AXIS_CHILD || search2->axis == XML_AXIS_DESCENDANT);
+			search2->axis = XML_AXIS_DESCENDANT;
+		}
+
+		/* 'search2' is the newly parsed step, 'search1' is the previous step (or NULL if 'search2' is the first step to parse (i.e. 'search2' == 'search') */
+		/* It is linked even when parsing failed, to be freed with 'search' */
+		if (search1 != NULL) {
+			search1->next = search2;
+			search2->prev = search1;
+		}
+		search1 = search2;
+		search2 = NULL; /* Will force allocation during next loop */
+
+		for (n_slashes = 0; *q == C2SX('/'); q++)
+			n_slashes++;
+		if (n_slashes > 2 || (n_slashes > 0 && *q == NULC))
+			ok = FALSE;
+		p = q;
+	}
+
+	__free(xpath0);
+	if (!ok)
+		(void)XMLSearch_free(search, TRUE);
+
+	return ok;
+}
+
+/*
+ Check whether 'to_test' matches attribute #'i_attr' of a search ('pattern'), using its compiled patterns 'c'
+ if not NULL, 'cmp' otherwise.
+ */
+static int _attribute_matches(XMLAttribute* to_test, XMLAttribute* pattern, const struct _XMLSearchCompiled* c, int i_attr, REGEXPR_COMPARE cmp)
+{
+	if (to_test == NULL && pattern == NULL)
+		return TRUE;
+
+	if (to_test == NULL || pattern == NULL)
+		return FALSE;
+	
+	/* No test on name => match */
+	if (pattern->name == NULL || pattern->name[0] == NULC)
+		return TRUE;
+
+	/* Test on name fails => no match */
+	if (!_MATCHES(c, PATTERN_ATTR_NAME(i_attr), to_test->name, pattern->name, cmp))
+		return FALSE;
+
+	/* No test on value => match */
+	if (pattern->value == NULL)
+		return TRUE;
+
+	/* Test on value according to pattern "equal" attribute */
+	return _MATCHES(c, PATTERN_ATTR_VALUE(i_attr), to_test->value, pattern->value, cmp) == pattern->active ? TRUE : FALSE;
+}
+
+/*
+ Check whether 'node' attribute 'number->name' is a number within the range of 'number'. It is read from the
+ number index of the document when there is one (see 'XMLDoc_build_number_index()'), and parsed otherwise.
+ */
+static int _number_matches(const XMLNode* node, const XMLSearchNumber* number)
+{
+	double x;
+
+	if (!XMLNode_get_attribute_double(node, number->name, &x, 0))
+		return FALSE;
+
+	return (x > number->min || (x == number->min && !number->min_excluded))
+		&& (x < number->max || (x == number->max && !number->max_excluded));
+}
+
+/* Matcher to use with 'config': the global one when 'config' is NULL, 'regstrcmp' if 'config' has none */
+static REGEXPR_COMPARE _config_compare(const XMLParserConfig* config)
+{
+	if (config == NULL)
+		return regstrcmp_search;
+
+	return config->regexpr_compare != NULL ? config->regexpr_compare : regstrcmp;
+}
+
+/*
+ Check whether 'node' matches 'search' criteria, without considering 'search->prev'.
+ */
+static int _node_matches_1(const XMLNode* node, const XMLSearch* search, REGEXPR_COMPARE cmp)
+{
+	const struct _XMLSearchCompiled* c = (search->compiled != NULL && search->compiled->cmp == cmp ? search->compiled : NULL); /* Compiled patterns behave as 'cmp' */
+	int i, j;
+
+	/* No comments, prolog, or such type of nodes are tested */
+	if (node->tag_type != TAG_FATHER && node->tag_type != TAG_SELF)
+		return FALSE;
+
+	/* Check tag */
+	if (search->tag != NULL && !_MATCHES(c, PATTERN_TAG, node->tag, search->tag, cmp))
+		return FALSE;
+
+	/* Check text */
+	if (search->text != NULL && !_MATCHES(c, PATTERN_TEXT, node->text, search->text, cmp))
+		return FALSE;
+
+	/* Check attributes */
+	if (search->attributes != NULL) {
+		for (i = 0; i < search->n_attributes; i++) {
+			for (j = 0; j < node->n_attributes; j++) {
+				if (!node->attributes[j].active)
+					continue;
+				if (_attribute_matches(&node->attributes[j], &search->attributes[i], c, i, cmp))
+					break;
+			}
+			if (j >= node->n_attributes) /* All attributes where scanned without a successful match */
+				return FALSE;
+		}
+	}
+
+	/* Check numbers */
+	for (i = 0; i < search->n_numbers; i++)
+		if (!_number_matches(node, &search->numbers[i]))
+			return FALSE;
+
+	return TRUE;
+}
+
+/*
+ Check whether 'node' and its closest ancestors match '*search' and its previous searches, up to the first one
+ on the descendant axis (or the first one), which is set in '*search'. Return the node matching it, or NULL.
+ */
+static const XMLNode* _segment_matches(const XMLNode* node, const XMLSearch** search, REGEXPR_COMPARE cmp)
+{
+	const XMLSearch* s;
+
+	for (s = *search; node != NULL && _node_matches_1(node, s, cmp); node = node->father, s = s->prev) {
+		if (s->prev == NULL || s->axis == XML_AXIS_DESCENDANT) {
+			*search = s;
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+static int _node_matches(const XMLNode* node, const XMLSearch* search, REGEXPR_COMPARE cmp)
+{
+	const XMLSearch* s;
+	const XMLNode* top;
+
+	if (node == NULL)
+		return FALSE;
+
+	if (search == NULL)
+		return TRUE;
+
+	/* If there is a father search, 'node' father must match it, and so on */
+	/* Above a search on the descendant axis, any ancestor can match the previous search: the closest one is taken, */
+	/* as it leaves the most ancestors to the searches before */
+	if ((top = _segment_matches(node, &search, cmp)) == NULL)
+		return FALSE;
+	while (search->prev != NULL) {
+		for (node = top->father; node != NULL; node = node->father) {
+			s = search->prev;
+			if ((top = _segment_matches(node, &s, cmp)) != NULL)
+				break;
+		}
+		if (node == NULL)
+			return FALSE;
+		search = s;
+	}
+
+	/* The first search can match at any depth, a leading '/' or '//' of XPath queries being ignored */
+	return TRUE;
+}
+
+/*
+ Check whether 'search' (the last one) has to be evaluated one step at a time, as it has positions or axes
+ other than the child and descendant ones.
+ */
+static int _search_is_set(const XMLSearch* search)
+{
+	for (; search != NULL; search = search->prev)
+		if (search->position != 0 || (search->axis != XML_AXIS_CHILD && search->axis != XML_AXIS_DESCENDANT))
+			return TRUE;
+
+	return FALSE;
+}
+
+/* --- Step at a time evaluation --- */
+
+/* Set of nodes, as an open addressing hash table of node pointers at most half full */
+typedef struct _NodeSet {
+	const XMLNode** nodes;	/* 'size' (a power of 2) slots, NULL for empty ones */
+	int n;
+	int size;
+} _NodeSet;
+
+static void _set_free(_NodeSet* set)
+{
+	if (set->nodes != NULL)
+		__free(set->nodes);
+	set->nodes = NULL;
+	set->n = 0;
+	set->size = 0;
+}
+
+/* Slot of 'node' in 'set' (of non-zero size), or the empty slot where to add it */
+static const XMLNode** _set_slot(const _NodeSet* set, const XMLNode* node)
+{
+	size_t h = (size_t)node;
+	size_t i;
+
+	h = (h ^ (h >> 16)) * 0x45d9f3b;
+	i = (h ^ (h >> 16)) & (size_t)(set->size - 1);
+	while (set->nodes[i] != NULL && set->nodes[i] != node)
+		i = (i + 1) & (size_t)(set->size - 1);
+
+	return &set->nodes[i];
+}
+
+static int _set_contains(const _NodeSet* set, const XMLNode* node)
+{
+	return set->n > 0 && *_set_slot(set, node) != NULL;
+}
+
+/* Add 'node' to 'set'. Return 1 if it was added, 0 if it was already there, -1 for memory error. */
+static int _set_add(_NodeSet* set, const XMLNode* node)
+{
+	_NodeSet old = *set;
+	const XMLNode** slot;
+	int i;
+
+	if (2 * (set->n + 1) > set->size) {
+		set->size = (old.size < 16 ? 16 : 2 * old.size);
+		set->nodes = (const XMLNode**)__calloc(set->size, sizeof(XMLNode*));
+		if (set->nodes == NULL) {
+			*set = old;
+			return -1;
+		}
+		for (i = 0; i < old.size; i++)
+			if (old.nodes[i] != NULL)
+				*_set_slot(set, old.nodes[i]) = old.nodes[i];
+		if (old.nodes != NULL)
+			__free(old.nodes);
+	}
+
+	slot = _set_slot(set, node);
+	if (*slot != NULL)
+		return 0;
+	*slot = node;
+	set->n++;
+
+	return 1;
+}
+
+/*
+ Take 'node', the next node matching a step found from a node, to 'out' if it is the one at 'position'
+ ('*count' counting them, '*last' being the last one for 'XML_POSITION_LAST').
+ Return 1 to go on, 0 when the step is done with that node, -1 for memory error.
+ */
+static int _step_take(_NodeSet* out, int position, int* count, const XMLNode* node, const XMLNode** last)
+{
+	if (position == XML_POSITION_LAST) {
+		*last = node;
+		return 1;
+	}
+	if (position != 0 && ++*count != position)
+		return 1;
+	if (_set_add(out, node) < 0)
+		return -1;
+
+	return position == 0 ? 1 : 0;
+}
+
+/*
+ Add to 'out' the nodes matching 'search' found from 'node' on 'axis' (not the descendant one). 'visited' keeps
+ the ancestors or siblings already walked from other nodes, as they should be walked once when there is no position.
+ Return 'false' for memory error.
+ */
+static int _step_axis(const XMLNode* node, XMLSearchAxis axis, const XMLSearch* search, REGEXPR_COMPARE cmp, _NodeSet* out, _NodeSet* visited)
+{
+	const XMLNode* last = NULL;
+	const XMLNode* n;
+	int count = 0;
+	int i, ret = 1;
+
+	switch (axis) {
+		case XML_AXIS_PARENT:
+			if (node->father != NULL && _node_matches_1(node->father, search, cmp))
+				ret = _step_take(out, search->position, &count, node->father, &last);
+			break;
+
+		case XML_AXIS_ANCESTOR: /* Closest first */
+			for (n = node->father; n != NULL && ret > 0; n = n->father) {
+				if (search->position == 0 && (ret = _set_add(visited, n)) <= 0)
+					break;
+				if (_node_matches_1(n, search, cmp))
+					ret = _step_take(out, search->position, &count, n, &last);
+			}
+			break;
+
+		case XML_AXIS_FOLLOWING_SIBLING:
+			if (node->father == NULL)
+				break;
+			for (i = 0; node->father->children[i] != node; i++) ;
+			for (i++; i < node->father->n_children && ret > 0; i++) {
+				n = node->father->children[i];
+				if (search->position == 0 && (ret = _set_add(visited, n)) <= 0)
+					break;
+				if (_node_matches_1(n, search, cmp))
+					ret = _step_take(out, search->position, &count, n, &last);
+			}
+			break;
+
+		default: /* Children */
+			for (i = 0; i < node->n_children && ret > 0; i++) {
+				if (_node_matches_1(node->children[i], search, cmp))
+					ret = _step_take(out, search->position, &count, node->children[i], &last);
+			}
+			break;
+	}
+	if (ret < 0)
+		return FALSE;
+
+	return last == NULL || _set_add(out, last) >= 0;
+}
+
+/*
+ Add to 'out' the nodes matching 'search' which are children of 'node' or of its descendants, as for XPath '//'
+ (i.e. positions are counted among siblings). 'visited' keeps the nodes already walked from other nodes.
+ Return 'false' for memory error.
+ */
+static int _step_descendants(const XMLNode* node, const XMLSearch* search, REGEXPR_COMPARE cmp, _NodeSet* out, _NodeSet* visited)
+{
+	const XMLNode** stack;
+	const XMLNode** pt;
+	int n, size, i, ret;
+
+	size = 64;
+	stack = (const XMLNode**)__malloc(size * sizeof(XMLNode*));
+	if (stack == NULL)
+		return FALSE;
+	stack[0] = node;
+	n = 1;
+	ret = TRUE;
+	while (ret && n > 0) {
+		node = stack[--n];
+		/* A node already walked was walked with all its descendants */
+		if ((i = _set_add(visited, node)) <= 0) {
+			ret = (i == 0);
+			continue;
+		}
+		if (!_step_axis(node, XML_AXIS_CHILD, search, cmp, out, visited)) {
+			ret = FALSE;
+			break;
+		}
+		if (n + node->n_children > size) {
+			while (n + node->n_children > size)
+				size *= 2;
+			pt = (const XMLNode**)__realloc((void*)stack, size * sizeof(XMLNode*));
+			if (pt == NULL) {
+				ret = FALSE;
+				break;
+			}
+			stack = pt;
+		}
+		for (i = node->n_children - 1; i >= 0; i--)
+			stack[n++] = node->children[i];
+	}
+	__free((void*)stack);
+
+	return ret;
+}
+
+/*
+ Evaluate 'search' (the last one) one step at a time to 'set', from 'from' if the first search is on the parent,
+ ancestor or following-sibling axis, from the whole tree of 'from' otherwise (as nodes are matched one at a time:
+ the first search can match any ancestor of the last one).
+ Return 'false' for memory error.
+ */
+static int _search_eval_set(const XMLNode* from, const XMLSearch* search, REGEXPR_COMPARE cmp, _NodeSet* set)
+{
+	const XMLSearch* first;
+	const XMLNode* top;
+	_NodeSet in, visited;
+	int i, ret;
+
+	for (first = search; first->prev != NULL; first = first->prev) ;
+	set->nodes = NULL;
+	set->n = set->size = 0;
+	visited = *set;
+
+	/* First search: top node has no siblings */
+	if (first->axis == XML_AXIS_CHILD || first->axis == XML_AXIS_DESCENDANT) {
+		for (top = from; top->father != NULL; top = top->father) ;
+		ret = ((first->position != 0 && first->position != 1 && first->position != XML_POSITION_LAST)
+			|| !_node_matches_1(top, first, cmp) || _set_add(set, top) >= 0);
+		ret = ret && _step_descendants(top, first, cmp, set, &visited);
+	} else
+		ret = _step_axis(from, first->axis, first, cmp, set, &visited);
+	_set_free(&visited);
+
+	/* Next searches from the nodes found by the previous one */
+	while (ret && first != search) {
+		first = first->next;
+		in = *set;
+		set->nodes = NULL;
+		set->n = set->size = 0;
+		for (i = 0; ret && i < in.size; i++) {
+			if (in.nodes[i] == NULL)
+				continue;
+			ret = (first->axis == XML_AXIS_DESCENDANT ? _step_descendants(in.nodes[i], first, cmp, set, &visited)
+				: _step_axis(in.nodes[i], first->axis, first, cmp, set, &visited));
+		}
+		_set_free(&visited);
+		_set_free(&in);
+	}
+	if (!ret)
+		_set_free(set);
+
+	return ret;
+}
+
+/*
+ Check whether 'node' matches 'search', evaluating it one step at a time (from the top of the tree of 'node')
+ when needed.
+ */
+static int _node_matches_any(const XMLNode* node, const XMLSearch* search, REGEXPR_COMPARE cmp)
+{
+	const XMLNode* top;
+	_NodeSet set;
+	int ret;
+
+	if (node == NULL || search == NULL || !_search_is_set(search))
+		return _node_matches(node, search, cmp);
+
+	/* Searches starting on the parent, ancestor or following-sibling axis are relative to the node to start */
+	/* searching from, the top node being taken for them (which has no father or siblings) */
+	for (top = node; top->father != NULL; top = top->father) ;
+	if (!_search_eval_set(top, search, cmp, &set))
+		return FALSE;
+	ret = _set_contains(&set, node);
+	_set_free(&set);
+
+	return ret;
+}
+
+int XMLSearch_node_matches(const XMLNode* node, const XMLSearch* search)
+{
+	return _node_matches_any(node, search, regstrcmp_search);
+}
+
+int XMLSearch_node_matches_ex(const XMLNode* node, const XMLSearch* search, const XMLParserConfig* config)
+{
+	return _node_matches_any(node, search, _config_compare(config));
+}
+
+/*
+ Index of the first attribute of the compiled 'search' testing equality to a literal value, or -1 if there is none.
+ */
+static int _search_literal_attribute(const XMLSearch* search)
+{
+	const struct _XMLSearchCompiled* c = search->compiled;
+	int i;
+
+	for (i = 0; i < search->n_attributes; i++)
+		if (search->attributes[i].active && search->attributes[i].name != NULL && search->attributes[i].name[0] != NULC
+			&& c->patterns[PATTERN_ATTR_NAME(i)].kind == PATTERN_EXACT && c->patterns[PATTERN_ATTR_VALUE(i)].kind == PATTERN_EXACT)
+			return i;
+
+	return -1;
+}
+
+static XMLNode* _search_next_set(const XMLNode* from, XMLSearch* search, REGEXPR_COMPARE cmp);
+
+static XMLNode* _search_next(const XMLNode* from, XMLSearch* search, REGEXPR_COMPARE cmp)
+{
+	XMLNode* node;
+	XMLAttribute* attr;
+	SXML_CHAR* tag;
+	int i;
+
+	if (search == NULL || from == NULL)
+		return NULL;
+
+	(void)_search_compile(search, cmp); /* Patterns are matched by 'cmp' in case of memory error */
+
+	/* Go down the last child search as fathers will be tested by the '_node_matches' function */
+	for (; search->next != NULL; search = search->next) ;
+
+	if (_search_is_set(search))
+		return _search_next_set(from, search, cmp);
+
+	/* Initialize the 'stop_at' node on first search, to remember where to stop as there will be multiple calls */
+	/* 'stop_at' can be NULL when 'from' is a root node, that is why it should be initialized with something else than NULL */
+	if (search->stop_at == INVALID_XMLNODE_POINTER)
+		search->stop_at = XMLNode_next_sibling(from);
+
+	/* Only nodes with a literal tag or attribute value can match: jump to them (using the document indexes, if any) */
+	if (search->compiled != NULL && search->compiled->cmp == cmp) {
+		tag = (search->compiled->patterns[PATTERN_TAG].kind == PATTERN_EXACT ? search->tag : NULL);
+		if ((i = _search_literal_attribute(search)) >= 0) {
+			attr = &search->attributes[i];
+			for (node = XMLNode_next_with_attribute(from, tag, attr->name, attr->value, search->stop_at); node != NULL;
+				node = XMLNode_next_with_attribute(node, tag, attr->name, attr->value, search->stop_at)) {
+				if (_node_matches(node, search, cmp))
+					return node;
+			}
+			return NULL;
+		}
+		if (tag != NULL) {
+			for (node = XMLNode_next_with_tag(from, tag, search->stop_at); node != NULL; node = XMLNode_next_with_tag(node, tag, search->stop_at)) {
+				if (_node_matches(node, search, cmp))
+					return node;
+			}
+			return NULL;
+		}
+	}
+
+	for (node = XMLNode_next(from); node != search->stop_at; node = XMLNode_next(node)) { /* && node != NULL */
+		if (_node_matches(node, search, cmp))
+			return node;
+	}
 
 	return NULL;
 }
 
+XMLNode* XMLSearch_next(const XMLNode* from, XMLSearch* search)
+{
+	return _search_next(from, search, regstrcmp_search);
+}
+
+/*
+ Walk of the nodes following a node in document order, as with 'XMLNode_next()', but in constant time per node:
+ the index of each ancestor of the current node among its father children is kept instead of being looked up.
+ */
+typedef struct _SearchWalk {
+	const XMLNode* node;	/* Current node, NULL at the end */
+	int depth;				/* Depth of 'node' below its top node */
+	int* idx;				/* 'idx[d]' is the index of the ancestor of depth 'd + 1' (or 'node') in its father children */
+	int size;
+} _SearchWalk;
+
+/* Start walking after 'from'. Return 'false' for memory error. */
+static int _walk_init(_SearchWalk* walk, const XMLNode* from)
+{
+	const XMLNode* n;
+	int d, i;
+
+	for (n = from, d = 0; n->father != NULL; n = n->father)
+		d++;
+	walk->node = from;
+	walk->depth = d;
+	walk->size = (d < 16 ? 16 : 2 * d);
+	walk->idx = (int*)__malloc(walk->size * sizeof(int));
+	if (walk->idx == NULL)
+		return FALSE;
+	for (n = from; n->father != NULL; n = n->father) {
+		for (i = 0; i < n->father->n_children && n->father->children[i] != n; i++) ;
+		walk->idx[--d] = i;
+	}
+
+	return TRUE;
+}
+
+/* Go to the next node, if any. Return 'false' for memory error. */
+static int _walk_next(_SearchWalk* walk)
+{
+	const XMLNode* node = walk->node;
+	int* idx;
+
+	if (node->n_children > 0) {
+		if (walk->depth >= walk->size) {
+			idx = (int*)__realloc(walk->idx, 2 * walk->size * sizeof(int));
+			if (idx == NULL)
+				return FALSE;
+			walk->idx = idx;
+			walk->size *= 2;
+		}
+		walk->idx[walk->depth++] = 0;
+		walk->node = node->children[0];
+		return TRUE;
+	}
+
+	/* Next sibling, or next sibling of the closest ancestor having one */
+	for ( ; walk->depth > 0; walk->depth--, node = node->father) {
+		if (++walk->idx[walk->depth - 1] < node->father->n_children) {
+			walk->node = node->father->children[walk->idx[walk->depth - 1]];
+			return TRUE;
+		}
+	}
+	walk->node = NULL;
+
+	return TRUE;
+}
+
+/*
+ Add 'node' as match #'n' in '*nodes' (of size '*sz_nodes'), growing it when needed.
+ Return 'false' for memory error.
+ */
+static int _search_add(XMLNode* node, int n, XMLNode*** nodes, int* sz_nodes)
+{
+	XMLNode** pt;
+	int sz;
+
+	if (n >= *sz_nodes || *nodes == NULL) {
+		sz = (*sz_nodes < 64 ? 64 : 2 * *sz_nodes);
+		pt = (XMLNode**)__realloc(*nodes, sz * sizeof(XMLNode*));
+		if (pt == NULL)
+			return FALSE;
+		*nodes = pt;
+		*sz_nodes = sz;
+	}
+	(*nodes)[n] = node;
+
+	return TRUE;
+}
+
+/*
+ Find the nodes matching 'search' (the last one) evaluated one step at a time from 'from', as '_search_all()' does.
+ They are added in document order: the ones after 'from' up to its next sibling (as for other searches) when the
+ first search is on the child or descendant axis, all of them otherwise.
+ */
+static int _search_eval(const XMLNode* from, const XMLSearch* search, REGEXPR_COMPARE cmp, XMLNode*** nodes, int* sz_nodes, int limit)
+{
+	const XMLSearch* first;
+	const XMLNode* stop_at;
+	_SearchWalk walk;
+	_NodeSet set;
+	int n = 0, found = 0;
+
+	if (!_search_eval_set(from, search, cmp, &set))
+		return -1;
+
+	for (first = search; first->prev != NULL; first = first->prev) ;
+	if (first->axis == XML_AXIS_CHILD || first->axis == XML_AXIS_DESCENDANT)
+		stop_at = XMLNode_next_sibling(from);
+	else {
+		for (; from->father != NULL; from = from->father) ;
+		stop_at = NULL;
+		if (_set_contains(&set, from)) {
+			if (nodes != NULL && !_search_add((XMLNode*)from, n, nodes, sz_nodes))
+				n = -1;
+			else {
+				n++;
+				found++;
+			}
+		}
+	}
+
+	/* Walk until all nodes were found */
+	if (n >= 0 && found < set.n && (limit <= 0 || n < limit)) {
+		if (!_walk_init(&walk, from))
+			n = -1;
+		else {
+			for (;;) {
+				if (!_walk_next(&walk)) {
+					n = -1;
+					break;
+				}
+				if (walk.node == NULL || walk.node == stop_at)
+					break;
+				if (!_set_contains(&set, walk.node))
+					continue;
+				if (nodes != NULL && !_search_add((XMLNode*)walk.node, n, nodes, sz_nodes)) {
+					n = -1;
+					break;
+				}
+				if (++n == limit || ++found == set.n)
+					break;
+			}
+			__free(walk.idx);
+		}
+	}
+	_set_free(&set);
+
+	return n;
+}
+
 /*
- Extract search information from 'xpath', where 'xpath' represents a single node
- (i.e. no '/' inside, except escaped ones), stripped from lead and tail '/'.
- tag[.=text, @attrib="value"] with potential spaces around '=' and ','.
- Return 'false' if parsing failed, 'true' for success.
- This is an internal function so we assume that arguments are valid (non-NULL).
+ Next node after 'from' matching 'search' (the last one) evaluated one step at a time: all nodes are found on the
+ first search (i.e. when 'stop_at' is not initialized yet), then returned one at a time.
  */
-static int _init_search_from_1XPath(SXML_CHAR* xpath, XMLSearch* search)
+static XMLNode* _search_next_set(const XMLNode* from, XMLSearch* search, REGEXPR_COMPARE cmp)
 {
-	SXML_CHAR *p, *q;
-	SXML_CHAR c, c1, cc;
-	int l0, l1, is, r0, r1;
-	int ret;
-
-	XMLSearch_init(search);
-
-	/* Look for tag name */
-	for (p = xpath; *p != NULC && *p != C2SX('['); p++) ;
-	c = *p; /* Either '[' or '\0' */
-	*p = NULC;
-	ret = XMLSearch_search_set_tag(search, xpath);
-	*p = c;
-	if (!ret)
-		return FALSE;
-
-	if (*p == NULC)
-		return TRUE;
-
-	/* Here, '*p' is '[', we have to parse either text or attribute names/values until ']' */
-	for (p++; *p && *p != C2SX(']'); p++) {
-		for (q = p; *q && *q != C2SX(',') && *q != C2SX(']'); q++) ; /* Look for potential ',' separator to null it */
-		cc = *q;
-		if (*q == C2SX(',') || *q == C2SX(']'))
-			*q = NULC;
-		ret = TRUE;
-		switch (*p) {
-			case C2SX('.'): /* '.[ ]=[ ]["']...["']' to search for text */
-				if (!split_left_right(p, C2SX('='), &l0, &l1, &is, &r0, &r1, TRUE, TRUE))
-					return FALSE;
-				c = p[r1+1];
-				p[r1+1] = NULC;
-				ret = XMLSearch_search_set_text(search, &p[r0]);
-				p[r1+1] = c;
-				p += r1+1;
-				break;
+	struct _XMLSearchResults* results = search->results;
+	int i;
 
-			/* Attribute name, possibly '@attrib[[ ]=[ ]"value"]' */
-			case C2SX('@'):
-				if (!split_left_right(++p, '=', &l0, &l1, &is, &r0, &r1, TRUE, TRUE))
-					return FALSE;
-				c = p[l1+1];
-				c1 = p[r1+1];
-				p[l1+1] = NULC;
-				p[r1+1] = NULC;
-				ret = (XMLSearch_search_add_attribute(search, &p[l0], (is < 0 ? NULL : &p[r0]), TRUE) < 0 ? FALSE : TRUE); /* 'is' < 0 when there is no '=' (i.e. check for attribute presence only */
-				p[l1+1] = c;
-				p[r1+1] = c1;
-				p += r1-1; /* Jump to next value */
-				break;
+	if (results == NULL) {
+		results = (struct _XMLSearchResults*)__calloc(1, sizeof(struct _XMLSearchResults));
+		if (results == NULL)
+			return NULL;
+		search->results = results;
+	}
 
-			default: /* Not implemented */
-				break;
+	if (search->stop_at == INVALID_XMLNODE_POINTER) {
+		results->next = 0;
+		results->n = _search_eval(from, search, cmp, &results->nodes, &results->size, 0);
+		if (results->n < 0) {
+			results->n = 0;
+			return NULL;
 		}
-		*q = cc; /* Restore ',' separator if any */
-		if (!ret)
-			return FALSE;
+		search->stop_at = NULL;
+	} else if (results->next == 0 || results->nodes[results->next - 1] != from) {
+		/* Searching on from another node found */
+		for (i = 0; i < results->n && results->nodes[i] != from; i++) ;
+		results->next = (i < results->n ? i + 1 : results->n);
 	}
 
-	return TRUE;
+	return results->next < results->n ? results->nodes[results->next++] : NULL;
 }
 
-int XMLSearch_init_from_XPath(const SXML_CHAR* xpath, XMLSearch* search)
+/*
+ Get in '*attr' and '*tag' the literal attribute and tag the nodes matching the compiled (last) 'search' have, when
+ the document of 'from' indexes them. Return 'false' if there are none, in which case nodes should be walked.
+ */
+static int _search_candidates(const XMLNode* from, XMLSearch* search, REGEXPR_COMPARE cmp, XMLAttribute** attr, SXML_CHAR** tag)
 {
-	XMLSearch *search1, *search2;
-	SXML_CHAR *p, *tag, *tag0;
-	SXML_CHAR c;
+	int i;
 
-	if (!XMLSearch_init(search))
-		return FALSE;
+	*attr = NULL;
+	*tag = NULL;
+	if (search->compiled != NULL && search->compiled->cmp == cmp) {
+		if ((i = _search_literal_attribute(search)) >= 0 && XMLNode_is_indexed(from, search->attributes[i].name))
+			*attr = &search->attributes[i];
+		if (search->compiled->patterns[PATTERN_TAG].kind == PATTERN_EXACT && (*attr != NULL || XMLNode_is_indexed(from, NULL)))
+			*tag = search->tag;
+	}
 
-	/* NULL or empty xpath is an empty (initialized only) search */
-	if (xpath == NULL || *xpath == NULC)
-		return TRUE;
+	return *attr != NULL || *tag != NULL;
+}
 
-	search1 = NULL;		/* Search struct to add the xpath portion to */
-	search2 = search;	/* Search struct to be filled from xpath portion */
+/*
+ Walk the nodes after 'from' up to 'stop_at' and add the ones matching 'search' to '*nodes' (unless 'nodes' is NULL),
+ starting at match #'n' and up to 'limit' matches if 'limit' is positive.
+ Return the new number of matches, or -1 for memory error.
+ */
+static int _search_walk(const XMLNode* from, const XMLNode* stop_at, const XMLSearch* search, REGEXPR_COMPARE cmp, XMLNode*** nodes, int* sz_nodes, int n, int limit)
+{
+	XMLNode* node;
+	_SearchWalk walk;
 
-	tag = tag0 = sx_strdup(xpath); /* Create a copy of 'xpath' to be able to patch it (or segfault if 'xpath' is const, cnacu6o Sergey@sourceforge!) */
-	while (*tag != NULC) {
-		if (search2 != search) { /* Allocate a new search when the original one (i.e. 'search') has already been filled */
-			search2 = (XMLSearch*)__calloc(1, sizeof(XMLSearch));
-			if (search2 == NULL) {
-				__free(tag0);
-				(void)XMLSearch_free(search, TRUE);
-				return FALSE;
-			}
+	if (limit > 0 && n >= limit)
+		return n;
+	if (!_walk_init(&walk, from))
+		return -1;
+	for (;;) {
+		if (!_walk_next(&walk)) {
+			n = -1;
+			break;
 		}
-		/* Skip all first '/' */
-		for (; *tag != NULC && *tag == C2SX('/'); tag++) ;
-		if (*tag == NULC) {
-			__free(tag0);
-			return FALSE;
+		if (walk.node == NULL || walk.node == stop_at)
+			break;
+		node = (XMLNode*)walk.node;
+		if (!_node_matches(node, search, cmp))
+			continue;
+		if (nodes != NULL && !_search_add(node, n, nodes, sz_nodes)) {
+			n = -1;
+			break;
 		}
+		if (++n == limit)
+			break;
+	}
+	__free(walk.idx);
 
-		/* Look for the end of tag name: after '/' (to get another tag) or end of string */
-		for (p = &tag[1]; *p != NULC && *p != C2SX('/'); p++) {
-			if (*p == C2SX('\\') && *++p == NULC)
-				break; /* Escape character, '\' could be the last character... */
-		}
-		c = *p; /* Backup character before nulling it */
-		*p = NULC;
-		if (!_init_search_from_1XPath(tag, search2)) {
-			__free(tag0);
-			(void)XMLSearch_free(search, TRUE);
-			return FALSE;
-		}
-		*p = c;
+	return n;
+}
 
-		/* 'search2' is the newly parsed tag, 'search1' is the previous tag (or NULL if 'search2' is the first tag to parse (i.e. 'search2' == 'search') */
+/*
+ Find the nodes matching 'search' after 'from', up to 'limit' of them if 'limit' is positive, and add them to '*nodes'
+ unless 'nodes' is NULL. Return the number of matches, or -1 for invalid arguments or memory error.
+ */
+static int _search_all(const XMLNode* from, XMLSearch* search, REGEXPR_COMPARE cmp, XMLNode*** nodes, int* sz_nodes, int limit)
+{
+	const XMLNode* stop_at;
+	XMLNode* node;
+	XMLAttribute* attr;
+	SXML_CHAR* tag;
+	int n = 0;
 
-		if (search1 != NULL) search1->next = search2;
-		if (search2 != search) search2->prev = search1;
-		search1 = search2;
-		search2 = NULL; /* Will force allocation during next loop */
-		tag = p;
+	if (search == NULL || from == NULL || (nodes != NULL && sz_nodes == NULL))
+		return -1;
+
+	(void)_search_compile(search, cmp);
+	for (; search->next != NULL; search = search->next) ;
+	if (_search_is_set(search))
+		return _search_eval(from, search, cmp, nodes, sz_nodes, limit);
+	stop_at = XMLNode_next_sibling(from);
+
+	/* Jump to the candidate nodes when the document indexes them, as a walk is faster otherwise */
+	if (_search_candidates(from, search, cmp, &attr, &tag)) {
+		node = (XMLNode*)from;
+		while ((node = (attr != NULL ? XMLNode_next_with_attribute(node, tag, attr->name, attr->value, stop_at) : XMLNode_next_with_tag(node, tag, stop_at))) != NULL) {
+			if (!_node_matches(node, search, cmp))
+				continue;
+			if (nodes != NULL && !_search_add(node, n, nodes, sz_nodes))
+				return -1;
+			if (++n == limit)
+				break;
+		}
+		return n;
 	}
 
-	__free(tag0);
-	return TRUE;
+	return _search_walk(from, stop_at, search, cmp, nodes, sz_nodes, 0, limit);
 }
 
-static int _attribute_matches(XMLAttribute* to_test, XMLAttribute* pattern)
+int XMLSearch_all(const XMLNode* from, XMLSearch* search, XMLNode*** nodes, int* sz_nodes, int limit)
 {
-	if (to_test == NULL && pattern == NULL)
-		return TRUE;
-
-	if (to_test == NULL || pattern == NULL)
-		return FALSE;
-	
-	/* No test on name => match */
-	if (pattern->name == NULL || pattern->name[0] == NULC)
-		return TRUE;
-
-	/* Test on name fails => no match */
-	if (!regstrcmp_search(to_test->name, pattern->name))
-		return FALSE;
+	if (nodes == NULL)
+		return -1;
 
-	/* No test on value => match */
-	if (pattern->value == NULL)
-		return TRUE;
+	return _search_all(from, search, regstrcmp_search, nodes, sz_nodes, limit);
+}
 
-	/* Test on value according to pattern "equal" attribute */
-	return regstrcmp_search(to_test->value, pattern->value) == pattern->active ? TRUE : FALSE;
+int XMLSearch_count(const XMLNode* from, XMLSearch* search)
+{
+	return _search_all(from, search, regstrcmp_search, NULL, NULL, 0);
 }
 
-int XMLSearch_node_matches(const XMLNode* node, const XMLSearch* search)
+#ifndef SXMLC_NO_THREADS
+/*
+ Parallel search: the descendants of the node to search from are split in 'SEARCH_PARALLEL_TASKS' tasks per thread
+ (going down at most 'SEARCH_PARALLEL_LEVELS' levels to split large subtrees), that threads take in turn as soon as
+ they are done with the previous one. Each task keeps its own matches, which are merged in task (i.e. document) order.
+ */
+#define SEARCH_PARALLEL_TASKS 8
+#define SEARCH_PARALLEL_LEVELS 16
+
+typedef struct _SearchTask {
+	const XMLNode* node;	/* Node to check alone when 'i0' is negative, father of the subtrees to check otherwise */
+	int i0, i1;				/* Subtrees of 'node->children[i0]' to 'node->children[i1 - 1]' */
+	XMLNode** nodes;		/* Matching nodes */
+	int n_nodes;
+	int sz_nodes;
+	int error;
+} _SearchTask;
+
+typedef struct _SearchJob {
+	const XMLSearch* search;
+	REGEXPR_COMPARE cmp;
+	_SearchTask* tasks;
+	int n_tasks;
+	int next;				/* Next task to take */
+	_sx_mutex mutex;
+} _SearchJob;
+
+/* Number of tasks 'task' is split in when its children ranges are split in at most 'n' parts */
+static int _task_split_count(const _SearchTask* task, int n)
 {
-	int i, j;
+	int c = task->i1 - task->i0;
 
-	if (node == NULL)
-		return FALSE;
+	if (task->i0 < 0 || c <= 0)
+		return 1;
+	if (c == 1) /* The child alone, then its children */
+		return task->node->children[task->i0]->n_children > 0 ? 2 : 1;
 
-	if (search == NULL)
-		return TRUE;
+	return c < n ? c : n;
+}
 
-	/* No comments, prolog, or such type of nodes are tested */
-	if (node->tag_type != TAG_FATHER && node->tag_type != TAG_SELF)
-		return FALSE;
+/*
+ Split the descendants of 'from' in about 'n_target' tasks, in document order.
+ Return the tasks, or NULL for memory error.
+ */
+static _SearchTask* _search_split(const XMLNode* from, int n_target, int* n_tasks)
+{
+	_SearchTask* tasks;
+	_SearchTask* split;
+	const _SearchTask* t;
+	const XMLNode* child;
+	int i, j, k, c, p, n, n_split, level;
+
+	tasks = (_SearchTask*)__calloc(1, sizeof(_SearchTask));
+	if (tasks == NULL)
+		return NULL;
+	tasks[0].node = from;
+	tasks[0].i0 = 0;
+	tasks[0].i1 = from->n_children;
+	n = 1;
+
+	for (level = 0; level < SEARCH_PARALLEL_LEVELS && n < n_target; level++) {
+		p = (n_target + n - 1) / n; /* Parts to split each range of children in */
+		for (i = 0, n_split = 0; i < n; i++)
+			n_split += _task_split_count(&tasks[i], p);
+		if (n_split == n)
+			break;
+		split = (_SearchTask*)__calloc(n_split, sizeof(_SearchTask));
+		if (split == NULL) {
+			__free(tasks);
+			return NULL;
+		}
+		for (i = 0, j = 0; i < n; i++) {
+			t = &tasks[i];
+			c = t->i1 - t->i0;
+			k = _task_split_count(t, p);
+			if (k == 1)
+				split[j++] = *t;
+			else if (c == 1) {
+				child = t->node->children[t->i0];
+				split[j].node = child;
+				split[j].i0 = split[j].i1 = -1;
+				j++;
+				split[j].node = child;
+				split[j].i0 = 0;
+				split[j].i1 = child->n_children;
+				j++;
+			} else {
+				for (c = 0; c < k; c++, j++) {
+					split[j].node = t->node;
+					split[j].i0 = t->i0 + (int)((size_t)(t->i1 - t->i0) * c / k);
+					split[j].i1 = t->i0 + (int)((size_t)(t->i1 - t->i0) * (c + 1) / k);
+				}
+			}
+		}
+		__free(tasks);
+		tasks = split;
+		n = n_split;
+	}
+	*n_tasks = n;
 
-	/* Check tag */
-	if (search->tag != NULL && !regstrcmp_search(node->tag, search->tag))
-		return FALSE;
+	return tasks;
+}
 
-	/* Check text */
-	if (search->text != NULL && !regstrcmp_search(node->text, search->text))
-		return FALSE;
+/* Find the nodes of 'task' matching the job search */
+static void _search_task(const _SearchJob* job, _SearchTask* task)
+{
+	_SearchWalk walk;
+	int i;
 
-	/* Check attributes */
-	if (search->attributes != NULL) {
-		for (i = 0; i < search->n_attributes; i++) {
-			for (j = 0; j < node->n_attributes; j++) {
-				if (!node->attributes[j].active)
-					continue;
-				if (_attribute_matches(&node->attributes[j], &search->attributes[i]))
+	if (task->i0 < 0) {
+		if (_node_matches(task->node, job->search, job->cmp)) {
+			if (_search_add((XMLNode*)task->node, 0, &task->nodes, &task->sz_nodes))
+				task->n_nodes = 1;
+			else
+				task->error = TRUE;
+		}
+		return;
+	}
+
+	/* Walk each subtree from its top node, which has depth 0 */
+	walk.size = 16;
+	walk.idx = (int*)__malloc(walk.size * sizeof(int));
+	if (walk.idx == NULL) {
+		task->error = TRUE;
+		return;
+	}
+	for (i = task->i0; i < task->i1 && !task->error; i++) {
+		walk.node = task->node->children[i];
+		walk.depth = 0;
+		while (walk.node != NULL) {
+			if (_node_matches(walk.node, job->search, job->cmp)) {
+				if (!_search_add((XMLNode*)walk.node, task->n_nodes, &task->nodes, &task->sz_nodes)) {
+					task->error = TRUE;
 					break;
+				}
+				task->n_nodes++;
+			}
+			if (!_walk_next(&walk)) {
+				task->error = TRUE;
+				break;
 			}
-			if (j >= node->n_attributes) /* All attributes where scanned without a successful match */
-				return FALSE;
 		}
 	}
+	__free(walk.idx);
+}
 
-	/* 'node' matches 'search'. If there is a father search, its father must match it */
-	if (search->prev != NULL)
-		return XMLSearch_node_matches(node->father, search->prev);
+SX_THREAD_FUNC(_search_worker)
+{
+	_SearchJob* job = (_SearchJob*)arg;
+	int i;
 
-	/* TODO: Should a node match if search has no more 'prev' search and node father is still below the initial search ?
-	 Depends if XPath started with "//" (=> yes) or "/" (=> no).
-	 if (search->prev == NULL && node->father != search->from) return FALSE; ? */
-		
-	return TRUE;
+	for (;;) {
+		_sx_mutex_lock(&job->mutex);
+		i = job->next;
+		if (i < job->n_tasks)
+			job->next++;
+		_sx_mutex_unlock(&job->mutex);
+		if (i >= job->n_tasks)
+			break;
+		_search_task(job, &job->tasks[i]);
+	}
+
+	return 0;
 }
 
-XMLNode* XMLSearch_next(const XMLNode* from, XMLSearch* search)
+/*
+ Find the descendants of 'from' matching the compiled (last) 'search' using 'n_threads' threads, the calling
+ thread taking tasks as well (e.g. when threads could not be created).
+ Return the number of matches stored in '*nodes', or -1 for memory error.
+ */
+static int _search_all_parallel(const XMLNode* from, const XMLSearch* search, REGEXPR_COMPARE cmp, XMLNode*** nodes, int* sz_nodes, int n_threads)
 {
-	XMLNode* node;
+	_SearchJob job;
+	_sx_thread* threads;
+	XMLNode** pt;
+	int i, n, n_started;
+
+	job.tasks = _search_split(from, n_threads * SEARCH_PARALLEL_TASKS, &job.n_tasks);
+	threads = (_sx_thread*)__malloc(n_threads * sizeof(_sx_thread));
+	if (job.tasks == NULL || threads == NULL) {
+		if (job.tasks != NULL)
+			__free(job.tasks);
+		if (threads != NULL)
+			__free(threads);
+		return -1;
+	}
+	job.search = search;
+	job.cmp = cmp;
+	job.next = 0;
+	_sx_mutex_init(&job.mutex);
+
+	/* The calling thread is one of the 'n_threads' */
+	for (n_started = 0; n_started < n_threads - 1; n_started++) {
+		if (!_sx_thread_create_arg(&threads[n_started], _search_worker, &job))
+			break;
+	}
+	(void)_search_worker(&job);
+	for (i = 0; i < n_started; i++)
+		_sx_thread_join(threads[i]);
+	_sx_mutex_destroy(&job.mutex);
+	__free(threads);
+
+	/* Merge matches in task order */
+	for (i = 0, n = 0; i < job.n_tasks && n >= 0; i++)
+		n = (job.tasks[i].error ? -1 : n + job.tasks[i].n_nodes);
+	if (n > 0 && (n > *sz_nodes || *nodes == NULL)) {
+		pt = (XMLNode**)__realloc(*nodes, n * sizeof(XMLNode*));
+		if (pt == NULL)
+			n = -1;
+		else {
+			*nodes = pt;
+			*sz_nodes = n;
+		}
+	}
+	for (i = 0, n = (n < 0 ? -1 : 0); i < job.n_tasks; i++) {
+		if (n >= 0 && job.tasks[i].n_nodes > 0) {
+			memcpy(*nodes + n, job.tasks[i].nodes, job.tasks[i].n_nodes * sizeof(XMLNode*));
+			n += job.tasks[i].n_nodes;
+		}
+		if (job.tasks[i].nodes != NULL)
+			__free(job.tasks[i].nodes);
+	}
+	__free(job.tasks);
 
-	if (search == NULL || from == NULL)
-		return NULL;
+	return n;
+}
+#endif
+
+int XMLSearch_all_parallel(const XMLNode* from, XMLSearch* search, XMLNode*** nodes, int* sz_nodes, int n_threads)
+{
+#ifndef SXMLC_NO_THREADS
+	const XMLNode* last;
+	XMLAttribute* attr;
+	SXML_CHAR* tag;
+	REGEXPR_COMPARE cmp = regstrcmp_search;
+	int n;
+
+	if (search == NULL || from == NULL || nodes == NULL || sz_nodes == NULL)
+		return -1;
 
-	/* Go down the last child search as fathers will be tested recursively by the 'XMLSearch_node_matches' function */
+	/* Compile before starting threads, which then only read 'search' */
+	(void)_search_compile(search, cmp);
 	for (; search->next != NULL; search = search->next) ;
 
-	/* Initialize the 'stop_at' node on first search, to remember where to stop as there will be multiple calls */
-	/* 'stop_at' can be NULL when 'from' is a root node, that is why it should be initialized with something else than NULL */
-	if (search->stop_at == INVALID_XMLNODE_POINTER)
-		search->stop_at = XMLNode_next_sibling(from);
+	/* Indexed searches only check the candidate nodes, which is faster than checking all nodes in parallel */
+	/* Searches evaluated one step at a time are not split */
+	if (n_threads <= 1 || from->n_children <= 0 || _search_is_set(search) || _search_candidates(from, search, cmp, &attr, &tag))
+		return _search_all(from, search, cmp, nodes, sz_nodes, 0);
 
-	for (node = XMLNode_next(from); node != search->stop_at; node = XMLNode_next(node)) { /* && node != NULL */
-		if (!XMLSearch_node_matches(node, search))
-			continue;
+	n = _search_all_parallel(from, search, cmp, nodes, sz_nodes, n_threads);
 
-		/* 'node' is a matching node */
+	/* Nodes following 'from' descendants are searched as well when 'from' has no next sibling */
+	if (n >= 0 && XMLNode_next_sibling(from) == NULL) {
+		for (last = from; last->n_children > 0; last = last->children[last->n_children - 1]) ;
+		n = _search_walk(last, NULL, search, cmp, nodes, sz_nodes, n, 0);
+	}
 
-		/* No search to perform on 'node' children => 'node' is returned */
-		if (search->next == NULL)
-			return node;
+	return n;
+#else
+	(void)n_threads;
+	if (nodes == NULL)
+		return -1;
 
-		/* Run the search on 'node' children */
-		return XMLSearch_next(node, search->next);
-	}
+	return _search_all(from, search, regstrcmp_search, nodes, sz_nodes, 0);
+#endif
+}
 
-	return NULL;
+XMLNode* XMLSearch_next_ex(const XMLNode* from, XMLSearch* search, const XMLParserConfig* config)
+{
+	return _search_next(from, search, _config_compare(config));
 }
 
 static SXML_CHAR* _get_XPath(const XMLNode* node, SXML_CHAR** xpath)
@@ -639,3 +2758,254 @@ xp_err:
 
 	return NULL;
 }
+
+/* --- Record streaming --- */
+
+/*
+ State of 'XMLDoc_parse_*_records()'. Records are built with the DOM callbacks into 'doc', while elements
+ outside of records are only kept (tag and attributes) while they are open, to match the search path.
+ */
+typedef struct _RecordParser {
+	XMLSearch search;			/* XPath search */
+	XMLSearch* last;			/* Last step of 'search', which records should match */
+	SXML_CHAR* text;			/* Text criteria of 'last', checked once the record is complete */
+	REGEXPR_COMPARE cmp;
+	XMLRecordCallback callback;
+	void* user;
+	XMLNode* spine;				/* Innermost open element outside of records */
+	XMLDoc doc;					/* Document holding the current record */
+	DOM_through_SAX dom;		/* DOM parsing of the current record */
+	int depth;					/* Number of open nodes in the current record, 0 when outside of records */
+	int n_records;
+	int stopped;				/* 'true' when the callback requested to stop */
+} _RecordParser;
+
+/* Run a DOM callback on the current record, from inside a SAX callback */
+#define _RECORD_SD(rp, sd, dom_sd) SAX_Data dom_sd = *(sd); dom_sd.user = &(rp)->dom
+
+static int _record_start_doc(SAX_Data* sd)
+{
+	_RecordParser* rp = (_RecordParser*)sd->user;
+	_RECORD_SD(rp, sd, dom_sd);
+
+	return DOMXMLDoc_doc_start(&dom_sd);
+}
+
+static int _record_start_node(const XMLNode* node, SAX_Data* sd)
+{
+	_RecordParser* rp = (_RecordParser*)sd->user;
+	XMLNode tmp;
+	XMLNode* spine = NULL;
+	int i;
+	_RECORD_SD(rp, sd, dom_sd);
+
+	if (rp->depth == 0) {
+		tmp = *node;
+		tmp.father = rp->spine;
+		if (!_node_matches(&tmp, rp->last, rp->cmp)) {
+			if (node->tag_type != TAG_FATHER)
+				return TRUE;
+			/* Keep the element while it is open, to match its descendants */
+			if ((spine = XMLNode_alloc()) == NULL || !XMLNode_set_tag(spine, node->tag)) goto start_err;
+			for (i = 0; i < node->n_attributes; i++)
+				if (XMLNode_set_attribute(spine, node->attributes[i].name, node->attributes[i].value) < 0) goto start_err;
+			spine->tag_type = node->tag_type;
+			spine->father = rp->spine;
+			rp->spine = spine;
+			return TRUE;
+		}
+	}
+	rp->depth++;
+
+	return DOMXMLDoc_node_start(node, &dom_sd);
+
+start_err:
+	if (spine != NULL) {
+		(void)XMLNode_free(spine);
+		__free(spine);
+	}
+	return DOMXMLDoc_parse_error(PARSE_ERR_MEMORY, sd->line_num, &dom_sd);
+}
+
+/*
+ Give 'node' of the complete current record to the user if it matches the search ('matches' is 'true' when it
+ matches all but the text criteria), or else its descendants matching it: text is only known once the record
+ is complete, so that they were not matched when they started.
+ Return 'false' if the user stopped parsing.
+ */
+static int _record_give(_RecordParser* rp, XMLNode* node, int matches)
+{
+	XMLNode* child;
+	int i;
+
+	if (matches && (rp->text == NULL || rp->cmp(node->text, rp->text))) {
+		rp->n_records++;
+		if (!rp->callback(node, rp->user))
+			rp->stopped = TRUE;
+		return !rp->stopped;
+	}
+
+	for (i = 0; i < node->n_children; i++) {
+		child = node->children[i];
+		if ((child->tag_type == TAG_FATHER || child->tag_type == TAG_SELF)
+			&& !_record_give(rp, child, _node_matches(child, rp->last, rp->cmp)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int _record_end_node(const XMLNode* node, SAX_Data* sd)
+{
+	_RecordParser* rp = (_RecordParser*)sd->user;
+	XMLNode* record;
+	XMLNode* spine;
+	int ret;
+	_RECORD_SD(rp, sd, dom_sd);
+
+	if (rp->depth == 0) {
+		if (node->tag_type != TAG_END) /* Nodes other than elements end right after they start */
+			return TRUE;
+		if (rp->spine == NULL || sx_strcmp(rp->spine->tag, node->tag))
+			return DOMXMLDoc_parse_error(PARSE_ERR_UNEXPECTED_NODE_END, sd->line_num, &dom_sd);
+		spine = rp->spine;
+		rp->spine = spine->father;
+		(void)XMLNode_free(spine);
+		__free(spine);
+		return TRUE;
+	}
+
+	if (!DOMXMLDoc_node_end(node, &dom_sd))
+		return FALSE;
+	if (--rp->depth > 0)
+		return TRUE;
+
+	/* Record is complete: give it to the user with its ancestors, then free it */
+	record = rp->doc.nodes[0];
+	record->father = rp->spine;
+	ret = _record_give(rp, record, TRUE);
+	record->father = NULL;
+	(void)XMLDoc_free(&rp->doc);
+
+	return ret;
+}
+
+static int _record_new_text(SXML_CHAR* text, SAX_Data* sd)
+{
+	_RecordParser* rp = (_RecordParser*)sd->user;
+	_RECORD_SD(rp, sd, dom_sd);
+
+	if (rp->depth == 0) /* Text of elements outside of records is not kept */
+		return TRUE;
+
+	return DOMXMLDoc_node_text(text, &dom_sd);
+}
+
+static int _record_on_error(ParseError error_num, int line_number, SAX_Data* sd)
+{
+	_RecordParser* rp = (_RecordParser*)sd->user;
+	_RECORD_SD(rp, sd, dom_sd);
+
+	return DOMXMLDoc_parse_error(error_num, line_number, &dom_sd);
+}
+
+static int _record_end_doc(SAX_Data* sd)
+{
+	_RecordParser* rp = (_RecordParser*)sd->user;
+	XMLNode* spine;
+	_RECORD_SD(rp, sd, dom_sd);
+
+	while ((spine = rp->spine) != NULL) {
+		rp->spine = spine->father;
+		(void)XMLNode_free(spine);
+		__free(spine);
+	}
+	(void)DOMXMLDoc_doc_end(&dom_sd); /* Display the error, if any */
+	(void)XMLDoc_free(&rp->doc); /* Unfinished record */
+
+	return TRUE;
+}
+
+/*
+ Parse a file (when 'buffer' is NULL) or a buffer into records.
+ */
+static int _parse_records(const SXML_CHAR* filename, const SXML_CHAR* buffer, const SXML_CHAR* name, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user, const XMLParserConfig* config)
+{
+	_RecordParser rp;
+	SAX_Callbacks sax;
+	int ret;
+
+	if (xpath == NULL || callback == NULL || (config != NULL && config->init_value != XML_INIT_DONE))
+		return -1;
+
+	XMLSearch_init(&rp.search);
+	if (!XMLSearch_init_from_XPath(xpath, &rp.search)) {
+		XMLSearch_free(&rp.search, TRUE);
+		return -1;
+	}
+	for (rp.last = &rp.search; rp.last->next != NULL; rp.last = rp.last->next) ;
+	/* Records are matched as they are parsed, without their next siblings */
+	if (_search_is_set(rp.last)) {
+		XMLSearch_free(&rp.search, TRUE);
+		return -1;
+	}
+	/* Text is not known when an element starts, it is checked when the record ends */
+	rp.text = rp.last->text;
+	rp.last->text = NULL;
+	(void)XMLSearch_compile(&rp.search);
+	rp.cmp = _config_compare(config);
+	rp.callback = callback;
+	rp.user = user;
+	rp.spine = NULL;
+	XMLDoc_init(&rp.doc);
+	rp.dom.doc = &rp.doc;
+	rp.dom.current = NULL;
+	rp.dom.text_as_nodes = (config != NULL ? config->text_as_nodes : FALSE);
+	rp.depth = 0;
+	rp.n_records = 0;
+	rp.stopped = FALSE;
+
+	SAX_Callbacks_init(&sax);
+	sax.start_doc = _record_start_doc;
+	sax.start_node = _record_start_node;
+	sax.end_node = _record_end_node;
+	sax.new_text = _record_new_text;
+	sax.on_error = _record_on_error;
+	sax.end_doc = _record_end_doc;
+
+	if (buffer == NULL)
+		ret = XMLDoc_parse_file_SAX_ex(filename, &sax, &rp, config);
+	else
+		ret = XMLDoc_parse_buffer_SAX_len_ex(buffer, sx_strlen(buffer), name, &sax, &rp, config);
+
+	rp.last->text = rp.text;
+	XMLSearch_free(&rp.search, TRUE);
+
+	return (ret || rp.stopped) ? rp.n_records : -1;
+}
+
+int XMLDoc_parse_file_records(const SXML_CHAR* filename, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user)
+{
+	return XMLDoc_parse_file_records_ex(filename, xpath, callback, user, NULL);
+}
+
+int XMLDoc_parse_file_records_ex(const SXML_CHAR* filename, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user, const XMLParserConfig* config)
+{
+	if (filename == NULL)
+		return -1;
+
+	return _parse_records(filename, NULL, NULL, xpath, callback, user, config);
+}
+
+int XMLDoc_parse_buffer_records(const SXML_CHAR* buffer, const SXML_CHAR* name, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user)
+{
+	return XMLDoc_parse_buffer_records_ex(buffer, name, xpath, callback, user, NULL);
+}
+
+int XMLDoc_parse_buffer_records_ex(const SXML_CHAR* buffer, const SXML_CHAR* name, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user, const XMLParserConfig* config)
+{
+	if (buffer == NULL)
+		return -1;
+
+	return _parse_records(NULL, buffer, name, xpath, callback, user, config);
+}
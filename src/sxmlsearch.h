@@ -36,8 +36,53 @@ extern "C" {
 
 #include "sxmlc.h"
 
+/**
+ * \brief How the nodes of a search relate to the nodes matching its previous search (`XMLSearch.prev`).
+ */
+typedef enum _XMLSearchAxis {
+	XML_AXIS_CHILD = 0,			/**< Children (`a/b`). Nodes below the starting node for the first search. */
+	XML_AXIS_DESCENDANT,		/**< Descendants (`a//b`), positions being counted among siblings as for XPath `//`. */
+	XML_AXIS_PARENT,			/**< Father (`a/..` or `a/parent::b`). */
+	XML_AXIS_ANCESTOR,			/**< Ancestors, closest first (`a/ancestor::b`). */
+	XML_AXIS_FOLLOWING_SIBLING	/**< Next siblings (`a/following-sibling::b`). */
+} XMLSearchAxis;
+
+/**
+ * \brief `XMLSearch.position` of the last node (`[last()]`).
+ */
+#define XML_POSITION_LAST (-1)
+
+/**
+ * \brief Comparison of an attribute number to a value (see `XMLSearch_search_add_number()`).
+ */
+typedef enum _XMLNumberCompare {
+	XML_NUMBER_LT = 0,	/**< `@a<value` */
+	XML_NUMBER_LE,		/**< `@a<=value` */
+	XML_NUMBER_GT,		/**< `@a>value` */
+	XML_NUMBER_GE,		/**< `@a>=value` */
+	XML_NUMBER_EQ		/**< Same number as `value` (e.g. `"1.0"` for 1), unlike `XMLSearch_search_add_attribute()`. */
+} XMLNumberCompare;
+
+/**
+ * \brief Numeric search criteria: an attribute which value is a number within a range.
+ */
+typedef struct _XMLSearchNumber {
+	SXML_CHAR* name;	/**< The attribute name, compared as is (not as a pattern). */
+	double min;			/**< Range lower bound, `-HUGE_VAL` if there is none. */
+	double max;			/**< Range upper bound, `HUGE_VAL` if there is none. */
+	int min_excluded;	/**< `true` if `min` itself does not match. */
+	int max_excluded;	/**< `true` if `max` itself does not match. */
+} XMLSearchNumber;
+
 /**
  * \brief XML search parameters. Can be initialized from an XPath string.
+ *
+ * Searches with a `position`, or with `XML_AXIS_PARENT`, `XML_AXIS_ANCESTOR` or `XML_AXIS_FOLLOWING_SIBLING` steps
+ * are evaluated one step at a time: each search finds its nodes from all the nodes found by the previous one.
+ * A first search on the child or descendant axis finds its nodes in the whole tree of the node to start
+ * searching from (as the first search of other searches can match any ancestor), only the nodes other searches
+ * would visit being returned. A first search on another axis finds its nodes from the node to start searching
+ * from, all of them being returned.
  */
 typedef struct _XMLSearch {
 
@@ -59,12 +104,26 @@ typedef struct _XMLSearch {
 	SXML_CHAR* text;	/**< Search for nodes which text match this `text` field. */
 						/**< If NULL or an empty string, all nodes will be matching (i.e. not used). */
 
+	XMLSearchNumber* numbers;	/**< Search for nodes having attributes which values are numbers within all these ranges. */
+								/**< Numbers are read from the number index of the document, if built (see `XMLDoc_build_number_index()`). */
+	int n_numbers;	/**< The size of `numbers` array. */
+
+	XMLSearchAxis axis;	/**< How nodes relate to the ones matching `prev` (`XML_AXIS_CHILD` by default). */
+
+	int position;		/**< Position of the node among the matching ones found from the same node, in `axis` order: */
+						/**< starting at 1, `XML_POSITION_LAST` for the last one, or 0 for all of them (default). */
+
 	struct _XMLSearch* next;	/**< Next search to perform on children of a node matching current struct. */
 								/**< Used to search for nodes children of specific nodes (used in XPath queries). */
 	struct _XMLSearch* prev;
 
+	struct _XMLSearchCompiled* compiled;	/**< Internal use only. Matchers built by `XMLSearch_compile()`, or NULL. */
+
 	XMLNode* stop_at;	/**< Internal use only. Must be initialized to 'INVALID_XMLNODE_POINTER' prior to first search. */
 
+	struct _XMLSearchResults* results;	/**< Internal use only. Nodes found by `XMLSearch_next()` for searches evaluated */
+										/**< one step at a time, or NULL. */
+
 	/* Keep 'init_value' as the last member */
 	int init_value;	/**< Initialized to 'XML_INIT_DONE' to indicate that document has been initialized properly */
 } XMLSearch;
@@ -82,7 +141,7 @@ typedef int (*REGEXPR_COMPARE)(SXML_CHAR* str, SXML_CHAR* pattern);
  * \brief Set a new comparison function to evaluate whether a string matches a given pattern.
  *
  * The default one is `regstrcmp()` which handles limited regular expressions (<code>'?'</code>
- * and <code>'*'</code> wildcards).
+ * and <code>'*'</code> wildcards). Use `regexcmp()` for regular expressions.
  *
  * \return The previous function used for matching.
  */
@@ -148,6 +207,24 @@ int XMLSearch_search_get_attribute_index(const XMLSearch* search, const SXML_CHA
  */
 int XMLSearch_search_remove_attribute(XMLSearch* search, int i_attr);
 
+/**
+ * \brief Add a numeric search criteria: attribute `attr_name` should be a number (see `str2number()`)
+ * 		which compares to `value` as `compare` tells.
+ * \param search The search parameters.
+ * \param attr_name is the attribute name to search. Mandatory.
+ * \param compare How the attribute number compares to `value`.
+ * \param value The value to compare attribute numbers to.
+ * \return the index of the new criteria in `search->numbers`, or -1 for invalid arguments or memory error.
+ */
+int XMLSearch_search_add_number(XMLSearch* search, const SXML_CHAR* attr_name, XMLNumberCompare compare, double value);
+
+/**
+ * \brief Add a numeric search criteria: attribute `attr_name` should be a number between `min` and `max`
+ * 		(both included).
+ * \return the index of the new criteria in `search->numbers`, or -1 for invalid arguments or memory error.
+ */
+int XMLSearch_search_add_range(XMLSearch* search, const SXML_CHAR* attr_name, double min, double max);
+
 /**
  * \brief Set the search based on text content.
  * \param search The search parameters.
@@ -201,6 +278,14 @@ SXML_CHAR* XMLSearch_get_XPath_string(const XMLSearch* search, SXML_CHAR** xpath
  * \param xpath should be like <code>"tag[.=text, @attrib="value", @attrib!='value', ...]/tag..."</code>.
  * 		*Warning*: the XPath query on node text like `father[child="text"]` should be
  * 		re-written `father/child[.="text"]` instead (which should be XPath-compliant as well).
+ * 		Steps are separated by `/` (children) or `//` (descendants), a leading `/` or `//` being ignored.
+ * 		A step can start with an axis (`child::`, `descendant::` which is handled as `//`, `parent::`,
+ * 		`ancestor::` or `following-sibling::`), be `..` (father) and have `*` as tag (any tag).
+ * 		Tags are names, possibly with `*` and `?` wildcards and characters escaped by a backslash
+ * 		(use `XMLSearch_search_set_tag()` for other patterns).
+ * 		A position (`[2]` or `[last()]`) can follow the other predicates (see `XMLSearch.position`).
+ * 		Attributes can be compared to numbers with `<`, `<=`, `>` and `>=` (e.g. `item[@price>100, @price<=200]`,
+ * 		see `XMLSearch_search_add_number()`).
  * \param search The search parameters.
  *
  *
@@ -209,11 +294,30 @@ SXML_CHAR* XMLSearch_get_XPath_string(const XMLSearch* search, SXML_CHAR** xpath
  */
 int XMLSearch_init_from_XPath(const SXML_CHAR* xpath, XMLSearch* search);
 
+/**
+ * \brief Prepare `search` and its next searches for faster matching, by classifying their patterns (tag,
+ * 		text, attribute names and values) as exact (`abc`), prefix (`abc*`), suffix (`*abc`), substring
+ * 		(`*abc*`) or general patterns.
+ *
+ * Only general patterns are then matched with `regstrcmp()`, the others being compared directly.
+ * When the matching function is `regexcmp()`, patterns are classified the same way (`^abc$`, `^abc`,
+ * `abc$` and `abc`), general ones being compiled into automata once for all the nodes they are matched to.
+ * Compiled patterns are only used with these two matching functions.
+ * `XMLSearch_next()` compiles the search on its first call (again if it is used with another matching
+ * function), and `XMLSearch_search_*()` functions modifying a search drop its compiled patterns.
+ * \param search The search parameters.
+ * \return `false` for invalid `search` or memory error (patterns are then matched as before),
+ * 		`true` otherwise.
+ */
+int XMLSearch_compile(XMLSearch* search);
+
 /**
  * \brief Check whether a node matches a search criteria.
  *
  * If `search->prev` is not NULL (i.e. has a father search), `node->father` is also
  * tested, recursively (i.e. grand-father and so on).
+ * Searches evaluated one step at a time (see `XMLSearch`) are evaluated on the whole tree of `node`,
+ * those whose first search is not on the child or descendant axis never matching.
  *
  * \param node The node to test. `tag_type` should be `TAG_FATHER` or `TAG_SELF` only.
  * \param search The search parameters.
@@ -223,6 +327,15 @@ int XMLSearch_init_from_XPath(const SXML_CHAR* xpath, XMLSearch* search);
  */
 int XMLSearch_node_matches(const XMLNode* node, const XMLSearch* search);
 
+/**
+ * \brief Same as `XMLSearch_node_matches()` but using the matching function of `config`
+ * instead of the global one set by `XMLSearch_set_regexpr_compare()`.
+ *
+ * \param config The configuration holding the matching function. If its `regexpr_compare` is NULL,
+ * 		`regstrcmp()` is used. If `config` is NULL, the global matching function is used.
+ */
+int XMLSearch_node_matches_ex(const XMLNode* node, const XMLSearch* search, const XMLParserConfig* config);
+
 /**
  * \brief Search next matching node, according to search parameters.
  *
@@ -248,6 +361,105 @@ int XMLSearch_node_matches(const XMLNode* node, const XMLSearch* search);
  */
 XMLNode* XMLSearch_next(const XMLNode* from, XMLSearch* search);
 
+/**
+ * \brief Get all the nodes matching a search, in the order `XMLSearch_next()` would return them.
+ *
+ * The nodes following `from` are visited once, up to the ones `XMLSearch_next()` would stop at
+ * (`from` itself is not checked). `search` is not modified, except for being compiled
+ * (see `XMLSearch_compile()`), so it does not need to be reinitialized between calls.
+ *
+ * \param from The node to start searching from.
+ * \param search The search parameters.
+ * \param nodes Address of the array receiving the matching nodes. `*nodes` can be `NULL` or an array
+ * 		returned by a previous call, which is reused and reallocated when too small. It should be
+ * 		freed by the caller with `free()`.
+ * \param sz_nodes Address of the number of nodes `*nodes` can hold (0 when `*nodes` is `NULL`),
+ * 		updated when it is reallocated.
+ * \param limit The maximum number of nodes to find, or 0 to find all of them.
+ *
+ * \return the number of matching nodes stored in `*nodes`, or -1 for invalid arguments or memory error.
+ */
+int XMLSearch_all(const XMLNode* from, XMLSearch* search, XMLNode*** nodes, int* sz_nodes, int limit);
+
+/**
+ * \brief Count the nodes matching a search, as `XMLSearch_all()` but without storing them.
+ *
+ * \param from The node to start searching from.
+ * \param search The search parameters.
+ *
+ * \return the number of matching nodes, or -1 for invalid arguments or memory error.
+ */
+int XMLSearch_count(const XMLNode* from, XMLSearch* search);
+
+/**
+ * \brief Same as `XMLSearch_all()` (without limit) but checking nodes in parallel, for large documents.
+ *
+ * The descendants of `from` are split in tasks that `n_threads` threads (including the calling one) take in
+ * turn, the matching nodes being returned in document order. The document must not be modified during
+ * the search, and the function set with `XMLSearch_set_regexpr_compare()` must be thread-safe.
+ * Searches using document indexes (see `XMLDoc_build_tag_index()`) or evaluated one step at a time (see `XMLSearch`)
+ * are done by the calling thread, as well as all searches when the library is built with `SXMLC_NO_THREADS`.
+ *
+ * \param from The node to start searching from.
+ * \param search The search parameters.
+ * \param nodes Address of the array receiving the matching nodes (see `XMLSearch_all()`).
+ * \param sz_nodes Address of the number of nodes `*nodes` can hold (see `XMLSearch_all()`).
+ * \param n_threads The number of threads to use.
+ *
+ * \return the number of matching nodes stored in `*nodes`, or -1 for invalid arguments or memory error.
+ */
+int XMLSearch_all_parallel(const XMLNode* from, XMLSearch* search, XMLNode*** nodes, int* sz_nodes, int n_threads);
+
+/**
+ * \brief Same as `XMLSearch_next()` but using the matching function of `config`
+ * (see `XMLSearch_node_matches_ex()`), so that concurrent searches can use different matchers.
+ */
+XMLNode* XMLSearch_next_ex(const XMLNode* from, XMLSearch* search, const XMLParserConfig* config);
+
+/**
+ * \brief The prototype of the function receiving records from `XMLDoc_parse_file_records()`.
+ * \param record The record node, with its children. It is freed when the function returns so it should be
+ * 		duplicated (e.g. `XMLNode_dup()`) to be kept. Its `father` node and above only have their tag and attributes,
+ * 		except the ones of a record dropped by the text criteria of the XPath query.
+ * \param user The user data given to `XMLDoc_parse_file_records()`.
+ * \return `false` to stop parsing.
+ */
+typedef int (*XMLRecordCallback)(XMLNode* record, void* user);
+
+/**
+ * \brief Parse a file, building nodes only for the elements matching an XPath query ("records"),
+ * 		so that memory usage depends on the size of records instead of the size of the file.
+ * Each record is given to `callback` as soon as it ends, then freed. Elements inside a record are not
+ * matched again (i.e. records are not nested), unless the record does not match the text criteria of `xpath`,
+ * which are checked when it ends.
+ * Text criteria are only supported on the last step of `xpath` as the text of the elements above is not kept,
+ * and positions and axes other than the child and descendant ones are not supported.
+ * \param filename The file to parse.
+ * \param xpath The XPath query records should match (see `XMLSearch_init_from_XPath()`), e.g. `"feed/item"`.
+ * \param callback The function called for each record.
+ * \param user The user data given to `callback`.
+ * \return the number of records given to `callback`, or -1 in case of error (memory, unavailable filename,
+ * 		malformed `xpath` or document).
+ */
+int XMLDoc_parse_file_records(const SXML_CHAR* filename, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user);
+
+/**
+ * \brief Same as `XMLDoc_parse_file_records()` using a given parser configuration (user tags, limits,
+ * 		`text_as_nodes` for records, matching function).
+ */
+int XMLDoc_parse_file_records_ex(const SXML_CHAR* filename, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user, const XMLParserConfig* config);
+
+/**
+ * \brief Same as `XMLDoc_parse_file_records()` on a memory buffer.
+ * \param name The buffer name (to identify several buffers if run concurrently).
+ */
+int XMLDoc_parse_buffer_records(const SXML_CHAR* buffer, const SXML_CHAR* name, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user);
+
+/**
+ * \brief Same as `XMLDoc_parse_buffer_records()` using a given parser configuration.
+ */
+int XMLDoc_parse_buffer_records_ex(const SXML_CHAR* buffer, const SXML_CHAR* name, const SXML_CHAR* xpath, XMLRecordCallback callback, void* user, const XMLParserConfig* config);
+
 /**
  * \brief Get node XPath-like equivalent: `tag[.="text", @attribute="value", ...]`, potentially
  * including father nodes XPathes.
@@ -262,11 +474,26 @@ SXML_CHAR* XMLNode_get_XPath(XMLNode* node, SXML_CHAR** xpath, int incl_parents)
  * Checks whether a string corresponds to a pattern.
  * \param str The string to check.
  * \param pattern can use wildcads such as `*` (any potentially empty string) or
- * 		`?` (any character) and use `\` as an escape character.
+ * 		`?` (any single character) and use `\` as an escape character.
  * \returns `true` when `str` matches `pattern`, `false` otherwise.
  */
 int regstrcmp(SXML_CHAR* str, SXML_CHAR* pattern);
 
+/**
+ * \brief Checks whether a part of a string matches a regular expression, in time proportional to the lengths
+ * 		of the string and of the pattern (there is no backtracking).
+ *
+ * It can be used as matching function (see `XMLSearch_set_regexpr_compare()` and `XMLParserConfig`),
+ * in which case searches compile their patterns once (see `XMLSearch_compile()`).
+ * \param str The string to check.
+ * \param pattern The regular expression: characters, `.` (any character), classes (`[abc]`, `[a-z]`,
+ * 		`[^abc]`, `\d`, `\w`, `\s` and `\D`, `\W`, `\S` for their complements), anchors (`^` and `$`),
+ * 		groups (`(...)`), alternation (`|`) and repetition (`*`, `+`, `?`, `{m}`, `{m,}` and `{m,n}`).
+ * 		`\` escapes special characters, `\n`, `\t` and `\r` being new line, tabulation and carriage return.
+ * \returns `true` when `str` matches `pattern`, `false` otherwise or if `pattern` is malformed.
+ */
+int regexcmp(SXML_CHAR* str, SXML_CHAR* pattern);
+
 #ifdef __cplusplus
 }
 #endif
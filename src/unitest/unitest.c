@@ -13,6 +13,8 @@
 //#define SXMLC_UNICODE
 #include "../sxmlc.h"
 #include "../sxmlsearch.h"
+#include "../sxmldiff.h"
+#include "../sxmlc_thread.h"
 
 typedef enum {
 	TEST_ERROR = -1,
@@ -405,13 +407,6 @@ static test_result test_parse_file(char* msg)
 }
 
 
-static test_result test_text_node(char* msg)
-{
-	// TODO: Test TAG_TEXT nodes
-	return _test_not_implemented(msg);
-}
-
-
 static test_result test_unicode(char* msg)
 {
 	// TODO: Test UTF16
@@ -508,6 +503,914 @@ static test_result test_move(char* msg)
 }
 
 
+static test_result test_dup(char* msg)
+{
+	XMLNode* root = XMLNode_new(TAG_FATHER, C2SX("root"), NULL);
+	XMLNode* child = XMLNode_new_text(C2SX("child"), C2SX("text"));
+	XMLNode *dup, *dup2;
+
+	XMLNode_set_attribute(root, C2SX("name"), C2SX("value"));
+	XMLNode_add_child(root, child);
+
+	dup = XMLNode_dup(root, true);
+	assert_true("Dup", dup != NULL, TEST_ERROR, "Cannot duplicate node", NOP);
+	assert_true("Shared tag", dup->tag == root->tag, TEST_ERROR, "Tag is not shared", NOP);
+	assert_equals_i(NULL, 1, dup->n_children, TEST_ERROR, "Wrong number of children", NOP);
+	assert_true("Child father", dup->children[0]->father == dup, TEST_ERROR, "Wrong father for duplicated child", NOP);
+	assert_equals_s("Child text", "text", dup->children[0]->text, TEST_ERROR, "Wrong duplicated text", NOP);
+	assert_true("Equal", XMLNode_equal(root, dup), TEST_ERROR, "Duplicated node is not equal", NOP);
+
+	// Modifying the copy should not modify the original
+	XMLNode_set_attribute(dup, C2SX("name"), C2SX("other"));
+	assert_true("Unshared", dup->attributes != root->attributes, TEST_ERROR, "Attributes are still shared", NOP);
+	assert_equals_s("Original attribute", "value", root->attributes[0].value, TEST_ERROR, "Original node was modified", NOP);
+	assert_equals_s("Copy attribute", "other", dup->attributes[0].value, TEST_ERROR, "Copy was not modified", NOP);
+	XMLNode_set_text(root->children[0], C2SX("new text"));
+	assert_equals_s("Copy child text", "text", dup->children[0]->text, TEST_ERROR, "Copy child was modified", NOP);
+
+	// Copy of a child is not attached to its father
+	dup2 = XMLNode_dup(child, false);
+	assert_true("Copy father", dup2 != NULL && dup2->father == NULL, TEST_ERROR, "Duplicated node has a father", NOP);
+	XMLNode_free(dup2);
+	free(dup2);
+
+	// Freeing the original should keep the copy
+	XMLNode_free(root);
+	free(root);
+	assert_equals_s("Copy child tag", "child", dup->children[0]->tag, TEST_ERROR, "Copy child was freed", NOP);
+	XMLNode_free(dup);
+	free(dup);
+
+	return TEST_OK;
+}
+
+#ifndef SXMLC_NO_THREADS
+#define DUP_THREADS 4
+
+static struct _dup_job {
+	const XMLNode* src;
+	XMLNode* dup[DUP_THREADS];
+	int n_ready;
+} _dup_job;
+
+SX_THREAD_FUNC(_dup_worker)
+{
+	int i = _shared_inc(&_dup_job.n_ready) - 1;
+
+	(void)arg;
+	while (_shared_get(&_dup_job.n_ready) < DUP_THREADS) ; // Start copying together
+	_dup_job.dup[i] = XMLNode_dup(_dup_job.src, true);
+
+	return 0;
+}
+#endif
+
+static test_result test_dup_threads(char* msg)
+{
+#ifdef SXMLC_NO_THREADS
+	return TEST_WARN;
+#else
+	XMLDoc doc;
+	XMLNode *root, *text;
+	_sx_thread threads[DUP_THREADS];
+	int i, round;
+
+	// Share counters are created by the first copy of each node, so each round starts from a new document
+	for (round = 0; round < 50; round++) {
+		XMLDoc_init(&doc);
+		// Text nodes parsed 'as nodes' hold their text inline
+		assert_true("Parse", XMLDoc_parse_buffer_DOM_text_as_nodes(C2SX("<r a=\"1\"><b>one</b><c x=\"y\">two<d/></c></r>"), C2SX("dup"), &doc, true), TEST_ERROR, "Cannot parse XML", NOP);
+		root = XMLDoc_root(&doc);
+		text = root->children[0]->children[0];
+		assert_true("Inline text", text->tag_type == TAG_TEXT && text->text == (SXML_CHAR*)(text + 1), TEST_ERROR, "Text is not inline", XMLDoc_free(&doc));
+		_dup_job.src = root;
+		_dup_job.n_ready = 0;
+		for (i = 0; i < DUP_THREADS; i++)
+			assert_true("Thread", _sx_thread_create(&threads[i], _dup_worker), TEST_ERROR, "Cannot create thread", XMLDoc_free(&doc));
+		for (i = 0; i < DUP_THREADS; i++)
+			_sx_thread_join(threads[i]);
+		// A single share counter for the original and all the copies
+		for (i = 0; i < DUP_THREADS; i++)
+			assert_true("Dup", _dup_job.dup[i] != NULL && _dup_job.dup[i]->shared == root->shared && XMLNode_equal(root, _dup_job.dup[i]), TEST_ERROR, "Wrong copy", XMLDoc_free(&doc));
+		assert_equals_i("Shares", DUP_THREADS + 1, *root->shared, TEST_ERROR, "Wrong share count", XMLDoc_free(&doc));
+		// Inline text is copied, not shared, so the original is not changed
+		assert_true("Text unchanged", text->text == (SXML_CHAR*)(text + 1) && text->shared == NULL, TEST_ERROR, "Original text node was modified", XMLDoc_free(&doc));
+		for (i = 0; i < DUP_THREADS; i++) {
+			XMLNode_free(_dup_job.dup[i]);
+			free(_dup_job.dup[i]);
+		}
+		assert_equals_i("Released", 1, *root->shared, TEST_ERROR, "Wrong share count", XMLDoc_free(&doc));
+		XMLDoc_free(&doc);
+	}
+
+	return TEST_OK;
+#endif
+}
+
+
+static test_result test_diff(char* msg)
+{
+	XMLDoc from, to, diff;
+	int n;
+
+	XMLDoc_init(&from);
+	XMLDoc_init(&to);
+	XMLDoc_init(&diff);
+	XMLDoc_parse_buffer_DOM(C2SX("<?xml version=\"1.0\"?><root><a x=\"1\"/><b>text</b><c/><d><e/></d><g/></root>"), C2SX("from"), &from);
+	XMLDoc_parse_buffer_DOM(C2SX("<?xml version=\"1.0\"?><root><d><e/></d><a x=\"2\"/><b>text</b><g/><f/></root>"), C2SX("to"), &to);
+
+	// Hash changes with the content and is restored with it
+	assert_true("Hash", XMLNode_hash(XMLDoc_root(&from)) != XMLNode_hash(XMLDoc_root(&to)), TEST_ERROR, "Different nodes have the same hash", NOP);
+	assert_true("Same hash", XMLNode_hash(XMLDoc_root(&from)->children[1]) == XMLNode_hash(XMLDoc_root(&to)->children[2]), TEST_ERROR, "Identical nodes have different hashes", NOP);
+	XMLNode_set_text(XMLDoc_root(&from)->children[1], C2SX("other"));
+	assert_true("Hash invalidated", XMLNode_hash(XMLDoc_root(&from)->children[1]) != XMLNode_hash(XMLDoc_root(&to)->children[2]), TEST_ERROR, "Hash was not invalidated", NOP);
+	XMLNode_set_text(XMLDoc_root(&from)->children[1], C2SX("text"));
+
+	// <c/> deleted, <d> moved, <a> updated and <f/> inserted
+	n = XMLDoc_diff(&from, &to, &diff);
+	assert_equals_i("Diff", 4, n, TEST_ERROR, "Wrong number of edits", NOP);
+	assert_true("Patch", XMLDoc_patch(&from, &diff), TEST_ERROR, "Cannot apply patch", NOP);
+	assert_true("Patched", XMLNode_hash(XMLDoc_root(&from)) == XMLNode_hash(XMLDoc_root(&to)), TEST_ERROR, "Patched document differs", NOP);
+	assert_equals_s("Patched attribute", "2", XMLDoc_root(&from)->children[1]->attributes[0].value, TEST_ERROR, "Attribute was not updated", NOP);
+	XMLDoc_free(&diff);
+
+	XMLDoc_init(&diff);
+	assert_equals_i("Identical", 0, XMLDoc_diff(&from, &to, &diff), TEST_ERROR, "Identical documents have differences", NOP);
+
+	XMLDoc_free(&diff);
+	XMLDoc_free(&to);
+	XMLDoc_free(&from);
+
+	return TEST_OK;
+}
+
+
+static int _exact_compare(SXML_CHAR* str, SXML_CHAR* pattern)
+{
+	return str != NULL && pattern != NULL && sx_strcmp(str, pattern) == 0;
+}
+
+static test_result test_config(char* msg)
+{
+	XMLParserConfig config;
+	XMLSearch search;
+	XMLDoc doc;
+
+	XMLParserConfig_init(&config);
+	assert_equals_i("Register", 0, XMLParserConfig_register_user_tag(&config, TAG_USER+1, C2SX("<#"), C2SX("#>")), TEST_ERROR, "Cannot register user tag", NOP);
+	assert_equals_i("Global tags", 0, XML_get_nb_registered_user_tags(), TEST_ERROR, "User tag was registered globally", NOP);
+
+	// User tags are only known by the configuration
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM_ex(C2SX("<root><#user#><a1/><a2/></root>"), C2SX("config"), &doc, &config), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_equals_i("User tag", TAG_USER+1, XMLDoc_root(&doc)->children[0]->tag_type, TEST_ERROR, "User tag not recognized", NOP);
+
+	// Search uses the configuration matcher
+	XMLSearch_init(&search);
+	XMLSearch_search_set_tag(&search, C2SX("a*"));
+	assert_true("Search", XMLSearch_next(XMLDoc_root(&doc), &search) != NULL, TEST_ERROR, "Wildcard search failed", NOP);
+	XMLSearch_free(&search, false);
+	XMLSearch_init(&search);
+	XMLSearch_search_set_tag(&search, C2SX("a*"));
+	config.regexpr_compare = _exact_compare;
+	assert_true("Search ex", XMLSearch_next_ex(XMLDoc_root(&doc), &search, &config) == NULL, TEST_ERROR, "Configuration matcher not used", NOP);
+	XMLSearch_free(&search, false);
+	XMLDoc_free(&doc);
+
+	// Nesting limit
+	config.max_depth = 2;
+	XMLDoc_init(&doc);
+	assert_true("Depth", XMLDoc_parse_buffer_DOM_ex(C2SX("<a><b><c/></b></a>"), C2SX("depth"), &doc, &config) == false, TEST_ERROR, "Nesting limit not enforced", NOP);
+	XMLDoc_free(&doc);
+	XMLDoc_init(&doc);
+	assert_true("Depth ok", XMLDoc_parse_buffer_DOM_ex(C2SX("<a><b/><b/></a>"), C2SX("depth"), &doc, &config), TEST_ERROR, "Nesting limit too strict", NOP);
+	XMLDoc_free(&doc);
+
+	XMLParserConfig_free(&config);
+
+	return TEST_OK;
+}
+
+
+static test_result test_free_async(char* msg)
+{
+	XMLDoc doc;
+	XMLNode* dup;
+	int i;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<root><a x=\"1\">text</a></root>"), C2SX("async"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	dup = XMLNode_dup(XMLDoc_root(&doc)->children[0], true);
+	assert_true("Dup", dup != NULL, TEST_ERROR, "Cannot duplicate node", NOP);
+
+	// Document is emptied right away and can be reused
+	assert_true("Free async", XMLDoc_free_async(&doc), TEST_ERROR, "Cannot free document", NOP);
+	assert_equals_i("Emptied", 0, doc.n_nodes, TEST_ERROR, "Document was not emptied", NOP);
+	assert_true("Reuse", XMLDoc_parse_buffer_DOM(C2SX("<root><b/></root>"), C2SX("async"), &doc), TEST_ERROR, "Cannot reuse document", NOP);
+	assert_equals_s("Reused", "b", XMLDoc_root(&doc)->children[0]->tag, TEST_ERROR, "Wrong content", NOP);
+	for (i = 0; i < 10; i++)
+		assert_true("Free async", XMLDoc_free_async(&doc), TEST_ERROR, "Cannot free document", NOP);
+
+	// Memory kept by a reset is handed to the reclaim thread as well
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<root><a>text</a><b/></root>"), C2SX("async"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_true("Reset", XMLDoc_reset(&doc) && doc.pool != NULL, TEST_ERROR, "Cannot reset document", NOP);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<root><c/></root>"), C2SX("async"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_true("Free reset", XMLDoc_free_async(&doc) && doc.pool == NULL && doc.n_nodes == 0, TEST_ERROR, "Cannot free document", NOP);
+	assert_true("Reset empty", XMLDoc_reset(&doc) && XMLDoc_free_async(&doc) && doc.pool == NULL, TEST_ERROR, "Cannot free document", NOP);
+
+	// And so are indexes
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<root><a id=\"1\"/><b id=\"2\"/></root>"), C2SX("async"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_true("Index", XMLDoc_build_tag_index(&doc) && XMLDoc_build_attribute_index(&doc, C2SX("id")), TEST_ERROR, "Cannot build index", NOP);
+	assert_true("Free indexed", XMLDoc_free_async(&doc) && doc.usage == NULL && doc.n_nodes == 0, TEST_ERROR, "Cannot free document", NOP);
+
+	// Content shared with the freed document is still valid
+	assert_true("Set text", XMLNode_set_text(dup, C2SX("other")), TEST_ERROR, "Cannot modify duplicated node", NOP);
+	assert_true("Flush", XMLDoc_free_async_flush(), TEST_ERROR, "Cannot flush", NOP);
+	assert_equals_s("Shared attribute", "1", dup->attributes[0].value, TEST_ERROR, "Shared content was freed", NOP);
+	assert_equals_s("Text", "other", dup->text, TEST_ERROR, "Wrong text", NOP);
+	XMLNode_free(dup);
+	free(dup);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+#define DEEP_DEPTH 200000
+
+static test_result test_deep(char* msg)
+{
+	XMLDoc doc, diff;
+	XMLNode* dup;
+	XMLNode* node;
+	SXML_CHAR* buf;
+	FILE* f;
+	int i, n;
+
+	// <a><a>...<a/>...</a></a>
+	buf = malloc((DEEP_DEPTH * 7 + 8) * sizeof(SXML_CHAR));
+	assert_true("Alloc", buf != NULL, TEST_ERROR, "Cannot allocate buffer", NOP);
+	for (i = n = 0; i < DEEP_DEPTH; i++, n += 3)
+		sx_strcpy(&buf[n], C2SX("<a>"));
+	sx_strcpy(&buf[n], C2SX("<a/>"));
+	n += 4;
+	for (i = 0; i < DEEP_DEPTH; i++, n += 4)
+		sx_strcpy(&buf[n], C2SX("</a>"));
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("deep"), &doc), TEST_ERROR, "Cannot parse XML", free(buf));
+	free(buf);
+
+	// Copy, hash, search, print, diff and free without recursion
+	dup = XMLNode_dup(XMLDoc_root(&doc), true);
+	assert_true("Dup", dup != NULL, TEST_ERROR, "Cannot duplicate deep node", NOP);
+	assert_true("Hash", XMLNode_hash(dup) == XMLNode_hash(XMLDoc_root(&doc)), TEST_ERROR, "Copy has a different hash", NOP);
+	for (node = XMLDoc_root(&doc), n = 0; (node = XMLNode_next(node)) != NULL; n++) ;
+	assert_equals_i("Next", DEEP_DEPTH, n, TEST_ERROR, "Wrong number of nodes", NOP);
+	f = tmpfile();
+	if (f != NULL) {
+		assert_true("Print", XMLDoc_print(&doc, f, NULL, NULL, false, 0, 0), TEST_ERROR, "Cannot print deep document", fclose(f));
+		assert_equals_i("Print size", DEEP_DEPTH * 7 + 4, (int)ftell(f), TEST_ERROR, "Wrong printed size", fclose(f));
+		fclose(f);
+	}
+	XMLDoc_init(&diff);
+	assert_equals_i("Diff", 0, XMLDoc_diff(&doc, &doc, &diff), TEST_ERROR, "Identical documents have differences", NOP);
+	XMLDoc_free(&diff);
+	XMLNode_free(dup);
+	free(dup);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+// Check that the usage maintained in 'doc' is the one of all its nodes, plus its nodes array
+static int _memory_matches(XMLDoc* doc, XMLMemoryUsage* usage)
+{
+	XMLMemoryUsage node_usage;
+	size_t bytes = doc->n_nodes * sizeof(XMLNode*);
+	int i;
+
+	if (!XMLDoc_memory_usage(doc, usage))
+		return false;
+	for (i = 0; i < doc->n_nodes; i++) {
+		if (!XMLNode_memory_usage(doc->nodes[i], &node_usage))
+			return false;
+		bytes += node_usage.total.bytes;
+	}
+
+	return usage->total.bytes == bytes;
+}
+
+static test_result test_memory(char* msg)
+{
+	XMLDoc doc;
+	XMLMemoryUsage usage, before;
+	XMLNode* root;
+	XMLNode* dup;
+
+	XMLDoc_init(&doc);
+	assert_true("Empty", XMLDoc_memory_usage(&doc, &usage) && usage.total.bytes == 0, TEST_ERROR, "Empty document uses memory", NOP);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<?xml version=\"1.0\"?><root a=\"1\"><b>text</b><c x=\"y\" z=\"t\"/></root>"), C2SX("memory"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_true("Parsed", _memory_matches(&doc, &usage), TEST_ERROR, "Usage does not match parsed nodes", NOP);
+	assert_equals_i("Nodes", 4, (int)usage.nodes.allocs, TEST_ERROR, "Wrong number of nodes", NOP);
+	assert_equals_i("Texts", 1, (int)usage.texts.allocs, TEST_ERROR, "Wrong number of texts", NOP);
+	before = usage;
+
+	// Modifications are accounted
+	root = XMLDoc_root(&doc);
+	assert_true("Set text", XMLNode_set_text(root->children[0], C2SX("a much longer text")), TEST_ERROR, "Cannot set text", NOP);
+	assert_true("Set attribute", XMLNode_set_attribute(root, C2SX("new"), C2SX("value")) >= 0, TEST_ERROR, "Cannot set attribute", NOP);
+	assert_true("Modified", _memory_matches(&doc, &usage) && usage.total.bytes > before.total.bytes, TEST_ERROR, "Modifications not accounted", NOP);
+	assert_true("Set text", XMLNode_set_text(root->children[0], C2SX("text")), TEST_ERROR, "Cannot set text", NOP);
+	assert_true("Remove attribute", XMLNode_remove_attribute(root, 1) >= 0, TEST_ERROR, "Cannot remove attribute", NOP);
+	assert_true("Restored", _memory_matches(&doc, &usage) && usage.total.bytes == before.total.bytes && usage.total.allocs == before.total.allocs, TEST_ERROR, "Usage not restored", NOP);
+
+	// Nodes added and removed
+	dup = XMLNode_dup(root->children[1], true);
+	assert_true("Dup", dup != NULL, TEST_ERROR, "Cannot duplicate node", NOP);
+	assert_true("Add child", XMLNode_add_child(root->children[0], dup), TEST_ERROR, "Cannot add child", NOP);
+	assert_true("Added", _memory_matches(&doc, &usage) && usage.nodes.allocs == before.nodes.allocs + 1, TEST_ERROR, "Added node not accounted", NOP);
+	assert_true("Copy", XMLNode_copy(root->children[1], root->children[0], true), TEST_ERROR, "Cannot copy node", NOP);
+	assert_true("Copied", _memory_matches(&doc, &usage), TEST_ERROR, "Copied node not accounted", NOP);
+	assert_true("Remove child", XMLNode_remove_child(root->children[0], 0, true) >= 0, TEST_ERROR, "Cannot remove child", NOP);
+	assert_true("Remove children", XMLNode_remove_children(root->children[1]), TEST_ERROR, "Cannot remove children", NOP);
+	assert_true("Removed", _memory_matches(&doc, &usage), TEST_ERROR, "Removed nodes still accounted", NOP);
+
+	XMLDoc_free(&doc);
+	assert_true("Freed", XMLDoc_memory_usage(&doc, &usage) && usage.total.bytes == 0 && usage.total.allocs == 0, TEST_ERROR, "Freed document uses memory", NOP);
+
+	return TEST_OK;
+}
+
+
+static test_result test_text_node(char* msg)
+{
+	XMLDoc doc;
+	XMLMemoryUsage usage;
+	XMLNode *p, *dup;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM_text_as_nodes(C2SX("<p>Some <b>bold</b> text</p>"), C2SX("text"), &doc, true), TEST_ERROR, "Cannot parse XML", NOP);
+	p = XMLDoc_root(&doc);
+	assert_equals_i("Children", 3, p->n_children, TEST_ERROR, "Wrong number of children", NOP);
+	assert_true("Types", p->children[0]->tag_type == TAG_TEXT && p->children[1]->tag_type == TAG_FATHER && p->children[2]->tag_type == TAG_TEXT, TEST_ERROR, "Wrong children types", NOP);
+	assert_equals_s("Text", "Some ", p->children[0]->text, TEST_ERROR, "Wrong text", NOP);
+	assert_equals_s("Inner text", "bold", p->children[1]->children[0]->text, TEST_ERROR, "Wrong inner text", NOP);
+	assert_true("Memory", _memory_matches(&doc, &usage) && usage.texts.allocs == 0, TEST_ERROR, "Text nodes texts allocated on their own", NOP);
+
+	// Text nodes behave as other nodes
+	assert_true("Set text", XMLNode_set_text(p->children[2], C2SX(" longer text")), TEST_ERROR, "Cannot set text", NOP);
+	dup = XMLNode_dup(p->children[0], false);
+	assert_true("Dup", dup != NULL, TEST_ERROR, "Cannot duplicate text node", NOP);
+	assert_true("Remove", XMLNode_remove_child(p, 0, true) >= 0, TEST_ERROR, "Cannot remove text node", NOP);
+	assert_equals_s("Dup text", "Some ", dup->text, TEST_ERROR, "Wrong duplicated text", NOP);
+	assert_true("Memory", _memory_matches(&doc, &usage) && usage.texts.allocs == 1, TEST_ERROR, "Usage does not match text nodes", NOP);
+	XMLNode_free(dup);
+	free(dup);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+// Check that 'doc' is the same as when parsing 'buf' from scratch, including source offsets
+static int _same_as_parsed(XMLDoc* doc, const SXML_CHAR* buf)
+{
+	XMLDoc ref;
+	XMLNode *n1, *n2;
+	int i, same = true;
+
+	XMLDoc_init(&ref);
+	if (!XMLDoc_parse_buffer_DOM(buf, C2SX("reference"), &ref))
+		return false;
+	if (ref.n_nodes != doc->n_nodes)
+		same = false;
+	for (i = 0; same && i < ref.n_nodes; i++) {
+		if (XMLNode_hash(ref.nodes[i]) != XMLNode_hash(doc->nodes[i]))
+			same = false;
+		for (n1 = ref.nodes[i], n2 = doc->nodes[i]; same && n1 != NULL; n1 = XMLNode_next(n1), n2 = XMLNode_next(n2))
+			if (n2 == NULL || n1->src_start != n2->src_start || n1->src_end != n2->src_end)
+				same = false;
+	}
+	XMLDoc_free(&ref);
+
+	return same;
+}
+
+static test_result test_reparse(char* msg)
+{
+	static SXML_CHAR buf0[] = C2SX("<?xml version=\"1.0\"?>\n<root>\n\t<a x=\"1\"><b>text</b></a>\n\t<c/>\n</root>\n");
+	SXML_CHAR buf[256];
+	XMLDoc doc;
+	XMLMemoryUsage usage;
+	XMLNode *root, *a, *c;
+	SXML_CHAR* p;
+	int marker, len;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf0, C2SX("reparse"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	a = root->children[0];
+	c = root->children[1];
+	a->user = &marker;
+	assert_true("Offsets", a->src_start == (int)(sx_strstr(buf0, C2SX("<a ")) - buf0) && a->src_end == (int)(sx_strstr(buf0, C2SX("</a>")) + 4 - buf0), TEST_ERROR, "Wrong node offsets", NOP);
+
+	// Edit inside a node only parses that node again
+	sx_strcpy(buf, buf0);
+	p = sx_strstr(buf, C2SX("\"1\"")) + 2;
+	memmove(p + 2, p, (sx_strlen(p) + 1) * sizeof(SXML_CHAR));
+	p[0] = C2SX('2');
+	p[1] = C2SX('3');
+	len = sx_strlen(buf);
+	assert_true("Reparse", XMLDoc_reparse_range(&doc, buf, len, (int)(p - buf), 0, 2), TEST_ERROR, "Cannot reparse edited attribute", NOP);
+	assert_true("Identity", XMLDoc_root(&doc) == root && root->children[0] == a && root->children[1] == c && a->user == &marker, TEST_ERROR, "Nodes were replaced", NOP);
+	assert_equals_s("Attribute", "123", a->attributes[0].value, TEST_ERROR, "Edit not parsed", NOP);
+	assert_true("Same", _same_as_parsed(&doc, buf), TEST_ERROR, "Reparsed document differs from parsed one", NOP);
+
+	// Edit adding a sibling parses the father again
+	p = sx_strstr(buf, C2SX("</a>")) + 4;
+	memmove(p + 4, p, (sx_strlen(p) + 1) * sizeof(SXML_CHAR));
+	memcpy(p, C2SX("<d/>"), 4 * sizeof(SXML_CHAR));
+	len = sx_strlen(buf);
+	assert_true("Reparse", XMLDoc_reparse_range(&doc, buf, len, (int)(p - buf), 0, 4), TEST_ERROR, "Cannot reparse added node", NOP);
+	assert_true("Father", XMLDoc_root(&doc) == root && root->n_children == 3, TEST_ERROR, "Added node not parsed", NOP);
+	assert_true("Same", _same_as_parsed(&doc, buf), TEST_ERROR, "Reparsed document differs from parsed one", NOP);
+
+	// Malformed edit leaves the document as it was
+	p = sx_strstr(buf, C2SX("<c/>"));
+	memcpy(p, C2SX("</x>"), 4 * sizeof(SXML_CHAR));
+	assert_true("Malformed", !XMLDoc_reparse_range(&doc, buf, len, (int)(p - buf), 4, 4), TEST_ERROR, "Malformed edit was accepted", NOP);
+	assert_true("Unchanged", XMLDoc_root(&doc) == root && root->n_children == 3, TEST_ERROR, "Document changed", NOP);
+	assert_true("Memory", _memory_matches(&doc, &usage), TEST_ERROR, "Usage does not match reparsed nodes", NOP);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+struct _records {
+	SXML_CHAR ids[8];
+	int n;
+	int max;
+};
+
+static int _record_cb(XMLNode* record, void* user)
+{
+	struct _records* rec = (struct _records*)user;
+
+	if (record->father == NULL || sx_strcmp(record->father->tag, C2SX("feed")) || record->n_attributes != 1)
+		return false;
+	rec->ids[rec->n++] = record->attributes[0].value[0];
+	rec->ids[rec->n] = NULC;
+
+	return rec->n < rec->max;
+}
+
+static int _count_record_cb(XMLNode* record, void* user)
+{
+	(*(int*)user)++;
+
+	return record->text != NULL && !sx_strcmp(record->text, C2SX("t1"));
+}
+
+static test_result test_records(char* msg)
+{
+	static SXML_CHAR buf[] = C2SX("<feed><title>t</title><item id=\"1\"><name>a</name></item><item id=\"2\">x</item>"
+		"<other><item id=\"3\"/></other><item id=\"4\"/></feed>");
+	struct _records rec;
+	XMLDoc doc;
+	XMLSearch search;
+	int n;
+
+	rec.n = 0;
+	rec.max = 10;
+	assert_equals_i("Records", 3, XMLDoc_parse_buffer_records(buf, C2SX("records"), C2SX("feed/item"), _record_cb, &rec), TEST_ERROR, "Wrong number of records", NOP);
+	assert_equals_s("Record ids", "124", rec.ids, TEST_ERROR, "Wrong records", NOP);
+
+	rec.n = 0;
+	assert_equals_i("Text", 1, XMLDoc_parse_buffer_records(buf, C2SX("records"), C2SX("feed/item[.=\"x\"]"), _record_cb, &rec), TEST_ERROR, "Text criteria not applied", NOP);
+	assert_equals_s("Text id", "2", rec.ids, TEST_ERROR, "Wrong record", NOP);
+
+	// Elements inside a record dropped by its text are matched
+	n = 0;
+	assert_equals_i("Nested text", 2, XMLDoc_parse_buffer_records(C2SX("<r><c>t0<c>t1</c></c><c>t1</c></r>"), C2SX("records"), C2SX("//c[.='t1']"), _count_record_cb, &n), TEST_ERROR, "Wrong number of records", NOP);
+	assert_equals_i("Nested count", 2, n, TEST_ERROR, "Wrong records", NOP);
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r><c>t0<c>t1</c></c><c>t1</c></r>"), C2SX("records"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("//c[.='t1']"), &search), TEST_ERROR, "Cannot parse XPath", XMLDoc_free(&doc));
+	assert_equals_i("Same as DOM", n, XMLSearch_count(XMLDoc_root(&doc), &search), TEST_ERROR, "Records differ from DOM search", XMLSearch_free(&search, true); XMLDoc_free(&doc));
+	XMLSearch_free(&search, true);
+	XMLDoc_free(&doc);
+
+	rec.n = 0;
+	rec.max = 1;
+	assert_equals_i("Stop", 1, XMLDoc_parse_buffer_records(buf, C2SX("records"), C2SX("item"), _record_cb, &rec), TEST_ERROR, "Parsing not stopped", NOP);
+
+	assert_equals_i("Malformed", -1, XMLDoc_parse_buffer_records(C2SX("<feed><item></feed>"), C2SX("records"), C2SX("item"), _record_cb, &rec), TEST_ERROR, "Malformed document accepted", NOP);
+
+	return TEST_OK;
+}
+
+
+static test_result test_reset(char* msg)
+{
+	static SXML_CHAR buf1[] = C2SX("<?xml version=\"1.0\"?><msg id=\"1\"><a x=\"y\">one</a><b/></msg>");
+	static SXML_CHAR buf2[] = C2SX("<?xml version=\"1.0\"?><msg id=\"22\"><a x=\"zz\">two two</a><b/><c>more</c></msg>");
+	XMLDoc doc;
+	XMLMemoryUsage usage;
+	XMLNode* root;
+	int i;
+
+	XMLDoc_init(&doc);
+	for (i = 0; i < 4; i++) {
+		assert_true("Parse", XMLDoc_parse_buffer_DOM(i % 2 ? buf2 : buf1, C2SX("reset"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+		root = XMLDoc_root(&doc);
+		assert_true("Root", root != NULL && doc.n_nodes == 2, TEST_ERROR, "Wrong document nodes", NOP);
+		assert_equals_s("Attribute", i % 2 ? "22" : "1", root->attributes[0].value, TEST_ERROR, "Wrong attribute", NOP);
+		assert_equals_i("Children", i % 2 ? 3 : 2, root->n_children, TEST_ERROR, "Wrong number of children", NOP);
+		assert_equals_s("Text", i % 2 ? "two two" : "one", root->children[0]->text, TEST_ERROR, "Wrong text", NOP);
+		assert_true("Memory", _memory_matches(&doc, &usage), TEST_ERROR, "Usage does not match parsed nodes", NOP);
+		assert_true("Reset", XMLDoc_reset(&doc), TEST_ERROR, "Cannot reset document", NOP);
+		assert_true("Empty", doc.n_nodes == 0 && XMLDoc_root(&doc) == NULL && XMLDoc_memory_usage(&doc, &usage) && usage.total.bytes == 0, TEST_ERROR, "Document not emptied", NOP);
+	}
+
+	// Parsed documents can be modified as usual before being reset
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf2, C2SX("reset"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	assert_true("Set text", XMLNode_set_text(root->children[2], C2SX("much more text")), TEST_ERROR, "Cannot set text", NOP);
+	assert_true("Remove child", XMLNode_remove_child(root, 1, true) >= 0, TEST_ERROR, "Cannot remove child", NOP);
+	assert_true("Reset", XMLDoc_reset(&doc), TEST_ERROR, "Cannot reset document", NOP);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM_text_as_nodes(buf1, C2SX("reset"), &doc, true), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	assert_equals_s("Text node", "one", root->children[0]->children[0]->text, TEST_ERROR, "Wrong text node", NOP);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+// Read back what was printed to 'f'
+static SXML_CHAR* _read_printed(FILE* f, SXML_CHAR* buf, int len)
+{
+	size_t n;
+
+	fseek(f, 0, SEEK_SET);
+	n = fread(buf, sizeof(SXML_CHAR), len - 1, f);
+	buf[n] = NULC;
+
+	return buf;
+}
+
+static test_result test_print(char* msg)
+{
+	static SXML_CHAR long_text[6000];
+	static SXML_CHAR buf1[7000], buf2[7000];
+	XMLDoc doc;
+	XMLNode* node;
+	SXML_CHAR* mem;
+	FILE *f1, *f2;
+	int i, j, n, depth;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<?xml version=\"1.0\"?><!--c--><r a=\"x&amp;y\"><b>1 &lt; 2</b><c/></r>"), C2SX("print"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	mem = XMLDoc_print_to_buffer(&doc, C2SX("\n"), C2SX("\t"), C2SX(" "), false, 0, 4);
+	assert_equals_s("Buffer", "<?xml version=\"1.0\"?>\n<!--c-->\n<r a=\"x&amp;y\">\n\t<b>1 &lt; 2</b>\n\t<c/>\n</r>", mem, TEST_ERROR, "Wrong printed buffer", NOP);
+	free(mem);
+
+	// Text larger than the output buffer, printed the same way to a file, a file descriptor and memory
+	for (i = 0; i < 5999; i++)
+		long_text[i] = (i % 100 == 99 ? C2SX('&') : C2SX('a') + i % 26);
+	long_text[i] = NULC;
+	node = XMLDoc_root(&doc)->children[0];
+	assert_true("Set text", XMLNode_set_text(node, long_text), TEST_ERROR, "Cannot set text", NOP);
+	f1 = tmpfile();
+	f2 = tmpfile();
+	if (f1 != NULL && f2 != NULL) {
+		assert_true("Print", XMLDoc_print(&doc, f1, NULL, NULL, false, 0, 0), TEST_ERROR, "Cannot print to file", NOP);
+		assert_true("Print fd", XMLDoc_print_to_fd(&doc, fileno(f2), NULL, NULL, NULL, false, 0, 0), TEST_ERROR, "Cannot print to file descriptor", NOP);
+		mem = XMLDoc_print_to_buffer(&doc, NULL, NULL, NULL, false, 0, 0);
+		assert_true("Buffer", mem != NULL && sx_strlen(mem) > 6000, TEST_ERROR, "Cannot print to buffer", NOP);
+		assert_equals_s("File", mem, _read_printed(f1, buf1, 7000), TEST_ERROR, "File and buffer output differ", free(mem));
+		assert_equals_s("File descriptor", mem, _read_printed(f2, buf2, 7000), TEST_ERROR, "File descriptor and buffer output differ", free(mem));
+		free(mem);
+	}
+	if (f1 != NULL)
+		fclose(f1);
+	if (f2 != NULL)
+		fclose(f2);
+	XMLDoc_free(&doc);
+
+	// Indentation deeper than the first indentation strings built
+	for (i = 0, n = 0; i < 40; i++)
+		n += sx_sprintf(buf1 + n, C2SX("<d>"));
+	for (i = 0; i < 40; i++)
+		n += sx_sprintf(buf1 + n, C2SX("</d>"));
+	for (i = 0, n = 0; i < 79; i++) {
+		depth = (i < 40 ? i : 78 - i);
+		if (i > 0)
+			buf2[n++] = C2SX('\n');
+		for (j = 0; j < depth; j++)
+			n += sx_sprintf(buf2 + n, C2SX("  "));
+		n += sx_sprintf(buf2 + n, i < 39 ? C2SX("<d>") : i == 39 ? C2SX("<d/>") : C2SX("</d>"));
+	}
+	XMLDoc_init(&doc);
+	assert_true("Parse deep", XMLDoc_parse_buffer_DOM(buf1, C2SX("indent"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	mem = XMLDoc_print_to_buffer(&doc, C2SX("\n"), C2SX("  "), NULL, false, 0, 0);
+	XMLDoc_free(&doc);
+	assert_true("Deep", mem != NULL && sx_strcmp(mem, buf2) == 0, TEST_ERROR, "Wrong indentation", free(mem));
+	free(mem);
+
+	return TEST_OK;
+}
+
+
+static test_result test_print_parallel(char* msg)
+{
+	static SXML_CHAR buf[300000];
+	XMLDoc doc;
+	SXML_CHAR *mem, *printed;
+	FILE* f;
+	int i, n, sz_line;
+
+	// Many children under a small first child of the root, so that parallel printing is done one level below
+	n = sx_sprintf(buf, C2SX("<?xml version=\"1.0\"?><r><meta a=\"1\"/><items>"));
+	for (i = 0; i < 3000; i++)
+		n += sx_sprintf(buf + n, C2SX("<i n=\"%d\" v=\"a&amp;b\"><t>text %d</t><e/></i>"), i, i);
+	sx_strcpy(buf + n, C2SX("</items><end/></r><!--end-->"));
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("parallel"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+
+	for (sz_line = 0; sz_line <= 20; sz_line += 20) {
+		mem = XMLDoc_print_to_buffer(&doc, C2SX("\n"), C2SX("\t"), C2SX(" "), false, sz_line, 4);
+		assert_true("Print", mem != NULL, TEST_ERROR, "Cannot print to buffer", NOP);
+		printed = (SXML_CHAR*)malloc((sx_strlen(mem) + 2) * sizeof(SXML_CHAR));
+		f = tmpfile();
+		if (f != NULL && printed != NULL) {
+			assert_true("Print parallel", XMLDoc_print_parallel(&doc, f, C2SX("\n"), C2SX("\t"), C2SX(" "), false, sz_line, 4, 3), TEST_ERROR, "Cannot print in parallel", free(mem); free(printed));
+			assert_true("Output", sx_strcmp(mem, _read_printed(f, printed, (int)sx_strlen(mem) + 2)) == 0, TEST_ERROR, "Parallel and sequential output differ", free(mem); free(printed));
+		}
+		if (f != NULL)
+			fclose(f);
+		free(printed);
+		free(mem);
+	}
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+/* Print 'doc' parsed from 'buf' incrementally to 'printed' (of 'len' characters) */
+static SXML_CHAR* _print_incremental(const XMLDoc* doc, const SXML_CHAR* buf, SXML_CHAR* printed, int len)
+{
+	FILE* f = tmpfile();
+	int ok;
+
+	if (f == NULL)
+		return NULL;
+	ok = XMLDoc_print_incremental(doc, buf, (int)sx_strlen(buf), f, C2SX("\n"), C2SX("\t"), C2SX(" "), false, 0, 4);
+	_read_printed(f, printed, len);
+	fclose(f);
+
+	return ok ? printed : NULL;
+}
+
+static test_result test_incremental(char* msg)
+{
+	static SXML_CHAR buf[] = C2SX("<?xml version=\"1.0\"?>\n<!-- c -->\n<root>\n  <a x=\"1\" y='2'>t&amp;u<b>text</b></a>\n  <c/>\n\t<d><e z=\"&#65;\"/></d>\n</root>\n");
+	SXML_CHAR printed[256];
+	XMLDoc doc;
+	XMLNode *root, *d, *e;
+	SXML_CHAR* p;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("incremental"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	d = root->children[2];
+	e = d->children[0];
+	assert_true("Not modified", !doc.modified && root->modified == 0 && e->modified == 0, TEST_ERROR, "Parsed nodes are marked as modified", NOP);
+
+	// Unmodified document is printed as it was parsed
+	p = _print_incremental(&doc, buf, printed, 256);
+	assert_true("Same", p != NULL && sx_strcmp(p, buf) == 0, TEST_ERROR, "Output differs from source", NOP);
+
+	// Only the modified node is printed again
+	XMLNode_set_attribute(e, C2SX("z"), C2SX("B"));
+	assert_true("Marks", e->modified == XML_MODIFIED_NODE && d->modified == XML_MODIFIED_DESCENDANTS && root->modified == XML_MODIFIED_DESCENDANTS && root->children[0]->modified == 0, TEST_ERROR, "Wrong modification marks", NOP);
+	p = _print_incremental(&doc, buf, printed, 256);
+	assert_true("Attribute", p != NULL && sx_strcmp(p, C2SX("<?xml version=\"1.0\"?>\n<!-- c -->\n<root>\n  <a x=\"1\" y='2'>t&amp;u<b>text</b></a>\n  <c/>\n\t<d><e z=\"B\"/></d>\n</root>\n")) == 0,
+		TEST_ERROR, "Wrong output after modifying an attribute", NOP);
+
+	// Father of a new node is printed again, with its unmodified children as they were
+	XMLNode_add_child(root, XMLNode_new(TAG_SELF, C2SX("f"), NULL));
+	p = _print_incremental(&doc, buf, printed, 256);
+	assert_true("Child", p != NULL && sx_strcmp(p, C2SX("<?xml version=\"1.0\"?>\n<!-- c -->\n<root>\n\t<a x=\"1\" y='2'>t&amp;u<b>text</b></a>\n\t<c/>\n\t<d><e z=\"B\"/></d>\n\t<f/>\n</root>\n")) == 0,
+		TEST_ERROR, "Wrong output after adding a node", NOP);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+static test_result test_writer(char* msg)
+{
+	static SXML_CHAR buf[1000];
+	XMLDoc doc;
+	XMLWriter writer;
+	XMLNode* root;
+	SXML_CHAR* mem;
+	FILE* f;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r a=\"x&amp;y\" long=\"0123456789\"><b>1 &lt; 2</b><c/><!--c--><![CDATA[x<y]]><d e=\"1\"><f>g</f><h/></d></r>"), C2SX("writer"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	mem = XMLDoc_print_to_buffer(&doc, C2SX("\n"), C2SX("\t"), C2SX(" "), false, 20, 4);
+	assert_true("Print", mem != NULL, TEST_ERROR, "Cannot print to buffer", NOP);
+
+	// The same document written element by element, with an existing subtree in the middle
+	if ((f = tmpfile()) == NULL) {
+		free(mem);
+		XMLDoc_free(&doc);
+		return TEST_OK;
+	}
+	assert_true("Init", XMLWriter_init(&writer, f, C2SX("\n"), C2SX("\t"), C2SX(" "), false, 20, 4), TEST_ERROR, "Cannot initialize writer", NOP);
+	XMLWriter_start_element(&writer, C2SX("r"));
+	XMLWriter_attribute(&writer, C2SX("a"), C2SX("x&y"));
+	XMLWriter_attribute(&writer, C2SX("long"), C2SX("0123456789"));
+	XMLWriter_start_element(&writer, C2SX("b"));
+	XMLWriter_text(&writer, C2SX("1 < 2"));
+	assert_true("Late attribute", !XMLWriter_attribute(&writer, C2SX("z"), C2SX("0")), TEST_ERROR, "Attribute written after text", NOP);
+	XMLWriter_end_element(&writer);
+	XMLWriter_start_element(&writer, C2SX("c"));
+	XMLWriter_end_element(&writer);
+	XMLWriter_comment(&writer, C2SX("c"));
+	XMLWriter_cdata(&writer, C2SX("x<y"));
+	assert_true("Node", XMLWriter_node(&writer, root->children[4]), TEST_ERROR, "Cannot write node", NOP);
+	assert_true("Free", XMLWriter_free(&writer), TEST_ERROR, "Cannot end writing", NOP);
+	assert_equals_s("Output", mem, _read_printed(f, buf, 1000), TEST_ERROR, "Writer and document output differ", free(mem));
+	assert_true("End", !XMLWriter_end_element(&writer), TEST_ERROR, "Writer used after being freed", free(mem));
+	free(mem);
+	XMLDoc_free(&doc);
+
+	// Lines are wrapped the same way without new lines between tags
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<a x0=\"v2&amp;&lt;longer value here\">mixed &amp; text<c x0=\"v3\" x1=\"v3\"/></a>"), C2SX("writer"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	mem = XMLDoc_print_to_buffer(&doc, C2SX(""), C2SX("\t"), C2SX(" "), false, 64, 4);
+	assert_true("Print", mem != NULL, TEST_ERROR, "Cannot print to buffer", XMLDoc_free(&doc));
+	fclose(f);
+	if ((f = tmpfile()) == NULL) {
+		free(mem);
+		XMLDoc_free(&doc);
+		return TEST_OK;
+	}
+	assert_true("Init", XMLWriter_init(&writer, f, C2SX(""), C2SX("\t"), C2SX(" "), false, 64, 4), TEST_ERROR, "Cannot initialize writer", NOP);
+	XMLWriter_start_element(&writer, C2SX("a"));
+	XMLWriter_attribute(&writer, C2SX("x0"), C2SX("v2&<longer value here"));
+	XMLWriter_text(&writer, C2SX("mixed & text"));
+	XMLWriter_start_element(&writer, C2SX("c"));
+	XMLWriter_attribute(&writer, C2SX("x0"), C2SX("v3"));
+	XMLWriter_attribute(&writer, C2SX("x1"), C2SX("v3"));
+	assert_true("Free", XMLWriter_free(&writer), TEST_ERROR, "Cannot end writing", NOP);
+	assert_equals_s("Wrapped output", mem, _read_printed(f, buf, 1000), TEST_ERROR, "Writer and document output differ", free(mem));
+	fclose(f);
+	free(mem);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+// Hash of the canonical output, with the number of calls
+typedef struct {
+	unsigned long hash;
+	int n_calls;
+	int max_calls;
+} _canonical_hash;
+
+static int _hash_output(const SXML_CHAR* data, int len, void* user)
+{
+	_canonical_hash* h = (_canonical_hash*)user;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h->hash = h->hash * 31 + (unsigned long)data[i];
+
+	return ++h->n_calls < h->max_calls;
+}
+
+static unsigned long _hash_string(const SXML_CHAR* str)
+{
+	unsigned long hash = 0;
+
+	for ( ; *str != NULC; str++)
+		hash = hash * 31 + (unsigned long)*str;
+
+	return hash;
+}
+
+static test_result test_canonical(char* msg)
+{
+	static SXML_CHAR buf[20000];
+	XMLDoc doc1, doc2;
+	SXML_CHAR *mem1, *mem2;
+	_canonical_hash h;
+	int i, n;
+
+	// Same document with different formatting, attribute order, quotes, escaping and empty elements
+	XMLDoc_init(&doc1);
+	XMLDoc_init(&doc2);
+	assert_true("Parse 1", XMLDoc_parse_buffer_DOM(C2SX("<?xml version=\"1.0\"?>\n<!--c-->\n<r b=\"2\" a=\"x&amp;y\" xmlns=\"u\"><e></e><t>1 &lt; 2 &gt; 0</t><![CDATA[<&>]]></r>"), C2SX("c14n-1"), &doc1), TEST_ERROR, "Cannot parse XML", NOP);
+	assert_true("Parse 2", XMLDoc_parse_buffer_DOM(C2SX("<!--c--><r xmlns='u' a='x&amp;y'\n   b='2'><e/><t>1 &lt; 2 > 0</t><![CDATA[<&>]]></r>"), C2SX("c14n-2"), &doc2), TEST_ERROR, "Cannot parse XML", NOP);
+	mem1 = XMLDoc_print_canonical_to_buffer(&doc1, true);
+	mem2 = XMLDoc_print_canonical_to_buffer(&doc2, true);
+	assert_true("Print", mem1 != NULL && mem2 != NULL, TEST_ERROR, "Cannot print canonical form", NOP);
+	assert_equals_s("Canonical", "<!--c-->\n<r xmlns=\"u\" a=\"x&amp;y\" b=\"2\"><e></e><t>1 &lt; 2 &gt; 0</t>&lt;&amp;&gt;</r>", mem1, TEST_ERROR, "Wrong canonical form", NOP);
+	assert_equals_s("Same canonical", mem1, mem2, TEST_ERROR, "Canonical forms differ", NOP);
+	free(mem1);
+	free(mem2);
+	mem1 = XMLDoc_print_canonical_to_buffer(&doc1, false);
+	assert_equals_s("Without comments", "<r xmlns=\"u\" a=\"x&amp;y\" b=\"2\"><e></e><t>1 &lt; 2 &gt; 0</t>&lt;&amp;&gt;</r>", mem1, TEST_ERROR, "Wrong canonical form without comments", NOP);
+	free(mem1);
+	XMLDoc_free(&doc1);
+	XMLDoc_free(&doc2);
+
+	// Output larger than the internal buffer, hashed by chunks
+	n = sx_sprintf(buf, C2SX("<r>"));
+	for (i = 0; i < 500; i++)
+		n += sx_sprintf(buf + n, C2SX("<i n=\"%d\" v='\"'/>"), i);
+	sx_strcpy(buf + n, C2SX("</r>"));
+	XMLDoc_init(&doc1);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("c14n-3"), &doc1), TEST_ERROR, "Cannot parse XML", NOP);
+	mem1 = XMLDoc_print_canonical_to_buffer(&doc1, false);
+	assert_true("Print", mem1 != NULL && sx_strlen(mem1) > 10000, TEST_ERROR, "Cannot print canonical form", NOP);
+	h.hash = 0;
+	h.n_calls = 0;
+	h.max_calls = 1000;
+	assert_true("Hash", XMLDoc_print_canonical(&doc1, false, _hash_output, &h), TEST_ERROR, "Cannot hash canonical form", free(mem1));
+	assert_true("Chunks", h.n_calls > 1, TEST_ERROR, "Canonical form not given by chunks", free(mem1));
+	assert_true("Hash value", h.hash == _hash_string(mem1), TEST_ERROR, "Wrong canonical hash", free(mem1));
+	free(mem1);
+	h.n_calls = 0;
+	h.max_calls = 1;
+	assert_true("Stop", !XMLDoc_print_canonical(&doc1, false, _hash_output, &h) && h.n_calls == 1, TEST_ERROR, "Printing not stopped", NOP);
+	XMLDoc_free(&doc1);
+
+	return TEST_OK;
+}
+
+
+// Escape 'str' one character at a time
+static SXML_CHAR* _str2html_ref(const SXML_CHAR* str, SXML_CHAR* html)
+{
+	SXML_CHAR* p = html;
+
+	for ( ; *str != NULC; str++) {
+		switch (*str) {
+			case C2SX('<'): sx_strcpy(p, C2SX("&lt;")); break;
+			case C2SX('>'): sx_strcpy(p, C2SX("&gt;")); break;
+			case C2SX('"'): sx_strcpy(p, C2SX("&quot;")); break;
+			case C2SX('\''): sx_strcpy(p, C2SX("&apos;")); break;
+			case C2SX('&'): sx_strcpy(p, C2SX("&amp;")); break;
+			default: *p = *str; p[1] = NULC; break;
+		}
+		p += sx_strlen(p);
+	}
+	*p = NULC;
+
+	return html;
+}
+
+static test_result test_html(char* msg)
+{
+	static const SXML_CHAR chars[] = C2SX("ab<c>d\"e'f&gh ");
+	static SXML_CHAR str[200], ref[1200], html[1200], back[1200];
+	SXML_CHAR* mem;
+	int len, off, i;
+
+	// Every length and alignment, across the 16-character blocks
+	for (len = 0; len < 70; len++) {
+		for (off = 0; off < 16; off++) {
+			for (i = 0; i < len; i++)
+				str[off + i] = chars[(i * 7 + len + off) % (sizeof(chars) / sizeof(SXML_CHAR) - 1)];
+			str[off + len] = NULC;
+			_str2html_ref(str + off, ref);
+			assert_equals_i("Length", (int)sx_strlen(ref), strlen_html(str + off), TEST_ERROR, "Wrong escaped length", NOP);
+			assert_equals_s("Escape", ref, str2html(str + off, html), TEST_ERROR, "Wrong escaped text", NOP);
+			assert_equals_s("Unescape", str + off, html2str(html, back), TEST_ERROR, "Wrong unescaped text", NOP);
+			assert_equals_s("Unescape in place", str + off, html2str(html, NULL), TEST_ERROR, "Wrong text unescaped in place", NOP);
+		}
+	}
+
+	mem = str2html(C2SX("a<b"), NULL);
+	assert_equals_s("Allocated", "a&lt;b", mem, TEST_ERROR, "Wrong allocated escaped text", free(mem));
+	free(mem);
+
+	// Unknown or incomplete entities are kept as is
+	sx_strcpy(html, C2SX("&amp;&am&ap&apos&#38;&&q&quot;&"));
+	assert_equals_s("Unknown entities", "&&am&ap&apos&#38;&&q\"&", html2str(html, NULL), TEST_ERROR, "Wrong unknown entities", NOP);
+
+	return TEST_OK;
+}
+
+
 static test_result test_search(char* msg)
 {
 	static char buf_stylesxml[] = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
@@ -569,6 +1472,453 @@ static test_result test_search(char* msg)
 	return TEST_OK;
 }
 
+static int _regstrcmp_wrapper(SXML_CHAR* str, SXML_CHAR* pattern)
+{
+	return regstrcmp(str, pattern);
+}
+
+/* Number of nodes below 'root' matching 'xpath' */
+static int _count_matches(XMLNode* root, const SXML_CHAR* xpath)
+{
+	XMLSearch search;
+	XMLNode* node;
+	int n = 0;
+
+	if (!XMLSearch_init_from_XPath(xpath, &search))
+		return -1;
+	for (node = XMLSearch_next(root, &search); node != NULL; node = XMLSearch_next(node, &search))
+		n++;
+	XMLSearch_free(&search, true);
+
+	return n;
+}
+
+#define SEARCH_THREADS 4
+
+struct _count_job {
+	XMLNode* root;
+	const SXML_CHAR* xpath;
+	int n;
+};
+
+#ifndef SXMLC_NO_THREADS
+SX_THREAD_FUNC(_count_worker)
+{
+	struct _count_job* job = (struct _count_job*)arg;
+
+	job->n = _count_matches(job->root, job->xpath);
+
+	return 0;
+}
+#endif
+
+// Count the matches of 'xpath' from several threads at the same time, returning -1 if they do not agree
+static int _count_matches_threads(XMLNode* root, const SXML_CHAR* xpath)
+{
+	struct _count_job jobs[SEARCH_THREADS];
+	int i;
+#ifndef SXMLC_NO_THREADS
+	_sx_thread threads[SEARCH_THREADS];
+	int n_started;
+#endif
+
+	for (i = 0; i < SEARCH_THREADS; i++) {
+		jobs[i].root = root;
+		jobs[i].xpath = xpath;
+		jobs[i].n = -1;
+	}
+#ifdef SXMLC_NO_THREADS
+	for (i = 0; i < SEARCH_THREADS; i++)
+		jobs[i].n = _count_matches(root, xpath);
+#else
+	for (n_started = 0; n_started < SEARCH_THREADS && _sx_thread_create_arg(&threads[n_started], _count_worker, &jobs[n_started]); n_started++) ;
+	for (i = 0; i < n_started; i++)
+		_sx_thread_join(threads[i]);
+#endif
+	for (i = 1; i < SEARCH_THREADS; i++)
+		if (jobs[i].n != jobs[0].n)
+			return -1;
+
+	return jobs[0].n;
+}
+
+static test_result test_search_patterns(char* msg)
+{
+	static SXML_CHAR* xpaths[] = { C2SX("item[@id=\"b7\"]"), C2SX("item[@id=\"a*\"]"), C2SX("item[@id=\"*7\"]"), C2SX("item[@id=\"*1*\"]"),
+		C2SX("it?m[@id=\"*\"]"), C2SX("*[.=\"x*y*z\"]"), C2SX("item[@id]") };
+	static const int counts[] = { 1, 10, 2, 2, 20, 1, 20 };
+	SXML_CHAR buf[1024];
+	XMLDoc doc;
+	REGEXPR_COMPARE previous;
+	int i, n;
+
+	// Wildcards match as many characters as needed
+	assert_true("Backtracking", regstrcmp(C2SX("xabyabc"), C2SX("*abc")) && regstrcmp(C2SX("abcbc"), C2SX("a*bc*c")), TEST_ERROR, "Pattern should match", NOP);
+	assert_true("Any character", !regstrcmp(C2SX("a"), C2SX("a?")) && regstrcmp(C2SX("a*"), C2SX("a\\*")) && !regstrcmp(C2SX("ab"), C2SX("a\\*")), TEST_ERROR, "Pattern should not match", NOP);
+
+	n = sx_sprintf(buf, C2SX("<r>"));
+	for (i = 0; i < 20; i++)
+		n += sx_sprintf(buf + n, C2SX("<item id=\"%c%d\">%s</item>"), i < 10 ? 'a' : 'b', i % 10, i == 5 ? "x-y-z" : "");
+	sx_strcpy(buf + n, C2SX("</r>"));
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("patterns"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+
+	// Compiled patterns match the same nodes as the matching function
+	for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++) {
+		assert_equals_i(xpaths[i], counts[i], _count_matches(XMLDoc_root(&doc), xpaths[i]), TEST_ERROR, "Wrong number of compiled matches", NOP);
+		previous = XMLSearch_set_regexpr_compare(_regstrcmp_wrapper);
+		n = _count_matches(XMLDoc_root(&doc), xpaths[i]);
+		XMLSearch_set_regexpr_compare(previous);
+		assert_equals_i(xpaths[i], counts[i], n, TEST_ERROR, "Wrong number of matches", NOP);
+	}
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+static test_result test_regex(char* msg)
+{
+	static SXML_CHAR* xpaths[] = { C2SX("item[@id=\"^(a|b)7$\"]"), C2SX("item[@id=\"^a\"]"), C2SX("item[@id=\"\\d{1}$\"]"),
+		C2SX("item[.=\"x.y-?z\"]"), C2SX("item[@id=\"^b(1|2|3)+$\"]"), C2SX("item[@id=\"(\"]") };
+	static const int counts[] = { 2, 10, 20, 1, 3, 0 };
+	SXML_CHAR buf[1024];
+	XMLDoc doc;
+	XMLSearch search;
+	REGEXPR_COMPARE previous;
+	int i, n;
+
+	assert_true("Match", regexcmp(C2SX("abbbc"), C2SX("^ab*c$")) && regexcmp(C2SX("x12y"), C2SX("[0-9]{2}")) && regexcmp(C2SX("cat"), C2SX("dog|cat")), TEST_ERROR, "Pattern should match", NOP);
+	assert_true("No match", !regexcmp(C2SX("abd"), C2SX("^ab*c$")) && !regexcmp(C2SX("x1y"), C2SX("[0-9]{2}")) && !regexcmp(C2SX("a"), C2SX("[^a]")), TEST_ERROR, "Pattern should not match", NOP);
+	assert_true("Malformed", !regexcmp(C2SX("a"), C2SX("(a")) && !regexcmp(C2SX("a"), C2SX("a{2,1}")) && !regexcmp(C2SX("a"), C2SX("*a")), TEST_ERROR, "Malformed pattern should not match", NOP);
+	// No backtracking: nested repetitions fail in linear time
+	for (i = 0; i < 1000; i++)
+		buf[i] = C2SX('a');
+	buf[i] = NULC;
+	assert_true("Linear", !regexcmp(buf, C2SX("^(a|aa)*(a*)*b")), TEST_ERROR, "Pattern should not match", NOP);
+
+	n = sx_sprintf(buf, C2SX("<r>"));
+	for (i = 0; i < 20; i++)
+		n += sx_sprintf(buf + n, C2SX("<item id=\"%c%d\">%s</item>"), i < 10 ? 'a' : 'b', i % 10, i == 5 ? "x-y-z" : "");
+	sx_strcpy(buf + n, C2SX("</r>"));
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("regex"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+
+	// Compiled automata match the same nodes as 'regexcmp()'
+	previous = XMLSearch_set_regexpr_compare(regexcmp);
+	for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++) {
+		n = _count_matches(XMLDoc_root(&doc), xpaths[i]);
+		assert_equals_i(xpaths[i], counts[i], n, TEST_ERROR, "Wrong number of matches", XMLSearch_set_regexpr_compare(previous));
+	}
+	XMLSearch_init(&search);
+	XMLSearch_search_set_tag(&search, C2SX("^item$"));
+	XMLSearch_search_add_attribute(&search, C2SX("id"), C2SX("^[ab][2-4]$"), true);
+	assert_equals_i("Classes", 6, XMLSearch_count(XMLDoc_root(&doc), &search), TEST_ERROR, "Wrong number of matches", XMLSearch_set_regexpr_compare(previous); XMLSearch_free(&search, true));
+	XMLSearch_set_regexpr_compare(previous);
+	assert_equals_i("Globbing", 0, XMLSearch_count(XMLDoc_root(&doc), &search), TEST_ERROR, "Search should be compiled again", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+static test_result test_tag_index(char* msg)
+{
+	XMLDoc doc;
+	XMLNode* root;
+	XMLNode* node;
+	int n;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r><a id=\"1\"><b/><a id=\"2\"/></a><!--a--><b><a id=\"3\"/></b></r>"), C2SX("index"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	assert_true("Build", XMLDoc_build_tag_index(&doc), TEST_ERROR, "Cannot build index", NOP);
+
+	for (n = 0, node = XMLNode_next_with_tag(root, C2SX("a"), NULL); node != NULL; node = XMLNode_next_with_tag(node, C2SX("a"), NULL))
+		n++;
+	assert_equals_i("Indexed tags", 3, n, TEST_ERROR, "Wrong number of nodes", NOP);
+	node = XMLNode_next_with_tag(root->children[0], C2SX("a"), root->children[1]);
+	assert_true("Stop", node == root->children[0]->children[1] && XMLNode_next_with_tag(node, C2SX("a"), root->children[1]) == NULL, TEST_ERROR, "Wrong node", NOP);
+	assert_equals_i("Search", 3, _count_matches(root, C2SX("a[@id]")), TEST_ERROR, "Wrong number of matches", NOP);
+
+	// Index follows tag changes
+	assert_true("Set tag", XMLNode_set_tag(root->children[0]->children[0], C2SX("a")), TEST_ERROR, "Cannot set tag", NOP);
+	assert_true("Indexed", XMLNode_is_indexed(root, NULL), TEST_ERROR, "Index should be up to date", NOP);
+	assert_equals_i("Search new tag", 4, _count_matches(root, C2SX("a")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_equals_i("Search old tag", 1, _count_matches(root, C2SX("b")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("Next", XMLNode_next_with_tag(root->children[0], C2SX("a"), NULL) == root->children[0]->children[0], TEST_ERROR, "Wrong node", NOP);
+
+	// Stale index is not used by lookups until built again
+	assert_true("Remove", XMLNode_remove_child(root, 2, true) >= 0, TEST_ERROR, "Cannot remove child", NOP);
+	assert_true("Stale", !XMLNode_is_indexed(root, NULL), TEST_ERROR, "Index should be stale", NOP);
+	assert_equals_i("Search after change", 3, _count_matches_threads(root, C2SX("a")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("Still stale", !XMLNode_is_indexed(root, NULL), TEST_ERROR, "Index rebuilt by a lookup", NOP);
+	node = XMLNode_new(TAG_SELF, C2SX("a"), NULL);
+	assert_true("Add", node != NULL && XMLNode_insert_child(root, node, 0), TEST_ERROR, "Cannot add child", NOP);
+	assert_equals_i("Search after add", 4, _count_matches(root, C2SX("a")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("First", XMLNode_next_with_tag(root, C2SX("a"), NULL) == node, TEST_ERROR, "Wrong node", NOP);
+	assert_true("Rebuild", XMLDoc_build_tag_index(&doc) && XMLNode_is_indexed(root, NULL), TEST_ERROR, "Cannot rebuild index", NOP);
+	assert_equals_i("Search after rebuild", 4, _count_matches(root, C2SX("a")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("First after rebuild", XMLNode_next_with_tag(root, C2SX("a"), NULL) == node, TEST_ERROR, "Wrong node", NOP);
+
+	assert_true("Free index", XMLDoc_free_tag_index(&doc), TEST_ERROR, "Cannot free index", NOP);
+	assert_equals_i("Search without index", 4, _count_matches(root, C2SX("a")), TEST_ERROR, "Wrong number of matches", NOP);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+static test_result test_attribute_index(char* msg)
+{
+	XMLDoc doc;
+	XMLNode* root;
+	XMLNode* node;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r><a id=\"x\"><b id=\"y\"/></a><b id=\"z\"/><c id=\"y\"/></r>"), C2SX("index"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	assert_true("Build", XMLDoc_build_attribute_index(&doc, C2SX("id")), TEST_ERROR, "Cannot build index", NOP);
+
+	assert_true("Get", XMLDoc_get_by_attribute(&doc, C2SX("id"), C2SX("y")) == root->children[0]->children[0], TEST_ERROR, "Wrong node", NOP);
+	assert_true("Get none", XMLDoc_get_by_attribute(&doc, C2SX("id"), C2SX("w")) == NULL, TEST_ERROR, "Node should not be found", NOP);
+	assert_equals_i("Search", 2, _count_matches(root, C2SX("*[@id=\"y\"]")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_equals_i("Search tag", 1, _count_matches(root, C2SX("c[@id=\"y\"]")), TEST_ERROR, "Wrong number of matches", NOP);
+
+	// Index follows the changes
+	assert_true("Set", XMLNode_set_attribute(root->children[1], C2SX("id"), C2SX("y")) > 0, TEST_ERROR, "Cannot set attribute", NOP);
+	assert_true("Remove", XMLNode_remove_attribute(root->children[0]->children[0], 0) >= 0, TEST_ERROR, "Cannot remove attribute", NOP);
+	assert_true("Get after change", XMLDoc_get_by_attribute(&doc, C2SX("id"), C2SX("y")) == root->children[1], TEST_ERROR, "Wrong node", NOP);
+	assert_equals_i("Search after change", 2, _count_matches(root, C2SX("*[@id=\"y\"]")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("Remove child", XMLNode_remove_child(root, 1, true) >= 0, TEST_ERROR, "Cannot remove child", NOP);
+	assert_true("Stale", !XMLNode_is_indexed(root, C2SX("id")), TEST_ERROR, "Index should be stale", NOP);
+	assert_equals_i("Search after removal", 1, _count_matches_threads(root, C2SX("*[@id=\"y\"]")), TEST_ERROR, "Wrong number of matches", NOP);
+	node = XMLDoc_get_by_attribute(&doc, C2SX("id"), C2SX("y"));
+	assert_true("Get after removal", node == root->children[1] && XMLNode_next_with_attribute(node, NULL, C2SX("id"), C2SX("y"), NULL) == NULL, TEST_ERROR, "Wrong node", NOP);
+	assert_true("Still stale", !XMLNode_is_indexed(root, C2SX("id")), TEST_ERROR, "Index rebuilt by a lookup", NOP);
+	assert_true("Rebuild", XMLDoc_build_attribute_index(&doc, C2SX("id")) && XMLNode_is_indexed(root, C2SX("id")), TEST_ERROR, "Cannot rebuild index", NOP);
+	assert_true("Get after rebuild", XMLDoc_get_by_attribute(&doc, C2SX("id"), C2SX("y")) == node, TEST_ERROR, "Wrong node", NOP);
+
+	assert_true("Free index", XMLDoc_free_attribute_index(&doc, C2SX("id")), TEST_ERROR, "Cannot free index", NOP);
+	assert_true("Get without index", XMLDoc_get_by_attribute(&doc, C2SX("id"), C2SX("x")) == root->children[0], TEST_ERROR, "Wrong node", NOP);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+static test_result test_search_all(char* msg)
+{
+	XMLDoc doc;
+	XMLSearch search;
+	XMLNode* root;
+	XMLNode** nodes = NULL;
+	int sz_nodes = 0;
+	int n;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r><a><b id=\"1\"/><b/></a><c><b id=\"2\"/></c><a><b id=\"3\"/></a></r>"), C2SX("all"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("a/b[@id]"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+
+	n = XMLSearch_all(root, &search, &nodes, &sz_nodes, 0);
+	assert_equals_i("All", 2, n, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	assert_true("Order", nodes[0] == root->children[0]->children[0] && nodes[1] == root->children[2]->children[0], TEST_ERROR, "Wrong nodes", XMLSearch_free(&search, true));
+	assert_equals_i("Count", 2, XMLSearch_count(root, &search), TEST_ERROR, "Wrong count", XMLSearch_free(&search, true));
+
+	// Array is reused, and search stops at 'limit' matches
+	n = XMLSearch_all(root, &search, &nodes, &sz_nodes, 1);
+	assert_equals_i("Limit", 1, n, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	assert_true("Limit node", nodes[0] == root->children[0]->children[0], TEST_ERROR, "Wrong node", XMLSearch_free(&search, true));
+	assert_equals_i("From child", 1, XMLSearch_count(root->children[2], &search), TEST_ERROR, "Wrong count", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+	free(nodes);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+static test_result test_search_parallel(char* msg)
+{
+	static SXML_CHAR buf[200000];
+	XMLDoc doc;
+	XMLSearch search;
+	XMLNode* root;
+	XMLNode** nodes = NULL;
+	XMLNode** all = NULL;
+	int sz_nodes = 0, sz_all = 0;
+	int i, n, n_all, n_threads;
+
+	// Subtrees of different sizes, so that tasks are split at different levels
+	n = sx_sprintf(buf, C2SX("<r><a><b k=\"x\"/></a><big>"));
+	for (i = 0; i < 2000; i++)
+		n += sx_sprintf(buf + n, C2SX("<i n=\"%d\"><b k=\"%s\"/><c><b/></c></i>"), i, i % 3 == 0 ? "x" : "y");
+	sx_strcpy(buf + n, C2SX("</big><b k=\"x\"/></r>"));
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(buf, C2SX("parallel"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("i/b[@k='x']"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+
+	n_all = XMLSearch_all(root, &search, &all, &sz_all, 0);
+	assert_equals_i("All", 667, n_all, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	for (n_threads = 1; n_threads <= 4; n_threads++) {
+		n = XMLSearch_all_parallel(root, &search, &nodes, &sz_nodes, n_threads);
+		assert_equals_i("Parallel", n_all, n, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+		assert_true("Order", memcmp(nodes, all, n * sizeof(XMLNode*)) == 0, TEST_ERROR, "Nodes differ from sequential search", XMLSearch_free(&search, true));
+	}
+	XMLSearch_free(&search, true);
+
+	// Nodes after a last child are searched as well
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("b"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	n_all = XMLSearch_all(root->children[1]->children[1999], &search, &all, &sz_all, 0);
+	n = XMLSearch_all_parallel(root->children[1]->children[1999], &search, &nodes, &sz_nodes, 3);
+	assert_equals_i("Last child", n_all, n, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	assert_true("Last child nodes", n == 3 && memcmp(nodes, all, n * sizeof(XMLNode*)) == 0, TEST_ERROR, "Nodes differ from sequential search", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+	free(nodes);
+	free(all);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+static test_result test_xpath_axes(char* msg)
+{
+	XMLDoc doc;
+	XMLSearch search;
+	XMLSearch* last;
+	XMLNode *root, *node;
+	XMLNode** nodes = NULL;
+	SXML_CHAR* xpath = NULL;
+	int sz_nodes = 0;
+	int i, n;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r><s><i n=\"1\"/><i n=\"2\"/><i n=\"3\"/></s><s><i n=\"4\"/><i n=\"5\"/></s>"
+		"<t><s><i n=\"6\"/><i n=\"7\"/><i n=\"8\"/></s></t></r>"), C2SX("axes"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+
+	// Third item of any section
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("s/i[3]"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	n = XMLSearch_all(root, &search, &nodes, &sz_nodes, 0);
+	assert_equals_i("Position", 2, n, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	assert_true("Position nodes", nodes[0] == root->children[0]->children[2] && nodes[1] == root->children[2]->children[0]->children[2], TEST_ERROR, "Wrong nodes", XMLSearch_free(&search, true));
+	for (last = &search; last->next != NULL; last = last->next) ;
+	assert_true("Matches", XMLSearch_node_matches(nodes[0], last) && !XMLSearch_node_matches(root->children[0]->children[1], last), TEST_ERROR, "Wrong node matching", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+
+	// Nodes are the same one at a time
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("//s/i[last()]"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	n = XMLSearch_all(root, &search, &nodes, &sz_nodes, 0);
+	assert_equals_i("Last", 3, n, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	for (i = 0, node = XMLSearch_next(root, &search); node != NULL; node = XMLSearch_next(node, &search), i++)
+		assert_true("Next", i < n && node == nodes[i], TEST_ERROR, "Wrong node", XMLSearch_free(&search, true));
+	assert_equals_i("Next count", n, i, TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("t//i"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	assert_equals_i("Descendants", 3, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("s/i[@n='2']/following-sibling::i"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	n = XMLSearch_all(root, &search, &nodes, &sz_nodes, 0);
+	assert_true("Following siblings", n == 1 && nodes[0] == root->children[0]->children[2], TEST_ERROR, "Wrong nodes", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("*[@n='7']/.."), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	n = XMLSearch_all(root, &search, &nodes, &sz_nodes, 0);
+	assert_true("Father", n == 1 && nodes[0] == root->children[2]->children[0], TEST_ERROR, "Wrong nodes", XMLSearch_free(&search, true));
+	XMLSearch_get_XPath_string(&search, &xpath, C2SX('\''));
+	assert_true("XPath string", xpath != NULL && sx_strcmp(xpath, C2SX("*[@n='7']/..")) == 0, TEST_ERROR, "Wrong XPath", free(xpath); XMLSearch_free(&search, true));
+	free(xpath);
+	xpath = NULL;
+	XMLSearch_free(&search, true);
+
+	// The node searched from is not a match
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("i[@n='7']/ancestor::*"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	assert_equals_i("Ancestors", 2, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("r//s[2]/i[last()]/following-sibling::*"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	XMLSearch_get_XPath_string(&search, &xpath, C2SX('\''));
+	assert_true("XPath string", xpath != NULL && sx_strcmp(xpath, C2SX("r//s[2]/i[last()]/following-sibling::*")) == 0, TEST_ERROR, "Wrong XPath", free(xpath); XMLSearch_free(&search, true));
+	free(xpath);
+	XMLSearch_free(&search, true);
+
+	assert_true("Position not last", !XMLSearch_init_from_XPath(C2SX("s/i[2][@n]"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Axis after //", !XMLSearch_init_from_XPath(C2SX("s//parent::r"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Trailing /", !XMLSearch_init_from_XPath(C2SX("s/i/"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Repeated axis", !XMLSearch_init_from_XPath(C2SX("child::child::a"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Unknown axis", !XMLSearch_init_from_XPath(C2SX("s/self::i"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Operator tag", !XMLSearch_init_from_XPath(C2SX(">="), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Spaces in tag", !XMLSearch_init_from_XPath(C2SX("s/i j"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Empty tag", !XMLSearch_init_from_XPath(C2SX("s/[@n]"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+	assert_true("Wildcards", XMLSearch_init_from_XPath(C2SX("child::s/x:i?-*"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	XMLSearch_free(&search, true);
+	free(nodes);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
+
+
+static test_result test_numbers(char* msg)
+{
+	XMLDoc doc;
+	XMLSearch search;
+	XMLNode* root;
+	SXML_CHAR* xpath = NULL;
+	double d;
+	int i;
+
+	XMLDoc_init(&doc);
+	assert_true("Parse", XMLDoc_parse_buffer_DOM(C2SX("<r><i p=\"50\"/><i p=\" 150.5 \"/><i p=\"abc\"/><i p=\"1e3\"/><i p=\"100\"/></r>"), C2SX("numbers"), &doc), TEST_ERROR, "Cannot parse XML", NOP);
+	root = XMLDoc_root(&doc);
+
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("i[@p > 100]"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	assert_equals_i("Greater", 2, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLSearch_get_XPath_string(&search, &xpath, C2SX('\''));
+	assert_true("XPath string", xpath != NULL && sx_strcmp(xpath, C2SX("i[@p>100]")) == 0, TEST_ERROR, "Wrong XPath", free(xpath); XMLSearch_free(&search, true));
+	free(xpath);
+	XMLSearch_free(&search, true);
+
+	assert_true("XPath", XMLSearch_init_from_XPath(C2SX("i[@p>=50, @p<='100']"), &search), TEST_ERROR, "Cannot parse XPath", NOP);
+	assert_equals_i("Range", 2, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	// Numbers parsed once in the index are updated with the values
+	assert_true("Build", XMLDoc_build_number_index(&doc, C2SX("p")), TEST_ERROR, "Cannot build index", XMLSearch_free(&search, true));
+	assert_equals_i("Indexed range", 2, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLNode_set_attribute(root->children[0], C2SX("p"), C2SX("500"));
+	assert_equals_i("Changed", 1, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLNode_set_attribute(root->children[2], C2SX("p"), C2SX("60"));
+	assert_equals_i("Now a number", 2, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLNode_remove_attribute(root->children[2], 0);
+	assert_equals_i("Removed", 1, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLNode_set_attribute(root->children[2], C2SX("p"), C2SX("abc"));
+	XMLSearch_free(&search, true);
+	// Numbers are only read by searches, which several threads can run at the same time
+	assert_equals_i("Threads", 1, _count_matches_threads(root, C2SX("i[@p>=50, @p<='100']")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("Stale", XMLNode_remove_child(root, 0, true) >= 0, TEST_ERROR, "Cannot remove child", NOP);
+	assert_equals_i("Stale threads", 1, _count_matches_threads(root, C2SX("i[@p>=50, @p<='100']")), TEST_ERROR, "Wrong number of matches", NOP);
+	assert_true("Insert", XMLNode_insert_child(root, XMLNode_new(TAG_SELF, C2SX("i"), NULL), 0) && XMLNode_set_attribute(root->children[0], C2SX("p"), C2SX("50")) > 0, TEST_ERROR, "Cannot insert child", NOP);
+	assert_true("Rebuild", XMLDoc_build_number_index(&doc, C2SX("p")), TEST_ERROR, "Cannot build index", NOP);
+
+	XMLSearch_init(&search);
+	XMLSearch_search_set_tag(&search, C2SX("i"));
+	assert_true("Add range", XMLSearch_search_add_range(&search, C2SX("p"), 100, 1000) >= 0, TEST_ERROR, "Cannot add range", XMLSearch_free(&search, true));
+	assert_equals_i("Range API", 3, XMLSearch_count(root, &search), TEST_ERROR, "Wrong number of matches", XMLSearch_free(&search, true));
+	XMLSearch_free(&search, true);
+
+	assert_true("XPath", !XMLSearch_init_from_XPath(C2SX("i[@p>abc]"), &search), TEST_ERROR, "Malformed XPath parsed", NOP);
+
+	assert_true("Double", XMLNode_get_attribute_double(root->children[1], C2SX("p"), &d, -1) && d == 150.5, TEST_ERROR, "Wrong number", NOP);
+	assert_true("Int", !XMLNode_get_attribute_int(root->children[1], C2SX("p"), &i, -1) && i == -1, TEST_ERROR, "Not an integer", NOP);
+	assert_true("Int exponent", XMLNode_get_attribute_int(root->children[3], C2SX("p"), &i, -1) && i == 1000, TEST_ERROR, "Wrong integer", NOP);
+	assert_true("Missing", !XMLNode_get_attribute_double(root->children[3], C2SX("q"), &d, 2.5) && d == 2.5, TEST_ERROR, "Default value not set", NOP);
+	assert_true("Not a number", !XMLNode_get_attribute_double(root->children[2], C2SX("p"), &d, 2.5) && d == 2.5, TEST_ERROR, "Default value not set", NOP);
+	assert_true("Free index", XMLDoc_free_number_index(&doc, C2SX("p")), TEST_ERROR, "Cannot free index", NOP);
+	assert_true("Double without index", XMLNode_get_attribute_double(root->children[1], C2SX("p"), &d, -1) && d == 150.5, TEST_ERROR, "Wrong number", NOP);
+	XMLDoc_free(&doc);
+
+	return TEST_OK;
+}
 
 
 struct _test {
@@ -580,10 +1930,34 @@ struct _test {
 		{ "PARSE FILE", test_parse_file },
 		{ "TEXT NODE", test_text_node },
 		{ "MOVE", test_move },
+		{ "DUP", test_dup },
+		{ "DUP THREADS", test_dup_threads },
+		{ "DIFF", test_diff },
+		{ "CONFIG", test_config },
+		{ "FREE ASYNC", test_free_async },
+		{ "DEEP", test_deep },
+		{ "MEMORY", test_memory },
+		{ "REPARSE", test_reparse },
+		{ "RECORDS", test_records },
+		{ "RESET", test_reset },
+		{ "PRINT", test_print },
+		{ "PARALLEL", test_print_parallel },
+		{ "INCREMENTAL", test_incremental },
+		{ "WRITER", test_writer },
+		{ "CANONICAL", test_canonical },
+		{ "HTML", test_html },
 		{ "USER", test_user },
 		{ "UTF8", test_UTF8 },
 		{ "UNICODE", test_unicode },
 		{ "SEARCH", test_search },
+		{ "PATTERNS", test_search_patterns },
+		{ "REGEX", test_regex },
+		{ "TAGINDEX", test_tag_index },
+		{ "ATTRINDEX", test_attribute_index },
+		{ "SEARCHALL", test_search_all },
+		{ "SEARCHPARALLEL", test_search_parallel },
+		{ "XPATH", test_xpath_axes },
+		{ "NUMBERS", test_numbers },
 };
 
 #if 1